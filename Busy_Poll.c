@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include "Busy_Poll.h"
+#include "IO_Backend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+static struct
+{
+    int enabled;
+    int cpus[BUSY_POLL_MAX_CPUS];
+    int ncpus;
+    uint64_t announced;     // slots already printed; path threads are started for every run
+    int fifo;               // SCHED_FIFO priority, 0 for none
+    char label[64];
+} busy;
+
+static __thread int thread_slot;
+
+/* Parses "2", "2,3" or "0-3,6" into busy.cpus. */
+static int parse_cpus(const char *list)
+{
+    busy.ncpus = 0;
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        long from = strtol(p, &end, 10);
+        long to = from;
+        if (end == p || from < 0 || from >= CPU_SETSIZE)
+            break;
+        p = end;
+        if (*p == '-')
+        {
+            to = strtol(p + 1, &end, 10);
+            if (end == p + 1 || to < from || to >= CPU_SETSIZE)
+                break;
+            p = end;
+        }
+        for (long cpu = from; cpu <= to && busy.ncpus < BUSY_POLL_MAX_CPUS; cpu++)
+            busy.cpus[busy.ncpus++] = (int)cpu;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            break;
+    }
+    if (*p != '\0' || busy.ncpus == 0)
+    {
+        printf("Invalid CPU list %s (e.g. 2 or 2,3 or 0-3)\n", list);
+        return -1;
+    }
+    return 0;
+}
+
+int Busy_Poll_option(int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "-busypoll") == 0)
+    {
+        busy.enabled = 1;
+        return 1;
+    }
+    if (*i + 1 >= argc)
+        return 0;
+    if (strcmp(argv[*i], "-cpu") == 0)
+        return parse_cpus(argv[++*i]) < 0 ? -1 : 1;
+    if (strcmp(argv[*i], "-fifo") == 0)
+    {
+        busy.fifo = atoi(argv[++*i]);
+        if (busy.fifo < sched_get_priority_min(SCHED_FIFO) || busy.fifo > sched_get_priority_max(SCHED_FIFO))
+        {
+            printf("SCHED_FIFO priority must be %d to %d\n", sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+            return -1;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int Busy_Poll_start(void)
+{
+    if (busy.enabled)
+    {
+        if (IO_set_busy_poll(1) < 0)
+        {
+            printf("-busypoll needs -io syscall or xdp\n");
+            return -1;
+        }
+        printf("Busy polling: receives spin, sockets busy-poll for %d us\n", BUSY_POLL_US);
+        // a spinning SCHED_FIFO thread never gives its CPU up to another of the same priority
+        if (busy.fifo > 0 && busy.ncpus < 2)
+            printf("Warning: with -fifo, give the spinning threads a CPU each (-cpu), or they may starve each other\n");
+    }
+    return Busy_Poll_pin_thread("Main", 0);
+}
+
+int Busy_Poll_enabled(void)
+{
+    return busy.enabled;
+}
+
+void Busy_Poll_socket(int fd)
+{
+    if (!busy.enabled)
+        return;
+    // not every kernel or device has them, spinning in IO_Backend works regardless
+    int usec = BUSY_POLL_US, on = 1, budget = BUSY_POLL_BUDGET;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+        perror("setsockopt(SO_BUSY_POLL) failed");
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on)) < 0 && errno != ENOPROTOOPT)
+        perror("setsockopt(SO_PREFER_BUSY_POLL) failed");
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) < 0 && errno != ENOPROTOOPT && errno != EPERM)
+        perror("setsockopt(SO_BUSY_POLL_BUDGET) failed");
+}
+
+int Busy_Poll_pin_thread(const char *name, int slot)
+{
+    thread_slot = slot;
+    if (busy.ncpus == 0 && busy.fifo == 0)
+        return 0;
+
+    char where[32] = "";
+    if (busy.ncpus > 0)
+    {
+        // helper slots are negative: -1 is the last CPU of the list, -2 the one before
+        int cpu = busy.cpus[slot >= 0 ? slot % busy.ncpus : busy.ncpus - 1 - (-slot - 1) % busy.ncpus];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        {
+            perror("sched_setaffinity() failed");
+            return -1;
+        }
+        snprintf(where, sizeof(where), " on CPU %d", cpu);
+    }
+    if (busy.fifo > 0)
+    {
+        struct sched_param param = {.sched_priority = busy.fifo};
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0)
+        {
+            errno = err;
+            perror("pthread_setschedparam(SCHED_FIFO) failed");
+            return -1;
+        }
+    }
+    uint64_t bit = 1ULL << (slot >= 0 ? slot % 32 : 32 + (-slot - 1) % 32);
+    if (__atomic_fetch_or(&busy.announced, bit, __ATOMIC_RELAXED) & bit)
+        return 0;
+    if (busy.fifo > 0)
+        printf("%s thread%s, SCHED_FIFO %d\n", name, where, busy.fifo);
+    else
+        printf("%s thread%s\n", name, where);
+    return 0;
+}
+
+int Busy_Poll_helper_slot(void)
+{
+    return -thread_slot - 1;
+}
+
+const char *Busy_Poll_label(const char *label)
+{
+    if (!busy.enabled)
+        return label;
+    snprintf(busy.label, sizeof(busy.label), "%s+busypoll", label);
+    return busy.label;
+}
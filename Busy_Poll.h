@@ -0,0 +1,33 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+/*
+ * Low-latency mode of every tool, for transfers that care about tail latency more
+ * than CPU use. -busypoll spins on non-blocking receives (IO_Backend) instead of
+ * sleeping in the kernel and waking through the scheduler, and has the kernel
+ * busy-poll the device queue of every socket (SO_BUSY_POLL, SO_PREFER_BUSY_POLL).
+ * -cpu pins the threads doing I/O to the listed CPUs by slot: the main thread takes
+ * the first, striping path i the (i + 2)th, and helpers (ACK threads) count from the
+ * end of the list. -fifo runs them SCHED_FIFO; give every spinning thread a CPU of
+ * its own then.
+ */
+#define BUSY_POLL_USAGE "[-busypoll] [-cpu <n[,n-m...]>] [-fifo <1-99>]"
+#define BUSY_POLL_US 50         // SO_BUSY_POLL: microseconds a receive busy-polls the device queue
+#define BUSY_POLL_BUDGET 64     // SO_BUSY_POLL_BUDGET: packets per busy-poll
+#define BUSY_POLL_MAX_CPUS 64
+
+/* Takes -busypoll, -cpu <list> or -fifo <priority> at argv[*i]: 1 if taken, 0 if not one of them, -1 if invalid. */
+int Busy_Poll_option(int argc, char *argv[], int *i);
+/* After IO_init(): turns spinning on and pins the calling thread; -1 if either fails. */
+int Busy_Poll_start(void);
+int Busy_Poll_enabled(void);
+/* Sets the busy-poll socket options on fd, when -busypoll is on. */
+void Busy_Poll_socket(int fd);
+/* Pins the calling thread to the CPU of slot (wrapping around -cpu), SCHED_FIFO with -fifo; name goes in the message. */
+int Busy_Poll_pin_thread(const char *name, int slot);
+/* The slot of a helper of the calling thread, counted from the end of -cpu; pass it to Busy_Poll_pin_thread(). */
+int Busy_Poll_helper_slot(void);
+/* label, with "+busypoll" appended when it is on, so results of the two modes stay apart in JSON/CSV. */
+const char *Busy_Poll_label(const char *label);
+
+#endif
@@ -0,0 +1,356 @@
+#include "Compress.h"
+#include "Timing.h"
+#include <endian.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_LOG 12
+#define MIN_MATCH 4
+#define LAST_LITERALS 5      // LZ4: the last 5 bytes are always literals
+#define MATCH_LIMIT 12       // LZ4: the last match starts at least 12 bytes before the end
+#define MAX_OFFSET 65535
+#define COMPRESSED_BIT 0x80000000u
+
+// ************ LZ4 block format **************
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* One sequence: literals, then a match of mlen at offset; mlen 0 for the closing literals. NULL if it does not fit. */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t litlen, size_t offset, size_t mlen)
+{
+    if ((size_t)(oend - op) < 1 + litlen / 255 + 1 + litlen + 2 + mlen / 255 + 1)
+        return NULL;
+
+    size_t ml = mlen ? mlen - MIN_MATCH : 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((litlen >= 15 ? 15 : litlen) << 4 | (ml >= 15 ? 15 : ml));
+    if (litlen >= 15)
+        op = put_length(op, litlen - 15);
+    memcpy(op, literals, litlen);
+    op += litlen;
+
+    if (mlen)
+    {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (ml >= 15)
+            op = put_length(op, ml - 15);
+    }
+    return op;
+}
+
+size_t Compress_lz4(const void *src_, size_t len, void *dst_, size_t cap)
+{
+    const uint8_t *src = (const uint8_t *)src_;
+    uint8_t *dst = (uint8_t *)dst_;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + cap;
+    uint32_t table[1 << HASH_LOG];
+    memset(table, 0, sizeof(table));
+
+    size_t anchor = 0;
+    size_t ip = 0;
+    unsigned int misses = 0;
+    while (len >= MATCH_LIMIT + 1 && ip + MATCH_LIMIT <= len)
+    {
+        uint32_t sequence = read32(src + ip);
+        uint32_t h = hash4(sequence);
+        size_t ref = table[h];
+        table[h] = (uint32_t)ip;
+        if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != sequence)
+        {
+            ip += 1 + (misses++ >> 6); // skip faster through data that does not match
+            continue;
+        }
+        misses = 0;
+
+        size_t end = len - LAST_LITERALS;
+        size_t mlen = MIN_MATCH;
+        while (ip + mlen + 8 <= end)
+        {
+            uint64_t diff = read64(src + ip + mlen) ^ read64(src + ref + mlen);
+            if (diff)
+            {
+                mlen += __builtin_ctzll(diff) / 8;
+                goto matched;
+            }
+            mlen += 8;
+        }
+        while (ip + mlen < end && src[ip + mlen] == src[ref + mlen])
+            mlen++;
+    matched:
+        op = put_sequence(op, oend, src + anchor, ip - anchor, ip - ref, mlen);
+        if (op == NULL)
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = put_sequence(op, oend, src + anchor, len - anchor, 0, 0);
+    return op == NULL ? 0 : (size_t)(op - dst);
+}
+
+/* Reads an LZ4 length extension; -1 if it runs past iend. */
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int Compress_lz4_decode(const void *src_, size_t len, void *dst_, size_t raw_len)
+{
+    const uint8_t *ip = (const uint8_t *)src_;
+    const uint8_t *iend = ip + len;
+    uint8_t *dst = (uint8_t *)dst_;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + raw_len;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+        size_t litlen = token >> 4;
+        if (litlen == 15 && get_length(&ip, iend, &litlen) < 0)
+            return -1;
+        if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, litlen);
+        op += litlen;
+        ip += litlen;
+        if (ip == iend)
+            break; // the closing literals
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_length(&ip, iend, &mlen) < 0)
+            return -1;
+        mlen += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || mlen > (size_t)(oend - op))
+            return -1;
+
+        const uint8_t *match = op - offset;
+        if (offset >= mlen)
+            memcpy(op, match, mlen);
+        else
+            for (size_t i = 0; i < mlen; i++) // overlapping: repeats the last offset bytes
+                op[i] = match[i];
+        op += mlen;
+    }
+    return op == oend ? 0 : -1;
+}
+
+double Compress_entropy(const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t stride = len > COMPRESS_SAMPLES ? len / COMPRESS_SAMPLES : 1;
+    unsigned int counts[256] = {0};
+    size_t n = 0;
+    for (size_t i = 0; i < len && n < COMPRESS_SAMPLES; i += stride, n++)
+        counts[p[i]]++;
+
+    double bits = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (counts[i] == 0)
+            continue;
+        double q = (double)counts[i] / n;
+        bits -= q * log2(q);
+    }
+    return bits;
+}
+
+// ************ Writer **************
+int Compress_Writer_init(Compress_Writer *writer)
+{
+    memset(writer, 0, sizeof(Compress_Writer));
+    writer->_frame = (char *)malloc(COMPRESS_FRAME_MAX);
+    if (writer->_frame == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    return 0;
+}
+
+void Compress_Writer_free(Compress_Writer *writer)
+{
+    free(writer->_frame);
+    writer->_frame = NULL;
+}
+
+void Compress_Writer_reset_stats(Compress_Writer *writer)
+{
+    char *frame = writer->_frame;
+    memset(writer, 0, sizeof(Compress_Writer));
+    writer->_frame = frame;
+}
+
+size_t Compress_Writer_frame(Compress_Writer *writer, const void *src, size_t len, const char **frame)
+{
+    uint64_t start = Timing_now_ns();
+    char *body = writer->_frame + COMPRESS_HEADER_SIZE;
+    uint32_t wire_len = 0;
+    if (Compress_entropy(src, len) > COMPRESS_ENTROPY_MAX)
+        writer->skipped_entropy++;
+    else if ((wire_len = (uint32_t)Compress_lz4(src, len, body, len - 1)) == 0)
+        writer->skipped_ratio++;
+    else
+        writer->compressed++;
+
+    uint32_t header[2];
+    header[0] = htobe32((uint32_t)len);
+    header[1] = htobe32(wire_len ? wire_len | COMPRESSED_BIT : (uint32_t)len);
+    memcpy(writer->_frame, header, COMPRESS_HEADER_SIZE);
+    if (wire_len == 0)
+    {
+        memcpy(body, src, len);
+        wire_len = (uint32_t)len;
+    }
+
+    writer->blocks++;
+    writer->raw_bytes += len;
+    writer->wire_bytes += COMPRESS_HEADER_SIZE + wire_len;
+    writer->ns += Timing_now_ns() - start;
+    *frame = writer->_frame;
+    return COMPRESS_HEADER_SIZE + wire_len;
+}
+
+void Compress_Writer_print_stats(const Compress_Writer *writer)
+{
+    double ms = writer->ns / 1000000.0;
+    printf("Compression: %llu bytes into %llu on the wire (ratio %.3f), %llu of %llu blocks compressed, %llu raw by entropy, %llu raw for no gain, %f ms CPU (%f MB/s)\n",
+           (unsigned long long)writer->raw_bytes, (unsigned long long)writer->wire_bytes,
+           writer->wire_bytes ? (double)writer->raw_bytes / writer->wire_bytes : 0.0, (unsigned long long)writer->compressed,
+           (unsigned long long)writer->blocks, (unsigned long long)writer->skipped_entropy,
+           (unsigned long long)writer->skipped_ratio, ms, ms > 0 ? writer->raw_bytes / (ms * 1000.0) : 0.0);
+}
+
+// ************ Reader **************
+int Compress_Reader_init(Compress_Reader *reader)
+{
+    memset(reader, 0, sizeof(Compress_Reader));
+    reader->_block = (char *)malloc(COMPRESS_BLOCK_SIZE);
+    reader->_raw = (char *)malloc(COMPRESS_BLOCK_SIZE);
+    if (reader->_block == NULL || reader->_raw == NULL)
+    {
+        perror("malloc failed");
+        Compress_Reader_free(reader);
+        return -1;
+    }
+    return 0;
+}
+
+void Compress_Reader_free(Compress_Reader *reader)
+{
+    free(reader->_block);
+    free(reader->_raw);
+    reader->_block = reader->_raw = NULL;
+}
+
+void Compress_Reader_reset(Compress_Reader *reader)
+{
+    reader->_header_have = 0;
+    reader->_block_have = 0;
+    reader->wire_bytes = 0;
+    reader->raw_bytes = 0;
+    reader->ns = 0;
+}
+
+ssize_t Compress_Reader_feed(Compress_Reader *reader, const char *data, size_t len, const char **out, size_t *out_len)
+{
+    size_t used = 0;
+    *out_len = 0;
+
+    if (reader->_header_have < COMPRESS_HEADER_SIZE)
+    {
+        size_t n = COMPRESS_HEADER_SIZE - reader->_header_have < len ? COMPRESS_HEADER_SIZE - reader->_header_have : len;
+        memcpy(reader->_header + reader->_header_have, data, n);
+        reader->_header_have += n;
+        used = n;
+        if (reader->_header_have < COMPRESS_HEADER_SIZE)
+            return (ssize_t)used;
+
+        uint32_t header[2];
+        memcpy(header, reader->_header, COMPRESS_HEADER_SIZE);
+        reader->_raw_len = be32toh(header[0]);
+        reader->_wire_len = be32toh(header[1]) & ~COMPRESSED_BIT;
+        reader->_compressed = (be32toh(header[1]) & COMPRESSED_BIT) != 0;
+        reader->_block_have = 0;
+        if (reader->_raw_len > COMPRESS_BLOCK_SIZE || reader->_wire_len > COMPRESS_BLOCK_SIZE ||
+            (!reader->_compressed && reader->_wire_len != reader->_raw_len))
+        {
+            printf("Corrupt compressed frame: %u bytes from %u\n", reader->_raw_len, reader->_wire_len);
+            return -1;
+        }
+    }
+
+    size_t n = reader->_wire_len - reader->_block_have < len - used ? reader->_wire_len - reader->_block_have : len - used;
+    memcpy(reader->_block + reader->_block_have, data + used, n);
+    reader->_block_have += n;
+    used += n;
+    reader->wire_bytes += used;
+    if (reader->_block_have < reader->_wire_len)
+        return (ssize_t)used;
+
+    // a whole block
+    reader->_header_have = 0;
+    if (reader->_compressed)
+    {
+        uint64_t start = Timing_now_ns();
+        if (Compress_lz4_decode(reader->_block, reader->_wire_len, reader->_raw, reader->_raw_len) < 0)
+        {
+            printf("Corrupt compressed block of %u bytes\n", reader->_wire_len);
+            return -1;
+        }
+        reader->ns += Timing_now_ns() - start;
+        *out = reader->_raw;
+    }
+    else
+        *out = reader->_block;
+    *out_len = reader->_raw_len;
+    reader->raw_bytes += reader->_raw_len;
+    return (ssize_t)used;
+}
+
+void Compress_Reader_print_stats(const Compress_Reader *reader, double ms)
+{
+    printf("Compression: wire %llu bytes at %f MB/s, application %llu bytes at %f MB/s (ratio %.3f), %f ms decompressing\n",
+           (unsigned long long)reader->wire_bytes, ms > 0 ? reader->wire_bytes / (ms * 1000.0) : 0.0,
+           (unsigned long long)reader->raw_bytes, ms > 0 ? reader->raw_bytes / (ms * 1000.0) : 0.0,
+           reader->wire_bytes ? (double)reader->raw_bytes / reader->wire_bytes : 0.0, reader->ns / 1000000.0);
+}
@@ -0,0 +1,77 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Optional inline compression of the payload, for the -compress mode of the senders.
+ *
+ * The payload goes out as frames of at most COMPRESS_BLOCK_SIZE application bytes:
+ * an 8-byte header (raw length, wire length, both big endian; the top bit of the
+ * wire length is set if the block is compressed) and the block. Blocks are compressed
+ * in the LZ4 block format by a small greedy LZ77 coder, unless a sampled order-0
+ * entropy above COMPRESS_ENTROPY_MAX bits/byte says they will not shrink, or they
+ * did not shrink after all; those go out raw. Receivers see PAYLOAD_COMPRESSED in
+ * the Payload_Header and feed what they receive to a Compress_Reader.
+ */
+#define COMPRESS_BLOCK_SIZE 65536
+#define COMPRESS_HEADER_SIZE 8
+#define COMPRESS_FRAME_MAX (COMPRESS_HEADER_SIZE + COMPRESS_BLOCK_SIZE)
+#define COMPRESS_ENTROPY_MAX 7.5
+#define COMPRESS_SAMPLES 2048
+
+typedef struct _Compress_Writer
+{
+    char *_frame;                // COMPRESS_FRAME_MAX bytes
+    uint64_t raw_bytes;          // application bytes framed
+    uint64_t wire_bytes;         // frame bytes, headers included
+    uint64_t blocks;
+    uint64_t compressed;         // blocks sent compressed
+    uint64_t skipped_entropy;    // sent raw: sampled entropy too high
+    uint64_t skipped_ratio;      // sent raw: compressed was no smaller
+    uint64_t ns;                 // time spent sampling and compressing
+} Compress_Writer;
+
+typedef struct _Compress_Reader
+{
+    unsigned char _header[COMPRESS_HEADER_SIZE];
+    size_t _header_have;
+    uint32_t _raw_len;
+    uint32_t _wire_len;
+    int _compressed;
+    char *_block;                // wire bytes of the current block
+    size_t _block_have;
+    char *_raw;                  // decoded block
+    uint64_t wire_bytes;
+    uint64_t raw_bytes;
+    uint64_t ns;                 // time spent decompressing
+} Compress_Reader;
+
+/* LZ4 block format. Returns the compressed length, 0 if it does not fit in cap. */
+size_t Compress_lz4(const void *src, size_t len, void *dst, size_t cap);
+/* Returns 0 if src decodes to exactly raw_len bytes into dst, -1 if it is corrupt. */
+int Compress_lz4_decode(const void *src, size_t len, void *dst, size_t raw_len);
+/* Order-0 entropy in bits per byte of up to COMPRESS_SAMPLES bytes spread over buf. */
+double Compress_entropy(const void *buf, size_t len);
+
+int Compress_Writer_init(Compress_Writer *writer);
+void Compress_Writer_free(Compress_Writer *writer);
+void Compress_Writer_reset_stats(Compress_Writer *writer);
+/* Frames len (at most COMPRESS_BLOCK_SIZE) bytes of src; *frame points at the frame, valid until the next call. */
+size_t Compress_Writer_frame(Compress_Writer *writer, const void *src, size_t len, const char **frame);
+void Compress_Writer_print_stats(const Compress_Writer *writer);
+
+int Compress_Reader_init(Compress_Reader *reader);
+void Compress_Reader_free(Compress_Reader *reader);
+/* Clears the frame state and the counters, for the next run. */
+void Compress_Reader_reset(Compress_Reader *reader);
+/* Consumes received bytes up to the end of the current frame at most. When that completes
+   a block, *out and *out_len give its application bytes (until the next call), else *out_len is 0.
+   Returns the bytes consumed, -1 on a corrupt frame. */
+ssize_t Compress_Reader_feed(Compress_Reader *reader, const char *data, size_t len, const char **out, size_t *out_len);
+/* Prints wire and application bytes and throughput of a run that took ms. */
+void Compress_Reader_print_stats(const Compress_Reader *reader, double ms);
+
+#endif
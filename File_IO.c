@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include "File_IO.h"
+#include "Timing.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int File_parse_read_mode(const char *name, File_Read_Mode *out)
+{
+    if (strcmp(name, "pread") == 0)
+        *out = FILE_PREAD;
+    else if (strcmp(name, "mmap") == 0)
+        *out = FILE_MMAP;
+    else
+    {
+        printf("Unknown file read mode %s (pread or mmap)\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// ************ Source **************
+int File_Source_open(File_Source *src, const char *path, File_Read_Mode mode)
+{
+    memset(src, 0, sizeof(File_Source));
+    src->_mode = mode;
+    src->_fd = open(path, O_RDONLY);
+    if (src->_fd == -1)
+    {
+        perror("open() failed");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(src->_fd, &st) == -1)
+    {
+        perror("fstat() failed");
+        close(src->_fd);
+        return -1;
+    }
+    src->_size = (uint64_t)st.st_size;
+    posix_fadvise(src->_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return 0;
+}
+
+uint64_t File_Source_size(const File_Source *src)
+{
+    return src->_size;
+}
+
+static void unmap_window(File_Source *src)
+{
+    if (src->_map != NULL)
+        munmap(src->_map, src->_map_len);
+    src->_map = NULL;
+}
+
+const char *File_Source_read(File_Source *src, char *buf, uint64_t offset, size_t len)
+{
+    if (offset + len > src->_size)
+        return NULL;
+
+    uint64_t start = Timing_now_ns();
+    const char *data = NULL;
+    if (src->_mode == FILE_MMAP)
+    {
+        unmap_window(src);
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t map_offset = offset & ~(page - 1);
+        src->_map_len = len + (offset - map_offset);
+        void *map = mmap(NULL, src->_map_len, PROT_READ, MAP_SHARED | MAP_POPULATE, src->_fd, (off_t)map_offset);
+        if (map == MAP_FAILED)
+        {
+            perror("mmap() failed");
+            return NULL;
+        }
+        src->_map = map;
+        data = (const char *)map + (offset - map_offset);
+    }
+    else
+    {
+        size_t done = 0;
+        while (done < len)
+        {
+            ssize_t n = pread(src->_fd, buf + done, len - done, (off_t)(offset + done));
+            if (n <= 0)
+            {
+                if (n == -1 && errno == EINTR)
+                    continue;
+                perror("pread() failed");
+                return NULL;
+            }
+            done += (size_t)n;
+        }
+        data = buf;
+    }
+
+    // start reading the next chunk while this one is on the wire
+    if (offset + len < src->_size)
+        posix_fadvise(src->_fd, (off_t)(offset + len), (off_t)len, POSIX_FADV_WILLNEED);
+    src->_disk_ns += Timing_now_ns() - start;
+    return data;
+}
+
+void File_Source_close(File_Source *src)
+{
+    unmap_window(src);
+    if (src->_fd >= 0)
+        close(src->_fd);
+    src->_fd = -1;
+}
+
+double File_Source_disk_ms(const File_Source *src)
+{
+    return src->_disk_ns / 1000000.0;
+}
+
+void File_Source_reset_time(File_Source *src)
+{
+    src->_disk_ns = 0;
+}
+
+// ************ Sink **************
+static int open_sink(File_Sink *sink, const char *path, uint64_t size, int direct, int trunc)
+{
+    memset(sink, 0, sizeof(File_Sink));
+    if (posix_memalign((void **)&sink->_stage, FILE_DIRECT_ALIGN, FILE_STAGE_SIZE) != 0)
+    {
+        perror("posix_memalign() failed");
+        return -1;
+    }
+
+    uint64_t start = Timing_now_ns();
+    sink->_direct = direct;
+    sink->_fd = open(path, O_WRONLY | O_CREAT | trunc | (direct ? O_DIRECT : 0), 0644);
+    if (sink->_fd == -1 && direct && errno == EINVAL)
+    {
+        printf("O_DIRECT is not supported for %s, writing through the page cache\n", path);
+        sink->_direct = 0;
+        sink->_fd = open(path, O_WRONLY | O_CREAT | trunc, 0644);
+    }
+    if (sink->_fd == -1)
+    {
+        perror("open() failed");
+        free(sink->_stage);
+        return -1;
+    }
+
+    // one extent up front; filesystems without fallocate just allocate as we go
+    if (size > 0 && fallocate(sink->_fd, 0, 0, (off_t)size) == -1 && errno != EOPNOTSUPP)
+    {
+        perror("fallocate() failed");
+        close(sink->_fd);
+        free(sink->_stage);
+        return -1;
+    }
+    sink->_disk_ns = Timing_now_ns() - start;
+    return 0;
+}
+
+int File_Sink_open(File_Sink *sink, const char *path, uint64_t size, int direct)
+{
+    return open_sink(sink, path, size, direct, O_TRUNC);
+}
+
+int File_Sink_open_keep(File_Sink *sink, const char *path, uint64_t size, int direct)
+{
+    if (open_sink(sink, path, size, direct, 0) < 0)
+        return -1;
+    sink->_keep = size;
+    return 0;
+}
+
+/* Writes the first len staged bytes at the sink's offset. */
+static int write_stage(File_Sink *sink, size_t len)
+{
+    uint64_t start = Timing_now_ns();
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pwrite(sink->_fd, sink->_stage + done, len - done, (off_t)(sink->_offset + done));
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("pwrite() failed");
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    sink->_disk_ns += Timing_now_ns() - start;
+    return 0;
+}
+
+int File_Sink_write(File_Sink *sink, const void *buf, size_t len)
+{
+    const char *data = (const char *)buf;
+    while (len > 0)
+    {
+        size_t n = FILE_STAGE_SIZE - sink->_staged < len ? FILE_STAGE_SIZE - sink->_staged : len;
+        memcpy(sink->_stage + sink->_staged, data, n);
+        sink->_staged += n;
+        sink->_written += n;
+        data += n;
+        len -= n;
+
+        if (sink->_staged == FILE_STAGE_SIZE)
+        {
+            if (write_stage(sink, FILE_STAGE_SIZE) < 0)
+                return -1;
+            sink->_offset += FILE_STAGE_SIZE;
+            sink->_staged = 0;
+        }
+    }
+    return 0;
+}
+
+/* Writes what is staged at the sink's offset. */
+static int flush_stage(File_Sink *sink)
+{
+    if (sink->_staged == 0)
+        return 0;
+    // O_DIRECT writes whole blocks: pad the tail, the ftruncate() on close cuts it off again
+    size_t len = sink->_staged;
+    if (sink->_direct)
+    {
+        len = (len + FILE_DIRECT_ALIGN - 1) & ~(size_t)(FILE_DIRECT_ALIGN - 1);
+        memset(sink->_stage + sink->_staged, 0, len - sink->_staged);
+    }
+    return write_stage(sink, len);
+}
+
+int File_Sink_seek(File_Sink *sink, uint64_t offset)
+{
+    if (flush_stage(sink) < 0)
+        return -1;
+    sink->_offset = offset;
+    sink->_staged = 0;
+    return 0;
+}
+
+int File_Sink_sync(File_Sink *sink)
+{
+    if (flush_stage(sink) < 0)
+        return -1;
+    sink->_offset += sink->_staged;
+    sink->_staged = 0;
+
+    uint64_t start = Timing_now_ns();
+    int result = 0;
+    if (fdatasync(sink->_fd) == -1)
+    {
+        perror("fdatasync() failed");
+        result = -1;
+    }
+    sink->_disk_ns += Timing_now_ns() - start;
+    return result;
+}
+
+int File_Sink_close(File_Sink *sink)
+{
+    int result = flush_stage(sink);
+
+    uint64_t start = Timing_now_ns();
+    if (ftruncate(sink->_fd, (off_t)(sink->_keep > 0 ? sink->_keep : sink->_written)) == -1)
+    {
+        perror("ftruncate() failed");
+        result = -1;
+    }
+    if (fdatasync(sink->_fd) == -1)
+    {
+        perror("fdatasync() failed");
+        result = -1;
+    }
+    close(sink->_fd);
+    sink->_disk_ns += Timing_now_ns() - start;
+    sink->_fd = -1;
+    free(sink->_stage);
+    sink->_stage = NULL;
+    return result;
+}
+
+uint64_t File_Sink_written(const File_Sink *sink)
+{
+    return sink->_written;
+}
+
+double File_Sink_disk_ms(const File_Sink *sink)
+{
+    return sink->_disk_ns / 1000000.0;
+}
@@ -0,0 +1,80 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming file I/O for the -f/-o transfer modes. Memory use is fixed by the
+ * chunk and staging sizes, not by the file size, and the time spent in disk I/O
+ * is kept apart so it can be reported next to the network figures.
+ *
+ * Source (sender): FILE_PREAD reads each chunk into the caller's buffer (e.g. the
+ * one registered with io_uring) and asks the kernel to read the next one ahead;
+ * FILE_MMAP maps one chunk-sized window at a time, populated up front so page
+ * faults do not land in the middle of a send.
+ *
+ * Sink (receiver): writes are gathered in an aligned staging buffer and go out
+ * with pwrite() into a file preallocated with fallocate(), optionally with
+ * O_DIRECT to bypass the page cache. The sink is flushed with fdatasync() on close.
+ */
+#define FILE_STAGE_SIZE (1024 * 1024)
+#define FILE_DIRECT_ALIGN 4096
+
+typedef enum _File_Read_Mode
+{
+    FILE_PREAD = 0,
+    FILE_MMAP = 1,
+} File_Read_Mode;
+
+typedef struct _File_Source
+{
+    int _fd;
+    uint64_t _size;
+    File_Read_Mode _mode;
+    void *_map;         // current mmap window
+    size_t _map_len;
+    uint64_t _disk_ns;  // time spent reading since the last File_reset_time()
+} File_Source;
+
+typedef struct _File_Sink
+{
+    int _fd;
+    int _direct;        // O_DIRECT: only whole aligned blocks are written
+    char *_stage;       // FILE_STAGE_SIZE bytes, FILE_DIRECT_ALIGN aligned
+    size_t _staged;
+    uint64_t _offset;   // file offset of _stage[0]
+    uint64_t _written;  // bytes handed to File_Sink_write()
+    uint64_t _disk_ns;
+    uint64_t _keep;     // File_Sink_open_keep(): the size the file is trimmed to, what it had is kept
+} File_Sink;
+
+/* Parses "pread" or "mmap". */
+int File_parse_read_mode(const char *name, File_Read_Mode *out);
+
+int File_Source_open(File_Source *src, const char *path, File_Read_Mode mode);
+uint64_t File_Source_size(const File_Source *src);
+/* Returns bytes [offset, offset + len) of the file: read into buf (FILE_PREAD) or mapped (FILE_MMAP).
+   Valid until the next call; NULL on error or a short file. */
+const char *File_Source_read(File_Source *src, char *buf, uint64_t offset, size_t len);
+void File_Source_close(File_Source *src);
+
+/* Creates or truncates path and preallocates size bytes. If O_DIRECT is refused, falls back to buffered writes. */
+int File_Sink_open(File_Sink *sink, const char *path, uint64_t size, int direct);
+/* Same, but an existing file keeps its bytes (a resumed transfer writes only those it lacks) and ends up size bytes. */
+int File_Sink_open_keep(File_Sink *sink, const char *path, uint64_t size, int direct);
+int File_Sink_write(File_Sink *sink, const void *buf, size_t len);
+/* Writes what is staged, and goes on at offset (a multiple of FILE_DIRECT_ALIGN with O_DIRECT). */
+int File_Sink_seek(File_Sink *sink, uint64_t offset);
+/* Writes what is staged and syncs it, going on right after it; with O_DIRECT at a FILE_DIRECT_ALIGN multiple only. */
+int File_Sink_sync(File_Sink *sink);
+/* Writes what is staged, trims the file to the bytes written, syncs and closes it. */
+int File_Sink_close(File_Sink *sink);
+uint64_t File_Sink_written(const File_Sink *sink);
+
+/* Disk time in ms since the source or sink was opened. */
+double File_Source_disk_ms(const File_Source *src);
+double File_Sink_disk_ms(const File_Sink *sink);
+void File_Source_reset_time(File_Source *src);
+
+#endif
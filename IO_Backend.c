@@ -0,0 +1,1152 @@
+#include "IO_Backend.h"
+#include "Timing.h"
+#include "Timestamp.h"
+#include "XDP.h"
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#include <linux/time_types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define IO_RING_ENTRIES 256
+#define IO_MAX_FILES 8
+#define IO_SEND_SLOTS 64
+#define IO_SLOT_SIZE 65536
+#define IO_PBUF_COUNT 64 // must be a power of two
+#define IO_PBUF_SIZE 65536
+#define IO_PBUF_GROUP 0
+#define IO_MAX_FD 1024   // datagram sockets counted by IO_print_packets()
+
+#define TAG_SHIFT 56
+#define MAKE_TAG(tag, value) (((unsigned long long)(tag) << TAG_SHIFT) | (value))
+
+enum
+{
+    TAG_NONE,
+    TAG_SEND_SLOT,
+    TAG_STREAM_SEND,
+    TAG_RECV,
+    TAG_TIMEOUT,
+    TAG_MULTISHOT,
+    TAG_CANCEL,
+};
+
+typedef struct _IO_Ready
+{
+    unsigned short bid; // provided buffer id
+    int len;
+    int off;            // bytes already handed to the caller
+} IO_Ready;
+
+typedef struct _IO_File
+{
+    int fd;             // -1 when the slot is free
+    int type;           // SOCK_STREAM or SOCK_DGRAM
+    int has_timeout;
+    struct __kernel_timespec timeout;
+    int armed;          // multishot recv in flight
+    int eof;
+    int error;
+    IO_Ready ready[IO_PBUF_COUNT];
+    int ready_head;
+    int ready_count;
+} IO_File;
+
+static struct
+{
+    IO_Backend backend;
+    int busy_poll;  // IO_set_busy_poll()
+    unsigned long syscalls;
+    int error; // errno of a failed queued send, reported by the next call
+
+    char xdp_dev[IF_NAMESIZE];  // IO_XDP: from "xdp:<dev>[:queue]"
+    unsigned int xdp_queue;
+
+    unsigned char datagram[IO_MAX_FD];  // IO_attach()ed sockets, whose datagrams are counted
+    unsigned long long sent;
+    unsigned long long received;
+    uint64_t first_ns;      // the first datagram since IO_reset_syscalls(), 0 before it
+    uint64_t cpu_ns;        // process CPU time at IO_reset_syscalls()
+    int cycles_fd;          // perf CPU cycles counter of the process, -1 without
+    uint64_t cycles;        // its value at IO_reset_syscalls()
+
+    int ring_fd;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    char *slots; // registered buffer 0
+    int slot_busy[IO_SEND_SLOTS];
+    int slots_free;
+    char *user_buf; // registered buffer 1
+    size_t user_len;
+    int zc; // SEND_ZC usable
+
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *pbufs;
+    unsigned short br_tail;
+
+    IO_File files[IO_MAX_FILES];
+
+    int recv_done;
+    int recv_res;
+    int stream_pending;
+    int stream_res;
+    int notif_pending;
+} io = {.backend = IO_SYSCALL, .ring_fd = -1, .cycles_fd = -2};
+
+// ************ io_uring plumbing **************
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    io.syscalls++;
+    return (int)syscall(__NR_io_uring_enter, io.ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(unsigned opcode, void *arg, unsigned nr_args)
+{
+    io.syscalls++;
+    return (int)syscall(__NR_io_uring_register, io.ring_fd, opcode, arg, nr_args);
+}
+
+static void handle_cqe(const struct io_uring_cqe *cqe)
+{
+    unsigned tag = (unsigned)(cqe->user_data >> TAG_SHIFT);
+    unsigned value = (unsigned)(cqe->user_data & 0xFFFFFFFF);
+
+    switch (tag)
+    {
+    case TAG_SEND_SLOT:
+        io.slot_busy[value] = 0;
+        io.slots_free++;
+        if (cqe->res < 0 && io.error == 0)
+        {
+            io.error = -cqe->res;
+            fprintf(stderr, "io_uring send failed: %s\n", strerror(-cqe->res));
+        }
+        break;
+    case TAG_STREAM_SEND:
+        if (cqe->flags & IORING_CQE_F_NOTIF)
+        {
+            io.notif_pending--;
+            break;
+        }
+        if (cqe->flags & IORING_CQE_F_MORE)
+            io.notif_pending++;
+        io.stream_pending--;
+        if (cqe->res < 0)
+            io.stream_res = cqe->res;
+        else if (io.stream_res >= 0)
+            io.stream_res += cqe->res;
+        break;
+    case TAG_RECV:
+        io.recv_done = 1;
+        io.recv_res = cqe->res;
+        break;
+    case TAG_MULTISHOT:
+    {
+        IO_File *f = &io.files[value];
+        if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+        {
+            IO_Ready *r = &f->ready[(f->ready_head + f->ready_count) % IO_PBUF_COUNT];
+            r->bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            r->len = cqe->res;
+            r->off = 0;
+            f->ready_count++;
+        }
+        else if (cqe->res == 0)
+            f->eof = 1;
+        else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+            f->error = -cqe->res;
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            f->armed = 0; // re-armed by the next IO_recv()
+        break;
+    }
+    default: // timeouts and cancellations carry no state
+        break;
+    }
+}
+
+static void reap(void)
+{
+    unsigned head = *io.cq_head;
+    unsigned tail = __atomic_load_n(io.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        handle_cqe(&io.cqes[head & *io.cq_mask]);
+        head++;
+    }
+    __atomic_store_n(io.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submits everything queued and, if min_complete > 0, waits for that many completions. */
+static int flush(unsigned min_complete)
+{
+    __atomic_store_n(io.sq_tail, io.sq_local_tail, __ATOMIC_RELEASE);
+    while (io.to_submit > 0 || min_complete > 0)
+    {
+        int ret = uring_enter(io.to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EBUSY)
+            {
+                reap(); // completion queue is full
+                continue;
+            }
+            perror("io_uring_enter() failed");
+            return -1;
+        }
+        io.to_submit -= (unsigned)ret < io.to_submit ? (unsigned)ret : io.to_submit;
+        min_complete = 0;
+    }
+    reap();
+    return 0;
+}
+
+/* Waits for at least one completion, without a syscall if one is already there. */
+static int wait_event(void)
+{
+    if (io.to_submit == 0 && *io.cq_head != __atomic_load_n(io.cq_tail, __ATOMIC_ACQUIRE))
+    {
+        reap();
+        return 0;
+    }
+    return flush(1);
+}
+
+/* Makes room for count SQEs so linked requests are never split across submissions. */
+static int reserve_sqes(unsigned count)
+{
+    unsigned head = __atomic_load_n(io.sq_head, __ATOMIC_ACQUIRE);
+    if (*io.sq_entries - (io.sq_local_tail - head) < count)
+        return flush(0);
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe(void)
+{
+    struct io_uring_sqe *sqe = &io.sqes[io.sq_local_tail & *io.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    io.sq_local_tail++;
+    io.to_submit++;
+    return sqe;
+}
+
+static void recycle_pbuf(unsigned short bid)
+{
+    struct io_uring_buf *buf = &io.br->bufs[io.br_tail & (IO_PBUF_COUNT - 1)];
+    buf->addr = (unsigned long long)(io.pbufs + (size_t)bid * IO_PBUF_SIZE);
+    buf->len = IO_PBUF_SIZE;
+    buf->bid = bid;
+    io.br_tail++;
+    __atomic_store_n(&io.br->tail, io.br_tail, __ATOMIC_RELEASE);
+}
+
+static int file_index(int fd)
+{
+    int free_slot = -1;
+    for (int i = 0; i < IO_MAX_FILES; i++)
+    {
+        if (io.files[i].fd == fd)
+            return i;
+        if (io.files[i].fd == -1 && free_slot == -1)
+            free_slot = i;
+    }
+    if (free_slot == -1)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+
+    IO_File *f = &io.files[free_slot];
+    memset(f, 0, sizeof(*f));
+    f->fd = -1;
+    socklen_t len = sizeof(f->type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &f->type, &len) != 0)
+        return -1;
+
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = free_slot;
+    update.fds = (unsigned long long)&fd;
+    if (uring_register(IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+    {
+        perror("IORING_REGISTER_FILES_UPDATE failed");
+        return -1;
+    }
+    f->fd = fd;
+    return free_slot;
+}
+
+static void uring_teardown(void)
+{
+    if (io.br != NULL)
+        munmap(io.br, io.br_size);
+    if (io.slots != NULL)
+        munmap(io.slots, (size_t)IO_SEND_SLOTS * IO_SLOT_SIZE);
+    free(io.pbufs);
+    if (io.sqes != NULL)
+        munmap(io.sqes, io.sqes_size);
+    if (io.cq_ptr != NULL && io.cq_ptr != io.sq_ptr)
+        munmap(io.cq_ptr, io.cq_size);
+    if (io.sq_ptr != NULL)
+        munmap(io.sq_ptr, io.sq_size);
+    if (io.ring_fd >= 0)
+        close(io.ring_fd);
+
+    io.br = NULL;
+    io.slots = NULL;
+    io.pbufs = NULL;
+    io.sqes = NULL;
+    io.cq_ptr = io.sq_ptr = NULL;
+    io.ring_fd = -1;
+}
+
+static int uring_setup(void *user_buf, size_t user_len)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    io.ring_fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &p);
+    if (io.ring_fd < 0)
+        return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    io.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    io.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (io.cq_size > io.sq_size)
+        io.sq_size = io.cq_size;
+    io.sq_ptr = mmap(NULL, io.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io.ring_fd, IORING_OFF_SQ_RING);
+    if (io.sq_ptr == MAP_FAILED)
+    {
+        io.sq_ptr = NULL;
+        return -1;
+    }
+    io.cq_ptr = io.sq_ptr;
+
+    io.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    io.sqes = mmap(NULL, io.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io.ring_fd, IORING_OFF_SQES);
+    if (io.sqes == MAP_FAILED)
+    {
+        io.sqes = NULL;
+        return -1;
+    }
+
+    char *sq = io.sq_ptr;
+    io.sq_head = (unsigned *)(sq + p.sq_off.head);
+    io.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    io.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    io.sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+    io.sq_array = (unsigned *)(sq + p.sq_off.array);
+    io.cq_head = (unsigned *)(sq + p.cq_off.head);
+    io.cq_tail = (unsigned *)(sq + p.cq_off.tail);
+    io.cq_mask = (unsigned *)(sq + p.cq_off.ring_mask);
+    io.cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        io.sq_array[i] = i; // SQEs are always consumed in order
+    io.sq_local_tail = *io.sq_tail;
+
+    // Registered buffers: send slots, plus the caller's payload if given.
+    io.slots = mmap(NULL, (size_t)IO_SEND_SLOTS * IO_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (io.slots == MAP_FAILED)
+    {
+        io.slots = NULL;
+        return -1;
+    }
+    struct iovec iov[2] = {{io.slots, (size_t)IO_SEND_SLOTS * IO_SLOT_SIZE}, {user_buf, user_len}};
+    if (uring_register(IORING_REGISTER_BUFFERS, iov, user_buf != NULL ? 2 : 1) < 0)
+        return -1;
+    io.slots_free = IO_SEND_SLOTS;
+    io.user_buf = user_buf;
+    io.user_len = user_buf != NULL ? user_len : 0;
+    io.zc = 1;
+
+    // Registered files: a sparse table filled in as sockets are first used.
+    int fds[IO_MAX_FILES];
+    for (int i = 0; i < IO_MAX_FILES; i++)
+    {
+        fds[i] = -1;
+        io.files[i].fd = -1;
+    }
+    if (uring_register(IORING_REGISTER_FILES, fds, IO_MAX_FILES) < 0)
+        return -1;
+
+    // Provided buffer ring for multishot receive.
+    io.br_size = IO_PBUF_COUNT * sizeof(struct io_uring_buf);
+    io.br = mmap(NULL, io.br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (io.br == MAP_FAILED)
+    {
+        io.br = NULL;
+        return -1;
+    }
+    io.pbufs = malloc((size_t)IO_PBUF_COUNT * IO_PBUF_SIZE);
+    if (io.pbufs == NULL)
+        return -1;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)io.br;
+    reg.ring_entries = IO_PBUF_COUNT;
+    reg.bgid = IO_PBUF_GROUP;
+    if (uring_register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+    io.br_tail = 0;
+    for (unsigned short bid = 0; bid < IO_PBUF_COUNT; bid++)
+        recycle_pbuf(bid);
+
+    return 0;
+}
+
+// ************ uring operations **************
+static ssize_t uring_send_sync(IO_File *f, int index, const void *buf, size_t len)
+{
+    int fixed = io.zc && io.user_buf != NULL && (const char *)buf >= io.user_buf &&
+                (const char *)buf + len <= io.user_buf + io.user_len;
+
+    if (reserve_sqes(1) < 0)
+        return -1;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = fixed ? IORING_OP_SEND_ZC : IORING_OP_SEND;
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (unsigned long long)buf;
+    sqe->len = (unsigned)len;
+    sqe->msg_flags = f->type == SOCK_STREAM ? MSG_WAITALL : 0;
+    if (fixed)
+    {
+        sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = 1;
+    }
+    sqe->user_data = MAKE_TAG(TAG_STREAM_SEND, index);
+
+    io.stream_pending = 1;
+    io.stream_res = 0;
+    while (io.stream_pending > 0 || io.notif_pending > 0)
+    {
+        if (wait_event() < 0)
+            return -1;
+    }
+
+    if (fixed && (io.stream_res == -EINVAL || io.stream_res == -EOPNOTSUPP))
+    {
+        io.zc = 0; // older kernel: retry as a plain send
+        return uring_send_sync(f, index, buf, len);
+    }
+    if (io.stream_res < 0)
+    {
+        errno = -io.stream_res;
+        return -1;
+    }
+    return io.stream_res;
+}
+
+static ssize_t uring_send(int fd, const void *buf, size_t len)
+{
+    int index = file_index(fd);
+    if (index < 0)
+        return -1;
+    IO_File *f = &io.files[index];
+
+    if (f->type == SOCK_STREAM || len > IO_SLOT_SIZE)
+        return uring_send_sync(f, index, buf, len);
+
+    // Datagram: copy into a registered slot and leave it queued for the next wait.
+    while (io.slots_free == 0)
+    {
+        if (wait_event() < 0)
+            return -1;
+    }
+    int slot = 0;
+    while (io.slot_busy[slot])
+        slot++;
+    io.slot_busy[slot] = 1;
+    io.slots_free--;
+    char *dst = io.slots + (size_t)slot * IO_SLOT_SIZE;
+    memcpy(dst, buf, len);
+
+    if (reserve_sqes(1) < 0)
+        return -1;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_WRITE_FIXED; // a write on a datagram socket sends one datagram
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (unsigned long long)dst;
+    sqe->len = (unsigned)len;
+    sqe->buf_index = 0;
+    sqe->user_data = MAKE_TAG(TAG_SEND_SLOT, slot);
+    return (ssize_t)len;
+}
+
+static ssize_t uring_recv_stream(IO_File *f, int index, void *buf, size_t len)
+{
+    while (f->ready_count == 0)
+    {
+        if (f->eof)
+            return 0;
+        if (f->error)
+        {
+            errno = f->error;
+            f->error = 0;
+            return -1;
+        }
+        if (!f->armed)
+        {
+            if (reserve_sqes(1) < 0)
+                return -1;
+            struct io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = index;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->buf_group = IO_PBUF_GROUP;
+            sqe->user_data = MAKE_TAG(TAG_MULTISHOT, index);
+            f->armed = 1;
+        }
+        if (wait_event() < 0)
+            return -1;
+    }
+
+    IO_Ready *r = &f->ready[f->ready_head];
+    size_t n = (size_t)(r->len - r->off);
+    if (n > len)
+        n = len;
+    memcpy(buf, io.pbufs + (size_t)r->bid * IO_PBUF_SIZE + r->off, n);
+    r->off += (int)n;
+    if (r->off == r->len)
+    {
+        recycle_pbuf(r->bid);
+        f->ready_head = (f->ready_head + 1) % IO_PBUF_COUNT;
+        f->ready_count--;
+    }
+    return (ssize_t)n;
+}
+
+/* One receive; with addr or control it is a recvmsg, control then gets the ancillary data. */
+static ssize_t uring_recv_single(IO_File *f, int index, void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen,
+                                 void *control, size_t *controllen, int flags)
+{
+    struct iovec iov = {buf, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = addrlen != NULL ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = controllen != NULL ? *controllen : 0;
+    int use_msg = addr != NULL || control != NULL;
+
+    if (reserve_sqes(2) < 0)
+        return -1;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = use_msg ? IORING_OP_RECVMSG : IORING_OP_RECV;
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE | (f->has_timeout ? IOSQE_IO_LINK : 0);
+    sqe->addr = use_msg ? (unsigned long long)&msg : (unsigned long long)buf;
+    sqe->len = use_msg ? 1 : (unsigned)len;
+    sqe->msg_flags = (unsigned)flags;
+    sqe->user_data = MAKE_TAG(TAG_RECV, index);
+    if (f->has_timeout)
+    {
+        sqe = get_sqe();
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = (unsigned long long)&f->timeout;
+        sqe->len = 1;
+        sqe->user_data = MAKE_TAG(TAG_TIMEOUT, index);
+    }
+
+    // Queued sends complete first; waiting for them too saves a wakeup per packet.
+    io.recv_done = 0;
+    reap();
+    if (flush(1 + IO_SEND_SLOTS - io.slots_free) < 0)
+        return -1;
+    while (!io.recv_done)
+    {
+        if (wait_event() < 0)
+            return -1;
+    }
+
+    if (io.recv_res == -ECANCELED) // the linked timeout fired, same as SO_RCVTIMEO expiring
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (io.recv_res < 0)
+    {
+        errno = -io.recv_res;
+        return -1;
+    }
+    if (addrlen != NULL)
+        *addrlen = msg.msg_namelen;
+    if (controllen != NULL)
+        *controllen = msg.msg_controllen;
+    return io.recv_res;
+}
+
+static ssize_t uring_recvfrom(int fd, void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen)
+{
+    int index = file_index(fd);
+    if (index < 0)
+        return -1;
+    IO_File *f = &io.files[index];
+
+    if (f->type == SOCK_STREAM && addr == NULL)
+        return uring_recv_stream(f, index, buf, len);
+    return uring_recv_single(f, index, buf, len, addr, addrlen, NULL, NULL, 0);
+}
+
+static void uring_forget(int fd)
+{
+    int index = -1;
+    for (int i = 0; i < IO_MAX_FILES; i++)
+    {
+        if (io.files[i].fd == fd)
+            index = i;
+    }
+    if (index < 0)
+        return;
+    IO_File *f = &io.files[index];
+
+    // queued datagrams must leave before the socket goes away
+    while (io.slots_free < IO_SEND_SLOTS && wait_event() == 0)
+        ;
+
+    if (f->armed && reserve_sqes(1) == 0)
+    {
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = MAKE_TAG(TAG_MULTISHOT, index);
+        sqe->user_data = MAKE_TAG(TAG_CANCEL, index);
+        while (f->armed && wait_event() == 0)
+            ;
+    }
+    for (; f->ready_count > 0; f->ready_count--)
+    {
+        recycle_pbuf(f->ready[f->ready_head].bid);
+        f->ready_head = (f->ready_head + 1) % IO_PBUF_COUNT;
+    }
+
+    // the registered table holds a reference that would keep the socket open
+    int empty = -1;
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = index;
+    update.fds = (unsigned long long)&empty;
+    uring_register(IORING_REGISTER_FILES_UPDATE, &update, 1);
+    f->fd = -1;
+}
+
+// ************ public API **************
+int IO_parse_backend(const char *name, IO_Backend *out)
+{
+    if (strcmp(name, "syscall") == 0)
+        *out = IO_SYSCALL;
+    else if (strcmp(name, "uring") == 0)
+        *out = IO_URING;
+    else if (strncmp(name, "xdp:", 4) == 0)
+    {
+        // xdp:<dev>[:queue]
+        const char *dev = name + 4;
+        const char *colon = strchr(dev, ':');
+        size_t len = colon != NULL ? (size_t)(colon - dev) : strlen(dev);
+        char *end = NULL;
+        unsigned long queue = colon != NULL ? strtoul(colon + 1, &end, 10) : 0;
+        if (len == 0 || len >= IF_NAMESIZE || (colon != NULL && (end == colon + 1 || *end != '\0' || queue > 63)))
+            return -1;
+        memcpy(io.xdp_dev, dev, len);
+        io.xdp_dev[len] = '\0';
+        io.xdp_queue = (unsigned int)queue;
+        *out = IO_XDP;
+    }
+    else
+        return -1;
+    return 0;
+}
+
+int IO_init(IO_Backend backend, void *user_buf, size_t user_len)
+{
+    io.backend = IO_SYSCALL;
+    io.syscalls = 0;
+    io.error = 0;
+    if (backend == IO_SYSCALL)
+        return 0;
+    if (backend == IO_XDP)
+    {
+        if (XDP_init(io.xdp_dev, io.xdp_queue) < 0)
+        {
+            perror("AF_XDP setup failed, falling back to syscalls");
+            return 0;
+        }
+        io.backend = IO_XDP;
+        XDP_reset_syscalls();
+        return 0;
+    }
+
+    if (uring_setup(user_buf, user_len) < 0)
+    {
+        perror("io_uring setup failed, falling back to syscalls");
+        uring_teardown();
+        io.syscalls = 0;
+        return 0;
+    }
+    io.backend = IO_URING;
+    io.syscalls = 0;
+    printf("Using io_uring I/O backend\n");
+    return 0;
+}
+
+void IO_cleanup(void)
+{
+    if (io.backend == IO_URING)
+    {
+        flush(0);
+        uring_teardown();
+    }
+    if (io.backend == IO_XDP)
+        XDP_cleanup();
+    io.backend = IO_SYSCALL;
+}
+
+IO_Backend IO_backend(void)
+{
+    return io.backend;
+}
+
+const char *IO_backend_name(void)
+{
+    if (io.backend == IO_XDP)
+        return io.busy_poll ? "xdp, busy-polled" : "xdp";
+    if (io.busy_poll)
+        return "syscall, busy-polled";
+    return io.backend == IO_URING ? "uring" : "syscall";
+}
+
+int IO_set_busy_poll(int on)
+{
+    if (on && io.backend == IO_URING)
+        return -1;
+    io.busy_poll = on;
+    if (io.backend == IO_XDP)
+        XDP_set_busy_poll(on);
+    return 0;
+}
+
+int IO_attach(int fd)
+{
+    if (fd >= 0 && fd < IO_MAX_FD)
+        io.datagram[fd] = 1;
+    if (io.backend != IO_XDP)
+        return -1;
+    return XDP_attach(fd);
+}
+
+int IO_flush(int fd)
+{
+    (void)fd; // the ring is shared: every socket's sends go
+    if (io.backend != IO_URING)
+        return 0;
+    if (flush(0) == -1)
+        return -1;
+    while (io.slots_free < IO_SEND_SLOTS)
+        if (flush(1) == -1)
+            return -1;
+    return 0;
+}
+
+void IO_peer_changed(int fd)
+{
+    if (io.backend == IO_XDP)
+        XDP_peer_changed(fd);
+}
+
+size_t IO_max_datagram(int fd)
+{
+    if (io.backend == IO_XDP && XDP_attached(fd))
+        return XDP_max_datagram(fd);
+    return 0;
+}
+
+/* fd through the AF_XDP socket */
+static int on_xdp(int fd)
+{
+    return io.backend == IO_XDP && XDP_attached(fd);
+}
+
+/* A datagram of fd went out or came in. */
+static void count_packet(int fd, unsigned long long *counter)
+{
+    if (fd < 0 || fd >= IO_MAX_FD || !io.datagram[fd])
+        return;
+    if (__atomic_load_n(&io.first_ns, __ATOMIC_RELAXED) == 0)
+    {
+        uint64_t unset = 0;
+        __atomic_compare_exchange_n(&io.first_ns, &unset, Timing_now_ns(), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+/* When a blocking receive on fd started now would give up (its SO_RCVTIMEO), 0 for never. */
+static uint64_t recv_deadline(int fd)
+{
+    struct timeval timeout;
+    socklen_t len = sizeof(timeout);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &len) < 0 || (timeout.tv_sec == 0 && timeout.tv_usec == 0))
+        return 0;
+    return Timing_now_ns() + (uint64_t)timeout.tv_sec * 1000000000ULL + (uint64_t)timeout.tv_usec * 1000ULL;
+}
+
+/*
+ * recvmsg() for the syscall backend. Busy-polled, a blocking receive spins on MSG_DONTWAIT
+ * instead of sleeping, until something arrives or fd's receive timeout would have expired
+ * (then it fails with EAGAIN, as the timeout would have).
+ */
+static ssize_t recv_msg(int fd, struct msghdr *msg, int flags)
+{
+    __atomic_add_fetch(&io.syscalls, 1, __ATOMIC_RELAXED);
+    if (!io.busy_poll || (flags & MSG_DONTWAIT))
+        return recvmsg(fd, msg, flags);
+
+    uint64_t deadline = recv_deadline(fd);
+    socklen_t namelen = msg->msg_namelen;
+    size_t controllen = msg->msg_controllen;
+    for (;;)
+    {
+        ssize_t ret = recvmsg(fd, msg, flags | MSG_DONTWAIT);
+        if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || (deadline != 0 && Timing_now_ns() >= deadline))
+            return ret;
+        msg->msg_namelen = namelen;
+        msg->msg_controllen = controllen;
+        __atomic_add_fetch(&io.syscalls, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int IO_set_recv_timeout(int fd, int seconds)
+{
+    struct timeval timeout;
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+        return -1;
+    XDP_set_timeout(fd, seconds);
+
+    if (io.backend == IO_URING)
+    {
+        int index = file_index(fd);
+        if (index < 0)
+            return -1;
+        io.files[index].has_timeout = seconds > 0;
+        io.files[index].timeout.tv_sec = seconds;
+        io.files[index].timeout.tv_nsec = 0;
+    }
+    return 0;
+}
+
+ssize_t IO_send(int fd, const void *buf, size_t len)
+{
+    if (io.error)
+    {
+        errno = io.error;
+        io.error = 0;
+        return -1;
+    }
+    count_packet(fd, &io.sent);
+    if (on_xdp(fd))
+        return XDP_send(fd, buf, len);
+    uint64_t start_ns = Timestamp_stamped(fd) ? Timestamp_now_ns() : 0;
+    if (io.backend == IO_URING)
+    {
+        ssize_t ret = uring_send(fd, buf, len);
+        if (ret >= 0)
+            Timestamp_sent(fd, len, start_ns);
+        return ret;
+    }
+
+    // a datagram always goes out whole, so this only loops on streams
+    size_t sent = 0;
+    while (sent < len)
+    {
+        __atomic_add_fetch(&io.syscalls, 1, __ATOMIC_RELAXED);  // striped paths send from several threads
+        ssize_t ret = send(fd, (const char *)buf + sent, len - sent, 0);
+        if (ret < 0)
+            return -1;
+        sent += (size_t)ret;
+    }
+    Timestamp_sent(fd, len, start_ns);
+    return (ssize_t)sent;
+}
+
+ssize_t IO_recv(int fd, void *buf, size_t len)
+{
+    return IO_recvfrom(fd, buf, len, NULL, NULL);
+}
+
+ssize_t IO_recvfrom(int fd, void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen)
+{
+    if (io.error)
+    {
+        errno = io.error;
+        io.error = 0;
+        return -1;
+    }
+    if (on_xdp(fd))
+    {
+        ssize_t ret = XDP_recvfrom(fd, buf, len, 0, addr, addrlen, NULL);
+        if (ret >= 0)
+            count_packet(fd, &io.received);
+        return ret;
+    }
+    if (io.backend == IO_URING)
+    {
+        ssize_t ret = uring_recvfrom(fd, buf, len, addr, addrlen);
+        if (ret >= 0)
+            count_packet(fd, &io.received);
+        return ret;
+    }
+
+    struct iovec iov = {buf, len};
+    char control[TIMESTAMP_CONTROL];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = addrlen != NULL ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (Timestamp_stamped(fd))
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+    }
+    ssize_t ret = recv_msg(fd, &msg, 0);
+    if (ret >= 0 && addrlen != NULL)
+        *addrlen = msg.msg_namelen;
+    if (ret >= 0 && msg.msg_control != NULL)
+        Timestamp_received(&msg);
+    if (ret >= 0)
+        count_packet(fd, &io.received);
+    return ret;
+}
+
+int IO_wait_readable(int fd, int timeout_ms)
+{
+    return IO_wait_readable_or(fd, -1, timeout_ms);
+}
+
+int IO_wait_readable_or(int fd, int wake_fd, int timeout_ms)
+{
+    if (on_xdp(fd))
+        return XDP_wait_readable_or(fd, wake_fd, timeout_ms);
+    // queued datagrams go out before the wait, not with the next receive
+    if (io.backend == IO_URING && flush(0) < 0)
+        return -1;
+
+    // poll() skips a negative fd, so wake_fd -1 waits for fd alone
+    struct pollfd pfd[2] = {{.fd = fd, .events = POLLIN}, {.fd = wake_fd, .events = POLLIN}};
+    uint64_t deadline = Timing_now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    int ret;
+    for (;;)
+    {
+        if (io.busy_poll)
+        {
+            // spin on a poll that never sleeps, until the timeout
+            while (((ret = poll(pfd, 2, 0)) == 0 && (timeout_ms < 0 || Timing_now_ns() < deadline)) || (ret < 0 && errno == EINTR))
+                ;
+        }
+        else
+        {
+            while ((ret = poll(pfd, 2, timeout_ms)) < 0 && errno == EINTR)
+                ;
+        }
+        // transmit stamps in the error queue wake poll() too (POLLERR): read them, and wait on for data
+        if (ret <= 0 || pfd[1].revents != 0 || (pfd[0].revents & POLLIN) || Timestamp_drain(fd) == 0)
+            break;
+        uint64_t now = Timing_now_ns();
+        if (timeout_ms >= 0)
+        {
+            if (now >= deadline)
+                return 0;
+            timeout_ms = (int)((deadline - now + 999999) / 1000000);
+        }
+    }
+    if (ret <= 0)
+        return ret < 0 ? -1 : 0;
+    return pfd[1].revents != 0 ? 2 : 1;
+}
+
+ssize_t IO_recv_ovfl(int fd, void *buf, size_t len, int flags, uint32_t *dropped, uint64_t *rx_ns)
+{
+    if (io.error)
+    {
+        errno = io.error;
+        io.error = 0;
+        return -1;
+    }
+
+    if (on_xdp(fd))
+    {
+        // no kernel receive stamps: the frame never reaches the socket
+        ssize_t ret = XDP_recvfrom(fd, buf, len, flags, NULL, NULL, dropped);
+        if (ret >= 0)
+            count_packet(fd, &io.received);
+        *rx_ns = 0;
+        return ret;
+    }
+
+    char control[CMSG_SPACE(sizeof(uint32_t)) + TIMESTAMP_CONTROL];
+    size_t controllen = sizeof(control);
+    ssize_t ret;
+    if (io.backend == IO_URING)
+    {
+        int index = file_index(fd);
+        if (index < 0)
+            return -1;
+        ret = uring_recv_single(&io.files[index], index, buf, len, NULL, NULL, control, &controllen, flags);
+    }
+    else
+    {
+        struct iovec iov = {buf, len};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = controllen;
+        ret = recv_msg(fd, &msg, flags);
+        controllen = msg.msg_controllen;
+    }
+    if (ret < 0)
+        return -1;
+    count_packet(fd, &io.received);
+
+    // present once the socket has dropped anything
+    struct msghdr parsed;
+    memset(&parsed, 0, sizeof(parsed));
+    parsed.msg_control = control;
+    parsed.msg_controllen = controllen;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&parsed); c != NULL; c = CMSG_NXTHDR(&parsed, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+            memcpy(dropped, CMSG_DATA(c), sizeof(uint32_t));
+    }
+    *rx_ns = Timestamp_received(&parsed);
+    return ret;
+}
+
+int IO_close(int fd)
+{
+    if (io.backend == IO_URING)
+        uring_forget(fd);
+    if (io.backend == IO_XDP)
+        XDP_forget(fd);
+    if (fd >= 0 && fd < IO_MAX_FD)
+        io.datagram[fd] = 0;
+    Timestamp_forget(fd);
+    return close(fd);
+}
+
+unsigned long IO_syscalls(void)
+{
+    return __atomic_load_n(&io.syscalls, __ATOMIC_RELAXED) + XDP_syscalls();
+}
+
+static uint64_t cpu_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* The process's CPU cycles so far, from a perf counter opened on first use; -1 without one (VMs, perf_event_paranoid). */
+static int64_t cpu_cycles(void)
+{
+    if (io.cycles_fd == -2)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.inherit = 1;   // the ACK thread and striped paths too
+        io.cycles_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    uint64_t value;
+    if (io.cycles_fd < 0 || read(io.cycles_fd, &value, sizeof(value)) != (ssize_t)sizeof(value))
+        return -1;
+    return (int64_t)value;
+}
+
+/* Cycles per ns of the time stamp counter, measured once; 0 where there is none. */
+static double tsc_ghz(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static double ghz;
+    if (ghz == 0)
+    {
+        uint64_t start_ns = Timing_now_ns();
+        uint64_t start = __rdtsc();
+        usleep(10000);
+        ghz = (double)(__rdtsc() - start) / (double)(Timing_now_ns() - start_ns);
+    }
+    return ghz;
+#else
+    return 0;
+#endif
+}
+
+void IO_reset_syscalls(void)
+{
+    io.syscalls = 0;
+    XDP_reset_syscalls();
+    io.sent = 0;
+    io.received = 0;
+    io.first_ns = 0;
+    io.cpu_ns = cpu_time_ns();
+    int64_t cycles = cpu_cycles();
+    io.cycles = cycles >= 0 ? (uint64_t)cycles : 0;
+}
+
+void IO_print_packets(void)
+{
+    unsigned long long packets = io.sent + io.received;
+    if (packets == 0)
+        return;
+    uint64_t now = Timing_now_ns();
+    double ms = io.first_ns != 0 && now > io.first_ns ? (double)(now - io.first_ns) / 1e6 : 0.0;
+    printf("Packets: %llu sent, %llu received in %.3f ms: %.0f pps", io.sent, io.received, ms,
+           ms > 0 ? (double)packets * 1000.0 / ms : 0.0);
+
+    // the cycles of the whole process, idle waits excepted, over the packets it handled
+    int64_t cycles = cpu_cycles();
+    double cpu_ns = (double)(cpu_time_ns() - io.cpu_ns);
+    if (cycles >= 0)
+        printf(", %.0f CPU cycles per packet (perf)\n", (double)((uint64_t)cycles - io.cycles) / (double)packets);
+    else if (tsc_ghz() > 0)
+        printf(", %.0f CPU cycles per packet (CPU time at the TSC rate)\n", cpu_ns * tsc_ghz() / (double)packets);
+    else
+        printf(", %.0f ns of CPU per packet\n", cpu_ns / (double)packets);
+}
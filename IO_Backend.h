@@ -0,0 +1,73 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Socket I/O used by the TCP tools and RUDP_API.
+ *
+ * IO_SYSCALL issues one send()/recv() per call, as the tools always did.
+ * IO_URING goes through an io_uring with registered files and buffers:
+ *   - datagram sends are copied to a registered slot and queued, then submitted
+ *     together with the next receive, so a send + wait for ACK is one syscall;
+ *   - stream receives use multishot recv into a provided buffer ring;
+ *   - stream sends go out as one MSG_WAITALL request, zero-copy from the buffer
+ *     registered in IO_init() when the data lies inside it.
+ * IO_XDP (xdp:<dev>[:queue], XDP.h) takes one datagram socket, the first IO_attach()ed, off
+ * the kernel's UDP stack onto an AF_XDP socket on <dev>; other sockets go through syscalls.
+ * IO_init() falls back to IO_SYSCALL when io_uring or AF_XDP is unavailable.
+ */
+typedef enum _IO_Backend
+{
+    IO_SYSCALL = 0,
+    IO_URING = 1,
+    IO_XDP = 2,
+} IO_Backend;
+
+/* Parses "syscall", "uring" or "xdp:<dev>[:queue]". */
+int IO_parse_backend(const char *name, IO_Backend *out);
+/* Sets the backend up. user_buf/user_len (optional) are registered for zero-copy stream sends. */
+int IO_init(IO_Backend backend, void *user_buf, size_t user_len);
+void IO_cleanup(void);
+IO_Backend IO_backend(void);
+const char *IO_backend_name(void);
+/* Busy polling (syscall and xdp backends, -1 with io_uring): blocking receives and waits spin
+   without sleeping, trading a CPU for wake-up latency. */
+int IO_set_busy_poll(int on);
+
+/* A bound datagram socket to take off the kernel's stack (IO_XDP): 0 if it now is, -1 if it stays on syscalls. */
+int IO_attach(int fd);
+/* Submits the sends queued (io_uring) and waits for them, so a connect() of fd after it cannot turn them away. */
+int IO_flush(int fd);
+/* fd was connect()ed: the backend reads its peer again. */
+void IO_peer_changed(int fd);
+/* The largest datagram fd can carry, 0 for no limit but the protocol's. */
+size_t IO_max_datagram(int fd);
+
+/* Receive timeout for fd, used instead of a bare SO_RCVTIMEO so both backends honour it. */
+int IO_set_recv_timeout(int fd, int seconds);
+/* Sends len bytes. Streams block until all is sent; datagrams may only be queued. */
+ssize_t IO_send(int fd, const void *buf, size_t len);
+ssize_t IO_recv(int fd, void *buf, size_t len);
+ssize_t IO_recvfrom(int fd, void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen);
+/* Sends what is queued, then waits up to timeout_ms for fd to be readable: 1 readable, 0 timed out, -1 error. */
+int IO_wait_readable(int fd, int timeout_ms);
+/* Same, but also ends once wake_fd (e.g. an eventfd, -1 for none) is readable: 2 then, even if fd is too. */
+int IO_wait_readable_or(int fd, int wake_fd, int timeout_ms);
+/* Receives like IO_recv(), flags as for recv() (e.g. MSG_DONTWAIT); with SO_RXQ_OVFL set on fd,
+   *dropped gets the datagrams the socket dropped so far (left as is before the first), and
+   *rx_ns the kernel's receive stamp with -tstamp (Timestamp.h), 0 without. */
+ssize_t IO_recv_ovfl(int fd, void *buf, size_t len, int flags, uint32_t *dropped, uint64_t *rx_ns);
+/* Completes queued sends on fd, forgets it and closes it. */
+int IO_close(int fd);
+
+/* Number of I/O system calls issued since the last IO_reset_syscalls(). */
+unsigned long IO_syscalls(void);
+void IO_reset_syscalls(void);
+/* Prints the datagrams sent and received since IO_reset_syscalls(), per second and in CPU cycles each. */
+void IO_print_packets(void);
+
+#endif
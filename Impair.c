@@ -0,0 +1,425 @@
+#include "Impair.h"
+#include "IO_Backend.h"
+#include "Payload.h"
+#include "Timing.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMPAIR_QUEUE 256                // delayed/held packets; beyond that they go out at once
+#define IMPAIR_DEFAULT_HOLD_US 10000
+
+typedef struct _Impair_Packet
+{
+    int fd;
+    int held;          // reordered: goes out right after the next packet on fd
+    uint64_t due_ns;
+    uint64_t order;    // ties on due_ns go out in this order
+    size_t len;
+    char *data;
+} Impair_Packet;
+
+static struct
+{
+    int enabled;
+    Impair_Config config;
+    uint64_t draws;    // position in the seeded stream
+    int bad_state;     // Gilbert-Elliott state
+    uint64_t order;
+    Impair_Packet queue[IMPAIR_QUEUE];
+    size_t queued;
+    unsigned long sent, dropped, duplicated, corrupted, reordered, delayed;
+    pthread_mutex_t lock;   // striped transfers send from one thread per path
+} impair;
+
+// ************ Randomness **************
+static double uniform(void)
+{
+    return (Payload_word(impair.config.seed, impair.draws++) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int chance(double percent)
+{
+    return percent > 0 && uniform() * 100.0 < percent;
+}
+
+static int packet_lost(void)
+{
+    const Impair_Config *c = &impair.config;
+    if (c->ge_p <= 0)
+        return chance(c->loss);
+
+    if (impair.bad_state ? chance(c->ge_r) : chance(c->ge_p))
+        impair.bad_state = !impair.bad_state;
+    return chance(impair.bad_state ? c->ge_bad_loss : c->loss);
+}
+
+static uint64_t packet_delay_ns(void)
+{
+    int64_t delay = (int64_t)impair.config.delay_us * 1000;
+    if (impair.config.jitter_us > 0)
+    {
+        int64_t jitter = (int64_t)impair.config.jitter_us * 1000;
+        delay += (int64_t)(uniform() * 2 * jitter) - jitter;
+    }
+    return delay > 0 ? (uint64_t)delay : 0;
+}
+
+// ************ Parsing **************
+/* Parses "a[:b[:c]]" into values, returns how many were given or -1. */
+static int parse_values(const char *text, double *values, int max)
+{
+    for (int n = 0; n < max;)
+    {
+        char *end;
+        values[n++] = strtod(text, &end);
+        if (end == text || values[n - 1] < 0)
+            return -1;
+        if (*end == '\0')
+            return n;
+        if (*end != ':')
+            return -1;
+        text = end + 1;
+    }
+    return -1;
+}
+
+int Impair_parse(const char *spec, Impair_Config *config)
+{
+    memset(config, 0, sizeof(Impair_Config));
+    config->ge_bad_loss = 100.0;
+    config->reorder_hold_us = IMPAIR_DEFAULT_HOLD_US;
+    config->seed = Payload_random_seed();
+
+    char *copy = strdup(spec);
+    if (copy == NULL)
+        return -1;
+
+    int result = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL && result == 0; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        if (value == NULL)
+        {
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        double v[3];
+        int n = strcmp(item, "seed") == 0 ? 1 : parse_values(value, v, 3);
+        if (strcmp(item, "seed") == 0)
+            config->seed = strtoull(value, NULL, 0);
+        else if (strcmp(item, "loss") == 0 && n == 1)
+            config->loss = v[0];
+        else if (strcmp(item, "ge") == 0 && n >= 2)
+        {
+            config->ge_p = v[0];
+            config->ge_r = v[1];
+            if (n == 3)
+                config->ge_bad_loss = v[2];
+        }
+        else if (strcmp(item, "dup") == 0 && n == 1)
+            config->duplicate = v[0];
+        else if (strcmp(item, "corrupt") == 0 && n == 1)
+            config->corrupt = v[0];
+        else if (strcmp(item, "reorder") == 0 && n >= 1 && n <= 2)
+        {
+            config->reorder = v[0];
+            if (n == 2)
+                config->reorder_hold_us = (unsigned int)(v[1] * 1000.0);
+        }
+        else if (strcmp(item, "delay") == 0 && n >= 1 && n <= 2)
+        {
+            config->delay_us = (unsigned int)(v[0] * 1000.0);
+            if (n == 2)
+                config->jitter_us = (unsigned int)(v[1] * 1000.0);
+        }
+        else
+            result = -1;
+    }
+    free(copy);
+
+    if (config->loss > 100 || config->ge_p > 100 || config->ge_r > 100 || config->ge_bad_loss > 100 ||
+        config->duplicate > 100 || config->corrupt > 100 || config->reorder > 100)
+        result = -1;
+    return result;
+}
+
+void Impair_init(const Impair_Config *config)
+{
+    memset(&impair, 0, sizeof(impair));
+    impair.config = *config;
+    pthread_mutex_init(&impair.lock, NULL);
+    impair.enabled = 1;
+
+    printf("Impairment: loss %.2f%%", config->loss);
+    if (config->ge_p > 0)
+        printf(" (Gilbert-Elliott %.2f%%/%.2f%%, %.2f%% in bad state)", config->ge_p, config->ge_r, config->ge_bad_loss);
+    printf(", dup %.2f%%, corrupt %.2f%%, reorder %.2f%% (hold %u us), delay %u +/- %u us, seed 0x%016llx\n",
+           config->duplicate, config->corrupt, config->reorder, config->reorder_hold_us, config->delay_us,
+           config->jitter_us, (unsigned long long)config->seed);
+}
+
+int Impair_enabled(void)
+{
+    return impair.enabled;
+}
+
+// ************ Queue **************
+static ssize_t transmit(int fd, const void *buf, size_t len)
+{
+    impair.sent++;
+    return IO_send(fd, buf, len);
+}
+
+/* Sends queued packets of fd (any fd if fd < 0) in (due, order) order: those due by now, or all of them if force. */
+static int release(int fd, int force)
+{
+    uint64_t now = Timing_now_ns();
+    for (;;)
+    {
+        size_t best = IMPAIR_QUEUE;
+        for (size_t i = 0; i < impair.queued; i++)
+        {
+            Impair_Packet *p = &impair.queue[i];
+            if ((fd >= 0 && p->fd != fd) || (!force && p->due_ns > now))
+                continue;
+            if (best == IMPAIR_QUEUE || p->due_ns < impair.queue[best].due_ns ||
+                (p->due_ns == impair.queue[best].due_ns && p->order < impair.queue[best].order))
+                best = i;
+        }
+        if (best == IMPAIR_QUEUE)
+            return 0;
+
+        Impair_Packet p = impair.queue[best];
+        impair.queue[best] = impair.queue[--impair.queued];
+        ssize_t result = transmit(p.fd, p.data, p.len);
+        free(p.data);
+        if (result == -1)
+            return -1;
+    }
+}
+
+static int enqueue(int fd, const void *buf, size_t len, uint64_t due_ns, int held)
+{
+    if (impair.queued == IMPAIR_QUEUE)
+        return transmit(fd, buf, len) == -1 ? -1 : 0;
+
+    Impair_Packet *p = &impair.queue[impair.queued];
+    p->data = (char *)malloc(len);
+    if (p->data == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    memcpy(p->data, buf, len);
+    p->fd = fd;
+    p->held = held;
+    p->due_ns = due_ns;
+    p->order = impair.order++;
+    p->len = len;
+    impair.queued++;
+    return 0;
+}
+
+/* A packet was just sent (due_ns 0) or queued on fd: packets held back for reordering follow it. */
+static int release_held(int fd, uint64_t due_ns)
+{
+    for (size_t i = 0; i < impair.queued; i++)
+    {
+        Impair_Packet *p = &impair.queue[i];
+        if (p->fd != fd || !p->held)
+            continue;
+        p->held = 0;
+        p->order = impair.order++;
+        if (due_ns == 0 || p->due_ns < due_ns)
+            p->due_ns = due_ns;
+    }
+    return due_ns == 0 ? release(fd, 0) : 0;
+}
+
+// ************ I/O **************
+static ssize_t impair_send(int fd, const void *buf, size_t len, size_t corrupt_from);
+
+ssize_t Impair_send(int fd, const void *buf, size_t len, size_t corrupt_from)
+{
+    if (!impair.enabled)
+        return IO_send(fd, buf, len);
+
+    pthread_mutex_lock(&impair.lock);
+    ssize_t result = impair_send(fd, buf, len, corrupt_from);
+    pthread_mutex_unlock(&impair.lock);
+    return result;
+}
+
+static ssize_t impair_send(int fd, const void *buf, size_t len, size_t corrupt_from)
+{
+    if (release(-1, 0) < 0)
+        return -1;
+
+    if (packet_lost())
+    {
+        impair.dropped++;
+        return (ssize_t)len;
+    }
+
+    int copies = 1;
+    if (chance(impair.config.duplicate))
+    {
+        impair.duplicated++;
+        copies = 2;
+    }
+
+    for (int c = 0; c < copies; c++)
+    {
+        const char *data = (const char *)buf;
+        char *corrupted = NULL;
+        if (chance(impair.config.corrupt) && len > corrupt_from)
+        {
+            corrupted = (char *)malloc(len);
+            if (corrupted == NULL)
+            {
+                perror("malloc failed");
+                return -1;
+            }
+            memcpy(corrupted, buf, len);
+            uint64_t bit = (uint64_t)(uniform() * (len - corrupt_from) * 8);
+            corrupted[corrupt_from + bit / 8] ^= (char)(1 << (bit % 8));
+            data = corrupted;
+            impair.corrupted++;
+        }
+
+        uint64_t delay = packet_delay_ns();
+        int result;
+        if (chance(impair.config.reorder))
+        {
+            impair.reordered++;
+            result = enqueue(fd, data, len, Timing_now_ns() + delay + impair.config.reorder_hold_us * 1000ULL, 1);
+        }
+        else if (delay > 0)
+        {
+            impair.delayed++;
+            uint64_t due = Timing_now_ns() + delay;
+            result = enqueue(fd, data, len, due, 0);
+            if (result == 0)
+                result = release_held(fd, due);
+        }
+        else
+        {
+            result = transmit(fd, data, len) == -1 ? -1 : 0;
+            if (result == 0)
+                result = release_held(fd, 0);
+        }
+        free(corrupted);
+        if (result < 0)
+            return -1;
+    }
+    return (ssize_t)len;
+}
+
+/* Sends delayed packets as they fall due until fd is readable or nothing is left to send. */
+static void wait_readable(int fd)
+{
+    for (;;)
+    {
+        // the lock is not held across the wait, other paths keep sending meanwhile
+        pthread_mutex_lock(&impair.lock);
+        uint64_t next = 0;
+        int pending = release(-1, 0) == 0 && impair.queued > 0;
+        if (pending)
+        {
+            next = impair.queue[0].due_ns;
+            for (size_t i = 1; i < impair.queued; i++)
+                if (impair.queue[i].due_ns < next)
+                    next = impair.queue[i].due_ns;
+        }
+        pthread_mutex_unlock(&impair.lock);
+        if (!pending)
+            return;
+
+        uint64_t now = Timing_now_ns();
+        if (next <= now)
+            continue;
+
+        if (IO_wait_readable(fd, (int)((next - now + 999999) / 1000000)) != 0)
+            return;
+    }
+}
+
+int Impair_poll(int fd, int timeout_ms)
+{
+    return Impair_poll_or(fd, -1, timeout_ms);
+}
+
+int Impair_poll_or(int fd, int wake_fd, int timeout_ms)
+{
+    uint64_t deadline = Timing_now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    for (;;)
+    {
+        // delayed packets still go out as they fall due while we wait
+        uint64_t next = deadline;
+        if (impair.enabled)
+        {
+            pthread_mutex_lock(&impair.lock);
+            if (release(-1, 0) < 0)
+                next = 0;
+            for (size_t i = 0; i < impair.queued; i++)
+                if (impair.queue[i].due_ns < next)
+                    next = impair.queue[i].due_ns;
+            pthread_mutex_unlock(&impair.lock);
+        }
+
+        uint64_t now = Timing_now_ns();
+        int wait_ms = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+        int ready = IO_wait_readable_or(fd, wake_fd, wait_ms);
+        if (ready != 0 || Timing_now_ns() >= deadline)
+            return ready;
+    }
+}
+
+ssize_t Impair_recv(int fd, void *buf, size_t len)
+{
+    if (impair.enabled)
+        wait_readable(fd);
+    return IO_recv(fd, buf, len);
+}
+
+ssize_t Impair_recvfrom(int fd, void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen)
+{
+    if (impair.enabled)
+        wait_readable(fd);
+    return IO_recvfrom(fd, buf, len, addr, addrlen);
+}
+
+ssize_t Impair_recv_ovfl(int fd, void *buf, size_t len, int flags, uint32_t *dropped, uint64_t *rx_ns)
+{
+    if (impair.enabled && (flags & MSG_DONTWAIT))
+    {
+        pthread_mutex_lock(&impair.lock);
+        release(-1, 0);
+        pthread_mutex_unlock(&impair.lock);
+    }
+    else if (impair.enabled)
+        wait_readable(fd);
+    return IO_recv_ovfl(fd, buf, len, flags, dropped, rx_ns);
+}
+
+void Impair_flush(int fd)
+{
+    if (!impair.enabled)
+        return;
+    pthread_mutex_lock(&impair.lock);
+    release(fd, 1);
+    pthread_mutex_unlock(&impair.lock);
+}
+
+void Impair_print_stats(void)
+{
+    if (!impair.enabled)
+        return;
+    printf("Impairment: sent %lu, dropped %lu, duplicated %lu, corrupted %lu, reordered %lu, delayed %lu\n", impair.sent,
+           impair.dropped, impair.duplicated, impair.corrupted, impair.reordered, impair.delayed);
+}
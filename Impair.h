@@ -0,0 +1,62 @@
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Seeded packet impairment for RUDP_API, applied to every packet a process sends,
+ * like netem on an interface but unprivileged, per process and reproducible.
+ * Run both ends with it to impair data and ACKs alike.
+ *
+ * Spec: comma separated key=value, probabilities in percent, times in ms:
+ *   loss=2            drop packets at random
+ *   ge=1:30[:100]     Gilbert-Elliott bursts: good->bad %, bad->good %, loss % in bad
+ *                     (loss= then applies in the good state)
+ *   dup=1             send a second copy
+ *   corrupt=1         flip one payload bit
+ *   reorder=5[:10]    hold a packet back until after the next one (at most 10 ms)
+ *   delay=20[:5]      delay every packet, with uniform +/- jitter
+ *   seed=42           same seed, same impairment pattern
+ * e.g. "loss=2,delay=10:2,seed=7".
+ */
+typedef struct _Impair_Config
+{
+    double loss;
+    double ge_p;
+    double ge_r;
+    double ge_bad_loss;
+    double duplicate;
+    double corrupt;
+    double reorder;
+    unsigned int reorder_hold_us;
+    unsigned int delay_us;
+    unsigned int jitter_us;
+    uint64_t seed;
+} Impair_Config;
+
+/* Fills config from spec; returns -1 on an unknown key or bad value. */
+int Impair_parse(const char *spec, Impair_Config *config);
+/* Enables impairment; until called every function passes straight through to IO_Backend. */
+void Impair_init(const Impair_Config *config);
+int Impair_enabled(void);
+
+/* Sends a datagram through the impairment. Corruption only flips bits at or after corrupt_from. */
+ssize_t Impair_send(int fd, const void *buf, size_t len, size_t corrupt_from);
+/* Receives, sending any delayed packets that fall due while waiting. */
+ssize_t Impair_recv(int fd, void *buf, size_t len);
+ssize_t Impair_recvfrom(int fd, void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen);
+/* With MSG_DONTWAIT in flags it only sends the delayed packets already due, never waits. */
+ssize_t Impair_recv_ovfl(int fd, void *buf, size_t len, int flags, uint32_t *dropped, uint64_t *rx_ns);
+/* Waits up to timeout_ms for fd to be readable, sending delayed packets meanwhile: 1 readable, 0 timed out, -1 error. */
+int Impair_poll(int fd, int timeout_ms);
+/* Same, but also returns 2 once wake_fd is readable (see IO_wait_readable_or()). */
+int Impair_poll_or(int fd, int wake_fd, int timeout_ms);
+/* Sends every packet still delayed or held back on fd, e.g. before closing it. */
+void Impair_flush(int fd);
+
+void Impair_print_stats(void);
+
+#endif
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "RUDP_API.h"
+#include "Payload.h"
+#include "Compress.h"
+#include "Stats.h"
+#include "Timing.h"
+#include "Trace.h"
+
+/*
+ * Microbenchmarks of the pieces every packet goes through. Each benchmark is
+ * warmed up, calibrated to BENCH_REP_NS per repetition and repeated; the mean,
+ * stddev and minimum ns/op over the repetitions are reported, plus GB/s where
+ * the operation has a size. -json stores the results, -baseline compares
+ * against a file stored earlier.
+ */
+
+#define BENCH_MAX 64
+#define BENCH_DEFAULT_REPS 10
+#define BENCH_WARMUP_NS 50000000ULL // 50 ms
+#define BENCH_REP_NS 20000000ULL    // 20 ms
+#define STATS_RESET 4096
+#define BENCH_MESSAGE 64            // bytes of a messages/ benchmark's message
+#define BENCH_MESSAGE_BATCH 16
+
+typedef struct _Bench_Ctx
+{
+    char *buf;
+    char *buf2;
+    char *text;        // compressible input for the compress benchmarks
+    char *packed;      // its LZ4 form
+    size_t packed_len;
+    size_t size;
+    RUDP_Packet *packet;
+    RUDP_Packet *ack;
+    Stats *stats;
+    Histogram *hist;
+    int sock;          // messages/: an RUDP connection to echo_main() over loopback
+    int batch;         // messages/: sent before their echoes are read
+} Bench_Ctx;
+
+typedef void (*Bench_Fn)(Bench_Ctx *ctx, uint64_t iters);
+
+typedef struct _Bench_Result
+{
+    char name[48];
+    size_t bytes; // per op, 0 if not a throughput benchmark
+    uint64_t iters;
+    Welford ns;   // ns/op of each repetition
+} Bench_Result;
+
+static volatile uint64_t sink; // keeps results alive
+static Bench_Result results[BENCH_MAX];
+static int result_count = 0;
+
+// ************ Benchmarks **************
+static void bench_checksum(Bench_Ctx *ctx, uint64_t iters)
+{
+    uint64_t acc = 0;
+    for (uint64_t i = 0; i < iters; i++)
+        acc += checksum(ctx->buf, ctx->size);
+    sink += acc;
+}
+
+/* The header fields rudp_send() fills per segment. */
+static void bench_header_build(Bench_Ctx *ctx, uint64_t iters)
+{
+    RUDP_Packet *p = ctx->packet;
+    for (uint64_t i = 0; i < iters; i++)
+    {
+        memset(p, 0, offsetof(RUDP_Packet, data));
+        p->flags.DATA = 1;
+        p->seq_num = (unsigned short)i;
+        p->length = MSG_BUFFER_SIZE;
+        sink += p->all_flags;
+    }
+}
+
+/* The checks rudp_send() makes on an incoming ACK, and rudp_recv() on any packet. */
+static void bench_header_parse(Bench_Ctx *ctx, uint64_t iters)
+{
+    const RUDP_Packet *p = ctx->ack;
+    uint64_t ok = 0;
+    for (uint64_t i = 0; i < iters; i++)
+        ok += p->length <= MSG_BUFFER_SIZE && checksum((void *)p->data, p->length) == p->checksum && p->flags.ACK &&
+              p->seq_num == (unsigned short)ctx->size;
+    sink += ok;
+}
+
+/* Copy a full segment in and checksum it, as rudp_send() does. */
+static void bench_segment_build(Bench_Ctx *ctx, uint64_t iters)
+{
+    RUDP_Packet *p = ctx->packet;
+    for (uint64_t i = 0; i < iters; i++)
+    {
+        memcpy(p->data, ctx->buf, MSG_BUFFER_SIZE);
+        p->length = MSG_BUFFER_SIZE;
+        p->checksum = checksum(p->data, p->length);
+        sink += p->checksum;
+    }
+}
+
+static void bench_build_ack(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+    {
+        ctx->packet->seq_num = (unsigned short)i;
+        build_ack(ctx->ack, ctx->packet);
+        sink += ctx->ack->checksum;
+    }
+}
+
+static void bench_stats_add(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+    {
+        if (Stats_size(ctx->stats) == STATS_RESET)
+        {
+            Stats_free(ctx->stats);
+            ctx->stats = Stats_alloc();
+        }
+        Stats_add(ctx->stats, (int)i, (double)(i & 1023), (double)(i & 511));
+    }
+    sink += Stats_size(ctx->stats);
+}
+
+static void bench_stats_percentile(Bench_Ctx *ctx, uint64_t iters)
+{
+    double acc = 0;
+    for (uint64_t i = 0; i < iters; i++)
+        acc += Stats_time_percentile(ctx->stats, 99.0);
+    sink += (uint64_t)acc;
+}
+
+static void bench_histogram_record(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        Histogram_record(ctx->hist, (i * 2654435761u) & 0xFFFFFF);
+    sink += ctx->hist->_count;
+}
+
+static void bench_payload_fill(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        Payload_fill_at(42, i * ctx->size, ctx->buf2, ctx->size);
+    sink += (unsigned char)ctx->buf2[0];
+}
+
+static void bench_payload_verify(Bench_Ctx *ctx, uint64_t iters)
+{
+    Payload p;
+    for (uint64_t i = 0; i < iters; i++)
+    {
+        Payload_init(&p, 42);
+        sink += (uint64_t)Payload_verify(&p, ctx->buf2, ctx->size);
+    }
+}
+
+static void bench_entropy(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        sink += (uint64_t)Compress_entropy(ctx->buf2, ctx->size);
+}
+
+static void bench_lz4(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        sink += Compress_lz4(ctx->text, ctx->size, ctx->packed, COMPRESS_FRAME_MAX);
+}
+
+static void bench_lz4_decode(Bench_Ctx *ctx, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        sink += (uint64_t)Compress_lz4_decode(ctx->packed, ctx->packed_len, ctx->buf2, ctx->size);
+}
+
+/*
+ * The other end of the messages/ benchmarks: echoes every message, the first byte says whether
+ * more of its batch follow, so the echoes of a batch go back together as well.
+ */
+static void *echo_main(void *arg)
+{
+    int sock = *(int *)arg;
+    char message[BENCH_MESSAGE];
+    struct iovec iov = {message, sizeof(message)};
+    int done = 0;
+    while (rudp_accept(sock, 0, &done) < 0)
+        ;
+    for (;;)
+    {
+        ssize_t n = rudp_recvmsg(sock, &iov, 1, &done);
+        if (n <= 0 || done < 0)
+            break;
+        struct iovec echo = {message, (size_t)n};
+        if (rudp_sendmsg(sock, &echo, 1, message[0] ? RUDP_MSG_MORE : 0) < 0)
+            break;
+    }
+    rudp_close(sock, 0);
+    return NULL;
+}
+
+/*
+ * Request/response over RUDP messages, batch requests at a time: with a batch of one every message
+ * is a segment and a turn of its own, with more they share one (messages_flush() once per batch).
+ */
+static void bench_messages(Bench_Ctx *ctx, uint64_t iters)
+{
+    char message[BENCH_MESSAGE];
+    memset(message, 0, sizeof(message));
+    struct iovec iov = {message, sizeof(message)};
+    int done;
+    for (uint64_t i = 0; i < iters; i += (uint64_t)ctx->batch)
+    {
+        for (int k = 0; k < ctx->batch; k++)
+        {
+            message[0] = k + 1 < ctx->batch;
+            if (rudp_sendmsg(ctx->sock, &iov, 1, message[0] ? RUDP_MSG_MORE : 0) < 0)
+                return;
+        }
+        for (int k = 0; k < ctx->batch; k++)
+            sink += (uint64_t)rudp_recvmsg(ctx->sock, &iov, 1, &done);
+    }
+}
+
+/* Connects ctx->sock to an echo_main() thread over loopback: 0, or -1 if either end could not be set up. */
+static int messages_open(Bench_Ctx *ctx, pthread_t *echo, int *echo_sock)
+{
+    // a port the kernel has free; bound explicitly, rudp_accept()'s disconnect would give up one picked on bind
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t len = sizeof(addr);
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe < 0 || bind(probe, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(probe, (struct sockaddr *)&addr, &len) < 0)
+    {
+        perror("No port for the messages/ benchmarks");
+        if (probe >= 0)
+            close(probe);
+        return -1;
+    }
+    close(probe);
+
+    Trace_set_level(TRACE_WARN);
+    *echo_sock = udp_socket(NULL, ntohs(addr.sin_port));
+    if (*echo_sock < 0)
+        return -1;
+    if (pthread_create(echo, NULL, echo_main, echo_sock) != 0)
+    {
+        perror("pthread_create() failed");
+        rudp_close(*echo_sock, 0);
+        return -1;
+    }
+    ctx->sock = udp_socket("127.0.0.1", ntohs(addr.sin_port));
+    if (ctx->sock < 0 || rudp_socket(ctx->sock) < 0)
+    {
+        printf("No RUDP connection for the messages/ benchmarks\n");
+        return -1;
+    }
+    return 0;
+}
+
+// ************ Driver **************
+static uint64_t time_run(Bench_Fn fn, Bench_Ctx *ctx, uint64_t iters)
+{
+    uint64_t start = Timing_now_ns();
+    fn(ctx, iters);
+    return Timing_now_ns() - start;
+}
+
+static void run_bench(const char *name, size_t bytes, Bench_Fn fn, Bench_Ctx *ctx, int reps, const char *filter)
+{
+    if ((filter != NULL && strstr(name, filter) == NULL) || result_count == BENCH_MAX)
+        return;
+
+    // warm up, and find how many iterations take about BENCH_REP_NS
+    uint64_t iters = 1, elapsed = 0, warm_start = Timing_now_ns();
+    while ((elapsed = time_run(fn, ctx, iters)) < BENCH_REP_NS / 16)
+        iters *= 2;
+    while (Timing_now_ns() - warm_start < BENCH_WARMUP_NS)
+        elapsed = time_run(fn, ctx, iters);
+    iters = iters * BENCH_REP_NS / (elapsed ? elapsed : 1);
+    if (iters == 0)
+        iters = 1;
+
+    Bench_Result *r = &results[result_count++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->bytes = bytes;
+    r->iters = iters;
+    Welford_init(&r->ns);
+    for (int i = 0; i < reps; i++)
+        Welford_add(&r->ns, (double)time_run(fn, ctx, iters) / iters);
+
+    printf("%-24s %12.2f ns/op +/- %5.1f%%  min %12.2f", r->name, Welford_mean(&r->ns),
+           100.0 * Welford_stddev(&r->ns) / Welford_mean(&r->ns), r->ns._min);
+    if (bytes > 0)
+        printf("  %8.3f GB/s", bytes / Welford_mean(&r->ns));
+    printf("\n");
+}
+
+static int write_json(const char *path, int reps)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    fprintf(fp, "{\n  \"reps\": %d,\n  \"benchmarks\": [\n", reps);
+    for (int i = 0; i < result_count; i++)
+    {
+        const Bench_Result *r = &results[i];
+        double mean = Welford_mean(&r->ns);
+        // one benchmark per line, read back by compare_baseline()
+        fprintf(fp, "    {\"name\": \"%s\", \"bytes\": %zu, \"iters\": %llu, \"ns_per_op\": %.4f, \"ns_stddev\": %.4f, "
+                    "\"ns_min\": %.4f, \"ns_ci95\": %.4f, \"gb_per_s\": %.4f}%s\n",
+                r->name, r->bytes, (unsigned long long)r->iters, mean, Welford_stddev(&r->ns), r->ns._min,
+                Welford_ci95(&r->ns), r->bytes ? r->bytes / mean : 0.0, i + 1 < result_count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    return 0;
+}
+
+/* Prints each benchmark's change against the ns_per_op stored in a previous -json file. */
+static int compare_baseline(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    printf("\n%-24s %12s %12s %8s  (* outside the 95%% intervals)\n", "vs baseline", "baseline ns", "now ns", "change");
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char name[48];
+        double base, base_ci = 0;
+        const char *n = strstr(line, "\"name\": \"");
+        const char *v = strstr(line, "\"ns_per_op\": ");
+        const char *c = strstr(line, "\"ns_ci95\": ");
+        if (n == NULL || v == NULL || sscanf(n + 9, "%47[^\"]", name) != 1 || sscanf(v + 13, "%lf", &base) != 1)
+            continue;
+        if (c != NULL)
+            sscanf(c + 11, "%lf", &base_ci);
+
+        for (int i = 0; i < result_count; i++)
+        {
+            if (strcmp(results[i].name, name) != 0)
+                continue;
+            double now = Welford_mean(&results[i].ns);
+            // a difference larger than both 95% intervals together is marked as significant
+            int significant = now - base > base_ci + Welford_ci95(&results[i].ns) || base - now > base_ci + Welford_ci95(&results[i].ns);
+            printf("%-24s %12.2f %12.2f %+7.1f%%%s\n", name, base, now, 100.0 * (now - base) / base, significant ? " *" : "");
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+    const char *filter = NULL;
+    int reps = BENCH_DEFAULT_REPS;
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc || reps < 2)
+    {
+        printf("Usage: %s [-json <file>] [-baseline <file>] [-filter <substring>] [-reps <n>]\n", argv[0]);
+        return 1;
+    }
+
+    Bench_Ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.buf = Payload_alloc(1, MSG_BUFFER_SIZE);
+    ctx.buf2 = (char *)malloc(65536);
+    ctx.text = (char *)malloc(65536);
+    ctx.packed = (char *)malloc(COMPRESS_FRAME_MAX);
+    ctx.packet = (RUDP_Packet *)calloc(1, sizeof(RUDP_Packet));
+    ctx.ack = (RUDP_Packet *)calloc(1, sizeof(RUDP_Packet));
+    ctx.stats = Stats_alloc();
+    ctx.hist = Histogram_alloc();
+    if (ctx.buf == NULL || ctx.buf2 == NULL || ctx.text == NULL || ctx.packed == NULL || ctx.packet == NULL || ctx.ack == NULL || ctx.stats == NULL || ctx.hist == NULL)
+    {
+        perror("malloc failed");
+        return 1;
+    }
+
+    printf("%d repetitions of ~%llu ms each, after %llu ms warmup\n\n", reps, BENCH_REP_NS / 1000000, BENCH_WARMUP_NS / 1000000);
+
+    static const size_t checksum_sizes[] = {64, 512, 1472, 8192, MSG_BUFFER_SIZE};
+    for (size_t k = 0; k < sizeof(checksum_sizes) / sizeof(checksum_sizes[0]); k++)
+    {
+        char name[48];
+        ctx.size = checksum_sizes[k];
+        snprintf(name, sizeof(name), "checksum/%zu", ctx.size);
+        run_bench(name, ctx.size, bench_checksum, &ctx, reps, filter);
+    }
+
+    run_bench("header/build", 0, bench_header_build, &ctx, reps, filter);
+    ctx.ack->flags.ACK = 1;
+    ctx.ack->seq_num = 7;
+    ctx.ack->checksum = checksum(ctx.ack->data, 0);
+    ctx.size = 7;
+    run_bench("header/parse", 0, bench_header_parse, &ctx, reps, filter);
+    run_bench("segment/build", MSG_BUFFER_SIZE, bench_segment_build, &ctx, reps, filter);
+    run_bench("ack/build", 0, bench_build_ack, &ctx, reps, filter);
+
+    run_bench("stats/add", 0, bench_stats_add, &ctx, reps, filter);
+    Stats_free(ctx.stats);
+    ctx.stats = Stats_alloc();
+    for (int k = 0; k < 1000; k++)
+        Stats_add(ctx.stats, k, (double)((k * 7919) % 1000), 1.0);
+    run_bench("stats/percentile_1000", 0, bench_stats_percentile, &ctx, reps, filter);
+    run_bench("histogram/record", 0, bench_histogram_record, &ctx, reps, filter);
+
+    ctx.size = 65536;
+    run_bench("payload/fill_64K", ctx.size, bench_payload_fill, &ctx, reps, filter);
+    Payload_fill_at(42, 0, ctx.buf2, ctx.size);
+    run_bench("payload/verify_64K", ctx.size, bench_payload_verify, &ctx, reps, filter);
+
+    // buf2 is still the (incompressible) payload stream; text is a log-like, compressible block
+    run_bench("compress/entropy_64K", ctx.size, bench_entropy, &ctx, reps, filter);
+    for (size_t off = 0, line = 0; off < ctx.size; line++)
+    {
+        char text[64];
+        int len = snprintf(text, sizeof(text), "seq %zu flags ACK length %zu checksum %04zX\n", line,
+                           line * 37 % MSG_BUFFER_SIZE, (size_t)(line * 2654435761u) & 0xFFFF);
+        size_t n = ctx.size - off < (size_t)len ? ctx.size - off : (size_t)len;
+        memcpy(ctx.text + off, text, n);
+        off += n;
+    }
+    ctx.packed_len = Compress_lz4(ctx.text, ctx.size, ctx.packed, COMPRESS_FRAME_MAX);
+    run_bench("compress/lz4_64K", ctx.size, bench_lz4, &ctx, reps, filter);
+    run_bench("compress/lz4_decode_64K", ctx.size, bench_lz4_decode, &ctx, reps, filter);
+
+    // ns per request and its echo; the batch iterations are rounded up to whole batches
+    if (filter == NULL || strstr("messages/each_64B messages/batch16_64B", filter) != NULL)
+    {
+        pthread_t echo;
+        int echo_sock;
+        if (messages_open(&ctx, &echo, &echo_sock) == 0)
+        {
+            ctx.batch = 1;
+            run_bench("messages/each_64B", 0, bench_messages, &ctx, reps, filter);
+            ctx.batch = BENCH_MESSAGE_BATCH;
+            run_bench("messages/batch16_64B", 0, bench_messages, &ctx, reps, filter);
+            rudp_close(ctx.sock, 1);
+            pthread_join(echo, NULL);
+        }
+    }
+
+    if (json_path != NULL && write_json(json_path, reps) == 0)
+        printf("\nResults written to %s\n", json_path);
+    if (baseline_path != NULL)
+        compare_baseline(baseline_path);
+
+    free(ctx.buf);
+    free(ctx.buf2);
+    free(ctx.text);
+    free(ctx.packed);
+    free(ctx.packet);
+    free(ctx.ack);
+    Stats_free(ctx.stats);
+    Histogram_free(ctx.hist);
+    return 0;
+}
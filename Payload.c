@@ -0,0 +1,171 @@
+#include "Payload.h"
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define VERIFY_BLOCK 4096
+
+/* wyrand output for counter k: the k-th state of the sequential generator, mixed. */
+static inline uint64_t wy_word(uint64_t seed, uint64_t k)
+{
+    uint64_t state = seed + (k + 1) * WY_P0;
+    __uint128_t m = (__uint128_t)(state ^ WY_P1) * state;
+    return (uint64_t)(m >> 64) ^ (uint64_t)m;
+}
+
+void Payload_fill_at(uint64_t seed, uint64_t offset, void *buf, size_t len)
+{
+    unsigned char *out = (unsigned char *)buf;
+    uint64_t k = offset / 8;
+    size_t skip = offset % 8;
+
+    // partial leading word
+    if (skip != 0 && len > 0)
+    {
+        uint64_t w = htole64(wy_word(seed, k++));
+        size_t n = 8 - skip < len ? 8 - skip : len;
+        memcpy(out, (unsigned char *)&w + skip, n);
+        out += n;
+        len -= n;
+    }
+
+    // whole words: independent iterations, unrolled by the compiler
+    size_t words = len / 8;
+    for (size_t i = 0; i < words; i++)
+    {
+        uint64_t w = htole64(wy_word(seed, k + i));
+        memcpy(out + i * 8, &w, 8);
+    }
+    out += words * 8;
+    len -= words * 8;
+    k += words;
+
+    // partial trailing word
+    if (len > 0)
+    {
+        uint64_t w = htole64(wy_word(seed, k));
+        memcpy(out, &w, len);
+    }
+}
+
+uint64_t Payload_word(uint64_t seed, uint64_t index)
+{
+    return wy_word(seed, index);
+}
+
+void Payload_init(Payload *payload, uint64_t seed)
+{
+    payload->seed = seed;
+    payload->offset = 0;
+}
+
+void Payload_fill(Payload *payload, void *buf, size_t len)
+{
+    Payload_fill_at(payload->seed, payload->offset, buf, len);
+    payload->offset += len;
+}
+
+int64_t Payload_verify(Payload *payload, const void *buf, size_t len)
+{
+    const unsigned char *in = (const unsigned char *)buf;
+    unsigned char expected[VERIFY_BLOCK];
+    int64_t mismatch = -1;
+
+    for (size_t done = 0; done < len && mismatch == -1;)
+    {
+        size_t n = len - done < VERIFY_BLOCK ? len - done : VERIFY_BLOCK;
+        Payload_fill_at(payload->seed, payload->offset + done, expected, n);
+        if (memcmp(expected, in + done, n) != 0)
+        {
+            size_t i = 0;
+            while (expected[i] == in[done + i])
+                i++;
+            mismatch = (int64_t)(payload->offset + done + i);
+        }
+        done += n;
+    }
+
+    payload->offset += len;
+    return mismatch;
+}
+
+char *Payload_alloc(uint64_t seed, size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+    char *buffer = (char *)malloc(size);
+    if (buffer == NULL)
+        return NULL;
+
+    Payload_fill_at(seed, 0, buffer, size);
+    return buffer;
+}
+
+uint64_t Payload_random_seed(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return wy_word((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec, (uint64_t)getpid());
+}
+
+uint64_t Payload_parse_size(const char *text)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text)
+        return 0;
+
+    switch (*end)
+    {
+    case 'K':
+    case 'k':
+        value <<= 10;
+        end++;
+        break;
+    case 'M':
+    case 'm':
+        value <<= 20;
+        end++;
+        break;
+    case 'G':
+    case 'g':
+        value <<= 30;
+        end++;
+        break;
+    default:
+        break;
+    }
+    return *end == '\0' ? value : 0;
+}
+
+void Payload_header_pack(Payload_Header *header, uint64_t seed, uint64_t size)
+{
+    header->magic = htobe32(PAYLOAD_MAGIC);
+    header->flags = 0;
+    header->seed = htobe64(seed);
+    header->size = htobe64(size);
+}
+
+int Payload_header_unpack(const Payload_Header *header, uint64_t *seed, uint64_t *size)
+{
+    if (be32toh(header->magic) != PAYLOAD_MAGIC)
+        return -1;
+    *seed = be64toh(header->seed);
+    *size = be64toh(header->size);
+    return 0;
+}
+
+void Payload_header_set_flags(Payload_Header *header, uint32_t flags)
+{
+    header->flags = htobe32(flags);
+}
+
+uint32_t Payload_header_flags(const Payload_Header *header)
+{
+    return be32toh(header->flags);
+}
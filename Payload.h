@@ -0,0 +1,54 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAYLOAD_MAGIC 0x50594C44u // "PYLD"
+#define PAYLOAD_FILE 0x1u         // header flag: the run is a file, not the seeded stream
+#define PAYLOAD_COMPRESSED 0x2u   // header flag: the run is sent as Compress frames
+
+/*
+ * Deterministic payload stream. Byte i of the stream only depends on (seed, i):
+ * every 8-byte word is an independent wyrand output of a counter, so any range can
+ * be generated on its own and the loop has no carried dependency to serialize it.
+ */
+typedef struct _Payload
+{
+    uint64_t seed;
+    uint64_t offset; // next byte of the stream
+} Payload;
+
+/* Sent in-band ahead of every run so the receiver can regenerate the stream. */
+typedef struct _Payload_Header
+{
+    uint32_t magic;
+    uint32_t flags;    // PAYLOAD_FILE, PAYLOAD_COMPRESSED
+    uint64_t seed;
+    uint64_t size;
+} Payload_Header;
+
+void Payload_init(Payload *payload, uint64_t seed);
+/* Writes the next len bytes of the stream into buf. */
+void Payload_fill(Payload *payload, void *buf, size_t len);
+/* Writes bytes [offset, offset + len) of the stream for seed into buf. */
+void Payload_fill_at(uint64_t seed, uint64_t offset, void *buf, size_t len);
+/* Word index of the stream for seed, as a number: a seeded random generator with random access. */
+uint64_t Payload_word(uint64_t seed, uint64_t index);
+/* Checks buf against the next len bytes. Returns -1 if they match, else the stream offset of the first difference. */
+int64_t Payload_verify(Payload *payload, const void *buf, size_t len);
+
+/* Allocates size bytes of the stream for seed, NULL on failure or size 0. */
+char *Payload_alloc(uint64_t seed, size_t size);
+/* A seed that differs between runs of the program. */
+uint64_t Payload_random_seed(void);
+/* Parses a size such as 4096, 64K, 2M or 8G. Returns 0 on error. */
+uint64_t Payload_parse_size(const char *text);
+
+void Payload_header_pack(Payload_Header *header, uint64_t seed, uint64_t size);
+/* Returns 0 and fills seed/size if header is valid, -1 otherwise. */
+int Payload_header_unpack(const Payload_Header *header, uint64_t *seed, uint64_t *size);
+void Payload_header_set_flags(Payload_Header *header, uint32_t flags);
+uint32_t Payload_header_flags(const Payload_Header *header);
+
+#endif
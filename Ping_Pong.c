@@ -0,0 +1,221 @@
+#include "Ping_Pong.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PING_PONG_BUFFER (PING_PONG_SIZE_MAX + NETBENCH_RECV_SIZE) // a receive may deliver a whole segment past the end
+
+int Ping_Pong_init(Ping_Pong *pp, size_t size, int count, int batch)
+{
+    memset(pp, 0, sizeof(Ping_Pong));
+    if (size < 1 || size > PING_PONG_SIZE_MAX || count < 1 || batch < 1 || batch > count)
+    {
+        printf("Ping-pong messages are 1 to %d bytes, at least one per round, batches of 1 to all of them\n", PING_PONG_SIZE_MAX);
+        return -1;
+    }
+    pp->size = size;
+    pp->count = count;
+    pp->batch = batch;
+    pp->_request = (char *)malloc(size);
+    pp->_reply = (char *)malloc(PING_PONG_BUFFER);
+    pp->_sent = (uint64_t *)malloc(batch * sizeof(uint64_t));
+    pp->_round_rtts = Histogram_alloc();
+    pp->_rtts = Histogram_alloc();
+    if (pp->_request == NULL || pp->_reply == NULL || pp->_sent == NULL || pp->_round_rtts == NULL || pp->_rtts == NULL)
+    {
+        perror("malloc failed");
+        Ping_Pong_free(pp);
+        return -1;
+    }
+    return 0;
+}
+
+void Ping_Pong_free(Ping_Pong *pp)
+{
+    free(pp->_request);
+    free(pp->_reply);
+    free(pp->_sent);
+    Histogram_free(pp->_round_rtts);
+    Histogram_free(pp->_rtts);
+    free(pp->_rounds);
+    memset(pp, 0, sizeof(Ping_Pong));
+}
+
+/* Receives one whole message into buf; its length, or -1. */
+static ssize_t recv_message(const Transport *transport, Transport_Conn *conn, char *buf)
+{
+    size_t got = 0;
+    int done = 0;
+    while (!done)
+    {
+        if (got > PING_PONG_SIZE_MAX)
+        {
+            printf("Ping-pong message longer than %d bytes\n", PING_PONG_SIZE_MAX);
+            return -1;
+        }
+        ssize_t n = transport->recv(conn, buf + got, PING_PONG_BUFFER - got, &done);
+        if (n < 0)
+            return -1;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static void fill_request(char *request, size_t size, char type, int index)
+{
+    request[0] = type;
+    for (size_t i = 1; i < size; i++)
+        request[i] = (char)(i + 7 * (size_t)index);
+}
+
+static int add_round(Ping_Pong *pp, const Ping_Pong_Round *r)
+{
+    if (pp->_nrounds == pp->_capacity)
+    {
+        size_t capacity = pp->_capacity ? 2 * pp->_capacity : 16;
+        Ping_Pong_Round *rounds = (Ping_Pong_Round *)realloc(pp->_rounds, capacity * sizeof(Ping_Pong_Round));
+        if (rounds == NULL)
+        {
+            perror("realloc failed");
+            return -1;
+        }
+        pp->_rounds = rounds;
+        pp->_capacity = capacity;
+    }
+    pp->_rounds[pp->_nrounds++] = *r;
+    return 0;
+}
+
+int Ping_Pong_run(Ping_Pong *pp, const Transport *transport, Transport_Conn *conn, int round)
+{
+    Histogram_reset(pp->_round_rtts);
+    uint64_t start = Timing_now_ns();
+    for (int first = 0; first < pp->count; first += pp->batch)
+    {
+        int batch = pp->count - first < pp->batch ? pp->count - first : pp->batch;
+        for (int k = 0; k < batch; k++)
+        {
+            conn->more = k + 1 < batch;
+            fill_request(pp->_request, pp->size, conn->more ? PING_PONG_MORE : PING_PONG_REQUEST, first + k);
+            pp->_sent[k] = Timing_now_ns();
+            if (transport->send(conn, pp->_request, pp->size, 1) < 0)
+                return -1;
+        }
+        conn->more = 0;
+        for (int k = 0; k < batch; k++)
+        {
+            ssize_t n = recv_message(transport, conn, pp->_reply);
+            if (n < 0)
+                return -1;
+            Histogram_record(pp->_round_rtts, Timing_now_ns() - pp->_sent[k]);
+            fill_request(pp->_request, pp->size, k + 1 < batch ? PING_PONG_MORE : PING_PONG_REQUEST, first + k);
+            if ((size_t)n != pp->size || memcmp(pp->_reply, pp->_request, pp->size) != 0)
+            {
+                printf("Ping-pong echo %d MISMATCH: %zd bytes back for %zu\n", first + k, n, pp->size);
+                return -1;
+            }
+        }
+    }
+    double seconds = (Timing_now_ns() - start) / 1e9;
+
+    // the end message goes unanswered, so it is not timed
+    fill_request(pp->_request, 1, PING_PONG_END, 0);
+    if (transport->send(conn, pp->_request, 1, 1) < 0)
+        return -1;
+
+    const Histogram *h = pp->_round_rtts;
+    Ping_Pong_Round r = {round, pp->count, seconds, seconds > 0 ? pp->count / seconds : 0.0, Histogram_mean(h) / 1000.0,
+                         Histogram_percentile(h, 50.0) / 1000.0, Histogram_percentile(h, 99.0) / 1000.0,
+                         Histogram_percentile(h, 99.9) / 1000.0, h->_max / 1000.0};
+    Histogram_merge(pp->_rtts, h);
+    printf("Round #%d: %d round trips of %zu bytes in %f s, %.1f messages/s\n", round, r.messages, pp->size, seconds, r.rate);
+    Histogram_print(h, "Round-trip time", 1000.0, "us");
+    return add_round(pp, &r);
+}
+
+int Ping_Pong_echo(const Transport *transport, Transport_Conn *conn, char *buf)
+{
+    int messages = 0;
+    for (;;)
+    {
+        ssize_t n = recv_message(transport, conn, buf);
+        if (n < 0)
+            return -1;
+        if (n == 0 || (buf[0] != PING_PONG_REQUEST && buf[0] != PING_PONG_MORE))
+            break;
+        // the echoes of a batch go back together as well
+        conn->more = buf[0] == PING_PONG_MORE;
+        if (transport->send(conn, buf, (size_t)n, 1) < 0)
+            return -1;
+        conn->more = 0;
+        messages++;
+    }
+    return messages;
+}
+
+void Ping_Pong_print(const Ping_Pong *pp)
+{
+    if (pp->_nrounds < 1)
+        return;
+
+    printf("-----------------------------\n");
+    printf("Ping-pong: %zu bytes each way, %d round trips per round, %d at a time\n", pp->size, pp->count, pp->batch);
+    double rate = 0;
+    for (size_t i = 0; i < pp->_nrounds; i++)
+    {
+        const Ping_Pong_Round *r = &pp->_rounds[i];
+        printf("Round #%d: %.1f messages/s, RTT mean %.3f p50 %.3f p99 %.3f p999 %.3f max %.3f us\n", r->round, r->rate,
+               r->mean_us, r->p50_us, r->p99_us, r->p999_us, r->max_us);
+        rate += r->rate;
+    }
+    printf("Average rate: %.1f messages/s\n", rate / pp->_nrounds);
+    Histogram_print(pp->_rtts, "Round-trip time", 1000.0, "us");
+    printf("-----------------------------\n");
+}
+
+int Ping_Pong_write_json(const Ping_Pong *pp, const char *path, const char *label)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    fprintf(fp, "{\n  \"label\": \"%s\",\n  \"size\": %zu,\n  \"batch\": %d,\n  \"rounds\": [", label, pp->size, pp->batch);
+    for (size_t i = 0; i < pp->_nrounds; i++)
+    {
+        const Ping_Pong_Round *r = &pp->_rounds[i];
+        fprintf(fp, "%s\n    {\"round\": %d, \"messages\": %d, \"seconds\": %f, \"messages_per_s\": %f, \"mean_us\": %f, "
+                    "\"p50_us\": %f, \"p99_us\": %f, \"p999_us\": %f, \"max_us\": %f}",
+                i ? "," : "", r->round, r->messages, r->seconds, r->rate, r->mean_us, r->p50_us, r->p99_us, r->p999_us, r->max_us);
+    }
+    const Histogram *h = pp->_rtts;
+    fprintf(fp, "\n  ],\n  \"rtt_us\": {\"n\": %llu, \"mean\": %f, \"min\": %f, \"p50\": %f, \"p99\": %f, \"p999\": %f, \"max\": %f}\n}\n",
+            (unsigned long long)h->_count, Histogram_mean(h) / 1000.0, h->_min / 1000.0, Histogram_percentile(h, 50.0) / 1000.0,
+            Histogram_percentile(h, 99.0) / 1000.0, Histogram_percentile(h, 99.9) / 1000.0, h->_max / 1000.0);
+
+    fclose(fp);
+    return 0;
+}
+
+int Ping_Pong_write_csv(const Ping_Pong *pp, const char *path, const char *label)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    fprintf(fp, "label,round,size,messages,messages_per_s,mean_us,p50_us,p99_us,p999_us,max_us\n");
+    for (size_t i = 0; i < pp->_nrounds; i++)
+    {
+        const Ping_Pong_Round *r = &pp->_rounds[i];
+        fprintf(fp, "%s,%d,%zu,%d,%f,%f,%f,%f,%f,%f\n", label, r->round, pp->size, r->messages, r->rate, r->mean_us,
+                r->p50_us, r->p99_us, r->p999_us, r->max_us);
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef PING_PONG_H
+#define PING_PONG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Transport.h"
+#include "Timing.h"
+
+/*
+ * Request/response latency over any transport, as RPC traffic sees it: the sender sends
+ * a request of size bytes, the receiver echoes it back whole, and only then does the next
+ * one go out. Every round trip is timed into a histogram; a round is count of them on one
+ * connection (one run of the transport), closed by an end message that is not echoed.
+ * With a batch, that many requests go out back to back before their echoes are read, the
+ * ones before the last flagged so the transport may send them together (Transport_Conn.more).
+ * The first byte of a message says which it is, the rest is a pattern of its index, so a
+ * late or mangled echo is told apart from the right one.
+ */
+#define PING_PONG_SIZE_DEFAULT 64
+#define PING_PONG_SIZE_MAX (1024 * 1024)
+#define PING_PONG_COUNT_DEFAULT 1000
+#define PING_PONG_REQUEST 'Q'
+#define PING_PONG_MORE 'M'       // a request with more of its batch right behind it
+#define PING_PONG_END 'E'
+
+typedef struct _Ping_Pong_Round
+{
+    int round;
+    int messages;
+    double seconds;
+    double rate;             // round trips per second
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double max_us;
+} Ping_Pong_Round;
+
+typedef struct _Ping_Pong
+{
+    size_t size;
+    int count;
+    int batch;
+    char *_request;
+    char *_reply;                // PING_PONG_SIZE_MAX plus one receive of slack
+    uint64_t *_sent;             // when each request of the batch went out
+    Histogram *_round_rtts;      // ns, the current round
+    Histogram *_rtts;            // ns, every round
+    Ping_Pong_Round *_rounds;
+    size_t _nrounds;
+    size_t _capacity;
+} Ping_Pong;
+
+/* Sender: count round trips of size bytes (1 to PING_PONG_SIZE_MAX) per round, batch (1 to count) at a time. */
+int Ping_Pong_init(Ping_Pong *pp, size_t size, int count, int batch);
+void Ping_Pong_free(Ping_Pong *pp);
+/* Sender: one round on a connection connect() just started; prints it and keeps its figures. */
+int Ping_Pong_run(Ping_Pong *pp, const Transport *transport, Transport_Conn *conn, int round);
+/*
+ * Receiver: after accept() started a run, echoes every request until the end message;
+ * buf holds PING_PONG_SIZE_MAX + NETBENCH_RECV_SIZE bytes. Returns the requests echoed, -1 on failure.
+ */
+int Ping_Pong_echo(const Transport *transport, Transport_Conn *conn, char *buf);
+
+/* Prints every round and the round trips of them all. */
+void Ping_Pong_print(const Ping_Pong *pp);
+/* Machine-readable copies of Ping_Pong_print, one round per row; label names the configuration. */
+int Ping_Pong_write_json(const Ping_Pong *pp, const char *path, const char *label);
+int Ping_Pong_write_csv(const Ping_Pong *pp, const char *path, const char *label);
+
+#endif
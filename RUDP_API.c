@@ -1,4 +1,12 @@
 #include "RUDP_API.h"
+#include "IO_Backend.h"
+#include "Impair.h"
+#include "Trace.h"
+#include "Timing.h"
+#include "Ring.h"
+#include "Busy_Poll.h"
+#include "Payload.h"
+#include "Timestamp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,23 +15,523 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
 
-#define rudp_dump_headers(x, p) \
-    printf("%03d: " x " SYN %d ACK %d DATA %d FIN %d length %05d checksum %04X seq_num %d\n", __LINE__, p->flags.SYN, p->flags.ACK, p->flags.DATA, p->flags.FIN, p->length, p->checksum, p->seq_num)
+#define RUDP_MAX_FD 1024
+#define RUDP_EVENT_RING 1024 // ACK thread events in flight to the sender, per ring
 
-int seq_num; // id of the expected packet
+static __thread int seq_num; // id of the expected packet; per thread, a striped transfer runs one connection per thread
+static __thread int peer_window = 1; // sender: the window the receiver last advertised
+static __thread int receiving;       // the last message came in: seq_num is the next one expected, not the last one sent
 
+// Receiver: segments that arrived ahead of a lost one, held until it is retransmitted
+typedef struct _RUDP_Reorder
+{
+    RUDP_Packet *pool;                 // RUDP_WINDOW + 1 packets
+    RUDP_Packet *slot[RUDP_WINDOW];    // by seq_num % RUDP_WINDOW
+    RUDP_Packet *spare;                // received into, then swapped into its slot
+    unsigned char held[RUDP_WINDOW];
+    int buffered;
+    int fins;                          // held segments with FIN: the message is all here
+    int closed;                        // the sender's close packet came in
+    unsigned short int syn_seq;        // the connection's SYN: one with another seq_num is a new connection
+    unsigned short int edge;           // one past the highest segment received; gaps below it are NACKed
+} RUDP_Reorder;
+
+static __thread RUDP_Reorder *reorder;
+static pthread_key_t reorder_key;      // frees a path thread's buffer when it exits
+static pthread_once_t reorder_once = PTHREAD_ONCE_INIT;
+
+// Sender: what the ACK thread hands over to the sending thread
+typedef struct _RUDP_Event
+{
+    uint64_t at_ns;              // when the ACK thread received it
+    unsigned short int seq_num;  // the segment ACKed, or to send again
+    unsigned short int window;
+    unsigned char update;        // a window update, nothing ACKed
+} RUDP_Event;
+
+// Sender: receives and checks the ACKs of a socket while a message is sent on it (rudp_set_ack_thread());
+// parked between messages, so the handshakes are received by the thread that calls rudp_socket()
+typedef struct _RUDP_Ack_Thread
+{
+    Ring acks;                   // ACKs and window updates, in the order they came
+    Ring retransmits;            // segments NACKed
+    RUDP_Packet *packet;
+    pthread_t thread;
+    int sock;
+    int slot;                    // Busy_Poll_pin_thread(), next to the sender's
+    int stop_fd;                 // eventfd: the sender parks or ends the thread
+    int wake_fd;                 // eventfd: the ACK thread wakes the sender
+    int stop;
+    int sleeping;                // the sender waits on wake_fd
+    pthread_mutex_t lock;        // park, parked
+    pthread_cond_t cond;
+    int park;                    // the sender asks the thread to leave the socket alone
+    int parked;                  // the thread does, until park is cleared
+} RUDP_Ack_Thread;
+
+// rudp_sendmsg()/rudp_recvmsg(): messages held to go out together, and the segment they are read from
+typedef struct _RUDP_Messages
+{
+    char *queue;                     // RUDP_COALESCE_MAX bytes, framed messages
+    unsigned int queued;
+    uint64_t held_ns;                // when the first message in the queue came
+    char segment[MSG_BUFFER_SIZE];   // received, read from off up to len
+    int segment_len;
+    int segment_off;
+    int reading;                     // the peer's turn is on, no FIN yet: nothing goes out before it ends
+} RUDP_Messages;
+
+// A socket's counters: written by the thread doing its I/O (one per path when striping, and its
+// ACK thread), read by rudp_get_stats() from any thread
+typedef struct _RUDP_Counters
+{
+    RUDP_Stats counters;  // the gauges in it are left 0, rudp_get_stats() computes them
+    uint64_t connected_ns;
+    uint64_t connection_bytes;
+    uint64_t window;
+} RUDP_Counters;
+
+// Per socket, by fd: what the kernel buffer holds in segments, and its SO_RXQ_OVFL count already reported
+static struct
+{
+    int rcvbuf;                  // bytes, as the kernel reports them
+    int capacity;
+    uint32_t dropped;
+    int ack_thread;              // rudp_set_ack_thread()
+    RUDP_Ack_Thread *acker;      // from the first message sent to rudp_close(), parked between messages
+    RUDP_Messages *messages;     // from the first rudp_sendmsg()/rudp_recvmsg() to rudp_close()
+    RUDP_Syn_Hook syn_hook;      // rudp_set_syn_hook()
+    void *syn_ctx;
+    RUDP_Packet *syn_ack;        // the last SYN-ACK the hook answered, sent again for a SYN sent again
+    RUDP_Packet *pending_syn;    // the SYN of a new connection that cut a run short, for rudp_accept()
+    RUDP_Config agreed;          // in the last handshake
+    int negotiated;              // agreed is set
+    uint64_t srtt_ns;            // RFC 6298 estimator of the path, for its own loss recovery; 0 before a sample
+    uint64_t rttvar_ns;
+    RUDP_Counters stats;         // from udp_socket_from() to rudp_close()
+    int open;                    // stats count in rudp_get_total_stats()
+} sockets[RUDP_MAX_FD];
+
+// this end's connection parameters, rudp_set_config()
+static RUDP_Config config = {MSG_BUFFER_SIZE, RUDP_WINDOW, RUDP_CHECKSUM_INET, RUDP_FEATURES_ALL, RETRY, TIMEOUT};
+
+// SYN and SYN-ACK options: a type byte, a 16-bit big-endian length, then the value, big-endian too; unknown types are skipped
+#define RUDP_OPT_SEGMENT 1   // 2 bytes
+#define RUDP_OPT_WINDOW 2    // 2 bytes
+#define RUDP_OPT_CHECKSUM 3  // 1 byte
+#define RUDP_OPT_FEATURES 4  // 4 bytes
+#define RUDP_OPT_DATA 5      // the SYN hook's data, last
+#define RUDP_OPT_HEADER 3
+
+// rudp_get_total_stats(): the sockets closed so far, and those past RUDP_MAX_FD
+static struct
+{
+    pthread_mutex_t lock;     // a socket's counters move into closed as it closes
+    RUDP_Stats closed;        // counters summed, the gauges those of the last one closed
+    RUDP_Counters unindexed;  // sockets without a sockets[] entry
+    int high;                 // one past the highest fd opened
+} totals = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static RUDP_Counters *stats_of(int sock)
+{
+    return sock >= 0 && sock < RUDP_MAX_FD ? &sockets[sock].stats : &totals.unindexed;
+}
+
+#define STAT_ADD(sock, field, n) __atomic_fetch_add(&stats_of(sock)->field, (uint64_t)(n), __ATOMIC_RELAXED)
+#define STAT_SET(sock, field, v) __atomic_store_n(&stats_of(sock)->field, (uint64_t)(v), __ATOMIC_RELAXED)
+#define STAT_GET(c, field) __atomic_load_n(&(c)->field, __ATOMIC_RELAXED)
+
+static void stats_connected(int sock)
+{
+    STAT_ADD(sock, counters.connections, 1);
+    STAT_SET(sock, connection_bytes, 0);
+    STAT_SET(sock, connected_ns, Timing_now_ns());
+}
+
+static void stats_retire(int sock);
+
+/*
+ * RFC 6298 estimator of sock's path; Karn: only samples of segments ACKed on their first
+ * transmission. Only the thread sending on sock updates it, others (stats) just read it.
+ */
+static void rtt_sample(int sock, uint64_t rtt_ns)
+{
+    if (sock < 0 || sock >= RUDP_MAX_FD)
+        return;
+    uint64_t srtt = __atomic_load_n(&sockets[sock].srtt_ns, __ATOMIC_RELAXED);
+    uint64_t rttvar = rtt_ns / 2;
+    if (srtt == 0)
+        srtt = rtt_ns;
+    else
+    {
+        uint64_t error = srtt > rtt_ns ? srtt - rtt_ns : rtt_ns - srtt;
+        rttvar = (3 * __atomic_load_n(&sockets[sock].rttvar_ns, __ATOMIC_RELAXED) + error) / 4;
+        srtt = (7 * srtt + rtt_ns) / 8;
+    }
+    __atomic_store_n(&sockets[sock].rttvar_ns, rttvar, __ATOMIC_RELAXED);
+    __atomic_store_n(&sockets[sock].srtt_ns, srtt, __ATOMIC_RELAXED);
+}
+
+/* sock's smoothed RTT, 0 before its first sample. */
+static uint64_t srtt_of(int sock)
+{
+    return sock >= 0 && sock < RUDP_MAX_FD ? __atomic_load_n(&sockets[sock].srtt_ns, __ATOMIC_RELAXED) : 0;
+}
+
+static void reorder_free(void *arg)
+{
+    RUDP_Reorder *r = (RUDP_Reorder *)arg;
+    free(r->pool);
+    free(r);
+}
+
+static void reorder_key_create(void)
+{
+    pthread_key_create(&reorder_key, reorder_free);
+}
+
+static RUDP_Reorder *reorder_get(void)
+{
+    if (reorder != NULL)
+        return reorder;
+
+    pthread_once(&reorder_once, reorder_key_create);
+    RUDP_Reorder *r = (RUDP_Reorder *)calloc(1, sizeof(RUDP_Reorder));
+    if (r == NULL || (r->pool = (RUDP_Packet *)malloc((RUDP_WINDOW + 1) * sizeof(RUDP_Packet))) == NULL)
+    {
+        perror("malloc failed");
+        free(r);
+        return NULL;
+    }
+    for (int i = 0; i < RUDP_WINDOW; i++)
+        r->slot[i] = &r->pool[i];
+    r->spare = &r->pool[RUDP_WINDOW];
+    pthread_setspecific(reorder_key, r);
+    reorder = r;
+    return r;
+}
+
+/* What the connection on sock runs with: the handshake's values, this end's before one. */
+static const RUDP_Config *agreed(int sock)
+{
+    return sock >= 0 && sock < RUDP_MAX_FD && sockets[sock].negotiated ? &sockets[sock].agreed : &config;
+}
+
+/* What this end offers in sock's handshake: its config, the segment cut to what the socket can carry (-io xdp). */
+static RUDP_Config offered(int sock)
+{
+    RUDP_Config c = config;
+    size_t max = IO_max_datagram(sock);
+    if (max > offsetof(RUDP_Packet, data) && c.segment > max - offsetof(RUDP_Packet, data))
+        c.segment = (unsigned int)(max - offsetof(RUDP_Packet, data));
+    return c;
+}
+
+/* Segments the receiver can take now: free reorder slots, but no more than its socket buffer holds. */
+static int receive_window(int sock)
+{
+    int free_slots = (int)agreed(sock)->window - (reorder != NULL ? reorder->buffered : 0);
+    int capacity = sock >= 0 && sock < RUDP_MAX_FD ? sockets[sock].capacity : 1;
+    if (free_slots < 0)
+        free_slots = 0;
+    return free_slots < capacity ? free_slots : capacity;
+}
+
+/* The segments of segment bytes sock's receive buffer holds, RUDP_WINDOW at most. */
+static void socket_capacity(int sock, unsigned int segment)
+{
+    // the kernel reports twice what it accounts for data; a segment takes up to twice its size with overhead
+    int capacity = sockets[sock].rcvbuf / (2 * (int)(offsetof(RUDP_Packet, data) + segment));
+    sockets[sock].capacity = capacity < 1 ? 1 : capacity > RUDP_WINDOW ? RUDP_WINDOW : capacity;
+}
+
+/* Sizes the kernel buffers for RUDP_WINDOW segments and turns on SO_RXQ_OVFL. */
+static void socket_tune(int sock)
+{
+    int size = RUDP_WINDOW * 2 * (int)sizeof(RUDP_Packet);
+    // root may go past net.core.rmem_max
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (setsockopt(sock, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+        perror("setsockopt(SO_RXQ_OVFL) failed");
+
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &actual, &len);
+    if (sock < RUDP_MAX_FD)
+    {
+        sockets[sock].rcvbuf = actual;
+        sockets[sock].dropped = 0;
+        socket_capacity(sock, config.segment);
+    }
+    Trace_log(TRACE_INFO, "Receive buffer %d bytes, window %d segments\n", actual, sock < RUDP_MAX_FD ? sockets[sock].capacity : 1);
+}
+
+/* Receives one datagram into packet, counting those the kernel dropped since the last one, and timing it with -tstamp. */
+static ssize_t receive_packet(int sock, RUDP_Packet *packet, int flags)
+{
+    uint32_t dropped = sock < RUDP_MAX_FD ? sockets[sock].dropped : 0;
+    uint64_t rx_ns = 0;
+    ssize_t result = Impair_recv_ovfl(sock, packet, sizeof(RUDP_Packet), flags, &dropped, &rx_ns);
+    if (rx_ns != 0 && result >= (ssize_t)offsetof(RUDP_Packet, data))
+        Timestamp_arrived(packet->tsval, packet->flags.ACK ? packet->tsecr : 0, rx_ns);
+    if (result >= 0 && sock < RUDP_MAX_FD && dropped != sockets[sock].dropped)
+    {
+        Trace_log(TRACE_WARN, "Receive buffer overflow: %u datagrams dropped\n", dropped - sockets[sock].dropped);
+        STAT_ADD(sock, counters.rcvbuf_drops, dropped - sockets[sock].dropped);
+        sockets[sock].dropped = dropped;
+    }
+    return result;
+}
+
+/* A window update (ACK + PROBE): answers a zero-window probe, or reopens a window that was 0. */
+static int send_window_update(int sock)
+{
+    RUDP_Packet update;
+    memset(&update, 0, offsetof(RUDP_Packet, data));
+    update.flags.ACK = 1;
+    update.flags.PROBE = 1;
+    update.seq_num = (unsigned short int)seq_num;
+    update.window = (unsigned short int)receive_window(sock);
+    update.checksum = checksum(update.data, 0);
+    STAT_SET(sock, window, update.window);
+
+    Trace_packet(TRACE_OUT, &update, offsetof(RUDP_Packet, data));
+    if (Impair_send(sock, &update, offsetof(RUDP_Packet, data), offsetof(RUDP_Packet, data)) == -1)
+    {
+        perror("sendto() failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* A NACK of the segments in missing, bit i for seq_num + i: asks for them before the sender's timeout. */
+static int send_nack(int sock, uint32_t missing)
+{
+    RUDP_Packet nack;
+    memset(&nack, 0, offsetof(RUDP_Packet, data));
+    nack.flags.NACK = 1;
+    nack.seq_num = (unsigned short int)seq_num;
+    nack.window = (unsigned short int)receive_window(sock);
+    nack.length = sizeof(missing);
+    memcpy(nack.data, &missing, sizeof(missing));
+    nack.checksum = checksum(nack.data, nack.length);
+
+    Trace_packet(TRACE_OUT, &nack, offsetof(RUDP_Packet, data) + nack.length);
+    if (Impair_send(sock, &nack, offsetof(RUDP_Packet, data) + nack.length, offsetof(RUDP_Packet, data)) == -1)
+    {
+        perror("sendto() failed");
+        return -1;
+    }
+    STAT_ADD(sock, counters.nacks_sent, 1);
+    return 0;
+}
+
+void rudp_config_default(RUDP_Config *c)
+{
+    c->segment = MSG_BUFFER_SIZE;
+    c->window = RUDP_WINDOW;
+    c->checksum = RUDP_CHECKSUM_INET;
+    c->features = RUDP_FEATURES_ALL;
+    c->retry = RETRY;
+    c->timeout = TIMEOUT;
+}
+
+int rudp_set_config(const RUDP_Config *c)
+{
+    if (c->segment < 1 || c->segment > MSG_BUFFER_SIZE || c->window < 1 || c->window > RUDP_WINDOW ||
+        c->checksum > RUDP_CHECKSUM_NONE || (c->features & ~RUDP_FEATURES_ALL) != 0 || c->retry < 1 || c->timeout < 1)
+    {
+        printf("Invalid RUDP configuration: segment 1 to %d bytes, window 1 to %d segments, retry and timeout 1 or more\n",
+               MSG_BUFFER_SIZE, RUDP_WINDOW);
+        return -1;
+    }
+    config = *c;
+    return 0;
+}
+
+void rudp_get_config(int sock, RUDP_Config *c)
+{
+    *c = *agreed(sock);
+}
+
+/* "nack,tlp" or "none" into *features; -1 if a name is unknown. */
+static int parse_features(const char *list, unsigned int *features)
+{
+    *features = 0;
+    if (strcmp(list, "none") == 0)
+        return 0;
+    while (*list != '\0')
+    {
+        size_t len = strcspn(list, ",");
+        if (len == 4 && strncmp(list, "nack", len) == 0)
+            *features |= RUDP_FEATURE_NACK;
+        else if (len == 3 && strncmp(list, "tlp", len) == 0)
+            *features |= RUDP_FEATURE_TLP;
+        else
+        {
+            printf("Unknown feature %.*s: nack, tlp or none\n", (int)len, list);
+            return -1;
+        }
+        list += len + (list[len] == ',');
+    }
+    return 0;
+}
+
+int rudp_config_option(int argc, char *argv[], int *i)
+{
+    if (*i + 1 >= argc)
+        return 0;
+    RUDP_Config c = config;
+    const char *value = argv[*i + 1];
+    if (strcmp(argv[*i], "-segment") == 0)
+        c.segment = (unsigned int)atoi(value);
+    else if (strcmp(argv[*i], "-window") == 0)
+        c.window = (unsigned int)atoi(value);
+    else if (strcmp(argv[*i], "-checksum") == 0 && strcmp(value, "inet") == 0)
+        c.checksum = RUDP_CHECKSUM_INET;
+    else if (strcmp(argv[*i], "-checksum") == 0 && strcmp(value, "none") == 0)
+        c.checksum = RUDP_CHECKSUM_NONE;
+    else if (strcmp(argv[*i], "-checksum") == 0)
+    {
+        printf("Unknown checksum %s: inet or none\n", value);
+        return -1;
+    }
+    else if (strcmp(argv[*i], "-features") == 0)
+    {
+        if (parse_features(value, &c.features) < 0)
+            return -1;
+    }
+    else if (strcmp(argv[*i], "-retry") == 0)
+        c.retry = (unsigned int)atoi(value);
+    else if (strcmp(argv[*i], "-timeout") == 0)
+        c.timeout = (unsigned int)atoi(value);
+    else
+        return 0;
+    if (rudp_set_config(&c) < 0)
+        return -1;
+    ++*i;
+    return 1;
+}
+
+static unsigned char *option_put(unsigned char *at, unsigned char type, const void *value, unsigned int len)
+{
+    at[0] = type;
+    at[1] = (unsigned char)(len >> 8);
+    at[2] = (unsigned char)len;
+    memcpy(at + RUDP_OPT_HEADER, value, len);
+    return at + RUDP_OPT_HEADER + len;
+}
+
+/* Writes the options of c and then len bytes of hook data (if any) to out; the bytes written. */
+static unsigned int options_write(unsigned char *out, const RUDP_Config *c, const void *data, unsigned int len)
+{
+    uint16_t segment = htons((uint16_t)c->segment);
+    uint16_t window = htons((uint16_t)c->window);
+    unsigned char checksum_type = (unsigned char)c->checksum;
+    uint32_t features = htonl(c->features);
+    unsigned char *at = out;
+    at = option_put(at, RUDP_OPT_SEGMENT, &segment, sizeof(segment));
+    at = option_put(at, RUDP_OPT_WINDOW, &window, sizeof(window));
+    at = option_put(at, RUDP_OPT_CHECKSUM, &checksum_type, sizeof(checksum_type));
+    at = option_put(at, RUDP_OPT_FEATURES, &features, sizeof(features));
+    if (len > 0)
+        at = option_put(at, RUDP_OPT_DATA, data, len);
+    return (unsigned int)(at - out);
+}
+
+/*
+ * Reads the options in the len bytes at in over *c, which keeps the values of those missing; the hook
+ * data goes into *data and *data_len (NULL and 0 without it). -1 if an option runs past the end.
+ */
+static int options_read(const unsigned char *in, unsigned int len, RUDP_Config *c, const void **data, unsigned int *data_len)
+{
+    *data = NULL;
+    *data_len = 0;
+    unsigned int at = 0;
+    while (at < len)
+    {
+        if (len - at < RUDP_OPT_HEADER)
+            return -1;
+        unsigned char type = in[at];
+        unsigned int size = (unsigned int)in[at + 1] << 8 | in[at + 2];
+        const unsigned char *value = in + at + RUDP_OPT_HEADER;
+        at += RUDP_OPT_HEADER;
+        if (size > len - at)
+            return -1;
+        at += size;
+        uint16_t u16 = 0;
+        uint32_t u32 = 0;
+        if (size == sizeof(u16))
+            memcpy(&u16, value, size);
+        if (size == sizeof(u32))
+            memcpy(&u32, value, size);
+        if (type == RUDP_OPT_SEGMENT && size == sizeof(u16))
+            c->segment = ntohs(u16);
+        else if (type == RUDP_OPT_WINDOW && size == sizeof(u16))
+            c->window = ntohs(u16);
+        else if (type == RUDP_OPT_CHECKSUM && size == 1)
+            c->checksum = value[0];
+        else if (type == RUDP_OPT_FEATURES && size == sizeof(u32))
+            c->features = ntohl(u32);
+        else if (type == RUDP_OPT_DATA)
+        {
+            *data = value;
+            *data_len = size;
+        }
+    }
+    return 0;
+}
+
+/* What this end, asking for mine, and the peer, asking for theirs, can both run with. */
+static void negotiate(const RUDP_Config *mine, const RUDP_Config *theirs, RUDP_Config *agreed_to)
+{
+    *agreed_to = *mine;
+    if (theirs->segment >= 1 && theirs->segment < mine->segment)
+        agreed_to->segment = theirs->segment;
+    if (theirs->window >= 1 && theirs->window < mine->window)
+        agreed_to->window = theirs->window;
+    agreed_to->checksum = mine->checksum == RUDP_CHECKSUM_NONE && theirs->checksum == RUDP_CHECKSUM_NONE ? RUDP_CHECKSUM_NONE : RUDP_CHECKSUM_INET;
+    agreed_to->features = mine->features & theirs->features;
+}
+
+/* The connection on sock runs with c from now on. */
+static void connected_with(int sock, const RUDP_Config *c)
+{
+    if (sock >= 0 && sock < RUDP_MAX_FD)
+    {
+        sockets[sock].agreed = *c;
+        sockets[sock].negotiated = 1;
+        socket_capacity(sock, c->segment);
+    }
+    Trace_log(TRACE_INFO, "RUDP connected: segment %u bytes, window %u, checksum %s, features%s%s%s\n", c->segment, c->window,
+              c->checksum == RUDP_CHECKSUM_NONE ? "none" : "inet", c->features & RUDP_FEATURE_NACK ? " nack" : "",
+              c->features & RUDP_FEATURE_TLP ? " tlp" : "", c->features == 0 ? " none" : "");
+}
 
 int udp_socket(const char *dest_ip, unsigned short int dest_port)
+{
+    return udp_socket_from(NULL, dest_ip, dest_port);
+}
+
+int udp_socket_from(const char *local_ip, const char *dest_ip, unsigned short int dest_port)
 {
     if (dest_ip == NULL)
     {
-        printf("Setting up UDP at port %u...\n", dest_port);
+        Trace_log(TRACE_INFO, "Setting up UDP at port %u...\n", dest_port);
     }
     else
     {
-        printf("Setting up UDP at %s:%u...\n", dest_ip, dest_port);
+        Trace_log(TRACE_INFO, "Setting up UDP at %s:%u...\n", dest_ip, dest_port);
     }
 
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -33,24 +541,54 @@ int udp_socket(const char *dest_ip, unsigned short int dest_port)
         return -1;
     }
 
-    struct timeval timeout;
-    timeout.tv_sec = TIMEOUT;
-    timeout.tv_usec = 0;
-
-    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+    if (IO_set_recv_timeout(sock, (int)config.timeout) < 0)
     {
-        printf("Error setting timeout for socket");
+        Trace_log(TRACE_ERROR, "Error setting timeout for socket");
         return -1;
     }
-    printf("Timeout set to %d seconds\n", TIMEOUT);
+    Trace_log(TRACE_INFO, "Timeout set to %u seconds\n", config.timeout);
+    if (sock < RUDP_MAX_FD)
+    {
+        sockets[sock].negotiated = 0;
+        sockets[sock].srtt_ns = 0;
+        sockets[sock].rttvar_ns = 0;
+        pthread_mutex_lock(&totals.lock);
+        memset(&sockets[sock].stats, 0, sizeof(sockets[sock].stats));
+        sockets[sock].open = 1;
+        if (sock >= totals.high)
+            totals.high = sock + 1;
+        pthread_mutex_unlock(&totals.lock);
+    }
+    socket_tune(sock);
+    Busy_Poll_socket(sock);
+    Timestamp_socket(sock);
 
     // Setup the server address structure.
     struct sockaddr_in serverAddress;                 // server address
     memset(&serverAddress, 0, sizeof(serverAddress)); // zero out the structure
     serverAddress.sin_family = AF_INET;               // IPv4 address family
     serverAddress.sin_port = htons(dest_port);        // server port
+
+    // the local address a path leaves from (sender) or listens on (receiver)
+    struct sockaddr_in localAddress;
+    memset(&localAddress, 0, sizeof(localAddress));
+    localAddress.sin_family = AF_INET;
+    if (local_ip != NULL && inet_pton(AF_INET, local_ip, &localAddress.sin_addr) <= 0)
+    {
+        printf("Invalid local address %s\n", local_ip);
+        close(sock);
+        return -1;
+    }
+
     if (dest_ip)
     {
+        if (local_ip != NULL && bind(sock, (struct sockaddr *)&localAddress, sizeof(localAddress)) == -1)
+        {
+            perror("bind() failed");
+            close(sock);
+            return -1;
+        }
+
         int rval = inet_pton(AF_INET, dest_ip, &serverAddress.sin_addr); // convert IP address to network address
         if (rval <= 0)                                                   // if the conversion failed
         {
@@ -64,10 +602,12 @@ int udp_socket(const char *dest_ip, unsigned short int dest_port)
             perror("connect failed");
             return -1;
         }
+        Trace_set_endpoints(sock);
     }
     else
     {
         // bind the socket to the server address
+        serverAddress.sin_addr = localAddress.sin_addr;
         if (bind(sock, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) == -1)
         {
             perror("bind() failed");
@@ -76,12 +616,26 @@ int udp_socket(const char *dest_ip, unsigned short int dest_port)
         }
     }
 
-    printf("UDP socket created for %s:%u...\n\n", inet_ntoa(serverAddress.sin_addr), dest_port);
+    // -io xdp: the socket's datagrams go through AF_XDP frames, a segment has to fit in one; its handshakes offer that
+    if (IO_attach(sock) == 0 && offered(sock).segment < config.segment)
+        Trace_log(TRACE_INFO, "Segment size %u is over the device's MTU, %u bytes on this socket\n", config.segment, offered(sock).segment);
+
+    Trace_log(TRACE_INFO, "UDP socket created for %s:%u...\n\n", inet_ntoa(serverAddress.sin_addr), dest_port);
     return sock;
 }
 
 int rudp_socket(int sock)
 {
+    return rudp_socket_with(sock, NULL, 0, NULL, NULL);
+}
+
+int rudp_socket_with(int sock, const void *syn_data, unsigned int syn_len, void *reply, unsigned int *reply_len)
+{
+    if (syn_len > RUDP_SYN_DATA_MAX)
+    {
+        printf("SYN data of %u bytes, at most %d fit\n", syn_len, (int)RUDP_SYN_DATA_MAX);
+        return -1;
+    }
     // send SYN message
     RUDP_Packet *packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
     if (packet == NULL)
@@ -91,25 +645,33 @@ int rudp_socket(int sock)
     }
     memset(packet, 0, sizeof(RUDP_Packet)); // zero out the packet
     packet->flags.SYN = 1;                  // set the SYN flag
-    packet->seq_num = seq_num = 0;
+    // a random first seq_num, so the receiver tells a new connection from this SYN sent again
+    packet->seq_num = seq_num = (unsigned short int)Payload_random_seed();
+    receiving = 0;
+    // what this end asks for, and the hook's data after it
+    RUDP_Config mine = offered(sock);
+    packet->length = (unsigned short int)options_write((unsigned char *)packet->data, &mine, syn_data, syn_len);
     packet->checksum = checksum(packet->data, packet->length);
 
     int total_tries = 0; // total number of tries
 
-    while (total_tries < RETRY) // while the total number of tries is less than the maximum number of tries
+    while (total_tries < (int)config.retry) // while the total number of tries is less than the maximum number of tries
     {
-        rudp_dump_headers("OUT", packet);
-        int send_result = sendto(sock, packet, sizeof(RUDP_Packet), 0, NULL, 0);
+        uint64_t sent_ns = Timing_now_ns();
+        Trace_packet(TRACE_OUT, packet, offsetof(RUDP_Packet, data) + packet->length);
+        int send_result = Impair_send(sock, packet, offsetof(RUDP_Packet, data) + packet->length, offsetof(RUDP_Packet, data));
         if (send_result == -1)
         {
             perror("sendto() failed");
             free(packet); // free allocated memory
             return -1;
         }
+        if (total_tries > 0)
+            STAT_ADD(sock, counters.retransmits, 1);
 
         // Attempt to receive SYN-ACK packet immediately after sending SYN
         int inner_total_tries = 0;        // total number of tries
-        while (inner_total_tries < RETRY) // while the total number of tries is less than the maximum number of tries
+        while (inner_total_tries < (int)config.retry) // while the total number of tries is less than the maximum number of tries
         {
             RUDP_Packet *recv_packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet)); // allocate memory for the received packet
             if (recv_packet == NULL)
@@ -118,34 +680,58 @@ int rudp_socket(int sock)
                 return -1;
             }
             memset(recv_packet, 0, sizeof(RUDP_Packet));
-            printf("%d: Waiting for RUDP socket [seq_num %d]\n", __LINE__, seq_num);
-            int recv_result = recvfrom(sock, recv_packet, sizeof(RUDP_Packet), 0, NULL, NULL);
+            Trace_log(TRACE_DEBUG, "Waiting for RUDP socket [seq_num %d]\n", seq_num);
+            int recv_result = Impair_recv(sock, recv_packet, sizeof(RUDP_Packet));
             if (recv_result == -1)
             {
+                // the SYN or the SYN-ACK was lost: send the SYN again
                 perror("recvfrom() failed");
+                STAT_ADD(sock, counters.timeouts, 1);
                 free(recv_packet);
-                free(packet);
-                return -1;
+                break;
             }
-            rudp_dump_headers("IN ", recv_packet);
-
-            if (recv_packet->flags.SYN && recv_packet->flags.ACK)
+            Trace_packet(TRACE_IN, recv_packet, recv_result);
+
+            // what the receiver agreed to and its hook answered is checked like DATA
+            RUDP_Config theirs = config;
+            const void *answer;
+            unsigned int answer_len;
+            if (recv_packet->flags.SYN && recv_packet->flags.ACK &&
+                (recv_packet->length > MSG_BUFFER_SIZE || checksum(recv_packet->data, recv_packet->length) != recv_packet->checksum ||
+                 options_read((const unsigned char *)recv_packet->data, recv_packet->length, &theirs, &answer, &answer_len) < 0 ||
+                 answer_len > RUDP_SYN_DATA_MAX))
+            {
+                Trace_log(TRACE_WARN, "SYN-ACK checksum error\n");
+                STAT_ADD(sock, counters.checksum_errors, 1);
+            }
+            else if (recv_packet->flags.SYN && recv_packet->flags.ACK)
             {
+                if (reply_len != NULL)
+                {
+                    memcpy(reply, answer, answer_len);
+                    *reply_len = answer_len;
+                }
+                RUDP_Config agreed_to;
+                negotiate(&mine, &theirs, &agreed_to);
+                peer_window = recv_packet->window > 0 ? recv_packet->window : 1;
+                if (total_tries == 0)
+                    rtt_sample(sock, Timing_now_ns() - sent_ns); // the first RTT, so a tail-loss probe can be timed
                 free(recv_packet);
                 free(packet);
-                printf("RUDP connected\n");
+                stats_connected(sock);
+                connected_with(sock, &agreed_to);
                 return 0;
             }
-            printf("Received wrong packet when trying to connect\n");
+            Trace_log(TRACE_WARN, "Received wrong packet when trying to connect\n");
 
             inner_total_tries++;
             free(recv_packet);
         }
-        printf("Could not receive SYN-ACK packet\n");
+        Trace_log(TRACE_WARN, "Could not receive SYN-ACK packet\n");
         total_tries++;
     }
 
-    printf("Could not establish RUDP socket after %d retries\n", RETRY);
+    Trace_log(TRACE_ERROR, "Could not establish RUDP socket after %u retries\n", config.retry);
     free(packet); // free allocated memory
 
     return -1;
@@ -153,6 +739,7 @@ int rudp_socket(int sock)
 
 int rudp_accept(int sock, int port, int *done)
 {
+    (void)port; // the socket is bound to it already
     // Setup the client address structure.
     struct sockaddr_in clientAddress;                      // client address
     memset(&clientAddress, 0, sizeof(clientAddress));      // zero out the structure
@@ -167,269 +754,1215 @@ int rudp_accept(int sock, int port, int *done)
     }
     memset(packet, 0, sizeof(RUDP_Packet)); // zero out the packet
 
-    printf("%d: Waiting for RUDP socket\n", __LINE__);
-    int recv_result = recvfrom(sock, packet, sizeof(RUDP_Packet), 0, (struct sockaddr *)&clientAddress, &clientAddressLength);
-    if (recv_result == -1)
+    // a new run may come from another port than the last one, a restarted sender's say
+    if (sock >= RUDP_MAX_FD || sockets[sock].pending_syn == NULL)
     {
-        perror("recvfrom() failed");
-        free(packet);
-        return -1;
+        // the last ACKs may still be queued (io_uring), and a disconnected socket has nowhere to send them
+        IO_flush(sock);
+        struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+        connect(sock, &unspec, sizeof(unspec));
+        IO_peer_changed(sock);
     }
-    rudp_dump_headers("IN ", packet);
 
-    if (packet->all_flags == 0xFF)
+    while (1)
     {
-        *done = -1;
-        free(packet);
-        return 0;
-    }
+        if (sock < RUDP_MAX_FD && sockets[sock].pending_syn != NULL)
+        {
+            // rudp_recv() took it already, from the peer the socket is connected to
+            memcpy(packet, sockets[sock].pending_syn, sizeof(RUDP_Packet));
+            free(sockets[sock].pending_syn);
+            sockets[sock].pending_syn = NULL;
+            getpeername(sock, (struct sockaddr *)&clientAddress, &clientAddressLength);
+        }
+        else
+        {
+            Trace_log(TRACE_DEBUG, "Waiting for RUDP socket\n");
+            int recv_result = Impair_recvfrom(sock, packet, sizeof(RUDP_Packet), (struct sockaddr *)&clientAddress, &clientAddressLength);
+            if (recv_result == -1 && errno == ECONNREFUSED)
+            {
+                // an ACK re-sent above found the last sender gone: wait for any
+                IO_flush(sock);
+                struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+                connect(sock, &unspec, sizeof(unspec));
+                IO_peer_changed(sock);
+                continue;
+            }
+            if (recv_result == -1)
+            {
+                int error = errno; // EAGAIN: nothing arrived within the timeout
+                perror("recvfrom() failed");
+                free(packet);
+                errno = error;
+                return -1;
+            }
+            Trace_packet(TRACE_IN, packet, recv_result);
+        }
 
-    if (connect(sock, (struct sockaddr *)&clientAddress, clientAddressLength) == -1)
-    {
-        perror("connect() failed");
-        free(packet);
-        return -1;
-    }
+        if (packet->all_flags == 0xFF)
+        {
+            *done = -1;
+            free(packet);
+            return 0;
+        }
 
-    if (packet->flags.SYN == 1) // if the received packet is a SYN packet
-    {
-        // send SYN-ACK message
-        RUDP_Packet *syn_ack_packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet)); // allocate memory for the packet
-        if (syn_ack_packet == NULL)
+        if (connect(sock, (struct sockaddr *)&clientAddress, clientAddressLength) == -1)
         {
-            perror("malloc failed");
+            perror("connect() failed");
             free(packet);
             return -1;
         }
-        memset(syn_ack_packet, 0, sizeof(RUDP_Packet));      // zero out the packet
-        syn_ack_packet->flags.SYN = 1;                       // set the SYN flag
-        syn_ack_packet->flags.ACK = 1;                       // set the ACK flag
-        syn_ack_packet->seq_num = seq_num = packet->seq_num; // Initialize sequence number
-        syn_ack_packet->checksum = checksum(syn_ack_packet->data, syn_ack_packet->length);
-
-        rudp_dump_headers("OUT", syn_ack_packet);
-        int send_result = sendto(sock, syn_ack_packet, sizeof(RUDP_Packet), 0, (struct sockaddr *)&clientAddress, clientAddressLength); // send the packet
-        if (send_result == -1)                                                                                                          // if the send failed
+        IO_peer_changed(sock);
+        Trace_set_endpoints(sock);
+
+        RUDP_Config theirs = config;
+        const void *syn_data;
+        unsigned int syn_len;
+        if (packet->flags.SYN == 1 && (packet->length > MSG_BUFFER_SIZE || checksum(packet->data, packet->length) != packet->checksum ||
+                                       options_read((const unsigned char *)packet->data, packet->length, &theirs, &syn_data, &syn_len) < 0))
         {
-            perror("sendto() failed");
+            // its data is for the hook: a mangled one waits for the SYN to be sent again
+            Trace_log(TRACE_WARN, "SYN checksum error\n");
+            STAT_ADD(sock, counters.checksum_errors, 1);
+            continue;
+        }
+        if (packet->flags.SYN == 1) // if the received packet is a SYN packet
+        {
+            // a new connection: nothing held from the last one
+            RUDP_Reorder *r = reorder_get();
+            if (r == NULL)
+            {
+                free(packet);
+                return -1;
+            }
+            memset(r->held, 0, sizeof(r->held));
+            r->buffered = 0;
+            r->fins = 0;
+            r->closed = 0;
+            r->syn_seq = packet->seq_num;
+            r->edge = (unsigned short int)(packet->seq_num + 1);
+
+            // send SYN-ACK message
+            RUDP_Packet *syn_ack_packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet)); // allocate memory for the packet
+            if (syn_ack_packet == NULL)
+            {
+                perror("malloc failed");
+                free(packet);
+                return -1;
+            }
+            memset(syn_ack_packet, 0, sizeof(RUDP_Packet));      // zero out the packet
+            syn_ack_packet->flags.SYN = 1;                       // set the SYN flag
+            syn_ack_packet->flags.ACK = 1;                       // set the ACK flag
+            syn_ack_packet->seq_num = seq_num = packet->seq_num; // Initialize sequence number
+            receiving = 1;
+            RUDP_Config mine = offered(sock);
+            RUDP_Config agreed_to;
+            negotiate(&mine, &theirs, &agreed_to);
+            connected_with(sock, &agreed_to);
+            syn_ack_packet->window = (unsigned short int)receive_window(sock);
+
+            // the values agreed to, then what the hook answers
+            RUDP_Syn_Hook hook = sock < RUDP_MAX_FD ? sockets[sock].syn_hook : NULL;
+            unsigned char *answer = (unsigned char *)malloc(RUDP_SYN_DATA_MAX);
+            unsigned int answer_len = 0;
+            if (answer == NULL)
+            {
+                perror("malloc failed");
+                free(packet);
+                free(syn_ack_packet);
+                return -1;
+            }
+            if (hook != NULL)
+                answer_len = hook(sockets[sock].syn_ctx, syn_data, syn_len, answer);
+            syn_ack_packet->length = (unsigned short int)options_write((unsigned char *)syn_ack_packet->data, &agreed_to, answer, answer_len);
+            free(answer);
+            syn_ack_packet->checksum = checksum(syn_ack_packet->data, syn_ack_packet->length);
+            if (sock < RUDP_MAX_FD)
+            {
+                // the sender may not get it: a SYN sent again gets the same answer, the hook is not asked twice
+                if (sockets[sock].syn_ack == NULL)
+                    sockets[sock].syn_ack = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
+                if (sockets[sock].syn_ack != NULL)
+                    memcpy(sockets[sock].syn_ack, syn_ack_packet, offsetof(RUDP_Packet, data) + syn_ack_packet->length);
+            }
+
+            size_t syn_ack_len = offsetof(RUDP_Packet, data) + syn_ack_packet->length;
+            Trace_packet(TRACE_OUT, syn_ack_packet, syn_ack_len);
+            int send_result = Impair_send(sock, syn_ack_packet, syn_ack_len, offsetof(RUDP_Packet, data)); // send the packet, connected above
+            if (send_result == -1)                                                                                                          // if the send failed
+            {
+                perror("sendto() failed");
+                free(packet);
+                free(syn_ack_packet);
+                return -1;
+            }
+
             free(packet);
             free(syn_ack_packet);
-            return -1;
+
+            seq_num++;
+            stats_connected(sock);
+            return 0;
         }
 
-        free(packet);
-        free(syn_ack_packet);
+        if (packet->flags.DATA && !(reorder != NULL && (short int)(packet->seq_num - (unsigned short int)seq_num) < 0 &&
+                                    (short int)(packet->seq_num - reorder->syn_seq) > 0))
+        {
+            // a run this receiver never saw, one it was restarted in the middle of: ACKing it would have the
+            // sender go on as if it were written, so it times out and connects again instead
+            Trace_log(TRACE_WARN, "Dropping segment %d of an unknown run\n", packet->seq_num);
+            continue;
+        }
+        if (packet->flags.DATA)
+        {
+            // the last segment of the previous run again: its ACK was lost, the sender is still waiting for it
+            Trace_log(TRACE_WARN, "Re-ACKing segment %d of the previous run\n", packet->seq_num);
+            if (send_ack(sock, packet) < 0)
+            {
+                free(packet);
+                return -1;
+            }
+            continue;
+        }
+        if (packet->flags.PROBE)
+            continue; // a window probe of the previous run, its sender has moved on
 
-        seq_num++;
-        printf("RUDP connected\n");
-        return 0;
+        break;
     }
 
-    printf("Received wrong packet when trying to accept\n");
+    Trace_log(TRACE_ERROR, "Received wrong packet when trying to accept\n");
     free(packet);
 
     return -1;
 }
 
-int rudp_recv(int sock, void *buffer, unsigned int buffer_size, pStrList *strList, int *done)
+/* Hands the held segment seq_num to the caller. */
+static int deliver(int sock, RUDP_Reorder *r, void *buffer, int *done)
 {
-    RUDP_Packet *packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
-    if (packet == NULL)
-    {
-        perror("malloc failed");
-        return -1;
-    }
-    memset(packet, 0, sizeof(RUDP_Packet));
+    int index = seq_num & (RUDP_WINDOW - 1);
+    RUDP_Packet *packet = r->slot[index];
+    int was_closed = receive_window(sock) == 0;
 
-    // Receive packet with error handling and timeout
-    struct timeval timeout;
-    timeout.tv_sec = TIMEOUT; // Set timeout in seconds
-    timeout.tv_usec = 0;
-
-    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) < 0)
+    int len = packet->length;
+    memcpy(buffer, packet->data, len);
+    if (packet->flags.FIN)
     {
-        perror("setsockopt failed");
-        free(packet);
-        return -1;
+        *done = 1;
+        r->fins--;
     }
+    r->held[index] = 0;
+    r->buffered--;
+    seq_num++;
+    STAT_ADD(sock, counters.bytes_received, len);
+    STAT_ADD(sock, connection_bytes, len);
+
+    // the sender stopped at a zero window: tell it now rather than at its next probe
+    if (was_closed && send_window_update(sock) < 0)
+        return -1;
+    return len;
+}
 
+/*
+ * Receives one datagram and handles it: DATA within the window is held and ACKed.
+ * Returns 1 when a datagram was handled, 0 when none was waiting (MSG_DONTWAIT), -1 on failure.
+ */
+static int receive_segment(int sock, RUDP_Reorder *r, int flags)
+{
+    RUDP_Packet *packet = r->spare;
+    const RUDP_Config *c = agreed(sock);
+
+    // Receive packet with error handling; udp_socket() set the timeout
     int total_tries = 0;        // total number of tries
-    while (total_tries < RETRY) // while the total number of tries is less than the maximum number of tries
+    int recv_result = -1;
+    while (total_tries < (int)c->retry) // while the total number of tries is less than the maximum number of tries
     {
-        printf("%d: Waiting for RUDP socket [seq_num %d]\n", __LINE__, seq_num);
-        int recv_result = recvfrom(sock, packet, sizeof(RUDP_Packet), 0, NULL, NULL);
+        Trace_log(TRACE_DEBUG, "Waiting for RUDP socket [seq_num %d]\n", seq_num);
+        recv_result = receive_packet(sock, packet, flags);
         if (recv_result != -1)
             break;
+        if (flags & MSG_DONTWAIT)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
 
         perror("recvfrom() failed");
+        STAT_ADD(sock, counters.timeouts, 1);
         total_tries++; // increment the total number of tries
     }
 
-    if (total_tries == RETRY) // if the total number of tries is equal to the maximum number of tries
+    if (total_tries == (int)c->retry) // if the total number of tries is equal to the maximum number of tries
     {
-        printf("Could not recv packet %d\n", seq_num); // print an error message;
-        free(packet);                                  // free the packet
+        Trace_log(TRACE_ERROR, "Could not recv packet %d\n", seq_num); // print an error message;
         return -1;                                     // return an error
     }
 
-    rudp_dump_headers("IN ", packet);
+    Trace_packet(TRACE_IN, packet, recv_result);
 
-    // Check if the packet is corrupted
-    if (checksum(packet->data, packet->length) != packet->checksum)
+    // the close packet: nothing follows it. Between runs rudp_accept() takes it, here a
+    // message stream ended (rudp_recvmsg())
+    if (packet->all_flags == 0xFF)
     {
-        printf("checksum error: 0x%08X 08%08X\n", checksum(packet->data, packet->length), packet->checksum);
-        free(packet);
-        return 0;
+        r->closed = 1;
+        return 1;
     }
 
-    // Check if the packet is a SYN packet
-    if (packet->flags.SYN)
+    // Check if the packet is corrupted; without a checksum only the length of DATA can be
+    if (packet->length > MSG_BUFFER_SIZE ||
+        (!(packet->flags.DATA && c->checksum == RUDP_CHECKSUM_NONE) && checksum(packet->data, packet->length) != packet->checksum))
     {
-        seq_num = 0; // Initialize sequence number
-        free(packet);
-        return 0;
+        Trace_log(TRACE_WARN, "checksum error: 0x%08X 08%08X\n", checksum(packet->data, packet->length), packet->checksum);
+        STAT_ADD(sock, counters.checksum_errors, 1);
+        return 1;
     }
 
-    if ((packet->seq_num > seq_num) || (packet->seq_num - seq_num < -1))
+    if (packet->flags.SYN && packet->seq_num != r->syn_seq && sock < RUDP_MAX_FD)
     {
-        printf("seq_num error: packet %d expected %d\n", packet->seq_num, seq_num);
-        free(packet);
+        // the sender gave up on this connection and opened a new one: the run ends here, and
+        // the SYN is left for rudp_accept()
+        Trace_log(TRACE_WARN, "The sender started over, the run is cut short\n");
+        if (sockets[sock].pending_syn == NULL)
+            sockets[sock].pending_syn = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
+        if (sockets[sock].pending_syn != NULL)
+            memcpy(sockets[sock].pending_syn, packet, sizeof(RUDP_Packet));
+        errno = ECONNRESET;
         return -1;
     }
-
-    // Send ACK for the received packet
-    if (send_ack(sock, packet) < 0)
+    // A SYN here is a retransmission: the SYN-ACK sent by rudp_accept() was lost
+    if (packet->flags.SYN)
+    {
+        STAT_ADD(sock, counters.duplicates, 1);
+        RUDP_Packet *syn_ack = sock < RUDP_MAX_FD ? sockets[sock].syn_ack : NULL;
+        if (syn_ack == NULL)
+            return send_ack(sock, packet) < 0 ? -1 : 1;
+        size_t len = offsetof(RUDP_Packet, data) + syn_ack->length;
+        Trace_packet(TRACE_OUT, syn_ack, len);
+        if (Impair_send(sock, syn_ack, len, offsetof(RUDP_Packet, data)) == -1)
+        {
+            perror("sendto() failed");
+            return -1;
+        }
+        return 1;
+    }
+
+    // a window update (ACK + PROBE) is for a sender, this side was one before the connection turned around
+    if (packet->flags.PROBE && !packet->flags.ACK)
+        return send_window_update(sock) < 0 ? -1 : 1;
+
+    if (!packet->flags.DATA)
+        return 1;
+
+    STAT_ADD(sock, counters.segments_received, 1);
+    int ahead = (short int)(packet->seq_num - (unsigned short int)seq_num); // sequence numbers wrap at 16 bits
+    int index = packet->seq_num & (RUDP_WINDOW - 1);
+    if (ahead >= (int)agreed(sock)->window)
+    {
+        // the sender went past the window we advertised: dropped, it will be retransmitted
+        Trace_log(TRACE_WARN, "seq_num out of window: packet %d expected %d\n", packet->seq_num, seq_num);
+        STAT_ADD(sock, counters.out_of_window, 1);
+        return 1;
+    }
+    if (ahead < 0 || r->held[index])
+    {
+        // a retransmission whose ACK was lost, or a duplicate: ACKed again, but already delivered or held
+        Trace_log(TRACE_WARN, "seq_num mismatch, not incrementing it: packet %d expected %d\n", packet->seq_num, seq_num);
+        STAT_ADD(sock, counters.duplicates, 1);
+        return send_ack(sock, packet) < 0 ? -1 : 1;
+    }
+
+    // hold it in its slot; the slot's old buffer is the next one received into
+    r->spare = r->slot[index];
+    r->slot[index] = packet;
+    r->held[index] = 1;
+    r->buffered++;
+    r->fins += packet->flags.FIN;
+
+    // Send ACK for the received packet, with the window left
+    if (send_ack(sock, packet) < 0)
+        return -1;
+
+    // past the highest one so far: the segments skipped over are new gaps, NACKed once right away
+    int skipped = (short int)(packet->seq_num - r->edge);
+    if (skipped < 0)
+        return 1;
+    uint32_t missing = 0;
+    for (int i = ahead - skipped; i < ahead; i++)
+        missing |= 1u << i;
+    r->edge = (unsigned short int)(packet->seq_num + 1);
+    return missing != 0 && (c->features & RUDP_FEATURE_NACK) && send_nack(sock, missing) < 0 ? -1 : 1;
+}
+
+int rudp_recv(int sock, void *buffer, unsigned int buffer_size, int *done)
+{
+    RUDP_Reorder *r = reorder_get();
+    if (r == NULL)
+        return -1;
+    if (!receiving)
+    {
+        // the connection turns around: the peer's reply follows the last segment sent
+        seq_num++;
+        memset(r->held, 0, sizeof(r->held));
+        r->buffered = 0;
+        r->fins = 0;
+        r->closed = 0;
+        r->edge = (unsigned short int)seq_num;
+        receiving = 1;
+    }
+
+    // the next segment may be here already: it arrived before one that was lost, or was taken in
+    // along with an earlier one. Otherwise wait for a datagram. Then take in whatever else is queued
+    // while there is room, so it is ACKed now and a slow reader closes the window; not past the end
+    // of the message, what follows it (a close, the next SYN) is for rudp_accept().
+    int result = r->held[seq_num & (RUDP_WINDOW - 1)] || r->closed ? 1 : receive_segment(sock, r, 0);
+    while (result > 0 && r->buffered < (int)agreed(sock)->window && r->fins == 0 && !r->closed)
+        result = receive_segment(sock, r, MSG_DONTWAIT);
+    if (result < 0)
+        return -1;
+
+    if (r->held[seq_num & (RUDP_WINDOW - 1)])
+    {
+        if (r->slot[seq_num & (RUDP_WINDOW - 1)]->length > buffer_size)
+        {
+            Trace_log(TRACE_ERROR, "Segment of %u bytes does not fit a buffer of %u\n",
+                      (unsigned int)r->slot[seq_num & (RUDP_WINDOW - 1)]->length, buffer_size);
+            return -1;
+        }
+        return deliver(sock, r, buffer, done);
+    }
+    if (r->closed)
+        *done = -1;
+    return 0;
+}
+
+int rudp_send(int sock, void *buffer, unsigned int buffer_size)
+{
+    return rudp_send_part(sock, buffer, buffer_size, 1);
+}
+
+typedef struct _RUDP_Segment
+{
+    uint64_t sent_ns;  // last transmission
+    int tries;         // transmissions so far
+    int acked;
+    int dupacks;       // segments sent after its last transmission and ACKed since
+} RUDP_Segment;
+
+// Sender: one rudp_send_part() call
+typedef struct _RUDP_Send
+{
+    int sock;
+    const RUDP_Config *config; // the connection's
+    RUDP_Packet *packet;       // segments are built in it
+    const void *buffer;
+    unsigned int buffer_size;
+    int last;
+    int first;                 // sequence number of segment 0
+    int packet_amount;
+    RUDP_Segment *segments;
+    int una, next, in_flight;  // segments [una, next) are in flight or ACKed out of order; at most RUDP_WINDOW apart
+    int probes;                // unanswered zero-window probes
+    uint64_t quiet_ns;         // last new segment, ACK or tail-loss probe: the next probe is due 2 * SRTT later
+    int tail_probed;           // unanswered tail-loss probes, each doubles the wait for the next
+} RUDP_Send;
+
+/* Builds segment i of the part (sequence number first + i) and sends it. */
+static int send_segment(RUDP_Send *s, int i)
+{
+    RUDP_Packet *packet = s->packet;
+    RUDP_Segment *segment = &s->segments[i];
+    memset(packet, 0, offsetof(RUDP_Packet, data)); // zero out the header
+    packet->flags.DATA = 1;                          // set the DATA flag
+    packet->seq_num = (unsigned short int)(s->first + i); // set the sequence number
+    packet->tsval = Timestamp_enabled() ? Timestamp_now_us() : 0;
+
+    // Set the FIN flag for the last packet of the message
+    unsigned int segment_size = s->config->segment;
+    if (i == s->packet_amount - 1)
+    {
+        packet->flags.FIN = s->last;
+        // set the length of the packet
+        packet->length = s->buffer_size - i * segment_size;
+    }
+    else
+    {
+        // set the length of the packet
+        packet->length = segment_size;
+    }
+
+    memcpy(packet->data, (const char *)s->buffer + (size_t)i * segment_size, packet->length); // copy the data to the packet
+
+    // Calculate the checksum for the packet, unless the connection left it to UDP
+    packet->checksum = s->config->checksum == RUDP_CHECKSUM_NONE ? 0 : checksum(packet->data, packet->length);
+
+    Trace_packet(TRACE_OUT, packet, offsetof(RUDP_Packet, data) + packet->length);
+    ssize_t send_result = Impair_send(s->sock, packet, offsetof(RUDP_Packet, data) + packet->length, offsetof(RUDP_Packet, data)); // send the packet
+    if (send_result == -1)                                                                                // if the send failed
     {
-        free(packet);
+        perror("sendto() failed");
         return -1;
     }
+    STAT_ADD(s->sock, counters.segments_sent, 1);
+    if (segment->tries > 0)
+        STAT_ADD(s->sock, counters.retransmits, 1);
+    else
+        STAT_ADD(s->sock, counters.bytes_sent, packet->length);
+    segment->tries++;
+    segment->sent_ns = Timing_now_ns();
+    return 0;
+}
+
+/* The receiver NACKed seq_num: sends it again now, unless that was done within the last RTT. */
+static int nacked(RUDP_Send *s, unsigned short int seq_num, uint64_t now)
+{
+    uint64_t srtt = srtt_of(s->sock);
+    int i = s->una + (unsigned short int)(seq_num - (unsigned short int)(s->first + s->una));
+    if (i >= s->next || s->segments[i].acked || s->segments[i].tries == (int)s->config->retry ||
+        (s->segments[i].tries > 1 && now - s->segments[i].sent_ns < srtt))
+        return 0;
+    Trace_log(TRACE_DEBUG, "NACK, segment %d sent again\n", s->first + i);
+    int result = send_segment(s, i);
+    s->segments[i].dupacks = 0;
+    STAT_ADD(s->sock, counters.fast_retransmits, 1);
+    return result;
+}
+
+/* seq_num was ACKed, the ACK received at at_ns: 1 if it was in flight, 0 for a duplicate, -1 if a retransmission failed. */
+static int acked(RUDP_Send *s, unsigned short int seq_num, unsigned short int window, uint64_t at_ns)
+{
+    // every ACK acknowledges the one segment it names
+    int offset = (unsigned short int)(seq_num - (unsigned short int)(s->first + s->una));
+    if (offset >= s->next - s->una || s->segments[s->una + offset].acked)
+    {
+        STAT_ADD(s->sock, counters.duplicates, 1);
+        return 0;
+    }
+    RUDP_Segment *segment = &s->segments[s->una + offset];
+    segment->acked = 1;
+    s->in_flight--;
+    peer_window = window;
+    s->probes = 0;
+    STAT_ADD(s->sock, counters.acks_received, 1);
+    unsigned int segment_size = s->config->segment;
+    STAT_ADD(s->sock, connection_bytes, s->una + offset == s->packet_amount - 1 ? s->buffer_size - (s->una + offset) * segment_size : segment_size);
+    if (segment->tries == 1)
+        rtt_sample(s->sock, at_ns - segment->sent_ns);
+    s->quiet_ns = at_ns;
+    s->tail_probed = 0;
+
+    // this path's own RTT: on a striped transfer the others may differ
+    uint64_t srtt = srtt_of(s->sock);
+
+    // the selective ACK form of duplicate ACKs: every ACK of a segment sent after an unACKed
+    // one counts against it, RUDP_DUPTHRESH of them and it is taken as lost, once it has been
+    // out for an RTT and a quarter (reordering, e.g. jitter, is not loss)
+    int result = 1;
+    for (int i = s->una; i < s->next && result == 1; i++)
+    {
+        RUDP_Segment *earlier = &s->segments[i];
+        if (earlier->acked || earlier->sent_ns >= segment->sent_ns || ++earlier->dupacks < RUDP_DUPTHRESH ||
+            s->quiet_ns - earlier->sent_ns < srtt + srtt / 4 || earlier->tries == (int)s->config->retry)
+            continue;
+        Trace_log(TRACE_DEBUG, "%d later segments ACKed, segment %d sent again\n", RUDP_DUPTHRESH, s->first + i);
+        if (send_segment(s, i) < 0)
+            result = -1;
+        earlier->dupacks = 0;
+        STAT_ADD(s->sock, counters.fast_retransmits, 1);
+    }
+    while (s->una < s->packet_amount && s->segments[s->una].acked)
+        s->una++;
+    return result;
+}
+
+/* Hands event to the sender, waiting while its ring is full; dropped only if the thread is being stopped. */
+static void ack_thread_put(RUDP_Ack_Thread *t, Ring *ring, const RUDP_Event *event)
+{
+    while (Ring_push(ring, event) < 0 && !__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE))
+    {
+        uint64_t one = 1;
+        if (__atomic_exchange_n(&t->sleeping, 0, __ATOMIC_SEQ_CST) && write(t->wake_fd, &one, sizeof(one)) < 0)
+            perror("write(eventfd) failed");
+        sched_yield();
+    }
+}
 
+/* Checks one packet from the receiver and queues what it says for the sender: 1 if it queued anything. */
+static int ack_thread_take(RUDP_Ack_Thread *t, const RUDP_Packet *packet, ssize_t len)
+{
+    Trace_packet(TRACE_IN, packet, len);
+    RUDP_Event event = {Timing_now_ns(), packet->seq_num, packet->window, 0};
+    if (packet->flags.NACK)
+    {
+        if (packet->length != sizeof(uint32_t) || checksum((void *)packet->data, packet->length) != packet->checksum)
+        {
+            STAT_ADD(t->sock, counters.checksum_errors, 1);
+            return 0;
+        }
+        STAT_ADD(t->sock, counters.nacks_received, 1);
+        uint32_t missing;
+        memcpy(&missing, packet->data, sizeof(missing));
+        for (int bit = 0; bit < RUDP_WINDOW; bit++)
+        {
+            if (!(missing & (1u << bit)))
+                continue;
+            event.seq_num = (unsigned short int)(packet->seq_num + bit);
+            ack_thread_put(t, &t->retransmits, &event);
+        }
+        return 1;
+    }
+    if (!packet->flags.ACK)
+    {
+        STAT_ADD(t->sock, counters.duplicates, 1);
+        return 0;
+    }
     if (packet->flags.FIN)
     {
-        *done = 1;
+        Trace_log(TRACE_INFO, "RUDP disconnected\n");
     }
+    event.update = packet->flags.PROBE;
+    ack_thread_put(t, &t->acks, &event);
+    return 1;
+}
 
-    if (packet->flags.DATA)
+/* Receives for the sender until stopped, waking it once per batch of packets if it waits. */
+static void *ack_thread_main(void *arg)
+{
+    RUDP_Ack_Thread *t = (RUDP_Ack_Thread *)arg;
+    Busy_Poll_pin_thread("ACK", t->slot);
+    while (!__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE))
     {
-        int len = packet->length;
-        memcpy(buffer, packet->data, len);
+        if (__atomic_load_n(&t->park, __ATOMIC_ACQUIRE))
+        {
+            // between messages: the socket is the sender's until the next one
+            pthread_mutex_lock(&t->lock);
+            t->parked = 1;
+            pthread_cond_broadcast(&t->cond);
+            while (t->park && !t->stop)
+                pthread_cond_wait(&t->cond, &t->lock);
+            t->parked = 0;
+            pthread_mutex_unlock(&t->lock);
+            // the wakeups of every park so far, or poll() would return at once from now on
+            uint64_t count;
+            if (read(t->stop_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                perror("read(eventfd) failed");
+            continue;
+        }
+        // delayed packets of the impairment go out from here meanwhile, the sender no longer polls
+        int ready = Impair_poll_or(t->sock, t->stop_fd, (int)agreed(t->sock)->timeout * 1000);
+        if (ready < 0)
+        {
+            perror("poll() failed");
+            break;
+        }
+        if (ready != 1)
+            continue;
 
-        if (packet->seq_num == seq_num)
-            seq_num++;
-        else
-            printf("seq_num mismatch, not incrementing it: packet %d expected %d\n", packet->seq_num, seq_num);
+        int queued = 0;
+        for (int i = 0; i < RUDP_WINDOW; i++)
+        {
+            ssize_t len = receive_packet(t->sock, t->packet, MSG_DONTWAIT);
+            if (len < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    perror("recvfrom() failed");
+                break;
+            }
+            queued |= ack_thread_take(t, t->packet, len);
+        }
+        uint64_t one = 1;
+        if (queued && __atomic_exchange_n(&t->sleeping, 0, __ATOMIC_SEQ_CST) && write(t->wake_fd, &one, sizeof(one)) < 0)
+            perror("write(eventfd) failed");
+    }
+    return NULL;
+}
 
-        free(packet);
-        return len;
+static void ack_thread_free(RUDP_Ack_Thread *t)
+{
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+    Ring_free(&t->acks);
+    Ring_free(&t->retransmits);
+    if (t->stop_fd >= 0)
+        close(t->stop_fd);
+    if (t->wake_fd >= 0)
+        close(t->wake_fd);
+    free(t->packet);
+    free(t);
+}
+
+static RUDP_Ack_Thread *ack_thread_start(int sock)
+{
+    RUDP_Ack_Thread *t = (RUDP_Ack_Thread *)aligned_alloc(RING_CACHE_LINE, sizeof(RUDP_Ack_Thread));
+    if (t == NULL)
+    {
+        perror("malloc failed");
+        return NULL;
+    }
+    memset(t, 0, sizeof(*t));
+    t->sock = sock;
+    t->slot = Busy_Poll_helper_slot();
+    t->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
+    if (t->stop_fd < 0 || t->wake_fd < 0 || t->packet == NULL)
+    {
+        perror("ACK thread setup failed");
+        ack_thread_free(t);
+        return NULL;
+    }
+    if (Ring_init(&t->acks, RUDP_EVENT_RING, sizeof(RUDP_Event)) < 0 ||
+        Ring_init(&t->retransmits, RUDP_EVENT_RING, sizeof(RUDP_Event)) < 0)
+    {
+        ack_thread_free(t);
+        return NULL;
+    }
+    if (pthread_create(&t->thread, NULL, ack_thread_main, t) != 0)
+    {
+        perror("pthread_create() failed");
+        ack_thread_free(t);
+        return NULL;
     }
+    return t;
+}
 
-    free(packet);
-    return 0;
+static void ack_thread_stop(RUDP_Ack_Thread *t)
+{
+    uint64_t one = 1;
+    pthread_mutex_lock(&t->lock);
+    __atomic_store_n(&t->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    if (write(t->stop_fd, &one, sizeof(one)) < 0)
+        perror("write(eventfd) failed");
+    pthread_join(t->thread, NULL);
+    ack_thread_free(t);
 }
 
-int rudp_send(int sock, void *buffer, unsigned int buffer_size)
+/* Sender, after a message: returns once the ACK thread no longer receives on the socket. */
+static void ack_thread_park(RUDP_Ack_Thread *t)
+{
+    uint64_t one = 1;
+    pthread_mutex_lock(&t->lock);
+    __atomic_store_n(&t->park, 1, __ATOMIC_RELEASE);
+    if (write(t->stop_fd, &one, sizeof(one)) < 0)
+        perror("write(eventfd) failed");
+    while (!t->parked)
+        pthread_cond_wait(&t->cond, &t->lock);
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* Sender, before a message: what the last one left queued is dropped, then the ACK thread receives again. */
+static void ack_thread_unpark(RUDP_Ack_Thread *t)
 {
-    // number of packets to send.  Last data packet must be partial, even if buffer_size==MSG_BUFFER_SIZE.
-    int packet_amount = buffer_size / MSG_BUFFER_SIZE + (buffer_size % MSG_BUFFER_SIZE != 0); // number of packets to send
+    if (!__atomic_load_n(&t->park, __ATOMIC_ACQUIRE))
+        return;
+    RUDP_Event event;
+    while (Ring_pop(&t->acks, &event) == 0)
+        ;
+    while (Ring_pop(&t->retransmits, &event) == 0)
+        ;
+    pthread_mutex_lock(&t->lock);
+    __atomic_store_n(&t->park, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* Sender: waits up to timeout_ms for the ACK thread to queue something: 1 if it did, 0 if not, -1 on error. */
+static int ack_thread_wait(RUDP_Ack_Thread *t, int timeout_ms)
+{
+    if (!Ring_empty(&t->acks) || !Ring_empty(&t->retransmits))
+        return 1;
+    // anything queued before sleeping is set is seen by the check below, anything after wakes wake_fd
+    __atomic_store_n(&t->sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!Ring_empty(&t->acks) || !Ring_empty(&t->retransmits))
+    {
+        __atomic_store_n(&t->sleeping, 0, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    struct pollfd pfd = {.fd = t->wake_fd, .events = POLLIN};
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+        ;
+    __atomic_store_n(&t->sleeping, 0, __ATOMIC_SEQ_CST);
+    uint64_t count;
+    if (ready > 0 && read(t->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read(eventfd) failed");
+    return ready < 0 ? -1 : ready > 0;
+}
 
+/* Sender: takes everything the ACK thread queued, ACKs first so NACKs are checked against them. */
+static int ack_thread_drain(RUDP_Ack_Thread *t, RUDP_Send *s)
+{
+    RUDP_Event event;
+    int result = 0;
+    while (result == 0 && Ring_pop(&t->acks, &event) == 0)
+    {
+        if (event.update)
+        {
+            // window update
+            peer_window = event.window;
+            s->probes = 0;
+        }
+        else if (acked(s, event.seq_num, event.window, event.at_ns) < 0)
+            result = -1;
+    }
+    while (result == 0 && Ring_pop(&t->retransmits, &event) == 0)
+    {
+        peer_window = event.window;
+        s->probes = 0;
+        if (nacked(s, event.seq_num, Timing_now_ns()) < 0)
+            result = -1;
+    }
+    return result;
+}
+
+void rudp_set_syn_hook(int sock, RUDP_Syn_Hook hook, void *ctx)
+{
+    if (sock < 0 || sock >= RUDP_MAX_FD)
+        return;
+    sockets[sock].syn_hook = hook;
+    sockets[sock].syn_ctx = ctx;
+}
+
+int rudp_set_ack_thread(int sock, int on)
+{
+    if (sock < 0 || sock >= RUDP_MAX_FD)
+    {
+        printf("Socket %d is out of range for an ACK thread\n", sock);
+        return -1;
+    }
+    // the io_uring ring and the AF_XDP rings belong to one thread
+    if (on && IO_backend() != IO_SYSCALL)
+    {
+        printf("An ACK thread needs the syscall I/O backend\n");
+        return -1;
+    }
+    sockets[sock].ack_thread = on;
+    if (!on && sockets[sock].acker != NULL)
+    {
+        ack_thread_stop(sockets[sock].acker);
+        sockets[sock].acker = NULL;
+    }
+    return 0;
+}
+
+int rudp_send_part(int sock, const void *buffer, unsigned int buffer_size, int last)
+{
+    RUDP_Send s;
+    memset(&s, 0, sizeof(s));
+    s.sock = sock;
+    s.config = agreed(sock);
+    s.buffer = buffer;
+    s.buffer_size = buffer_size;
+    s.last = last;
+    s.first = receiving ? seq_num : seq_num + 1; // after a message came in, the reply goes on from it
+    receiving = 0;
+    // number of packets to send, of the segment size the connection agreed to
+    unsigned int segment_size = s.config->segment;
+    uint64_t timeout_ns = s.config->timeout * 1000000000ULL;
+    s.packet_amount = buffer_size / segment_size + (buffer_size % segment_size != 0); // number of packets to send
+
+    s.packet = malloc(sizeof(RUDP_Packet));      // allocate memory for the packet
     RUDP_Packet *recv_packet = malloc(sizeof(RUDP_Packet)); // allocate memory for the received packet
-    if (recv_packet == NULL)
+    s.segments = calloc(s.packet_amount > 0 ? s.packet_amount : 1, sizeof(RUDP_Segment));
+    if (s.packet == NULL || recv_packet == NULL || s.segments == NULL)
     {
         perror("malloc failed");
+        free(s.packet);
+        free(recv_packet);
+        free(s.segments);
         return -1;
     }
 
-    for (int i = 0; i < packet_amount; i++) // for each packet to send
+    // with an ACK thread this thread only sends; the ACK thread is started once and parked after
+    // every message, so the next handshake is received here again
+    RUDP_Ack_Thread *acker = NULL;
+    int result = 1;
+    if (sock >= 0 && sock < RUDP_MAX_FD && sockets[sock].ack_thread)
+    {
+        if (sockets[sock].acker == NULL)
+            sockets[sock].acker = ack_thread_start(sock);
+        acker = sockets[sock].acker;
+        if (acker == NULL)
+            result = -1;
+        else
+            ack_thread_unpark(acker);
+    }
+    uint64_t probe_ns = 0;         // when to probe a zero window, 0 when the window is open
+    int probe_ms = RUDP_PROBE_MS;
+
+    while (s.una < s.packet_amount && result == 1)
     {
-        RUDP_Packet *packet = malloc(sizeof(RUDP_Packet)); // allocate memory for the packet
-        if (packet == NULL)
+        int window = peer_window < (int)s.config->window ? peer_window : (int)s.config->window;
+        STAT_SET(sock, window, window);
+        while (s.next < s.packet_amount && s.next - s.una < RUDP_WINDOW && s.in_flight < window)
         {
-            perror("malloc failed");
-            free(recv_packet);
-            return -1;
+            if (send_segment(&s, s.next) < 0)
+            {
+                result = -1;
+                break;
+            }
+            s.next++;
+            s.in_flight++;
+            s.quiet_ns = s.segments[s.next - 1].sent_ns;
+            s.tail_probed = 0;
         }
+        if (result < 0)
+            break;
 
-        memset(packet, 0, sizeof(RUDP_Packet)); // zero out the packet
-        packet->flags.DATA = 1;                 // set the DATA flag
-        packet->seq_num = ++seq_num;            // set the sequence number
+        // a tail-loss probe needs an RTT of this path to go by: none before its first sample
+        uint64_t srtt = srtt_of(sock);
+        uint64_t pto_ns = (2 * srtt > RUDP_TLP_MIN_MS * 1000000ULL ? 2 * srtt : RUDP_TLP_MIN_MS * 1000000ULL) << s.tail_probed;
+        int tail_due = s.in_flight > 0 && srtt > 0 && pto_ns < timeout_ns && (s.config->features & RUDP_FEATURE_TLP);
 
-        // Set the FIN flag for the last packet
-        if (i == packet_amount - 1)
+        // wait for an ACK until the oldest segment in flight times out, or until the next zero-window probe
+        uint64_t now = Timing_now_ns();
+        uint64_t deadline = now;
+        if (s.in_flight > 0)
         {
-            packet->flags.FIN = 1;
-            // set the length of the packet
-            packet->length = buffer_size;
+            deadline = UINT64_MAX;
+            for (int i = s.una; i < s.next; i++)
+                if (!s.segments[i].acked && s.segments[i].sent_ns + timeout_ns < deadline)
+                    deadline = s.segments[i].sent_ns + timeout_ns;
+            if (tail_due && s.quiet_ns + pto_ns < deadline)
+                deadline = s.quiet_ns + pto_ns;
+            probe_ns = 0;
+            probe_ms = RUDP_PROBE_MS;
         }
         else
         {
-            // set the length of the packet
-            packet->length = MSG_BUFFER_SIZE;
-            buffer_size -= packet->length;
+            if (probe_ns == 0)
+                probe_ns = now + probe_ms * 1000000ULL;
+            deadline = probe_ns;
         }
 
-        memcpy(packet->data, buffer + i * MSG_BUFFER_SIZE, packet->length); // copy the data to the packet
-
-        // Calculate the checksum for the packet
-        packet->checksum = checksum(packet->data, packet->length);
-
-        int total_tries = 0;        // total number of tries
-        while (total_tries < RETRY) // while the total number of tries is less than the maximum number of tries
+        Trace_log(TRACE_DEBUG, "Waiting for RUDP socket [seq_num %d]\n", s.first + s.una);
+        int wait_ms = deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+        int ready = acker != NULL ? ack_thread_wait(acker, wait_ms) : Impair_poll(sock, wait_ms);
+        if (ready < 0)
         {
-            rudp_dump_headers("OUT", packet);
-            ssize_t send_result = sendto(sock, packet, offsetof(RUDP_Packet, data) + packet->length, 0, NULL, 0); // send the packet
-            if (send_result == -1)                                                                                // if the send failed
+            perror("poll() failed");
+            result = -1;
+            break;
+        }
+        if (ready == 0 && s.in_flight == 0)
+        {
+            // zero window: ask for it again, backing off
+            if (s.probes++ == (int)s.config->retry)
+            {
+                Trace_log(TRACE_ERROR, "Receiver window stayed closed after %u probes\n", s.config->retry);
+                result = -1;
+                break;
+            }
+            RUDP_Packet *probe = recv_packet;
+            memset(probe, 0, offsetof(RUDP_Packet, data));
+            probe->flags.PROBE = 1;
+            probe->seq_num = (unsigned short int)(s.first + s.una);
+            probe->checksum = checksum(probe->data, 0);
+            Trace_packet(TRACE_OUT, probe, offsetof(RUDP_Packet, data));
+            if (Impair_send(sock, probe, offsetof(RUDP_Packet, data), offsetof(RUDP_Packet, data)) == -1)
             {
                 perror("sendto() failed");
-                free(packet);
-                free(recv_packet);
-                return -1;
+                result = -1;
+                break;
             }
-
-            clock_t start_time = clock(); // start the timer
-
-            do
+            STAT_ADD(sock, counters.window_probes, 1);
+            int timeout_ms = (int)s.config->timeout * 1000;
+            probe_ms = probe_ms * 2 < timeout_ms ? probe_ms * 2 : timeout_ms;
+            probe_ns = Timing_now_ns() + probe_ms * 1000000ULL;
+            continue;
+        }
+        now = Timing_now_ns();
+        if (ready == 0 && tail_due && now >= s.quiet_ns + pto_ns)
+        {
+            // nothing ACKed for 2 * SRTT: the last segments or their ACKs may be lost, and no later
+            // segment will reveal it. Send the last one again, its ACK or NACK tells what is missing
+            s.tail_probed++;
+            s.quiet_ns = now;
+            for (int i = s.next - 1; i >= s.una; i--)
+            {
+                if (s.segments[i].acked || s.segments[i].tries == (int)s.config->retry)
+                    continue;
+                Trace_log(TRACE_DEBUG, "Tail-loss probe, segment %d\n", s.first + i);
+                if (send_segment(&s, i) < 0)
+                    result = -1;
+                STAT_ADD(sock, counters.tail_probes, 1);
+                break;
+            }
+            continue;
+        }
+        if (ready == 0)
+        {
+            // retransmit every segment whose ACK is overdue
+            STAT_ADD(sock, counters.timeouts, 1);
+            for (int i = s.una; i < s.next && result == 1; i++)
             {
-                // receive ACK message
-                printf("%d: Waiting for RUDP socket [seq_num %d]\n", __LINE__, seq_num);
-                ssize_t recv_result = recvfrom(sock, recv_packet, sizeof(RUDP_Packet), 0, NULL, 0); // receive the packet
-                if (recv_result == -1)                                                              // if the receive failed
+                if (s.segments[i].acked || s.segments[i].sent_ns + timeout_ns > now)
+                    continue;
+                if (s.segments[i].tries == (int)s.config->retry)
                 {
-                    perror("recvfrom() failed");
-                    break;
+                    Trace_log(TRACE_ERROR, "Could not send packet %d\n", s.first + i); // print an error message;
+                    result = -1;
                 }
-                rudp_dump_headers("IN ", recv_packet);
+                else if (send_segment(&s, i) < 0)
+                    result = -1;
+            }
+            continue;
+        }
+        if (acker != NULL)
+        {
+            if (ack_thread_drain(acker, &s) < 0)
+                result = -1;
+            continue;
+        }
 
-                if (recv_packet->flags.ACK && recv_packet->seq_num == seq_num) // if the received packet is an ACK packet
-                {
-                    if (recv_packet->flags.FIN)
-                    {
-                        printf("RUDP disconnected\n");
-                    }
-                    total_tries = RETRY; // no need to retry
-                    break;               // break the loop
-                }
-            } while ((double)(clock() - start_time) / CLOCKS_PER_SEC < TIMEOUT); // while the time elapsed is less than the timeout
+        // receive ACK message
+        ssize_t recv_result = receive_packet(sock, recv_packet, 0); // receive the packet
+        if (recv_result == -1)                                 // if the receive failed
+        {
+            perror("recvfrom() failed");
+            continue;
+        }
+        Trace_packet(TRACE_IN, recv_packet, recv_result);
 
-            total_tries++; // increment the total number of tries
+        if (recv_packet->flags.NACK)
+        {
+            if (recv_packet->length != sizeof(uint32_t) || checksum(recv_packet->data, recv_packet->length) != recv_packet->checksum)
+            {
+                STAT_ADD(sock, counters.checksum_errors, 1);
+                continue;
+            }
+            STAT_ADD(sock, counters.nacks_received, 1);
+            peer_window = recv_packet->window;
+            s.probes = 0;
+
+            uint32_t missing;
+            memcpy(&missing, recv_packet->data, sizeof(missing));
+            for (int bit = 0; bit < RUDP_WINDOW && result == 1; bit++)
+                if ((missing & (1u << bit)) && nacked(&s, (unsigned short int)(recv_packet->seq_num + bit), now) < 0)
+                    result = -1;
+            continue;
+        }
+        if (!recv_packet->flags.ACK)
+        {
+            // the end of the peer's last message again: its ACK was lost, and the peer waits for it
+            // before it takes this one. Anything newer is dropped, and sent again once it listens
+            if (recv_packet->flags.DATA && (short int)(recv_packet->seq_num - s.first) < 0 && send_ack(sock, recv_packet) < 0)
+                result = -1;
+            STAT_ADD(sock, counters.duplicates, 1);
+            continue;
+        }
+        if (recv_packet->flags.PROBE)
+        {
+            // window update
+            peer_window = recv_packet->window;
+            s.probes = 0;
+            continue;
+        }
+        if (acked(&s, recv_packet->seq_num, recv_packet->window, Timing_now_ns()) < 0)
+            result = -1;
+        if (recv_packet->flags.FIN)
+        {
+            Trace_log(TRACE_INFO, "RUDP disconnected\n");
         }
+    }
+
+    if (acker != NULL && (last || result != 1))
+        ack_thread_park(acker);
+    seq_num = s.first + s.packet_amount - 1;
+    free(s.packet);    // free the packet
+    free(recv_packet); // free the received packet
+    free(s.segments);
+    return result;     // 1 on success
+}
+
+static RUDP_Messages *messages_get(int sock)
+{
+    if (sock < 0 || sock >= RUDP_MAX_FD)
+    {
+        printf("Socket %d out of range for messages\n", sock);
+        return NULL;
+    }
+    if (sockets[sock].messages != NULL)
+        return sockets[sock].messages;
+
+    RUDP_Messages *m = (RUDP_Messages *)calloc(1, sizeof(RUDP_Messages));
+    if (m == NULL || (m->queue = (char *)malloc(RUDP_COALESCE_MAX)) == NULL)
+    {
+        perror("malloc failed");
+        free(m);
+        return NULL;
+    }
+    sockets[sock].messages = m;
+    return m;
+}
 
-        if (total_tries == RETRY) // if the total number of tries is equal to the maximum number of tries
+/*
+ * Sends the messages held; with last, FIN ends this side's turn and the peer may answer. Not while
+ * the peer's turn is still on: the connection turns around only after its last segment.
+ */
+static int messages_flush(int sock, RUDP_Messages *m, int last)
+{
+    if (m->queued == 0 || m->reading)
+        return 0;
+    int result = rudp_send_part(sock, m->queue, m->queued, last);
+    m->queued = 0;
+    return result > 0 ? 0 : -1;
+}
+
+/* Appends to the queue; a full one goes out first, without FIN, and the message goes on in the next. */
+static int messages_put(int sock, RUDP_Messages *m, const void *data, size_t len)
+{
+    const char *from = (const char *)data;
+    while (len > 0)
+    {
+        if (m->queued == RUDP_COALESCE_MAX)
         {
-            printf("Could not send packet %d\n", seq_num); // print an error message;
-            free(packet);                                  // free the packet
-            free(recv_packet);
-            return -1; // return an error
+            if (m->reading)
+            {
+                Trace_log(TRACE_ERROR, "Messages sent before the ones received are all read: more than %d bytes\n", RUDP_COALESCE_MAX);
+                return -1;
+            }
+            if (rudp_send_part(sock, m->queue, m->queued, 0) <= 0)
+                return -1;
+            m->queued = 0;
+            m->held_ns = Timing_now_ns();
         }
+        size_t n = RUDP_COALESCE_MAX - m->queued;
+        if (n > len)
+            n = len;
+        memcpy(m->queue + m->queued, from, n);
+        m->queued += (unsigned int)n;
+        from += n;
+        len -= n;
+    }
+    return 0;
+}
 
-        free(packet); // free the packet
+/* Takes the next len bytes of the stream into to (dropped if NULL): 1, or 0 with *done -1 if the sender closed first. */
+static int messages_take(int sock, RUDP_Messages *m, void *to, size_t len, int *done)
+{
+    char *into = (char *)to;
+    while (len > 0)
+    {
+        if (m->segment_off == m->segment_len)
+        {
+            // FIN ends the peer's turn, not the stream
+            int fin = 0;
+            int n = rudp_recv(sock, m->segment, sizeof(m->segment), &fin);
+            if (n < 0)
+                return -1;
+            if (n == 0 && fin < 0)
+            {
+                *done = -1;
+                return 0;
+            }
+            m->segment_len = n;
+            m->segment_off = 0;
+            if (n > 0)
+                m->reading = fin == 0;
+            continue;
+        }
+        size_t n = (size_t)(m->segment_len - m->segment_off);
+        if (n > len)
+            n = len;
+        if (into != NULL)
+        {
+            memcpy(into, m->segment + m->segment_off, n);
+            into += n;
+        }
+        m->segment_off += (int)n;
+        len -= n;
     }
+    return 1;
+}
 
-    free(recv_packet); // free the received packet
-    return 1;          // return success
+ssize_t rudp_sendmsg(int sock, const struct iovec *iov, int iovcnt, int flags)
+{
+    RUDP_Messages *m = messages_get(sock);
+    if (m == NULL)
+        return -1;
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (len > UINT32_MAX)
+    {
+        printf("Message of %zu bytes, RUDP messages are 4 GB at most\n", len);
+        return -1;
+    }
+
+    // the ones held waited long enough for company: they go now, without FIN as this side goes on
+    uint64_t now = Timing_now_ns();
+    if (m->queued > 0 && now - m->held_ns > RUDP_COALESCE_US * 1000ULL && messages_flush(sock, m, 0) < 0)
+        return -1;
+    if (m->queued == 0)
+        m->held_ns = now;
+
+    uint32_t header = htonl((uint32_t)len);
+    if (messages_put(sock, m, &header, sizeof(header)) < 0)
+        return -1;
+    for (int i = 0; i < iovcnt; i++)
+        if (messages_put(sock, m, iov[i].iov_base, iov[i].iov_len) < 0)
+            return -1;
+    STAT_ADD(sock, counters.messages_sent, 1);
+
+    if (!(flags & RUDP_MSG_MORE) && messages_flush(sock, m, 1) < 0)
+        return -1;
+    return (ssize_t)len;
+}
+
+int rudp_flush(int sock)
+{
+    if (sock < 0 || sock >= RUDP_MAX_FD || sockets[sock].messages == NULL)
+        return 0;
+    return messages_flush(sock, sockets[sock].messages, 1);
+}
+
+ssize_t rudp_recvmsg(int sock, const struct iovec *iov, int iovcnt, int *done)
+{
+    *done = 0;
+    RUDP_Messages *m = messages_get(sock);
+    if (m == NULL)
+        return -1;
+    // the peer may be waiting for what is held before it answers
+    if (messages_flush(sock, m, 1) < 0)
+        return -1;
+
+    uint32_t header;
+    int result = messages_take(sock, m, &header, sizeof(header), done);
+    if (result <= 0)
+        return result;
+    size_t len = ntohl(header), left = len;
+    for (int i = 0; i < iovcnt && left > 0 && result > 0; i++)
+    {
+        size_t n = iov[i].iov_len < left ? iov[i].iov_len : left;
+        result = messages_take(sock, m, iov[i].iov_base, n, done);
+        left -= n;
+    }
+    // what does not fit is dropped, the next message starts after it
+    if (result > 0 && left > 0)
+        result = messages_take(sock, m, NULL, left, done);
+    if (result <= 0)
+    {
+        if (result == 0)
+            Trace_log(TRACE_ERROR, "Connection closed in the middle of a message\n");
+        return -1;
+    }
+    STAT_ADD(sock, counters.messages_received, 1);
+    return (ssize_t)len;
 }
 
 int rudp_close(int sock, int send)
 {
+    RUDP_Messages *m = sock >= 0 && sock < RUDP_MAX_FD ? sockets[sock].messages : NULL;
+    if (m != NULL)
+    {
+        // messages still held go before the connection ends
+        if (send && (m->reading || messages_flush(sock, m, 1) < 0))
+            Trace_log(TRACE_WARN, "Messages held on close were not all delivered\n");
+        free(m->queue);
+        free(m);
+        sockets[sock].messages = NULL;
+    }
+
     if (send)
     {
         RUDP_Packet *close_pk = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
@@ -441,8 +1974,8 @@ int rudp_close(int sock, int send)
         memset(close_pk, 0, sizeof(RUDP_Packet));
         close_pk->all_flags = 0xFF; // special case to signal RUDP connection ended
 
-        rudp_dump_headers("OUT", close_pk);
-        int sendResult = sendto(sock, close_pk, sizeof(RUDP_Packet), 0, NULL, 0);
+        Trace_packet(TRACE_OUT, close_pk, offsetof(RUDP_Packet, data));
+        int sendResult = Impair_send(sock, close_pk, offsetof(RUDP_Packet, data), offsetof(RUDP_Packet, data));
         if (sendResult == -1)
         {
             perror("sendto() failed");
@@ -452,42 +1985,68 @@ int rudp_close(int sock, int send)
         free(close_pk);
     }
 
-    close(sock);
+    if (sock >= 0 && sock < RUDP_MAX_FD)
+    {
+        if (sockets[sock].acker != NULL)
+            ack_thread_stop(sockets[sock].acker);
+        sockets[sock].acker = NULL;
+        sockets[sock].ack_thread = 0;
+        sockets[sock].syn_hook = NULL;
+        free(sockets[sock].syn_ack);
+        sockets[sock].syn_ack = NULL;
+        free(sockets[sock].pending_syn);
+        sockets[sock].pending_syn = NULL;
+        stats_retire(sock);
+    }
+    Impair_flush(sock);
+    IO_close(sock);
 
-    printf("UDP socket closed\n");
+    Trace_log(TRACE_INFO, "UDP socket closed\n");
     return 0;
 }
 
-int send_ack(int socket, RUDP_Packet *packet)
+void build_ack(RUDP_Packet *ack_packet, const RUDP_Packet *packet)
 {
-    RUDP_Packet *ack_packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
-    if (ack_packet == NULL)
-    {
-        perror("malloc failed");
-        return -1;
-    }
     memset(ack_packet, 0, sizeof(RUDP_Packet));
 
     ack_packet->flags.ACK = 1;
     ack_packet->flags.FIN = packet->flags.FIN;
     ack_packet->flags.SYN = packet->flags.SYN;
     ack_packet->seq_num = packet->seq_num;
+    ack_packet->tsecr = packet->tsval;
     ack_packet->checksum = checksum(ack_packet->data, ack_packet->length);
+}
 
-    rudp_dump_headers("OUT", ack_packet);
-    if (sendto(socket, ack_packet, sizeof(RUDP_Packet), 0, NULL, 0) == -1)
+int send_ack(int socket, RUDP_Packet *packet)
+{
+    RUDP_Packet *ack_packet = (RUDP_Packet *)malloc(sizeof(RUDP_Packet));
+    if (ack_packet == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    build_ack(ack_packet, packet);
+    ack_packet->window = (unsigned short int)receive_window(socket);
+    ack_packet->tsval = Timestamp_enabled() ? Timestamp_now_us() : 0;
+    STAT_SET(socket, window, ack_packet->window);
+
+    // header only, the ACK carries no data
+    Trace_packet(TRACE_OUT, ack_packet, offsetof(RUDP_Packet, data));
+    if (Impair_send(socket, ack_packet, offsetof(RUDP_Packet, data), offsetof(RUDP_Packet, data)) == -1)
     {
         perror("sendto() failed");
         free(ack_packet);
         return -1;
     }
+    STAT_ADD(socket, counters.acks_sent, 1);
     if (ack_packet->flags.FIN)
     {
-        printf("RUDP disconnected\n");
+        Trace_log(TRACE_INFO, "RUDP disconnected\n");
     }
     free(ack_packet);
     return 0;
 }
+
 unsigned short int checksum(void *data, unsigned int bytes)
 {
     unsigned short int *data_pointer = (unsigned short int *)data;
@@ -508,102 +2067,120 @@ unsigned short int checksum(void *data, unsigned int bytes)
     return (~((unsigned short int)total_sum));
 }
 
-// ************ Linked List **************
-Node *Node_alloc(int run, double time, double speed, Node *next)
+/* Snapshot of c, srtt_ns/rttvar_ns the estimator of its socket. */
+static void stats_read(const RUDP_Counters *c, uint64_t srtt_ns, uint64_t rttvar_ns, RUDP_Stats *stats)
 {
-    Node *p = (Node *)malloc(sizeof(Node));
-    if (p == NULL)
-    {
-        return NULL;
-    }
-    p->_run = run;
-    p->_time = time;
-    p->_speed = speed;
-    p->_next = next;
-    return p;
+    // every field is a uint64_t
+    const uint64_t *from = (const uint64_t *)&c->counters;
+    uint64_t *to = (uint64_t *)stats;
+    for (size_t i = 0; i < sizeof(RUDP_Stats) / sizeof(uint64_t); i++)
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+
+    uint64_t connected = STAT_GET(c, connected_ns);
+    uint64_t age_ns = connected ? Timing_now_ns() - connected : 0;
+    stats->srtt_us = srtt_ns / 1000;
+    stats->rttvar_us = rttvar_ns / 1000;
+    stats->window = STAT_GET(c, window);
+    stats->goodput_bps = age_ns ? (uint64_t)(STAT_GET(c, connection_bytes) * 8 * 1e9 / age_ns) : 0;
+    stats->connection_ms = age_ns / 1000000;
 }
 
-void Node_free(Node *node)
+/* Adds the counters of from to to (gauges excepted). */
+static void stats_sum(RUDP_Stats *to, const RUDP_Stats *from)
 {
-    free(node);
+    uint64_t *t = (uint64_t *)to;
+    const uint64_t *f = (const uint64_t *)from;
+    for (size_t i = 0; i < offsetof(RUDP_Stats, srtt_us) / sizeof(uint64_t); i++)
+        t[i] += f[i];
 }
 
-StrList *StrList_alloc()
+/* sock is closing: its counters go into the process's totals. */
+static void stats_retire(int sock)
 {
-    StrList *p = (StrList *)malloc(sizeof(StrList));
-    p->_head = NULL;
-    p->_size = 0;
-    return p;
-}
-
-void StrList_free(StrList *strList)
-{
-    if (strList == NULL)
-        return;
-    Node *p1 = strList->_head;
-    Node *p2;
-    while (p1)
+    RUDP_Stats stats;
+    pthread_mutex_lock(&totals.lock);
+    if (sockets[sock].open)
     {
-        p2 = p1;
-        p1 = p1->_next;
-        Node_free(p2);
+        rudp_get_stats(sock, &stats);
+        stats_sum(&totals.closed, &stats);
+        totals.closed.srtt_us = stats.srtt_us;
+        totals.closed.rttvar_us = stats.rttvar_us;
+        totals.closed.window = stats.window;
+        sockets[sock].open = 0;
     }
-    free(strList);
+    pthread_mutex_unlock(&totals.lock);
 }
 
-size_t StrList_size(const StrList *strList)
+void rudp_get_stats(int sock, RUDP_Stats *stats)
 {
-    return strList->_size;
+    if (sock < 0 || sock >= RUDP_MAX_FD)
+    {
+        stats_read(&totals.unindexed, 0, 0, stats);
+        return;
+    }
+    stats_read(&sockets[sock].stats, __atomic_load_n(&sockets[sock].srtt_ns, __ATOMIC_RELAXED),
+               __atomic_load_n(&sockets[sock].rttvar_ns, __ATOMIC_RELAXED), stats);
 }
 
-void StrList_insertLast(StrList *strList, int run, double time, double speed)
+void rudp_get_total_stats(RUDP_Stats *stats)
 {
-    Node *p = Node_alloc(run, time, speed, NULL);
-    if (strList->_head == NULL)
+    pthread_mutex_lock(&totals.lock);
+    *stats = totals.closed;
+    RUDP_Stats one;
+    stats_read(&totals.unindexed, 0, 0, &one);
+    stats_sum(stats, &one);
+
+    // the open connections: their windows and goodputs add up, the RTT is their mean, the age the oldest
+    int open = 0;
+    uint64_t srtt_us = 0, rttvar_us = 0, window = 0, goodput_bps = 0, connection_ms = 0;
+    for (int sock = 0; sock < totals.high; sock++)
     {
-        strList->_head = p;
-    }
-    else
-    {
-        Node *q = strList->_head;
-        while (q->_next)
+        if (!sockets[sock].open)
+            continue;
+        rudp_get_stats(sock, &one);
+        stats_sum(stats, &one);
+        if (one.srtt_us > 0)
         {
-            q = q->_next;
+            srtt_us += one.srtt_us;
+            rttvar_us += one.rttvar_us;
+            open++;
         }
-        q->_next = p;
+        window += one.window;
+        goodput_bps += one.goodput_bps;
+        connection_ms = one.connection_ms > connection_ms ? one.connection_ms : connection_ms;
     }
-    strList->_size++;
-}
-
-void print_stats(const StrList *strList)
-{
-    if (strList->_size < 1)
-        return;
-
-    printf("-----------------------------\n");
-    printf("Stats:\n");
-    printf("Number of runs: %zu\n", strList->_size);
-    Node *current = strList->_head;
-
-    for (size_t i = 0; i < strList->_size; i++)
+    pthread_mutex_unlock(&totals.lock);
+    if (open > 0)
     {
-        printf("Run #%d Data: Time: %f ms, Speed: %f MB/s\n", current->_run, current->_time, current->_speed);
-        current = current->_next;
+        stats->srtt_us = srtt_us / open;
+        stats->rttvar_us = rttvar_us / open;
     }
-
-    current = strList->_head;
-
-    double totalTime = 0.0;
-    double totalSpeed = 0.0;
-
-    for (size_t i = 0; i < strList->_size; i++)
+    if (window > 0 || goodput_bps > 0)
     {
-        totalTime += current->_time;
-        totalSpeed += current->_speed;
-        current = current->_next;
+        stats->window = window;
+        stats->goodput_bps = goodput_bps;
+        stats->connection_ms = connection_ms;
     }
+}
 
-    printf("Average Time: %f ms\n", totalTime / strList->_size);
-    printf("Average Speed: %f MB/s\n", totalSpeed / strList->_size);
-    printf("-----------------------------\n");
+void rudp_print_stats(const RUDP_Stats *stats)
+{
+    printf("RUDP: %llu connections, sent %llu bytes in %llu segments (%llu retransmitted), received %llu bytes in %llu segments\n",
+           (unsigned long long)stats->connections, (unsigned long long)stats->bytes_sent,
+           (unsigned long long)stats->segments_sent, (unsigned long long)stats->retransmits,
+           (unsigned long long)stats->bytes_received, (unsigned long long)stats->segments_received);
+    printf("RUDP: ACKs %llu sent %llu received, %llu timeouts, %llu duplicates, %llu checksum errors, %llu out of window, srtt %llu us (var %llu us)\n",
+           (unsigned long long)stats->acks_sent, (unsigned long long)stats->acks_received,
+           (unsigned long long)stats->timeouts, (unsigned long long)stats->duplicates,
+           (unsigned long long)stats->checksum_errors, (unsigned long long)stats->out_of_window,
+           (unsigned long long)stats->srtt_us, (unsigned long long)stats->rttvar_us);
+    printf("RUDP: window %llu segments, %llu zero-window probes, %llu datagrams dropped on a full receive buffer\n",
+           (unsigned long long)stats->window, (unsigned long long)stats->window_probes,
+           (unsigned long long)stats->rcvbuf_drops);
+    printf("RUDP: NACKs %llu sent %llu received, %llu fast retransmits, %llu tail-loss probes\n",
+           (unsigned long long)stats->nacks_sent, (unsigned long long)stats->nacks_received,
+           (unsigned long long)stats->fast_retransmits, (unsigned long long)stats->tail_probes);
+    if (stats->messages_sent > 0 || stats->messages_received > 0)
+        printf("RUDP: messages %llu sent %llu received\n", (unsigned long long)stats->messages_sent,
+               (unsigned long long)stats->messages_received);
 }
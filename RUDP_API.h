@@ -2,16 +2,26 @@
 #define RUDP_API_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define MSG_BUFFER_SIZE 16384
 #define FILE_SIZE (1024 * 1024 * 2)
-#define RETRY 10
-#define TIMEOUT 5
+#define RETRY 10            // default RUDP_Config.retry
+#define TIMEOUT 5           // default RUDP_Config.timeout, seconds
+#define RUDP_WINDOW 32      // segments in flight (sender) and held for reordering (receiver), a power of two
+#define RUDP_PROBE_MS 200   // first zero-window probe, doubling up to TIMEOUT
+#define RUDP_DUPTHRESH 3    // segments sent after one and ACKed before it that make it lost
+#define RUDP_TLP_MIN_MS 10  // floor of the tail-loss probe timeout, 2 * SRTT
+#define RUDP_MSG_MORE 0x1   // rudp_sendmsg(): another message follows right away, this one may wait to share its segments
+#define RUDP_COALESCE_US 200 // longest a message is held for others to join it, checked on the next call
+#define RUDP_COALESCE_MAX (RUDP_WINDOW * MSG_BUFFER_SIZE) // bytes of messages held at most: one window of segments
 
 typedef struct _RUDP_Flags 
 {
@@ -19,6 +29,8 @@ typedef struct _RUDP_Flags
     unsigned char ACK : 1;
     unsigned char DATA : 1;
     unsigned char FIN : 1;
+    unsigned char PROBE : 1; // zero-window probe; with ACK, a window update
+    unsigned char NACK : 1;  // gaps the receiver just found: data is a uint32_t, bit i for segment seq_num + i
 } RUDP_flags;
 
 typedef struct _RUDP_Packet 
@@ -30,44 +42,153 @@ typedef struct _RUDP_Packet
     unsigned short int length;
     unsigned short int checksum;
     unsigned short int seq_num;
+    unsigned short int window;  // ACKs: segments the receiver can take, RUDP_WINDOW at most
+    uint32_t tsval;             // DATA and ACKs with -tstamp: the sender's CLOCK_REALTIME in us when it went out, else 0
+    uint32_t tsecr;             // ACKs: the tsval of the segment ACKed, for an RTT sample from the kernel's stamps
     char data[MSG_BUFFER_SIZE];
 } RUDP_Packet;
 
-//******************* linked list ****************
-typedef struct _Node
+/*
+ * Connection parameters. Each end has its own (rudp_set_config(), or the RUDP_CONFIG_USAGE flags of
+ * the tools); the SYN carries the sender's as a block of TLV options, the receiver agrees on values
+ * both can run with and the SYN-ACK carries them back, so the two ends of a connection use the same
+ * without being rebuilt. segment and window go down to the smaller of the two, the checksum is
+ * RUDP_CHECKSUM_NONE only if both ask for it, and the features are those both have. retry and
+ * timeout stay local, they are not sent.
+ */
+#define RUDP_CHECKSUM_INET 0    // checksum() over every payload
+#define RUDP_CHECKSUM_NONE 1    // DATA payloads left to UDP's own checksum (-impair corrupt then goes unseen)
+#define RUDP_FEATURE_NACK 0x1   // the receiver NACKs the gaps it finds, the sender retransmits before its timeout
+#define RUDP_FEATURE_TLP 0x2    // the sender probes the tail after 2 * SRTT without an ACK
+#define RUDP_FEATURES_ALL (RUDP_FEATURE_NACK | RUDP_FEATURE_TLP)
+#define RUDP_OPTIONS_MAX 32     // bytes of a SYN or SYN-ACK taken by the options
+#define RUDP_SYN_DATA_MAX (MSG_BUFFER_SIZE - RUDP_OPTIONS_MAX) // SYN hook data, either way
+#define RUDP_CONFIG_USAGE "[-segment <bytes>] [-window <segments>] [-checksum inet|none] [-features nack,tlp|none] [-retry <n>] [-timeout <s>]"
+
+typedef struct _RUDP_Config
 {
-    int _run;
-    double _time;
-    double _speed;
-    struct _Node *_next;
-} Node;
+    unsigned int segment;   // payload bytes per DATA segment, 1 to MSG_BUFFER_SIZE
+    unsigned int window;    // segments in flight at most, 1 to RUDP_WINDOW
+    unsigned int checksum;  // RUDP_CHECKSUM_*
+    unsigned int features;  // RUDP_FEATURE_* bits
+    unsigned int retry;     // sends of a segment, SYN or window probe before giving up
+    unsigned int timeout;   // seconds a receive waits, and a segment for its ACK
+} RUDP_Config;
 
-typedef struct _StrList
+/*
+ * Connection counters, kept per socket from udp_socket_from() to rudp_close(). RUDP_API
+ * updates them with relaxed atomics from the thread doing the socket's I/O, so any thread
+ * (e.g. RUDP_Export) can take a snapshot at any time; fields are individually consistent,
+ * not as a whole.
+ */
+typedef struct _RUDP_Stats
 {
-    Node *_head;
-    size_t _size;
-} StrList, *pStrList;
+    uint64_t bytes_sent;         // payload bytes, first transmissions only
+    uint64_t bytes_received;     // payload bytes delivered in order
+    uint64_t segments_sent;      // DATA segments, retransmissions included
+    uint64_t segments_received;  // DATA segments, duplicates included
+    uint64_t acks_sent;
+    uint64_t acks_received;
+    uint64_t retransmits;        // DATA and SYN segments sent again
+    uint64_t timeouts;           // receives that waited TIMEOUT for nothing
+    uint64_t duplicates;         // segments already delivered, ACKs of another segment
+    uint64_t checksum_errors;
+    uint64_t out_of_window;      // DATA beyond the advertised window
+    uint64_t connections;
+    uint64_t window_probes;      // zero-window probes sent
+    uint64_t rcvbuf_drops;       // datagrams the kernel dropped on a full receive buffer (SO_RXQ_OVFL)
+    uint64_t nacks_sent;
+    uint64_t nacks_received;
+    uint64_t fast_retransmits;   // segments sent again on a NACK or RUDP_DUPTHRESH later ACKs, before their timeout
+    uint64_t tail_probes;        // last segments in flight sent again after 2 * SRTT without an ACK
+    uint64_t messages_sent;      // rudp_sendmsg()
+    uint64_t messages_received;  // rudp_recvmsg()
+    // gauges, computed when the snapshot is taken
+    uint64_t srtt_us;            // RFC 6298 smoothed RTT, from segments ACKed on their first transmission
+    uint64_t rttvar_us;
+    uint64_t window;             // sender: segments allowed in flight; receiver: last window advertised
+    uint64_t goodput_bps;        // bytes delivered or ACKed on the current connection, per second since it opened
+    uint64_t connection_ms;      // age of the current connection
+} RUDP_Stats;
 
+/* MSG_BUFFER_SIZE, RUDP_WINDOW, RUDP_CHECKSUM_INET, RUDP_FEATURES_ALL, RETRY, TIMEOUT. */
+void rudp_config_default(RUDP_Config *config);
+/* What this end asks for from the next socket and handshake on; -1 if a value is out of range. */
+int rudp_set_config(const RUDP_Config *config);
+/* What the connection on sock agreed to; this end's own before its handshake, or for sock -1. */
+void rudp_get_config(int sock, RUDP_Config *config);
+/* Takes one of RUDP_CONFIG_USAGE at argv[*i] into this end's configuration: 1 if taken, 0 if not, -1 if invalid. */
+int rudp_config_option(int argc, char *argv[], int *i);
 /* Opens the socket. Sender: connect; Reciever: bind. */
 int udp_socket(const char *dest_ip, unsigned short int dest_port);
+/* Same, from local_ip (sender) or listening on it (receiver) instead of any address; NULL is any. */
+int udp_socket_from(const char *local_ip, const char *dest_ip, unsigned short int dest_port);
 /* Sender: sends SYN, waits for SYN+ACK */
 int rudp_socket(int sock);
+/*
+ * Same, the SYN carrying syn_len bytes of syn_data for the receiver's hook (rudp_set_syn_hook()), up to
+ * RUDP_SYN_DATA_MAX; what the hook answered in the SYN-ACK goes into reply (RUDP_SYN_DATA_MAX bytes),
+ * its length into *reply_len.
+ */
+int rudp_socket_with(int sock, const void *syn_data, unsigned int syn_len, void *reply, unsigned int *reply_len);
 /* Reciever: connect + gets SYN+ACK or flags=0xFF for USP termination */
 int rudp_accept(int sock, int port, int *done);
-int rudp_recv(int sock, void *buffer, unsigned int buffer_size, pStrList *strList, int *done);
+/*
+ * Receiver: answers the data of a SYN, len bytes (0 from a plain rudp_socket()), with up to
+ * RUDP_SYN_DATA_MAX bytes written to reply for the SYN-ACK; returns their number.
+ */
+typedef unsigned int (*RUDP_Syn_Hook)(void *ctx, const void *syn, unsigned int len, void *reply);
+/* Receiver: rudp_accept() calls hook on every new connection of sock, until rudp_close(); NULL removes it. */
+void rudp_set_syn_hook(int sock, RUDP_Syn_Hook hook, void *ctx);
+/*
+ * Messages go one way at a time, but either way: once a whole message came in, the receiver may
+ * send one back on the same connection and the sender rudp_recv() it (e.g. an echo). *done is 1
+ * after the last segment of a message, -1 when the sender closed the connection (0 returned).
+ * A SYN after data means the sender started over: -1 with errno ECONNRESET, and the next
+ * rudp_accept() takes the new connection.
+ */
+int rudp_recv(int sock, void *buffer, unsigned int buffer_size, int *done);
 int rudp_send(int sock, void *buffer, unsigned int buffer_size);
+/* Sends a piece of a message; FIN goes on its last segment only if last, so a message can be streamed in parts. */
+int rudp_send_part(int sock, const void *buffer, unsigned int buffer_size, int last);
+/*
+ * Message API, on a connection set up as above: the boundaries of every message are kept, each goes
+ * as a 4-byte big-endian length and then its bytes. Small messages share segments: one sent with
+ * RUDP_MSG_MORE is held, and goes out with the ones after it in a single rudp_send_part(). A message
+ * without the flag, rudp_flush(), rudp_recvmsg() and rudp_close() send what is held with FIN, which
+ * ends this side's turn: as with rudp_send(), the two sides take turns, and the peer answers only
+ * after it. Held messages also go, without FIN, once RUDP_COALESCE_MAX bytes are held or the first
+ * is older than RUDP_COALESCE_US at the next call. A reply given before the peer's turn ended is held
+ * until rudp_recvmsg() reads its FIN. Returns the message length once sent or held, -1 on failure.
+ */
+ssize_t rudp_sendmsg(int sock, const struct iovec *iov, int iovcnt, int flags);
+int rudp_flush(int sock);
+/*
+ * Receives the next message into iov, the rest of it dropped if it does not fit; returns its whole
+ * length. 0 with *done -1 when the sender closed the connection instead.
+ */
+ssize_t rudp_recvmsg(int sock, const struct iovec *iov, int iovcnt, int *done);
+/*
+ * Sender: from the next message on, sock's ACKs are received and checked on a thread of its own,
+ * which hands them over through lock-free rings, so sending never waits behind ACK processing.
+ * The thread is parked between messages and ended by rudp_close() or turning it off.
+ * Needs the syscall I/O backend; on (1) or off (0) until rudp_close().
+ */
+int rudp_set_ack_thread(int sock, int on);
 int rudp_close(int sock, int send);
 int receive_data_packet(int sock, void *buffer, RUDP_Packet *packet, int *sq_num);
+/* Fills ack_packet with the ACK of packet, as sent by send_ack (the whole packet is sent, so it is all cleared). */
+void build_ack(RUDP_Packet *ack_packet, const RUDP_Packet *packet);
 int send_ack(int socket, RUDP_Packet *packet);
 unsigned short int checksum(void *data, unsigned int bytes);
-
-void print_stats(const StrList *strList);
-void StrList_insertLast(StrList *strList, int run, double time, double speed);
-size_t StrList_size(const StrList *strList);
-void StrList_free(StrList *strList);
-StrList *StrList_alloc();
-void Node_free(Node *node);
-Node *Node_alloc(int run, double time, double speed, Node *next);
-
+/* Snapshot of sock's counters since udp_socket_from(); safe to call from any thread. */
+void rudp_get_stats(int sock, RUDP_Stats *stats);
+/*
+ * The whole process: the counters of every socket, closed ones included. The gauges are those of
+ * the open connections (srtt their mean; window and goodput summed; age of the oldest), or the RTT
+ * and window of the last one closed when none is open.
+ */
+void rudp_get_total_stats(RUDP_Stats *stats);
+void rudp_print_stats(const RUDP_Stats *stats);
 
 #endif
@@ -0,0 +1,197 @@
+#include "RUDP_Export.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct
+{
+    int fd;                    // Unix socket, or -1
+    struct sockaddr_un addr;
+    char *shm;                 // mapped segment, or NULL
+    char shm_name[256];
+    unsigned int interval_ms;
+    uint64_t seq;
+    int running;               // guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;       // signalled by RUDP_Export_stop()
+    pthread_t thread;
+} export = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+int RUDP_Export_parse(const char *target)
+{
+    if ((strncmp(target, "unix:", 5) == 0 && target[5] != '\0' && strlen(target + 5) < sizeof(export.addr.sun_path)) ||
+        (strncmp(target, "shm:", 4) == 0 && target[4] != '\0' && strlen(target + 4) < sizeof(export.shm_name)))
+        return 0;
+    printf("Unknown stats export %s (unix:<path> or shm:<name>)\n", target);
+    return -1;
+}
+
+int RUDP_Export_format(const RUDP_Stats *s, uint64_t seq, char *buf, size_t len)
+{
+    return snprintf(buf, len,
+                    "{\"seq\": %llu, \"connections\": %llu, \"bytes_sent\": %llu, \"bytes_received\": %llu, "
+                    "\"segments_sent\": %llu, \"segments_received\": %llu, \"acks_sent\": %llu, \"acks_received\": %llu, "
+                    "\"retransmits\": %llu, \"timeouts\": %llu, \"duplicates\": %llu, \"checksum_errors\": %llu, "
+                    "\"out_of_window\": %llu, \"window_probes\": %llu, \"rcvbuf_drops\": %llu, "
+                    "\"nacks_sent\": %llu, \"nacks_received\": %llu, \"fast_retransmits\": %llu, \"tail_probes\": %llu, "
+                    "\"messages_sent\": %llu, \"messages_received\": %llu, "
+                    "\"srtt_us\": %llu, \"rttvar_us\": %llu, \"window\": %llu, \"goodput_bps\": %llu, \"connection_ms\": %llu}\n",
+                    (unsigned long long)seq, (unsigned long long)s->connections, (unsigned long long)s->bytes_sent,
+                    (unsigned long long)s->bytes_received, (unsigned long long)s->segments_sent,
+                    (unsigned long long)s->segments_received, (unsigned long long)s->acks_sent,
+                    (unsigned long long)s->acks_received, (unsigned long long)s->retransmits,
+                    (unsigned long long)s->timeouts, (unsigned long long)s->duplicates,
+                    (unsigned long long)s->checksum_errors, (unsigned long long)s->out_of_window,
+                    (unsigned long long)s->window_probes, (unsigned long long)s->rcvbuf_drops,
+                    (unsigned long long)s->nacks_sent, (unsigned long long)s->nacks_received,
+                    (unsigned long long)s->fast_retransmits, (unsigned long long)s->tail_probes,
+                    (unsigned long long)s->messages_sent, (unsigned long long)s->messages_received,
+                    (unsigned long long)s->srtt_us, (unsigned long long)s->rttvar_us, (unsigned long long)s->window,
+                    (unsigned long long)s->goodput_bps, (unsigned long long)s->connection_ms);
+}
+
+static void publish(void)
+{
+    RUDP_Stats stats;
+    char line[RUDP_EXPORT_SHM_SIZE];
+    rudp_get_total_stats(&stats);
+    int len = RUDP_Export_format(&stats, ++export.seq, line, sizeof(line));
+    if (len <= 0 || len >= (int)sizeof(line))
+        return;
+
+    if (export.fd >= 0)
+    {
+        // ENOENT/ECONNREFUSED: nobody is listening right now, try again next time
+        sendto(export.fd, line, len, MSG_DONTWAIT, (struct sockaddr *)&export.addr, sizeof(export.addr));
+    }
+    if (export.shm != NULL)
+    {
+        // readers may catch a line half rewritten, the next read has it whole
+        memcpy(export.shm, line, len);
+        memset(export.shm + len, 0, RUDP_EXPORT_SHM_SIZE - len);
+    }
+}
+
+static void *export_thread(void *arg)
+{
+    (void)arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    pthread_mutex_lock(&export.lock);
+    while (export.running)
+    {
+        publish();
+        next.tv_nsec += (long)(export.interval_ms % 1000) * 1000000L;
+        next.tv_sec += export.interval_ms / 1000 + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        while (export.running && pthread_cond_timedwait(&export.wake, &export.lock, &next) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&export.lock);
+    return NULL;
+}
+
+static int open_shm(const char *name)
+{
+    snprintf(export.shm_name, sizeof(export.shm_name), "%s", name);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        perror("shm_open() failed");
+        return -1;
+    }
+    if (ftruncate(fd, RUDP_EXPORT_SHM_SIZE) == -1)
+    {
+        perror("ftruncate() failed");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    void *map = mmap(NULL, RUDP_EXPORT_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap() failed");
+        shm_unlink(name);
+        return -1;
+    }
+    export.shm = (char *)map;
+    return 0;
+}
+
+static void close_target(void)
+{
+    if (export.fd >= 0)
+        close(export.fd);
+    export.fd = -1;
+    if (export.shm != NULL)
+    {
+        munmap(export.shm, RUDP_EXPORT_SHM_SIZE);
+        shm_unlink(export.shm_name);
+    }
+    export.shm = NULL;
+}
+
+int RUDP_Export_start(const char *target, unsigned int interval_ms)
+{
+    if (RUDP_Export_parse(target) < 0)
+        return -1;
+
+    if (strncmp(target, "unix:", 5) == 0)
+    {
+        export.fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (export.fd == -1)
+        {
+            perror("socket() failed");
+            return -1;
+        }
+        memset(&export.addr, 0, sizeof(export.addr));
+        export.addr.sun_family = AF_UNIX;
+        strcpy(export.addr.sun_path, target + 5);
+    }
+    else if (open_shm(target + 4) < 0)
+        return -1;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&export.wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    export.interval_ms = interval_ms > 0 ? interval_ms : RUDP_EXPORT_DEFAULT_MS;
+    export.seq = 0;
+    export.running = 1;
+    if (pthread_create(&export.thread, NULL, export_thread, NULL) != 0)
+    {
+        perror("pthread_create() failed");
+        export.running = 0;
+        pthread_cond_destroy(&export.wake);
+        close_target();
+        return -1;
+    }
+    printf("Exporting RUDP stats to %s every %u ms\n", target, export.interval_ms);
+    return 0;
+}
+
+void RUDP_Export_stop(void)
+{
+    pthread_mutex_lock(&export.lock);
+    int running = export.running;
+    export.running = 0;
+    pthread_cond_signal(&export.wake);
+    pthread_mutex_unlock(&export.lock);
+    if (!running)
+        return;
+
+    if (pthread_join(export.thread, NULL) != 0)
+        perror("pthread_join() failed");
+    publish();
+    pthread_cond_destroy(&export.wake);
+    close_target();
+}
@@ -0,0 +1,28 @@
+#ifndef RUDP_EXPORT_H
+#define RUDP_EXPORT_H
+
+#include <stddef.h>
+#include "RUDP_API.h"
+
+/*
+ * Publishes rudp_get_total_stats() every interval from a thread of its own, so long
+ * transfers can be watched live. Each snapshot is one line of JSON, sent to
+ *   unix:<path>   a Unix datagram socket bound at path, if one is (nothing listening is fine),
+ *                 e.g. socat -u UNIX-RECV:/tmp/rudp.sock -
+ *   shm:<name>    a POSIX shared memory segment, rewritten in place,
+ *                 NUL padded, e.g. watch -n 1 head -1 /dev/shm/rudp_stats for shm:/rudp_stats
+ * The segment is removed again by RUDP_Export_stop().
+ */
+#define RUDP_EXPORT_DEFAULT_MS 1000
+#define RUDP_EXPORT_SHM_SIZE 4096
+
+/* Checks that target is "unix:<path>" or "shm:<name>". */
+int RUDP_Export_parse(const char *target);
+/* Opens target and starts the publishing thread. */
+int RUDP_Export_start(const char *target, unsigned int interval_ms);
+/* Publishes a last snapshot and stops the thread. */
+void RUDP_Export_stop(void);
+/* Formats stats as one line of JSON, newline included; returns its length. */
+int RUDP_Export_format(const RUDP_Stats *stats, uint64_t seq, char *buf, size_t len);
+
+#endif
@@ -2,87 +2,244 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include "RUDP_API.h"
+#include "IO_Backend.h"
+#include "Impair.h"
+#include "Trace.h"
+#include "RUDP_Export.h"
+#include "Payload.h"
+#include "File_IO.h"
+#include "Compress.h"
+#include "RUDP_Stripe.h"
+#include "Stats.h"
+#include "Run.h"
+#include "Timing.h"
+#include "Busy_Poll.h"
+#include "Timestamp.h"
+#include "Resume.h"
 #include <time.h>
 
 int main(int argc, char* argv[])
 {
-    if (argc != 3 || strcmp(argv[1], "-p") != 0)
+    int port = -1;
+    IO_Backend backend = IO_SYSCALL;
+    int verify = 0;
+    const char *json_path = NULL;
+    const char *csv_path = NULL;
+    const char *out_path = NULL;
+    int direct = 0;
+    const char *impair_spec = NULL;
+    Impair_Config impair;
+    const char *trace_path = NULL;
+    Trace_Level level = TRACE_INFO;
+    const char *export_target = NULL;
+    unsigned int export_ms = RUDP_EXPORT_DEFAULT_MS;
+    int paths = 1;
+    char *locals[STRIPE_MAX_PATHS];
+    int nlocals = 0;
+    int resume = 0;
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-verify") == 0)
+            verify = 1;
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (strcmp(argv[i], "-direct") == 0)
+            direct = 1;
+        else if (strcmp(argv[i], "-resume") == 0)
+            resume = 1;
+        else if (strcmp(argv[i], "-paths") == 0 && i + 1 < argc)
+            paths = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-bind") == 0 && i + 1 < argc)
+            nlocals = RUDP_Stripe_parse_addrs(argv[++i], locals);
+        else if (strcmp(argv[i], "-impair") == 0 && i + 1 < argc)
+        {
+            impair_spec = argv[++i];
+            if (Impair_parse(impair_spec, &impair) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-export") == 0 && i + 1 < argc)
+        {
+            export_target = argv[++i];
+            if (RUDP_Export_parse(export_target) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-export-ms") == 0 && i + 1 < argc)
+            export_ms = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc)
+        {
+            if (Trace_parse_level(argv[++i], &level) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc)
+        {
+            if (IO_parse_backend(argv[++i], &backend) < 0)
+                break;
+        }
+        else if (Timestamp_option(argc, argv, &i) == 0 && rudp_config_option(argc, argv, &i) <= 0 && Busy_Poll_option(argc, argv, &i) <= 0)
+            break;
+    }
+    if (i < argc || port < 0 || paths < 1 || paths > STRIPE_MAX_PATHS || (resume && (out_path == NULL || paths > 1)))
     {
         printf("Invalid arguments\n");
+        printf("Usage: %s -p <port> [-io <syscall|uring|xdp:dev[:queue]>] [-impair <spec>] [-log <error|warn|info|debug>] [-trace <file[.pcapng]>] [-export <unix:path|shm:name>] [-export-ms <ms>] [-verify] [-json <file>] [-csv <file>] [-o <file> [-direct] [-resume]] [-paths <1-%d> [-bind <addr,...>]] " RUDP_CONFIG_USAGE " " BUSY_POLL_USAGE " " TIMESTAMP_USAGE "\n", argv[0], STRIPE_MAX_PATHS);
+        return 1;
+    }
+    // the io_uring ring belongs to one thread, the paths of a striped run each have their own
+    if (paths > 1 && backend == IO_URING)
+    {
+        printf("-paths needs -io syscall\n");
         return 1;
     }
-
-    int port = atoi(argv[2]);
 
     printf("Starting RUDP Receiver\n\n");
 
-    // Create a UDP socket
-    int sock = udp_socket(NULL, port);
-    if (sock == -1)
+    Trace_set_level(level);
+    if (trace_path != NULL)
+        Trace_enable(TRACE_DEFAULT_CAPACITY);
+    IO_init(backend, NULL, 0);
+    if (Busy_Poll_start() < 0 || Timestamp_start() < 0)
+        return 1;
+    if (impair_spec != NULL)
+        Impair_init(&impair);
+
+    // Create the UDP sockets, one per path
+    int socks[STRIPE_MAX_PATHS];
+    if (RUDP_Stripe_open(socks, paths, NULL, 0, (unsigned short int)port, locals, nlocals) < 0)
     {
         return 1;
     }
+    int sock = socks[0];
+    if (paths > 1)
+        printf("Receiving striped runs over %d paths, ports %d to %d\n", paths, port, port + paths - 1);
 
 
     char buffer[MSG_BUFFER_SIZE];
-    int round = 1;
-    int done, bytes_received, totalBytes;
-    StrList* strList = StrList_alloc();
+    int done, bytes_received;
+    Compress_Reader reader;     // runs sent with -compress
+    if (Compress_Reader_init(&reader) < 0)
+        return 1;
+
+    // per-run timer, plus every run's figures for the final report
+    Run_Report report;
+    if (Run_Report_init(&report) < 0)
+        return 1;
+    Stats *stats = report.stats;
+    const char *gap_label = paths > 1 ? "Stripe inter-arrival" : "Segment inter-arrival";
+    if (export_target != NULL && RUDP_Export_start(export_target, export_ms) < 0)
+    {
+        RUDP_Stripe_close(socks, paths, 0);
+        return 1;
+    }
+
+    Run_State run;
+    run.verify = verify;
+    run.out_path = out_path;
+    run.direct = direct;
+    run.reader = &reader;
+    run.timer = &report.timer;
+    run.resume = NULL;
+
+    // the sender's SYN names the transfer, the SYN-ACK answers with the blocks already here
+    Resume transfer;
+    if (resume)
+    {
+        if (Resume_init_receiver(&transfer, out_path) < 0)
+            return 1;
+        rudp_set_syn_hook(sock, Resume_syn_hook, &transfer);
+        run.resume = &transfer;
+        printf("Resumable: unfinished transfers are recorded in %s.resume\n", out_path);
+    }
 
     do
     {
         done = 0;
+        IO_reset_syscalls();
+        Run_State_start(&run);
 
-        // Accept incoming connection requests
-        if (rudp_accept(sock, port, &done) < 0)
+        if (paths > 1)
         {
-            perror("Failed to accept connection");
-            rudp_close(sock, 0);
-            return 1;
+            // the paths accept, receive and reorder the stripes themselves; TTFB counts from the call, any wait for the sender included
+            Run_Timer_arm(&report.timer);
+            if (RUDP_Stripe_recv(socks, paths, Run_State_consume, &run, &done, Stats_size(stats) == 0) < 0)
+                printf("Striped run failed\n");
+            if (done == -1)
+                break;   // the sender closed the session, or no new run came on any path
         }
+        else
+        {
+            // Accept incoming connection requests
+            int accepted;
+            while ((accepted = rudp_accept(sock, port, &done)) < 0 && errno == EAGAIN && (Stats_size(stats) == 0 || (resume && done == 0)))
+                printf("No sender yet, still waiting\n");
+            if (accepted < 0)
+            {
+                if (Stats_size(stats) == 0)
+                {
+                    perror("Failed to accept connection");
+                    RUDP_Export_stop();
+                    rudp_close(sock, 0);
+                    return 1;
+                }
+                // the sender's close packet was lost, keep what was received
+                printf("No new run from the sender, ending the session\n");
+                break;
+            }
 
-        // Clear the buffer
-        memset(buffer, 0, sizeof(buffer));
+            // Clear the buffer
+            memset(buffer, 0, sizeof(buffer));
 
-        // Capture start time
-        clock_t start_time, end_time;
-        
-        // Receive data from the client in chunks
-        int firstround = 1;
+            // TTFB counts from the handshake to the first data segment
+            Run_Timer_arm(&report.timer);
 
-        while ((done == 0) && ((bytes_received = rudp_recv(sock, buffer, sizeof(buffer), &strList, &done)) >= 0))
-        {
-            if (firstround)
+            // Receive data from the client in chunks
+            while ((done == 0) && ((bytes_received = rudp_recv(sock, buffer, sizeof(buffer), &done)) >= 0))
             {
-                firstround = 0;
-                totalBytes = 0;
-                start_time = clock();
+                if (Run_State_consume(&run, buffer, bytes_received) < 0)
+                    break;
             }
-            totalBytes += bytes_received;
-            printf("Got %d bytes of data.  Total %d bytes\n", bytes_received, totalBytes);
         }
 
-        if (done > 0) {
-            // Capture end time
-            end_time = clock();
-            printf("End receiving data\n");
-
-            // Calculate time difference in milliseconds
-            double milliseconds = ((double)(end_time - start_time) / CLOCKS_PER_SEC) * 1000.0;
-            StrList_insertLast(strList, round, milliseconds, totalBytes / (milliseconds * 1000.0));
-            printf("Run #%d Data: Time: %fms Speed: %fMB/s\n\n", round, milliseconds, totalBytes / (milliseconds * 1000.0));
-            round++;
+        if (Run_State_finish(&run, &report, done > 0, gap_label) < 0)
+            break;
+        if (done > 0)
+        {
+            IO_print_packets();
+            printf("I/O syscalls: %lu (%s)\n\n", IO_syscalls(), IO_backend_name());
         }
-    } while (done > 0);
+        else if (resume && done == 0)
+            printf("Run cut short, waiting for the sender to resume it\n\n");
+    } while (done > 0 || (resume && done == 0));
 
-    rudp_close(sock, 0);
+    RUDP_Stripe_close(socks, paths, 0);
 
     // Print statistics
-    print_stats(strList);
-
-    StrList_free(strList);
+    Run_Report_print(&report, gap_label, json_path, csv_path, Busy_Poll_label("rudp"));
+    Run_Report_free(&report);
+    Compress_Reader_free(&reader);
+    if (resume)
+        Resume_free(&transfer);
+    RUDP_Export_stop();
+    RUDP_Stats rudp_stats;
+    rudp_get_total_stats(&rudp_stats);
+    rudp_print_stats(&rudp_stats);
+    Impair_print_stats();
+    Timestamp_print();
+    if (trace_path != NULL && Trace_dump(trace_path) == 0)
+        printf("Packet trace written to %s\n", trace_path);
+    Trace_cleanup();
+    IO_cleanup();
 
     printf("\nReceiver finished!\n");
 
@@ -8,87 +8,342 @@
 #include <stdlib.h>
 #include <time.h>
 #include "RUDP_API.h"
+#include "IO_Backend.h"
+#include "Impair.h"
+#include "Trace.h"
+#include "RUDP_Export.h"
+#include "Payload.h"
+#include "File_IO.h"
+#include "Compress.h"
+#include "RUDP_Stripe.h"
+#include "Run.h"
+#include "Busy_Poll.h"
+#include "Timestamp.h"
+#include "Resume.h"
 
-
-char *util_generate_random_data(unsigned int size)
+/*
+* @brief
+Sends one run in parts of RUN_PART_SIZE bytes through part, FIN on the last segment.
+* @return
+1 on success, -1 on failure.
+*/
+static int send_parts(int sock, Run_Source *src, char *part)
 {
-    char *buffer = NULL;
-
-    if (size == 0)
-        return NULL;
-
-    buffer = (char *)calloc(size, sizeof(char));
-
-    if (buffer == NULL)
-        return NULL;
-
-    srand(time(NULL));
-
-    for (unsigned int i = 0; i < size; i++)
-        *(buffer + i) = ((unsigned int)rand() % 256);
+    for (;;)
+    {
+        ssize_t n = Run_Source_read(src, part, RUN_PART_SIZE);
+        if (n < 0)
+            return -1;
+        int last = Run_Source_done(src);
+        if (rudp_send_part(sock, part, (unsigned int)n, last) <= 0)
+            return -1;
+        if (last)
+            return 1;
+    }
+}
 
-    return buffer;
+/*
+* @brief
+Sends one run of a file that can be resumed: every connection asks the receiver which blocks it
+has and sends the others. A run that fails is tried again on a new connection, RESUME_ATTEMPTS times.
+skipped gets the bytes the receiver had already, so not sent by the attempt that finished.
+* @return
+1 on success, -1 on failure.
+*/
+static int send_resumable(int sock, Run_Source *src, Resume *transfer, char *part, uint64_t *skipped)
+{
+    Run_Source start = *src;
+    char reply[MSG_BUFFER_SIZE];
+    char request[MSG_BUFFER_SIZE];
+    unsigned int request_len = Resume_request(transfer, request);
+    for (int attempt = 0;; attempt++)
+    {
+        unsigned int reply_len = 0;
+        *src = start;
+        int sent = -1;
+        if (rudp_socket_with(sock, request, request_len, reply, &reply_len) == 0)
+        {
+            Resume_take_reply(transfer, reply, reply_len);
+            Run_Source_resume(src, transfer);
+            uint64_t have = transfer->active ? Resume_have_bytes(transfer) : 0;
+            *skipped = have;
+            if (have > 0)
+                printf("Resuming: the receiver has %llu of %llu bytes\n", (unsigned long long)have,
+                       (unsigned long long)transfer->size);
+            sent = send_parts(sock, src, part);
+        }
+        if (sent > 0 || attempt == RESUME_ATTEMPTS)
+            return sent;
+        printf("Run failed, trying again from where the receiver stopped (%d of %d)\n", attempt + 1, RESUME_ATTEMPTS);
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 5 || strcmp(argv[1], "-ip") != 0 || strcmp(argv[3], "-p") != 0)
+    char *ips[STRIPE_MAX_PATHS];   // one per path, in turn
+    int nips = 0;
+    const char *port = NULL;
+    IO_Backend backend = IO_SYSCALL;
+    uint64_t size = FILE_SIZE;
+    uint64_t seed = Payload_random_seed();
+    int rounds = 0;     // 0 asks before every run
+    const char *impair_spec = NULL;
+    Impair_Config impair;
+    const char *trace_path = NULL;
+    Trace_Level level = TRACE_INFO;
+    const char *file_path = NULL;
+    File_Read_Mode read_mode = FILE_PREAD;
+    int use_compress = 0;
+    const char *export_target = NULL;
+    unsigned int export_ms = RUDP_EXPORT_DEFAULT_MS;
+    int paths = 1;
+    char *locals[STRIPE_MAX_PATHS];
+    int nlocals = 0;
+    int ack_thread = 0;
+    int resume = 0;
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc)
+            nips = RUDP_Stripe_parse_addrs(argv[++i], ips);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            port = argv[++i];
+        else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc)
+            size = Payload_parse_size(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            file_path = argv[++i];
+        else if (strcmp(argv[i], "-compress") == 0)
+            use_compress = 1;
+        else if (strcmp(argv[i], "-ackthread") == 0)
+            ack_thread = 1;
+        else if (strcmp(argv[i], "-resume") == 0)
+            resume = 1;
+        else if (strcmp(argv[i], "-paths") == 0 && i + 1 < argc)
+            paths = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-bind") == 0 && i + 1 < argc)
+            nlocals = RUDP_Stripe_parse_addrs(argv[++i], locals);
+        else if (strcmp(argv[i], "-fread") == 0 && i + 1 < argc)
+        {
+            if (File_parse_read_mode(argv[++i], &read_mode) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-rounds") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-impair") == 0 && i + 1 < argc)
+        {
+            impair_spec = argv[++i];
+            if (Impair_parse(impair_spec, &impair) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-export") == 0 && i + 1 < argc)
+        {
+            export_target = argv[++i];
+            if (RUDP_Export_parse(export_target) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-export-ms") == 0 && i + 1 < argc)
+            export_ms = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc)
+        {
+            if (Trace_parse_level(argv[++i], &level) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc)
+        {
+            if (IO_parse_backend(argv[++i], &backend) < 0)
+                break;
+        }
+        else if (Timestamp_option(argc, argv, &i) == 0 && rudp_config_option(argc, argv, &i) <= 0 && Busy_Poll_option(argc, argv, &i) <= 0)
+            break;
+    }
+    if (i < argc || nips == 0 || port == NULL || size == 0 || rounds < 0 || paths < 1 || paths > STRIPE_MAX_PATHS)
     {
-        printf("Usage: %s -ip <server_ip> -p <port>\n", argv[0]);
+        printf("Usage: %s -ip <server_ip[,...]> -p <port> [-rounds <n>] [-io <syscall|uring|xdp:dev[:queue]>] [-impair <spec>] [-log <error|warn|info|debug>] [-trace <file[.pcapng]>] [-export <unix:path|shm:name>] [-export-ms <ms>] [-size <bytes[K|M|G]>] [-seed <n>] [-f <file> [-fread <pread|mmap>]] [-compress] [-resume] [-paths <1-%d> [-bind <addr,...>]] [-ackthread] " RUDP_CONFIG_USAGE " " BUSY_POLL_USAGE " " TIMESTAMP_USAGE "\n", argv[0], STRIPE_MAX_PATHS);
+        return 1;
+    }
+    // what the receiver has is a set of blocks of one file, on one connection
+    if (resume && (file_path == NULL || paths > 1))
+    {
+        printf("-resume needs -f and a single path\n");
+        return 1;
+    }
+    // the io_uring ring belongs to one thread, the paths of a striped run each have their own
+    if (paths > 1 && backend == IO_URING)
+    {
+        printf("-paths needs -io syscall\n");
         return 1;
     }
-
-    char buffer[MSG_BUFFER_SIZE] = {0};
 
     printf("Starting RUDP Sender\n\n");
 
-    // Generate some random data.
-    unsigned int size = FILE_SIZE;
-    char *message = util_generate_random_data(size);
-    if (message == NULL)
+    // The run is the header the receiver needs to verify it, then the payload generated, or with -f
+    // the file read, a chunk at a time: no size is held in memory whole.
+    File_Source file;
+    Compress_Writer compress;
+    if (use_compress && Compress_Writer_init(&compress) < 0)
+        return 1;
+    if (file_path != NULL)
+    {
+        if (File_Source_open(&file, file_path, read_mode) < 0)
+            return 1;
+        size = File_Source_size(&file);
+        printf("File: %s, %llu bytes, read with %s\n", file_path, (unsigned long long)size,
+               read_mode == FILE_MMAP ? "mmap" : "pread");
+    }
+    Resume transfer;
+    if (resume)
+    {
+        if (Resume_init_sender(&transfer, file_path, size) < 0)
+            return 1;
+        printf("Resumable: transfer %016llx, up to %d more attempts for a run that fails\n", (unsigned long long)transfer.id,
+               RESUME_ATTEMPTS);
+    }
+    char *chunk = (char *)malloc(RUN_PART_SIZE);
+    // a single path sends the run through part, striped runs through the stripe buffers
+    char *part = NULL;
+    if (paths == 1)
+        part = (char *)malloc(RUN_PART_SIZE);
+    if (chunk == NULL || (paths == 1 && part == NULL))
     {
-        perror("util_generate_random_data() failed");
+        perror("malloc failed");
         return 1;
     }
-    printf("Generated %d bytes of random data\n", size);
+    Payload_Header header;
+    Payload_header_pack(&header, seed, size);
+    Payload_header_set_flags(&header, (file_path != NULL ? PAYLOAD_FILE : 0) | (use_compress ? PAYLOAD_COMPRESSED : 0));
+    if (file_path == NULL)
+        printf("Payload: %llu bytes, seed 0x%016llx\n", (unsigned long long)size, (unsigned long long)seed);
+
+    Trace_set_level(level);
+    if (trace_path != NULL)
+        Trace_enable(TRACE_DEFAULT_CAPACITY);
+    IO_init(backend, NULL, 0);
+    if (Busy_Poll_start() < 0 || Timestamp_start() < 0)
+        return 1;
+    if (impair_spec != NULL)
+        Impair_init(&impair);
 
-    // Try to create a UDP socket (IPv4, datagram-based, default protocol).
-    int sock = udp_socket(argv[2], atoi(argv[4]));
-    if (sock == -1)
+    // Try to create the UDP sockets (IPv4, datagram-based, default protocol), one per path.
+    int socks[STRIPE_MAX_PATHS];
+    if (RUDP_Stripe_open(socks, paths, ips, nips, (unsigned short int)atoi(port), locals, nlocals) < 0)
     {
         perror("udp_socket() failed");
         return 1;
     }
+    int sock = socks[0];
+    if (paths > 1)
+        printf("Striping every run over %d paths, ports %d to %d\n", paths, atoi(port), atoi(port) + paths - 1);
+    if (export_target != NULL && RUDP_Export_start(export_target, export_ms) < 0)
+    {
+        RUDP_Stripe_close(socks, paths, 0);
+        return 1;
+    }
+    // every path sends on its thread and takes its ACKs on another
+    for (int p = 0; ack_thread && p < paths; p++)
+    {
+        if (rudp_set_ack_thread(socks[p], 1) < 0)
+        {
+            RUDP_Stripe_close(socks, paths, 0);
+            return 1;
+        }
+    }
+    if (ack_thread)
+        printf("ACKs are processed on a thread of their own\n");
 
+    int round = 1;
     char again = 'y';
     while (again == 'y')
     {
-        // Create RUDP socket
-        if (rudp_socket(sock) < 0) {
-            close(sock);
-            return 1;
-        }
+        IO_reset_syscalls();
+        if (file_path != NULL)
+            File_Source_reset_time(&file);
+        if (use_compress)
+            Compress_Writer_reset_stats(&compress);
 
-        // Send the data.
-        if (rudp_send(sock, message, size) <= 0)
+        Run_Source src;
+        Run_Source_init(&src, &header, NULL, file_path != NULL ? &file : NULL, chunk, size, use_compress ? &compress : NULL);
+
+        // Send the data; a striped run connects every path itself.
+        int sent;
+        uint64_t skipped = 0; // a resumed run's blocks the receiver had
+        if (paths > 1)
+            sent = RUDP_Stripe_send(socks, paths, Run_Source_read, &src);
+        else if (resume)
+            sent = send_resumable(sock, &src, &transfer, part, &skipped);
+        else
+        {
+            // Create RUDP socket
+            if (rudp_socket(sock) < 0) {
+                RUDP_Export_stop();
+                close(sock);
+                return 1;
+            }
+
+            sent = send_parts(sock, &src, part);
+        }
+        if (sent <= 0)
         {
             printf("Could not send RUDP message\n");
-            close(sock);
+            for (int p = 0; p < paths; p++)
+                close(socks[p]);
             break;
         }
 
-        printf("Sent %d bytes to the server!\n\n", size);
-        printf("Do you want to send the message again? (y/n): ");
-        scanf(" %c", &again);
+        if (skipped > 0)
+            printf("Sent %llu bytes to the server, skipped %llu it had already!\n",
+                   (unsigned long long)(sizeof(Payload_Header) + size - skipped), (unsigned long long)skipped);
+        else
+            printf("Sent %llu bytes to the server!\n", (unsigned long long)(sizeof(Payload_Header) + size));
+        if (use_compress)
+            Compress_Writer_print_stats(&compress);
+        if (file_path != NULL)
+        {
+            double disk_ms = File_Source_disk_ms(&file);
+            printf("Disk: read %llu bytes in %f ms (%f MB/s)\n", (unsigned long long)size, disk_ms,
+                   disk_ms > 0 ? size / (disk_ms * 1000.0) : 0.0);
+        }
+        IO_print_packets();
+        printf("I/O syscalls: %lu (%s)\n\n", IO_syscalls(), IO_backend_name());
+        round++;
+
+        if (rounds > 0)
+            again = round <= rounds ? 'y' : 'n';
+        else
+        {
+            printf("Do you want to send the message again? (y/n): ");
+            if (scanf(" %c", &again) != 1)
+                again = 'n';
+        }
     }
-    free(message);
+    free(chunk);
+    free(part);
+    if (resume)
+        Resume_free(&transfer);
+    if (file_path != NULL)
+        File_Source_close(&file);
+    if (use_compress)
+        Compress_Writer_free(&compress);
 
-    // Close the socket UDP socket, unless rudp_send() failed
-    if ((again != 'y') && (rudp_close(sock, 1) < 0)) {
-        close(sock);
+    // Close the UDP sockets, unless rudp_send() failed
+    if ((again != 'y') && (RUDP_Stripe_close(socks, paths, 1) < 0)) {
+        RUDP_Export_stop();
         return 1;
     }
 
+    RUDP_Export_stop();
+    RUDP_Stats rudp_stats;
+    rudp_get_total_stats(&rudp_stats);
+    rudp_print_stats(&rudp_stats);
+    Impair_print_stats();
+    Timestamp_print();
+    if (trace_path != NULL && Trace_dump(trace_path) == 0)
+        printf("Packet trace written to %s\n", trace_path);
+    Trace_cleanup();
+    IO_cleanup();
     printf("\nClient finished!\n");
     return 0;
 }
@@ -0,0 +1,400 @@
+#include "RUDP_Stripe.h"
+#include "Busy_Poll.h"
+#include <endian.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRIPE_BUFFER (sizeof(Stripe_Header) + STRIPE_SIZE + MSG_BUFFER_SIZE)  // a whole stripe, plus one segment of slack
+
+typedef struct _Stripe_Slot
+{
+    int ready;
+    size_t len;
+    char *data;        // STRIPE_SIZE bytes
+} Stripe_Slot;
+
+/* State shared by the path threads of one run; everything below lock is guarded by it. */
+typedef struct _Stripe_Run
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int failed;
+    uint64_t next;     // sender: stripes handed out; receiver: next stripe to write
+    // sender
+    Stripe_Read read;
+    void *ctx;
+    int end;           // read returned 0: next is the total
+    // receiver
+    int patient;
+    Stripe_Slot *slots;
+    uint64_t window;   // slots, indexed by stripe % window
+    uint64_t total;
+    int total_known;
+    int ended;         // paths that got their STRIPE_END
+    int closed;        // paths that got the close packet, or no new run
+    int exited;        // path threads done
+} Stripe_Run;
+
+typedef struct _Stripe_Path
+{
+    Stripe_Run *run;
+    int index;
+    int sock;
+    pthread_t thread;
+    uint64_t stripes;
+    uint64_t bytes;
+} Stripe_Path;
+
+static void run_fail(Stripe_Run *run)
+{
+    pthread_mutex_lock(&run->lock);
+    run->failed = 1;
+    pthread_cond_broadcast(&run->wake);
+    pthread_mutex_unlock(&run->lock);
+}
+
+static void pack_header(Stripe_Header *h, uint64_t index, uint32_t length, uint32_t flags)
+{
+    h->index = htobe64(index);
+    h->length = htobe32(length);
+    h->flags = htobe32(flags);
+}
+
+static void print_paths(const Stripe_Path *path, int paths)
+{
+    uint64_t bytes = 0;
+    for (int i = 0; i < paths; i++)
+        bytes += path[i].bytes;
+    for (int i = 0; i < paths; i++)
+        printf("Path %d: %llu stripes, %llu bytes (%.1f%%)\n", i, (unsigned long long)path[i].stripes,
+               (unsigned long long)path[i].bytes, bytes > 0 ? 100.0 * path[i].bytes / bytes : 0.0);
+}
+
+/* Starts one thread per path running fn, returns how many started. */
+static int start_paths(Stripe_Path *path, const int *socks, int paths, Stripe_Run *run, void *(*fn)(void *))
+{
+    for (int i = 0; i < paths; i++)
+    {
+        path[i].run = run;
+        path[i].index = i;
+        path[i].sock = socks[i];
+        path[i].stripes = 0;
+        path[i].bytes = 0;
+        if (pthread_create(&path[i].thread, NULL, fn, &path[i]) != 0)
+        {
+            perror("pthread_create() failed");
+            run_fail(run);
+            return i;
+        }
+    }
+    return paths;
+}
+
+int RUDP_Stripe_parse_addrs(char *text, char **addrs)
+{
+    int n = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(text, ",", &save); item != NULL && n < STRIPE_MAX_PATHS; item = strtok_r(NULL, ",", &save))
+        addrs[n++] = item;
+    return n;
+}
+
+int RUDP_Stripe_open(int *socks, int paths, char *const *dests, int ndests, unsigned short int port, char *const *locals, int nlocals)
+{
+    if (paths < 1 || paths > STRIPE_MAX_PATHS || port + paths - 1 > 65535)
+    {
+        printf("Cannot stripe over %d paths from port %u (1 to %d paths)\n", paths, port, STRIPE_MAX_PATHS);
+        return -1;
+    }
+    for (int i = 0; i < paths; i++)
+    {
+        socks[i] = udp_socket_from(nlocals > 0 ? locals[i % nlocals] : NULL, ndests > 0 ? dests[i % ndests] : NULL,
+                                   (unsigned short int)(port + i));
+        if (socks[i] == -1)
+        {
+            RUDP_Stripe_close(socks, i, 0);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int RUDP_Stripe_close(const int *socks, int paths, int send)
+{
+    int result = 0;
+    for (int i = 0; i < paths; i++)
+    {
+        if (rudp_close(socks[i], send) < 0)
+        {
+            close(socks[i]);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// ************ Sender **************
+static void *send_path(void *arg)
+{
+    Stripe_Path *p = (Stripe_Path *)arg;
+    Stripe_Run *run = p->run;
+    Busy_Poll_pin_thread("Path", 1 + p->index);
+
+    char *buf = (char *)malloc(sizeof(Stripe_Header) + STRIPE_SIZE);
+    if (buf == NULL)
+    {
+        perror("malloc failed");
+        run_fail(run);
+        return NULL;
+    }
+    if (rudp_socket(p->sock) < 0)
+    {
+        printf("Path %d: connection failed\n", p->index);
+        run_fail(run);
+        free(buf);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        // the stream is read in order, each path takes the next stripe once its last one is ACKed
+        pthread_mutex_lock(&run->lock);
+        ssize_t n = 0;
+        if (!run->failed && !run->end)
+            n = run->read(run->ctx, buf + sizeof(Stripe_Header), STRIPE_SIZE);
+        if (n < 0)
+            run->failed = 1;
+        if (n <= 0)
+            run->end = 1;
+        uint64_t index = run->next;
+        if (n > 0)
+            run->next++;
+        int failed = run->failed;
+        pthread_mutex_unlock(&run->lock);
+        if (failed)
+            break;
+
+        pack_header((Stripe_Header *)buf, index, (uint32_t)n, n > 0 ? 0 : STRIPE_END);
+        if (rudp_send(p->sock, buf, sizeof(Stripe_Header) + n) <= 0)
+        {
+            printf("Path %d: send failed\n", p->index);
+            run_fail(run);
+            break;
+        }
+        if (n == 0)
+            break;
+        p->stripes++;
+        p->bytes += n;
+    }
+    free(buf);
+    return NULL;
+}
+
+int RUDP_Stripe_send(const int *socks, int paths, Stripe_Read read, void *ctx)
+{
+    Stripe_Run run;
+    memset(&run, 0, sizeof(run));
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.wake, NULL);
+    run.read = read;
+    run.ctx = ctx;
+
+    Stripe_Path path[STRIPE_MAX_PATHS];
+    int started = start_paths(path, socks, paths, &run, send_path);
+    for (int i = 0; i < started; i++)
+        pthread_join(path[i].thread, NULL);
+
+    if (!run.failed)
+        print_paths(path, paths);
+    pthread_cond_destroy(&run.wake);
+    pthread_mutex_destroy(&run.lock);
+    return run.failed ? -1 : 1;
+}
+
+// ************ Receiver **************
+/* Receives one RUDP message (one stripe) into buf. */
+static ssize_t recv_stripe(int sock, char *buf)
+{
+    size_t have = 0;
+    int fin = 0;
+    while (!fin)
+    {
+        if (have + MSG_BUFFER_SIZE > STRIPE_BUFFER)
+        {
+            printf("Stripe longer than %d bytes\n", STRIPE_SIZE);
+            return -1;
+        }
+        int n = rudp_recv(sock, buf + have, MSG_BUFFER_SIZE, &fin);
+        if (n < 0)
+            return -1;
+        have += n;
+    }
+    return (ssize_t)have;
+}
+
+static void *recv_path(void *arg)
+{
+    Stripe_Path *p = (Stripe_Path *)arg;
+    Stripe_Run *run = p->run;
+    Busy_Poll_pin_thread("Path", 1 + p->index);
+    char *buf = (char *)malloc(STRIPE_BUFFER);
+    int done = 0, accepted;
+
+    while ((accepted = rudp_accept(p->sock, 0, &done)) < 0 && errno == EAGAIN && run->patient && !__atomic_load_n(&run->failed, __ATOMIC_RELAXED))
+    {
+        if (p->index == 0)
+            printf("No sender yet, still waiting\n");
+    }
+
+    pthread_mutex_lock(&run->lock);
+    if (buf == NULL || (accepted < 0 && run->patient))
+        run->failed = 1;
+    else if (accepted < 0 || done == -1)
+        run->closed++;   // the sender closed the session, or its close packet was lost
+    pthread_mutex_unlock(&run->lock);
+
+    while (buf != NULL && accepted == 0 && done == 0)
+    {
+        ssize_t len = recv_stripe(p->sock, buf);
+        if (len < 0)
+        {
+            run_fail(run);
+            break;
+        }
+
+        const Stripe_Header *h = (const Stripe_Header *)buf;
+        uint64_t index = be64toh(h->index);
+        uint32_t length = be32toh(h->length);
+        if ((size_t)len < sizeof(Stripe_Header) || length != len - sizeof(Stripe_Header) || length > STRIPE_SIZE)
+        {
+            printf("Path %d: invalid stripe header\n", p->index);
+            run_fail(run);
+            break;
+        }
+
+        pthread_mutex_lock(&run->lock);
+        if (be32toh(h->flags) & STRIPE_END)
+        {
+            run->total = index;
+            run->total_known = 1;
+            run->ended++;
+            pthread_cond_broadcast(&run->wake);
+            pthread_mutex_unlock(&run->lock);
+            break;
+        }
+        // ahead of the window: wait for the other paths to fill the gap
+        while (!run->failed && index >= run->next + run->window)
+            pthread_cond_wait(&run->wake, &run->lock);
+        Stripe_Slot *slot = &run->slots[index % run->window];
+        if (run->failed || index < run->next || slot->ready)
+        {
+            if (!run->failed)
+                printf("Path %d: stripe %llu received twice\n", p->index, (unsigned long long)index);
+            run->failed = 1;
+            pthread_cond_broadcast(&run->wake);
+            pthread_mutex_unlock(&run->lock);
+            break;
+        }
+        pthread_mutex_unlock(&run->lock);
+
+        // the slot is this path's until it is marked ready
+        memcpy(slot->data, buf + sizeof(Stripe_Header), length);
+        slot->len = length;
+        p->stripes++;
+        p->bytes += length;
+
+        pthread_mutex_lock(&run->lock);
+        slot->ready = 1;
+        pthread_cond_broadcast(&run->wake);
+        pthread_mutex_unlock(&run->lock);
+    }
+
+    pthread_mutex_lock(&run->lock);
+    run->exited++;
+    pthread_cond_broadcast(&run->wake);
+    pthread_mutex_unlock(&run->lock);
+    free(buf);
+    return NULL;
+}
+
+int RUDP_Stripe_recv(const int *socks, int paths, Stripe_Write write, void *ctx, int *done, int patient)
+{
+    *done = 0;
+    Stripe_Run run;
+    memset(&run, 0, sizeof(run));
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.wake, NULL);
+    run.patient = patient;
+    run.window = (uint64_t)STRIPE_WINDOW * paths;
+
+    run.slots = (Stripe_Slot *)calloc(run.window, sizeof(Stripe_Slot));
+    char *data = (char *)malloc(run.window * STRIPE_SIZE);
+    if (run.slots == NULL || data == NULL)
+    {
+        perror("malloc failed");
+        free(run.slots);
+        free(data);
+        return -1;
+    }
+    for (uint64_t i = 0; i < run.window; i++)
+        run.slots[i].data = data + i * STRIPE_SIZE;
+
+    Stripe_Path path[STRIPE_MAX_PATHS];
+    int started = start_paths(path, socks, paths, &run, recv_path);
+
+    // writes the stripes in order as the paths deliver them
+    int complete = 0;
+    pthread_mutex_lock(&run.lock);
+    while (!run.failed)
+    {
+        Stripe_Slot *slot = &run.slots[run.next % run.window];
+        if (slot->ready)
+        {
+            pthread_mutex_unlock(&run.lock);
+            int result = write(ctx, slot->data, slot->len);
+            pthread_mutex_lock(&run.lock);
+            if (result < 0)
+            {
+                run.failed = 1;
+                break;
+            }
+            slot->ready = 0;
+            run.next++;
+            pthread_cond_broadcast(&run.wake);
+            continue;
+        }
+        if (run.total_known && run.next == run.total && run.ended == paths)
+        {
+            complete = 1;
+            break;
+        }
+        if (run.exited == started)
+            break;
+        pthread_cond_wait(&run.wake, &run.lock);
+    }
+    pthread_cond_broadcast(&run.wake);
+    pthread_mutex_unlock(&run.lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(path[i].thread, NULL);
+
+    int result = 0;
+    if (complete)
+    {
+        *done = 1;
+        print_paths(path, paths);
+    }
+    else if (!run.failed && run.closed == paths)
+        *done = -1;
+    else
+        result = -1;
+
+    free(data);
+    free(run.slots);
+    pthread_cond_destroy(&run.wake);
+    pthread_mutex_destroy(&run.lock);
+    return result;
+}
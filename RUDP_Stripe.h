@@ -0,0 +1,57 @@
+#ifndef RUDP_STRIPE_H
+#define RUDP_STRIPE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "RUDP_API.h"
+
+/*
+ * Multipath striping: one logical transfer spread over several RUDP connections,
+ * each on its own UDP socket (port + i, optionally from its own local address).
+ *
+ * The logical byte stream is cut into stripes of up to STRIPE_SIZE bytes, numbered
+ * in one sequence space shared by every path. Each path runs in a thread of its own
+ * with its own RUDP connection, so retransmission timers and loss recovery are per
+ * path; a path takes the next stripe as soon as its previous one is ACKed, so a
+ * faster path carries more of the transfer. Each stripe is one RUDP message that
+ * starts with a Stripe_Header; a path ends its share of the run with a STRIPE_END
+ * stripe carrying the total number of stripes.
+ *
+ * The receiver puts stripes back in order through a window of STRIPE_WINDOW stripes
+ * per path: a path that runs ahead waits for the others to fill the gap.
+ */
+#define STRIPE_MAX_PATHS 8
+#define STRIPE_SIZE (MSG_BUFFER_SIZE * 16)
+#define STRIPE_WINDOW 4
+#define STRIPE_END 0x1u
+
+typedef struct _Stripe_Header
+{
+    uint64_t index;    // big endian; STRIPE_END: stripes in the run
+    uint32_t length;   // big endian, bytes after the header
+    uint32_t flags;    // big endian
+} Stripe_Header;
+
+/* Writes up to cap next bytes of the logical stream into buf; returns 0 at its end, -1 on error. Called under a lock. */
+typedef ssize_t (*Stripe_Read)(void *ctx, char *buf, size_t cap);
+/* Takes the next len bytes of the logical stream, in order, on the thread that called RUDP_Stripe_recv(); -1 aborts the run. */
+typedef int (*Stripe_Write)(void *ctx, const char *data, size_t len);
+
+/*
+ * Opens paths UDP sockets into socks. Sender (ndests > 0): to dests[i % ndests], port + i, from locals[i % nlocals];
+ * receiver: bound to port + i on locals[i % nlocals]. nlocals 0 is any address.
+ */
+int RUDP_Stripe_open(int *socks, int paths, char *const *dests, int ndests, unsigned short int port, char *const *locals, int nlocals);
+/* Sends one run read from read over every path; 1 when every stripe is ACKed, -1 on failure. */
+int RUDP_Stripe_send(const int *socks, int paths, Stripe_Read read, void *ctx);
+/*
+ * Receives one run over every path into write. *done is 1 once the run is complete and -1 when
+ * the sender closed the session. With patient set, the paths keep waiting for a first sender.
+ */
+int RUDP_Stripe_recv(const int *socks, int paths, Stripe_Write write, void *ctx, int *done, int patient);
+/* Closes every path, telling the receiver with send set; -1 if that failed on any of them. */
+int RUDP_Stripe_close(const int *socks, int paths, int send);
+/* Parses "a,b,..." into at most STRIPE_MAX_PATHS addresses pointing into text; returns how many. */
+int RUDP_Stripe_parse_addrs(char *text, char **addrs);
+
+#endif
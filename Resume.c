@@ -0,0 +1,277 @@
+#include "Resume.h"
+#include "RUDP_API.h"
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// SYN data, SYN-ACK data (then the map) and records (then the map) alike, big-endian
+typedef struct _Resume_Header
+{
+    uint32_t magic;
+    uint32_t blocks;
+    uint64_t id;
+    uint64_t size;
+} Resume_Header;
+
+#define RESUME_MAX_BLOCKS ((RUDP_SYN_DATA_MAX - sizeof(Resume_Header)) * 8) // the map has to fit in the SYN-ACK
+
+static uint32_t blocks_of(uint64_t size)
+{
+    return (uint32_t)((size + RESUME_BLOCK - 1) / RESUME_BLOCK);
+}
+
+static size_t map_bytes(uint32_t blocks)
+{
+    return (blocks + 7) / 8;
+}
+
+static void header_pack(Resume_Header *h, const Resume *r)
+{
+    h->magic = htobe32(RESUME_MAGIC);
+    h->blocks = htobe32(r->blocks);
+    h->id = htobe64(r->id);
+    h->size = htobe64(r->size);
+}
+
+/* Reads h into id, size and blocks; -1 unless it is a header of a transfer with as many blocks as its size takes. */
+static int header_unpack(const Resume_Header *h, uint64_t *id, uint64_t *size, uint32_t *blocks)
+{
+    *id = be64toh(h->id);
+    *size = be64toh(h->size);
+    *blocks = be32toh(h->blocks);
+    if (be32toh(h->magic) != RESUME_MAGIC || *blocks != blocks_of(*size) || *blocks > RESUME_MAX_BLOCKS)
+        return -1;
+    return 0;
+}
+
+/* FNV-1a, 64 bits. */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static int alloc_map(Resume *r)
+{
+    r->map = (unsigned char *)calloc(1, map_bytes(RESUME_MAX_BLOCKS));
+    if (r->map == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    return 0;
+}
+
+int Resume_init_sender(Resume *r, const char *path, uint64_t size)
+{
+    memset(r, 0, sizeof(Resume));
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        perror("stat() failed");
+        return -1;
+    }
+    if (blocks_of(size) > RESUME_MAX_BLOCKS)
+    {
+        printf("%s is too large to resume: %llu blocks of %d bytes at most\n", path,
+               (unsigned long long)RESUME_MAX_BLOCKS, RESUME_BLOCK);
+        return -1;
+    }
+
+    // the same file, unchanged, is the same transfer wherever it is sent from
+    const char *name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    uint64_t mtime[2] = {(uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec};
+    uint64_t id = hash_bytes(0xCBF29CE484222325ULL, name, strlen(name));
+    id = hash_bytes(id, &size, sizeof(size));
+    r->id = hash_bytes(id, mtime, sizeof(mtime));
+    r->size = size;
+    r->blocks = blocks_of(size);
+    return alloc_map(r);
+}
+
+int Resume_init_receiver(Resume *r, const char *out_path)
+{
+    memset(r, 0, sizeof(Resume));
+    r->_out = out_path;
+    r->_record = (char *)malloc(strlen(out_path) + sizeof(".resume"));
+    if (r->_record == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    sprintf(r->_record, "%s.resume", out_path);
+    return alloc_map(r);
+}
+
+void Resume_free(Resume *r)
+{
+    free(r->map);
+    free(r->_record);
+    memset(r, 0, sizeof(Resume));
+}
+
+unsigned int Resume_request(const Resume *r, void *buf)
+{
+    Resume_Header h;
+    header_pack(&h, r);
+    memcpy(buf, &h, sizeof(h));
+    return sizeof(h);
+}
+
+void Resume_take_reply(Resume *r, const void *reply, unsigned int len)
+{
+    Resume_Header h;
+    uint64_t id, size;
+    uint32_t blocks;
+    r->active = 0;
+    memset(r->map, 0, map_bytes(r->blocks));
+    if (len < sizeof(h))
+        return;     // a receiver without -resume: the whole file goes
+    memcpy(&h, reply, sizeof(h));
+    if (header_unpack(&h, &id, &size, &blocks) < 0 || id != r->id || size != r->size ||
+        len != sizeof(h) + map_bytes(blocks))
+    {
+        printf("Invalid resume answer from the receiver, sending the whole file\n");
+        return;
+    }
+    memcpy(r->map, (const char *)reply + sizeof(h), map_bytes(blocks));
+    r->active = 1;
+}
+
+/* Receiver: the record of transfer id, if there is one and the file it describes is still there. */
+static int load_record(Resume *r, uint64_t id, uint64_t size)
+{
+    FILE *fp = fopen(r->_record, "rb");
+    if (fp == NULL)
+        return -1;
+    Resume_Header h;
+    uint64_t rid, rsize;
+    uint32_t blocks;
+    int result = -1;
+    struct stat st;
+    if (fread(&h, sizeof(h), 1, fp) == 1 && header_unpack(&h, &rid, &rsize, &blocks) == 0 && rid == id && rsize == size &&
+        fread(r->map, 1, map_bytes(blocks), fp) == map_bytes(blocks) && stat(r->_out, &st) == 0)
+        result = 0;
+    fclose(fp);
+    return result;
+}
+
+unsigned int Resume_syn_hook(void *ctx, const void *syn, unsigned int len, void *reply)
+{
+    Resume *r = (Resume *)ctx;
+    Resume_Header h;
+    uint64_t id, size;
+    uint32_t blocks;
+    r->active = 0;
+    if (len != sizeof(h))
+        return 0;   // a sender without -resume: a new file
+    memcpy(&h, syn, sizeof(h));
+    if (header_unpack(&h, &id, &size, &blocks) < 0)
+        return 0;
+
+    // what this receiver got of it so far, else what an earlier one recorded, else nothing
+    if (r->id != id || r->size != size)
+    {
+        memset(r->map, 0, map_bytes(RESUME_MAX_BLOCKS));
+        if (load_record(r, id, size) < 0)
+            memset(r->map, 0, map_bytes(RESUME_MAX_BLOCKS));
+        r->id = id;
+        r->size = size;
+        r->blocks = blocks;
+    }
+    r->active = 1;
+    uint64_t have = Resume_have_bytes(r);
+    if (have > 0)
+        printf("Resuming transfer %016llx: %llu of %llu bytes already here\n", (unsigned long long)id,
+               (unsigned long long)have, (unsigned long long)size);
+
+    header_pack(&h, r);
+    memcpy(reply, &h, sizeof(h));
+    memcpy((char *)reply + sizeof(h), r->map, map_bytes(blocks));
+    return (unsigned int)(sizeof(h) + map_bytes(blocks));
+}
+
+int Resume_has(const Resume *r, uint64_t block)
+{
+    return block < r->blocks && (r->map[block / 8] & (1u << (block % 8))) != 0;
+}
+
+void Resume_mark(Resume *r, uint64_t block)
+{
+    if (block < r->blocks)
+        r->map[block / 8] |= (unsigned char)(1u << (block % 8));
+}
+
+uint64_t Resume_next_missing(const Resume *r, uint64_t offset)
+{
+    uint64_t block = offset / RESUME_BLOCK;
+    while (block < r->blocks && Resume_has(r, block))
+        block++;
+    uint64_t next = block * RESUME_BLOCK;
+    return next < r->size ? next : r->size;
+}
+
+uint64_t Resume_have_bytes(const Resume *r)
+{
+    uint64_t have = 0;
+    for (uint64_t block = 0; block < r->blocks; block++)
+        if (Resume_has(r, block))
+            have += (block + 1) * RESUME_BLOCK <= r->size ? RESUME_BLOCK : r->size - block * RESUME_BLOCK;
+    return have;
+}
+
+int Resume_save(const Resume *r)
+{
+    // written aside and renamed over the old one, so a crash leaves one or the other whole
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", r->_record) >= (int)sizeof(tmp))
+        return -1;
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+    Resume_Header h;
+    header_pack(&h, r);
+    int result = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(r->map, 1, map_bytes(r->blocks), fp) == map_bytes(r->blocks) &&
+                         fflush(fp) == 0 && fsync(fileno(fp)) == 0 ? 0 : -1;
+    if (fclose(fp) != 0 || result < 0 || rename(tmp, r->_record) < 0)
+    {
+        perror("Writing the resume record failed");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int Resume_finish(Resume *r, int completed)
+{
+    if (r->id == 0)
+        return 0;
+    r->active = 0;
+    if (completed)
+    {
+        // nothing left to resume
+        if (unlink(r->_record) < 0 && errno != ENOENT)
+            perror("unlink() failed");
+        memset(r->map, 0, map_bytes(r->blocks));
+        r->id = 0;
+        return 0;
+    }
+
+    if (Resume_save(r) < 0)
+        return -1;
+    printf("Transfer %016llx unfinished: %llu of %llu bytes recorded in %s\n", (unsigned long long)r->id,
+           (unsigned long long)Resume_have_bytes(r), (unsigned long long)r->size, r->_record);
+    return 0;
+}
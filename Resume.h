@@ -0,0 +1,57 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Resumable file transfers (-resume with -f on RUDP_Sender, with -o on RUDP_Receiver).
+ * A transfer is named by an ID hashed from the file's name, size and modification time.
+ * The receiver records which blocks of RESUME_BLOCK bytes it has written, in memory and,
+ * every RESUME_SYNC_BLOCKS blocks synced to the file and when a run ends unfinished, in
+ * <out>.resume next to the file, so a receiver restarted even after a crash knows them too.
+ * The sender's SYN asks for the transfer by ID, the SYN-ACK answers with the map of blocks
+ * the receiver has, and the run carries the Payload_Header and then only the blocks missing
+ * from the map, in order; the receiver writes them in place.
+ */
+#define RESUME_BLOCK (1024 * 1024)  // a part of the run (RUN_PART_SIZE): the unit recorded and sent again
+#define RESUME_MAGIC 0x52534D31u    // "RSM1": SYN data, SYN-ACK data and records start with it
+#define RESUME_ATTEMPTS 3           // sender: runs that failed are tried again this many times, each from where it stopped
+#define RESUME_SYNC_BLOCKS 64       // receiver: blocks written between two syncs of the file and its record
+
+typedef struct _Resume
+{
+    uint64_t id;
+    uint64_t size;
+    uint32_t blocks;
+    unsigned char *map;     // bit i: the receiver has block i
+    int active;             // this connection resumes: the run carries only the blocks missing from map
+    const char *_out;       // receiver: the file written
+    char *_record;          // receiver: <out>.resume
+} Resume;
+
+/* Sender: the transfer of the file at path, size bytes; -1 if it cannot be resumed (too large, no such file). */
+int Resume_init_sender(Resume *r, const char *path, uint64_t size);
+/* Receiver: transfers are written to out_path, and recorded in out_path.resume. */
+int Resume_init_receiver(Resume *r, const char *out_path);
+void Resume_free(Resume *r);
+
+/* Sender: the SYN data that asks for the transfer (at most RUDP_SYN_DATA_MAX bytes); its length. */
+unsigned int Resume_request(const Resume *r, void *buf);
+/* Sender: takes the SYN-ACK data; active if the receiver answered with its map, else the whole file goes. */
+void Resume_take_reply(Resume *r, const void *reply, unsigned int len);
+/* Receiver, an RUDP_Syn_Hook: looks the transfer up (in memory, else in the record) and answers with its map. */
+unsigned int Resume_syn_hook(void *ctx, const void *syn, unsigned int len, void *reply);
+
+int Resume_has(const Resume *r, uint64_t block);
+void Resume_mark(Resume *r, uint64_t block);
+/* The file offset of the first block at or after offset's block that is missing; size if none is. */
+uint64_t Resume_next_missing(const Resume *r, uint64_t offset);
+/* Bytes of the file the receiver has. */
+uint64_t Resume_have_bytes(const Resume *r);
+/* Receiver: writes the map to <out>.resume, aside and renamed over the old record; every block marked has to be synced. */
+int Resume_save(const Resume *r);
+/* Receiver, once the run ended and the file was synced: a finished transfer drops its record, any other keeps it. */
+int Resume_finish(Resume *r, int completed);
+
+#endif
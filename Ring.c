@@ -0,0 +1,70 @@
+#include "Ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int Ring_init(Ring *ring, uint32_t capacity, size_t entry_size)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        printf("Ring capacity %u is not a power of two\n", capacity);
+        return -1;
+    }
+    ring->_entries = (char *)malloc((size_t)capacity * entry_size);
+    if (ring->_entries == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    ring->_entry_size = entry_size;
+    ring->_mask = capacity - 1;
+    Ring_reset(ring);
+    return 0;
+}
+
+void Ring_free(Ring *ring)
+{
+    free(ring->_entries);
+    ring->_entries = NULL;
+}
+
+void Ring_reset(Ring *ring)
+{
+    ring->_tail = ring->_head_seen = 0;
+    ring->_head = ring->_tail_seen = 0;
+}
+
+int Ring_push(Ring *ring, const void *entry)
+{
+    uint32_t tail = ring->_tail;
+    if (tail - ring->_head_seen > ring->_mask)
+    {
+        // looks full: see how far the consumer got
+        ring->_head_seen = __atomic_load_n(&ring->_head, __ATOMIC_ACQUIRE);
+        if (tail - ring->_head_seen > ring->_mask)
+            return -1;
+    }
+    memcpy(ring->_entries + (size_t)(tail & ring->_mask) * ring->_entry_size, entry, ring->_entry_size);
+    // the entry is written before the consumer can see it
+    __atomic_store_n(&ring->_tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int Ring_pop(Ring *ring, void *entry)
+{
+    if (Ring_empty(ring))
+        return -1;
+    uint32_t head = ring->_head;
+    memcpy(entry, ring->_entries + (size_t)(head & ring->_mask) * ring->_entry_size, ring->_entry_size);
+    // the entry is read before the producer may overwrite it
+    __atomic_store_n(&ring->_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int Ring_empty(Ring *ring)
+{
+    if (ring->_head != ring->_tail_seen)
+        return 0;
+    ring->_tail_seen = __atomic_load_n(&ring->_tail, __ATOMIC_ACQUIRE);
+    return ring->_head == ring->_tail_seen;
+}
@@ -0,0 +1,40 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+
+/*
+ * Lock-free single-producer single-consumer ring of fixed-size entries.
+ * One thread pushes, one other thread pops; neither ever blocks or takes a lock.
+ * The indexes run free and are masked on use, so all entries are usable. Each
+ * side keeps its index, and a cached copy of the other side's, on its own cache
+ * line: the other side's line is only read when the cached copy says full/empty.
+ */
+typedef struct _Ring
+{
+    char *_entries;
+    size_t _entry_size;
+    uint32_t _mask;
+    _Alignas(RING_CACHE_LINE) uint32_t _tail;   // producer: next entry to push
+    uint32_t _head_seen;                        // producer: _head as last read
+    _Alignas(RING_CACHE_LINE) uint32_t _head;   // consumer: next entry to pop
+    uint32_t _tail_seen;                        // consumer: _tail as last read
+} Ring;
+
+/* Allocates capacity entries (a power of two) of entry_size bytes; the Ring itself must be 64-byte aligned. */
+int Ring_init(Ring *ring, uint32_t capacity, size_t entry_size);
+void Ring_free(Ring *ring);
+/* Empties the ring; only while neither side uses it. */
+void Ring_reset(Ring *ring);
+
+/* Producer: copies entry in; -1 if the ring is full. */
+int Ring_push(Ring *ring, const void *entry);
+/* Consumer: copies the oldest entry out; -1 if the ring is empty. */
+int Ring_pop(Ring *ring, void *entry);
+/* Consumer: true if there is nothing to pop. */
+int Ring_empty(Ring *ring);
+
+#endif
@@ -0,0 +1,300 @@
+#include "Run.h"
+#include <stdio.h>
+#include <string.h>
+
+void Run_Source_init(Run_Source *src, const Payload_Header *header, const char *payload, File_Source *file,
+                     char *chunk, uint64_t size, Compress_Writer *compress)
+{
+    memset(src, 0, sizeof(*src));
+    src->_header = header;
+    src->_payload = payload;
+    src->_file = file;
+    src->_chunk = chunk;
+    src->_size = size;
+    src->_compress = compress;
+    uint64_t size_in_header;
+    Payload_header_unpack(header, &src->_seed, &size_in_header);
+}
+
+/* Goes past the blocks the receiver has, from a block boundary. */
+static void skip_present(Run_Source *src)
+{
+    if (src->_resume != NULL && src->_resume->active)
+        src->_offset = Resume_next_missing(src->_resume, src->_offset);
+}
+
+void Run_Source_resume(Run_Source *src, const Resume *resume)
+{
+    src->_resume = resume;
+    skip_present(src);
+}
+
+int Run_Source_done(const Run_Source *src)
+{
+    return src->_header_taken == sizeof(Payload_Header) && src->_offset == src->_size && src->_pending_len == 0;
+}
+
+ssize_t Run_Source_read(void *ctx, char *buf, size_t cap)
+{
+    Run_Source *src = (Run_Source *)ctx;
+    size_t filled = 0;
+    while (filled < cap)
+    {
+        if (src->_header_taken < sizeof(Payload_Header))
+        {
+            size_t n = sizeof(Payload_Header) - src->_header_taken < cap - filled ? sizeof(Payload_Header) - src->_header_taken : cap - filled;
+            memcpy(buf + filled, (const char *)src->_header + src->_header_taken, n);
+            src->_header_taken += n;
+            filled += n;
+            continue;
+        }
+        if (src->_pending_len == 0)
+        {
+            if (src->_offset == src->_size)
+                break;
+            // files are read, payloads generated, a part at a time; with compress every block goes out as a Compress frame
+            size_t limit = src->_compress != NULL ? COMPRESS_BLOCK_SIZE : RUN_PART_SIZE;
+            size_t n = src->_size - src->_offset < limit ? src->_size - src->_offset : limit;
+            const char *data = src->_chunk;
+            if (src->_payload != NULL)
+                data = src->_payload + src->_offset;
+            else if (src->_file != NULL)
+                data = File_Source_read(src->_file, src->_chunk, src->_offset, n);
+            else
+                Payload_fill_at(src->_seed, src->_offset, src->_chunk, n);
+            if (data == NULL)
+                return -1;
+            src->_offset += n;
+            // parts and Compress blocks divide RESUME_BLOCK, so this is a block boundary or inside one
+            if (src->_offset % RESUME_BLOCK == 0)
+                skip_present(src);
+            if (src->_compress != NULL)
+                src->_pending_len = Compress_Writer_frame(src->_compress, data, n, &src->_pending);
+            else
+            {
+                src->_pending = data;
+                src->_pending_len = n;
+            }
+        }
+        size_t n = src->_pending_len < cap - filled ? src->_pending_len : cap - filled;
+        memcpy(buf + filled, src->_pending, n);
+        src->_pending += n;
+        src->_pending_len -= n;
+        filled += n;
+    }
+    return (ssize_t)filled;
+}
+
+void Run_State_start(Run_State *run)
+{
+    run->total_bytes = 0;
+    run->header_bytes = 0;
+    run->size = 0;
+    run->mismatch = -1;
+    run->is_file = 0;
+    run->is_compressed = 0;
+    run->payload_bytes = 0;
+    run->failed = 0;
+    run->sink_open = 0;
+    run->resumed = 0;
+    run->offset = 0;
+    run->unsaved = 0;
+}
+
+/* Opens the sink; a resumed run keeps what the file has and starts at the first block missing. */
+static int open_sink(Run_State *run)
+{
+    run->resumed = run->resume != NULL && run->resume->active && run->is_file && run->size == run->resume->size;
+    if (!run->resumed)
+        return File_Sink_open(&run->sink, run->out_path, run->size, run->direct);
+    if (File_Sink_open_keep(&run->sink, run->out_path, run->size, run->direct) < 0)
+        return -1;
+    run->offset = Resume_next_missing(run->resume, 0);
+    return File_Sink_seek(&run->sink, run->offset);
+}
+
+/* Writes payload where it goes in the file; a resumed run skips the blocks the file has. */
+static int write_payload(Run_State *run, const char *payload, size_t len)
+{
+    if (!run->resumed)
+        return File_Sink_write(&run->sink, payload, len);
+    while (len > 0)
+    {
+        uint64_t block = run->offset / RESUME_BLOCK;
+        uint64_t end = (block + 1) * RESUME_BLOCK < run->size ? (block + 1) * RESUME_BLOCK : run->size;
+        if (run->offset >= run->size)
+        {
+            printf("Resumed run longer than the blocks missing\n");
+            return -1;
+        }
+        size_t n = end - run->offset < len ? end - run->offset : len;
+        if (File_Sink_write(&run->sink, payload, n) < 0)
+            return -1;
+        run->offset += n;
+        payload += n;
+        len -= n;
+        if (run->offset == end)
+        {
+            // the block is all here; recorded as such once the sink is synced, every RESUME_SYNC_BLOCKS
+            // and by Resume_finish(), so a crash loses the blocks since the last sync at most
+            Resume_mark(run->resume, block);
+            if (++run->unsaved == RESUME_SYNC_BLOCKS)
+            {
+                if (File_Sink_sync(&run->sink) < 0)
+                    return -1;
+                Resume_save(run->resume);
+                run->unsaved = 0;
+            }
+            uint64_t next = Resume_next_missing(run->resume, end);
+            if (next != end && File_Sink_seek(&run->sink, next) < 0)
+                return -1;
+            run->offset = next;
+        }
+    }
+    return 0;
+}
+
+int Run_State_consume(void *ctx, const char *data, size_t n)
+{
+    Run_State *run = (Run_State *)ctx;
+    if (n > 0)
+        Run_Timer_chunk(run->timer);
+    run->total_bytes += n;
+
+    if (run->header_bytes < sizeof(run->header))
+    {
+        size_t h = sizeof(run->header) - run->header_bytes < n ? sizeof(run->header) - run->header_bytes : n;
+        memcpy((char *)&run->header + run->header_bytes, data, h);
+        run->header_bytes += h;
+        data += h;
+        n -= h;
+        if (run->header_bytes == sizeof(run->header))
+        {
+            if (Payload_header_unpack(&run->header, &run->seed, &run->size) < 0)
+                printf("Invalid payload header\n");
+            Payload_init(&run->expected, run->seed);
+            run->is_file = (Payload_header_flags(&run->header) & PAYLOAD_FILE) != 0;
+            run->is_compressed = (Payload_header_flags(&run->header) & PAYLOAD_COMPRESSED) != 0;
+            Compress_Reader_reset(run->reader);
+            if (run->out_path != NULL)
+            {
+                if (open_sink(run) < 0)
+                    return -1;
+                run->sink_open = 1;
+            }
+        }
+    }
+
+    // with -compress the data is Compress frames, decoded a block at a time
+    while (n > 0 && !run->failed)
+    {
+        const char *payload = data;
+        size_t payload_len = n;
+        if (run->is_compressed)
+        {
+            ssize_t consumed = Compress_Reader_feed(run->reader, data, n, &payload, &payload_len);
+            if (consumed < 0)
+            {
+                run->failed = 1;
+                break;
+            }
+            data += consumed;
+            n -= consumed;
+        }
+        else
+            n = 0;
+
+        run->payload_bytes += payload_len;
+        if (run->sink_open && payload_len > 0 && write_payload(run, payload, payload_len) < 0)
+            run->failed = 1;
+        if (run->verify && !run->is_file && payload_len > 0 && run->mismatch == -1)
+            run->mismatch = Payload_verify(&run->expected, payload, payload_len);
+    }
+    return run->failed ? -1 : 0;
+}
+
+int Run_State_finish(Run_State *run, Run_Report *report, int completed, const char *gap_label)
+{
+    // synced before it is reported, so the figure is the disk's and not the page cache's
+    int synced = run->sink_open && File_Sink_close(&run->sink) == 0;
+    // only blocks on disk are recorded; an unfinished run is picked up where it stopped
+    if (run->resumed && synced)
+        Resume_finish(run->resume, completed);
+    if (synced && completed)
+    {
+        double disk_ms = File_Sink_disk_ms(&run->sink);
+        printf("Disk: wrote %llu bytes to %s in %f ms (%f MB/s)\n", (unsigned long long)File_Sink_written(&run->sink),
+               run->out_path, disk_ms, disk_ms > 0 ? File_Sink_written(&run->sink) / (disk_ms * 1000.0) : 0.0);
+    }
+    if (!completed)
+        return 0;
+    if (run->out_path != NULL && !run->sink_open)
+    {
+        printf("Could not write %s\n", run->out_path);
+        return -1;
+    }
+
+    printf("End receiving data\n");
+    if (run->verify && run->is_file)
+        printf("Integrity: not checked, the run is a file\n");
+    else if (run->verify && run->mismatch == -1 && run->payload_bytes == run->size)
+        printf("Integrity: OK\n");
+    else if (run->verify)
+        printf("Integrity: MISMATCH at byte %lld (%llu of %llu bytes received)\n", (long long)run->mismatch,
+               (unsigned long long)run->payload_bytes, (unsigned long long)run->size);
+
+    // Wall-clock time from the first to the last chunk of the run
+    double milliseconds = Run_Timer_total_ms(run->timer);
+    if (run->is_compressed)
+        Compress_Reader_print_stats(run->reader, milliseconds);
+    // application bytes: with -compress the wire carries fewer
+    double speed = milliseconds > 0 ? (sizeof(run->header) + run->payload_bytes) / (milliseconds * 1000.0) : 0.0;
+    int round = (int)Stats_size(report->stats) + 1;
+    Stats_add(report->stats, round, milliseconds, speed);
+    printf("Run #%d Data: Time: %fms Speed: %fMB/s TTFB: %fms\n", round, milliseconds, speed, Run_Timer_ttfb_ms(run->timer));
+    Histogram_print(Run_Timer_gaps(run->timer), gap_label, 1000.0, "us");
+    Histogram_merge(report->gaps, Run_Timer_gaps(run->timer));
+    Histogram_record(report->ttfb, (uint64_t)(Run_Timer_ttfb_ms(run->timer) * 1000000.0));
+    Histogram_record(report->times, (uint64_t)(milliseconds * 1000000.0));
+    return 0;
+}
+
+int Run_Report_init(Run_Report *report)
+{
+    report->stats = Stats_alloc();
+    report->gaps = Histogram_alloc();
+    report->ttfb = Histogram_alloc();
+    report->times = Histogram_alloc();
+    if (Run_Timer_init(&report->timer) < 0 || report->stats == NULL || report->gaps == NULL || report->ttfb == NULL ||
+        report->times == NULL)
+    {
+        perror("Histogram_alloc() failed");
+        return -1;
+    }
+    return 0;
+}
+
+void Run_Report_free(Run_Report *report)
+{
+    Stats_free(report->stats);
+    Run_Timer_destroy(&report->timer);
+    Histogram_free(report->gaps);
+    Histogram_free(report->ttfb);
+    Histogram_free(report->times);
+}
+
+void Run_Report_print(const Run_Report *report, const char *gap_label, const char *json_path, const char *csv_path,
+                      const char *label)
+{
+    print_stats(report->stats);
+    if (Stats_size(report->stats) > 0)
+    {
+        Histogram_print(report->times, "Transfer time", 1000000.0, "ms");
+        Histogram_print(report->ttfb, "Time to first byte", 1000000.0, "ms");
+        Histogram_print(report->gaps, gap_label, 1000.0, "us");
+    }
+    if (json_path != NULL)
+        Stats_write_json(report->stats, json_path, label);
+    if (csv_path != NULL)
+        Stats_write_csv(report->stats, csv_path, label);
+}
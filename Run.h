@@ -0,0 +1,105 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "Payload.h"
+#include "File_IO.h"
+#include "Compress.h"
+#include "Resume.h"
+#include "Stats.h"
+#include "Timing.h"
+
+/*
+ * One run as the transports carry it, independent of the transport: a Payload_Header,
+ * then the payload, or the file with -f, or their Compress frames with -compress.
+ *
+ * The sender reads the run as a byte stream from a Run_Source; the receiver feeds
+ * whatever arrives, in order, to a Run_State, which parses the header, decodes,
+ * writes and verifies the payload. A Run_Report keeps every run's figures, so every
+ * transport is timed and summarized by the same code.
+ */
+#define RUN_PART_SIZE (1024 * 1024) // bytes read from a Run_Source at a time: files are read, runs sent, in parts
+
+typedef struct _Run_Source
+{
+    const Payload_Header *_header;
+    const char *_payload;        // in memory, or NULL to read it from _file or, without one, generate it
+    File_Source *_file;
+    char *_chunk;                // RUN_PART_SIZE bytes the file is read or the payload generated into
+    uint64_t _seed;
+    uint64_t _size;
+    Compress_Writer *_compress;
+    size_t _header_taken;
+    uint64_t _offset;            // payload bytes read so far
+    const char *_pending;        // the part or frame being handed out
+    size_t _pending_len;
+    const Resume *_resume;       // blocks the receiver has are skipped
+} Run_Source;
+
+typedef struct _Run_State
+{
+    // set once
+    int verify;
+    const char *out_path;
+    int direct;
+    Compress_Reader *reader;     // runs sent with -compress
+    Run_Timer *timer;            // a chunk is recorded for every Run_State_consume()
+    Resume *resume;              // -resume: files are written where their blocks go, and the blocks recorded
+    // per run, cleared by Run_State_start()
+    uint64_t total_bytes;        // as received, header included
+    Payload_Header header;
+    size_t header_bytes;
+    uint64_t seed;
+    uint64_t size;
+    Payload expected;
+    int64_t mismatch;
+    int is_file;
+    int is_compressed;
+    uint64_t payload_bytes;      // decoded
+    int failed;
+    File_Sink sink;              // -o: every run is written to out_path
+    int sink_open;
+    int resumed;                 // the run carries only the blocks resume lacks
+    uint64_t offset;             // resumed: where in the file the next payload byte goes
+    int unsaved;                 // resumed: blocks marked since the file was last synced and recorded
+} Run_State;
+
+/* Every run's figures, for the per-run lines and the final report. */
+typedef struct _Run_Report
+{
+    Stats *stats;
+    Run_Timer timer;
+    Histogram *gaps;             // chunk inter-arrival, ns
+    Histogram *ttfb;
+    Histogram *times;
+} Run_Report;
+
+/* payload and file NULL: the payload is generated from the header's seed a part at a time. */
+void Run_Source_init(Run_Source *src, const Payload_Header *header, const char *payload, File_Source *file,
+                     char *chunk, uint64_t size, Compress_Writer *compress);
+/* With resume active, the run leaves out the blocks the receiver has; before the first read. */
+void Run_Source_resume(Run_Source *src, const Resume *resume);
+/* True once every byte of the run was read. */
+int Run_Source_done(const Run_Source *src);
+/* Copies up to cap next bytes of the run into buf (a Stripe_Read); 0 at its end, -1 on failure. */
+ssize_t Run_Source_read(void *ctx, char *buf, size_t cap);
+
+/* Clears the per-run fields for the next run. */
+void Run_State_start(Run_State *run);
+/* Takes the next n bytes of the run (a Stripe_Write); -1 once the run cannot go on. */
+int Run_State_consume(void *ctx, const char *data, size_t n);
+/*
+ * Ends the run: closes its file and, if it completed, prints and records its figures
+ * in report, gaps labelled gap_label. Returns -1 if the file could not be written.
+ */
+int Run_State_finish(Run_State *run, Run_Report *report, int completed, const char *gap_label);
+
+int Run_Report_init(Run_Report *report);
+void Run_Report_free(Run_Report *report);
+/* Prints every run and the summaries; json_path and csv_path may be NULL. */
+void Run_Report_print(const Run_Report *report, const char *gap_label, const char *json_path, const char *csv_path,
+                      const char *label);
+
+#endif
@@ -0,0 +1,217 @@
+#include "Stats.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_INITIAL_CAPACITY 16
+
+// two-sided 95% Student's t quantiles for 1..30 degrees of freedom
+static const double t95[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                             2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                             2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+// ************ Welford **************
+void Welford_init(Welford *w)
+{
+    memset(w, 0, sizeof(Welford));
+}
+
+void Welford_add(Welford *w, double x)
+{
+    w->_n++;
+    double delta = x - w->_mean;
+    w->_mean += delta / w->_n;
+    w->_m2 += delta * (x - w->_mean);
+    if (w->_n == 1 || x < w->_min)
+        w->_min = x;
+    if (w->_n == 1 || x > w->_max)
+        w->_max = x;
+}
+
+double Welford_mean(const Welford *w)
+{
+    return w->_mean;
+}
+
+double Welford_stddev(const Welford *w)
+{
+    return w->_n > 1 ? sqrt(w->_m2 / (w->_n - 1)) : 0.0;
+}
+
+double Welford_ci95(const Welford *w)
+{
+    if (w->_n < 2)
+        return 0.0;
+    size_t df = w->_n - 1;
+    double t = df <= sizeof(t95) / sizeof(t95[0]) ? t95[df - 1] : 1.96;
+    return t * Welford_stddev(w) / sqrt((double)w->_n);
+}
+
+// ************ Stats **************
+Stats *Stats_alloc(void)
+{
+    Stats *p = (Stats *)malloc(sizeof(Stats));
+    if (p == NULL)
+        return NULL;
+    p->_samples = (Run_Sample *)malloc(STATS_INITIAL_CAPACITY * sizeof(Run_Sample));
+    if (p->_samples == NULL)
+    {
+        free(p);
+        return NULL;
+    }
+    p->_size = 0;
+    p->_capacity = STATS_INITIAL_CAPACITY;
+    Welford_init(&p->_time);
+    Welford_init(&p->_speed);
+    return p;
+}
+
+void Stats_free(Stats *stats)
+{
+    if (stats == NULL)
+        return;
+    free(stats->_samples);
+    free(stats);
+}
+
+int Stats_add(Stats *stats, int run, double time_ms, double speed)
+{
+    if (stats->_size == stats->_capacity)
+    {
+        Run_Sample *grown = (Run_Sample *)realloc(stats->_samples, 2 * stats->_capacity * sizeof(Run_Sample));
+        if (grown == NULL)
+            return -1;
+        stats->_samples = grown;
+        stats->_capacity *= 2;
+    }
+
+    Run_Sample *s = &stats->_samples[stats->_size++];
+    s->run = run;
+    s->time_ms = time_ms;
+    s->speed = speed;
+    Welford_add(&stats->_time, time_ms);
+    Welford_add(&stats->_speed, speed);
+    return 0;
+}
+
+size_t Stats_size(const Stats *stats)
+{
+    return stats->_size;
+}
+
+const Run_Sample *Stats_get(const Stats *stats, size_t index)
+{
+    return index < stats->_size ? &stats->_samples[index] : NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_of(const Stats *stats, size_t field_offset, double percentile)
+{
+    if (stats->_size == 0)
+        return 0.0;
+
+    double *values = (double *)malloc(stats->_size * sizeof(double));
+    if (values == NULL)
+        return 0.0;
+    for (size_t i = 0; i < stats->_size; i++)
+        values[i] = *(const double *)((const char *)&stats->_samples[i] + field_offset);
+    qsort(values, stats->_size, sizeof(double), compare_doubles);
+
+    double rank = percentile / 100.0 * (stats->_size - 1);
+    size_t lo = (size_t)rank;
+    size_t hi = lo + 1 < stats->_size ? lo + 1 : lo;
+    double result = values[lo] + (rank - lo) * (values[hi] - values[lo]);
+    free(values);
+    return result;
+}
+
+double Stats_time_percentile(const Stats *stats, double percentile)
+{
+    return percentile_of(stats, offsetof(Run_Sample, time_ms), percentile);
+}
+
+double Stats_speed_percentile(const Stats *stats, double percentile)
+{
+    return percentile_of(stats, offsetof(Run_Sample, speed), percentile);
+}
+
+static void print_summary(const Stats *stats, const char *name, const Welford *w, size_t field_offset, const char *unit)
+{
+    printf("Average %s: %f %s\n", name, Welford_mean(w), unit);
+    printf("  stddev %f, min %f, p50 %f, p90 %f, p99 %f, max %f, 95%% CI +/- %f %s\n", Welford_stddev(w), w->_min,
+           percentile_of(stats, field_offset, 50.0), percentile_of(stats, field_offset, 90.0),
+           percentile_of(stats, field_offset, 99.0), w->_max, Welford_ci95(w), unit);
+}
+
+void print_stats(const Stats *stats)
+{
+    if (stats->_size < 1)
+        return;
+
+    printf("-----------------------------\n");
+    printf("Stats:\n");
+    printf("Number of runs: %zu\n", stats->_size);
+
+    for (size_t i = 0; i < stats->_size; i++)
+        printf("Run #%d Data: Time: %f ms, Speed: %f MB/s\n", stats->_samples[i].run, stats->_samples[i].time_ms, stats->_samples[i].speed);
+
+    print_summary(stats, "Time", &stats->_time, offsetof(Run_Sample, time_ms), "ms");
+    print_summary(stats, "Speed", &stats->_speed, offsetof(Run_Sample, speed), "MB/s");
+    printf("-----------------------------\n");
+}
+
+static void write_json_summary(FILE *fp, const Stats *stats, const char *name, const Welford *w, size_t field_offset)
+{
+    fprintf(fp, "  \"%s\": {\"n\": %zu, \"mean\": %f, \"stddev\": %f, \"min\": %f, \"max\": %f, "
+                "\"p50\": %f, \"p90\": %f, \"p99\": %f, \"ci95\": %f}",
+            name, w->_n, Welford_mean(w), Welford_stddev(w), w->_min, w->_max, percentile_of(stats, field_offset, 50.0),
+            percentile_of(stats, field_offset, 90.0), percentile_of(stats, field_offset, 99.0), Welford_ci95(w));
+}
+
+int Stats_write_json(const Stats *stats, const char *path, const char *label)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    fprintf(fp, "{\n  \"label\": \"%s\",\n  \"runs\": [", label);
+    for (size_t i = 0; i < stats->_size; i++)
+    {
+        const Run_Sample *s = &stats->_samples[i];
+        fprintf(fp, "%s\n    {\"run\": %d, \"time_ms\": %f, \"speed_mbps\": %f}", i ? "," : "", s->run, s->time_ms, s->speed);
+    }
+    fprintf(fp, "\n  ],\n");
+    write_json_summary(fp, stats, "time_ms", &stats->_time, offsetof(Run_Sample, time_ms));
+    fprintf(fp, ",\n");
+    write_json_summary(fp, stats, "speed_mbps", &stats->_speed, offsetof(Run_Sample, speed));
+    fprintf(fp, "\n}\n");
+
+    fclose(fp);
+    return 0;
+}
+
+int Stats_write_csv(const Stats *stats, const char *path, const char *label)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    fprintf(fp, "label,run,time_ms,speed_mbps\n");
+    for (size_t i = 0; i < stats->_size; i++)
+        fprintf(fp, "%s,%d,%f,%f\n", label, stats->_samples[i].run, stats->_samples[i].time_ms, stats->_samples[i].speed);
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+/* Online mean/variance (Welford), min and max of one measured quantity. */
+typedef struct _Welford
+{
+    size_t _n;
+    double _mean;
+    double _m2; // sum of squared differences from the mean
+    double _min;
+    double _max;
+} Welford;
+
+typedef struct _Run_Sample
+{
+    int run;
+    double time_ms;
+    double speed;   // MB/s
+} Run_Sample;
+
+/*
+ * Per-run results of a receiver. Samples live in one growable array, so adding a
+ * run is amortized O(1); the summaries are kept up to date as runs are added.
+ */
+typedef struct _Stats
+{
+    Run_Sample *_samples;
+    size_t _size;
+    size_t _capacity;
+    Welford _time;
+    Welford _speed;
+} Stats;
+
+void Welford_init(Welford *w);
+void Welford_add(Welford *w, double x);
+double Welford_mean(const Welford *w);
+double Welford_stddev(const Welford *w);
+/* Half width of the 95% confidence interval of the mean (Student's t). */
+double Welford_ci95(const Welford *w);
+
+/*
+ * Allocates a new empty Stats.
+ * It's the user responsibility to free it with Stats_free.
+ */
+Stats *Stats_alloc(void);
+/* If stats==NULL does nothing (same as free). */
+void Stats_free(Stats *stats);
+/* Appends a run, returns -1 if the array could not grow. */
+int Stats_add(Stats *stats, int run, double time_ms, double speed);
+size_t Stats_size(const Stats *stats);
+const Run_Sample *Stats_get(const Stats *stats, size_t index);
+/* Percentile (0-100) of run times or speeds, interpolated between ranks. */
+double Stats_time_percentile(const Stats *stats, double percentile);
+double Stats_speed_percentile(const Stats *stats, double percentile);
+
+/* Prints every run followed by the summaries. */
+void print_stats(const Stats *stats);
+/* Machine-readable copies of print_stats; label names the configuration (e.g. the CC algorithm). */
+int Stats_write_json(const Stats *stats, const char *path, const char *label);
+int Stats_write_csv(const Stats *stats, const char *path, const char *label);
+
+#endif
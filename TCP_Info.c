@@ -0,0 +1,158 @@
+#include "TCP_Info.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h> // the glibc struct tcp_info lacks the pacing/delivery rates
+
+static double elapsed_ms(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+static void take_sample(TCP_Info_Sampler *sampler)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+
+    if (getsockopt(sampler->_sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // overwrite the oldest sample once the ring is full
+    TCP_Info_Sample *s = &sampler->_samples[sampler->_count % sampler->_capacity];
+    s->t_ms = elapsed_ms(&sampler->_start, &now);
+    s->cwnd = info.tcpi_snd_cwnd;
+    s->ssthresh = info.tcpi_snd_ssthresh;
+    s->srtt_us = info.tcpi_rtt;
+    s->rttvar_us = info.tcpi_rttvar;
+    s->retransmits = info.tcpi_total_retrans;
+    s->pacing_rate = info.tcpi_pacing_rate;
+    s->delivery_rate = info.tcpi_delivery_rate;
+    sampler->_count++;
+}
+
+static void *sampler_thread(void *arg)
+{
+    TCP_Info_Sampler *sampler = (TCP_Info_Sampler *)arg;
+    struct timespec next = sampler->_start;
+
+    while (sampler->_running)
+    {
+        take_sample(sampler);
+
+        // absolute deadlines keep the cadence steady regardless of getsockopt() cost
+        next.tv_nsec += (long)sampler->_interval_us * 1000;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    take_sample(sampler); // final state of the run
+    return NULL;
+}
+
+TCP_Info_Sampler *TCP_Info_alloc(int sock, unsigned int interval_us, size_t capacity)
+{
+    if (interval_us == 0 || capacity == 0)
+        return NULL;
+
+    TCP_Info_Sampler *p = (TCP_Info_Sampler *)calloc(1, sizeof(TCP_Info_Sampler));
+    if (p == NULL)
+        return NULL;
+
+    p->_samples = (TCP_Info_Sample *)calloc(capacity, sizeof(TCP_Info_Sample));
+    if (p->_samples == NULL)
+    {
+        free(p);
+        return NULL;
+    }
+    p->_sock = sock;
+    p->_interval_us = interval_us;
+    p->_capacity = capacity;
+    return p;
+}
+
+int TCP_Info_start(TCP_Info_Sampler *sampler)
+{
+    sampler->_count = 0;
+    sampler->_running = 1;
+    clock_gettime(CLOCK_MONOTONIC, &sampler->_start);
+
+    if (pthread_create(&sampler->_thread, NULL, sampler_thread, sampler) != 0)
+    {
+        perror("pthread_create() failed");
+        sampler->_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int TCP_Info_stop(TCP_Info_Sampler *sampler)
+{
+    if (!sampler->_running)
+        return 0;
+
+    sampler->_running = 0;
+    if (pthread_join(sampler->_thread, NULL) != 0)
+    {
+        perror("pthread_join() failed");
+        return -1;
+    }
+    return 0;
+}
+
+size_t TCP_Info_size(const TCP_Info_Sampler *sampler)
+{
+    return sampler->_count < sampler->_capacity ? sampler->_count : sampler->_capacity;
+}
+
+int TCP_Info_export_csv(const TCP_Info_Sampler *sampler, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    fprintf(fp, "t_ms,cwnd,ssthresh,srtt_us,rttvar_us,retransmits,pacing_rate,delivery_rate\n");
+
+    size_t size = TCP_Info_size(sampler);
+    size_t first = sampler->_count - size; // oldest sample still in the ring
+    for (size_t i = 0; i < size; i++)
+    {
+        const TCP_Info_Sample *s = &sampler->_samples[(first + i) % sampler->_capacity];
+        fprintf(fp, "%.3f,%u,%u,%u,%u,%u,%llu,%llu\n", s->t_ms, s->cwnd, s->ssthresh, s->srtt_us, s->rttvar_us,
+                s->retransmits, (unsigned long long)s->pacing_rate, (unsigned long long)s->delivery_rate);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+void TCP_Info_print(int sock)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+        return;
+    printf("TCP_INFO: srtt %u us (var %u us), %u segments retransmitted, cwnd %u\n",
+           info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_total_retrans, info.tcpi_snd_cwnd);
+}
+
+void TCP_Info_free(TCP_Info_Sampler *sampler)
+{
+    if (sampler == NULL)
+        return;
+    TCP_Info_stop(sampler);
+    free(sampler->_samples);
+    free(sampler);
+}
@@ -0,0 +1,49 @@
+#ifndef TCP_INFO_H
+#define TCP_INFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TCP_INFO_DEFAULT_CAPACITY 65536
+
+typedef struct _TCP_Info_Sample
+{
+    double t_ms;             // time since the sampler was started
+    uint32_t cwnd;           // congestion window, in segments
+    uint32_t ssthresh;       // slow start threshold, in segments
+    uint32_t srtt_us;        // smoothed RTT
+    uint32_t rttvar_us;      // RTT variance
+    uint32_t retransmits;    // total retransmitted segments so far
+    uint64_t pacing_rate;    // bytes per second
+    uint64_t delivery_rate;  // bytes per second
+} TCP_Info_Sample;
+
+typedef struct _TCP_Info_Sampler
+{
+    int _sock;
+    unsigned int _interval_us;
+    TCP_Info_Sample *_samples; // preallocated ring
+    size_t _capacity;
+    size_t _count;             // total samples taken, may exceed _capacity
+    volatile int _running;
+    pthread_t _thread;
+    struct timespec _start;
+} TCP_Info_Sampler;
+
+/* Allocates a sampler for sock with a ring of capacity samples. */
+TCP_Info_Sampler *TCP_Info_alloc(int sock, unsigned int interval_us, size_t capacity);
+/* Clears the ring and starts the sampling thread. */
+int TCP_Info_start(TCP_Info_Sampler *sampler);
+/* Stops the sampling thread, keeping the samples. */
+int TCP_Info_stop(TCP_Info_Sampler *sampler);
+/* Number of samples currently held in the ring. */
+size_t TCP_Info_size(const TCP_Info_Sampler *sampler);
+/* Writes the ring, oldest sample first, as CSV. */
+int TCP_Info_export_csv(const TCP_Info_Sampler *sampler, const char *path);
+/* Prints the connection's RTT and retransmissions as the kernel sees them now. */
+void TCP_Info_print(int sock);
+void TCP_Info_free(TCP_Info_Sampler *sampler);
+
+#endif
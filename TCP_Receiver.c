@@ -8,114 +8,94 @@
 #include <netinet/in.h>
 #include <errno.h>
 #include <time.h>
+#include "TCP_Tuning.h"
+#include "IO_Backend.h"
+#include "Payload.h"
+#include "File_IO.h"
+#include "Compress.h"
+#include "Timing.h"
+#include "Stats.h"
+#include "Busy_Poll.h"
+#include "Timestamp.h"
 
 #define BUFFER_SIZE 65536
 #define MAX_PENDING_CONNECTIONS 1
 
-typedef struct _node
+void cleanup(int listeningSocket, int clientSocket)
 {
-    int _run;
-    double _time;
-    double _speed;
-    struct _node *_next;
-} Node;
+    if (clientSocket >= 0)
+        IO_close(clientSocket);
+    close(listeningSocket);
+    IO_cleanup();
+}
 
-typedef struct _StrList
+int main(int argc, char *argv[])
 {
-    Node *_head;
-    size_t _size;
-} StrList;
+    char *message = "Exit\n";
 
-Node *Node_alloc(int run, double time, double speed, Node *next)
-{
-    Node *p = (Node *)malloc(sizeof(Node));
-    if (p == NULL)
+    const char *port = NULL;
+    const char *algo = "unknown";
+    const char *profile_name = "default";
+    IO_Backend backend = IO_SYSCALL;
+    int verify = 0;
+    const char *json_path = NULL;
+    const char *csv_path = NULL;
+    const char *out_path = NULL;
+    int direct = 0;
+    int i;
+    for (i = 1; i < argc; i++)
     {
-        return NULL;
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            port = argv[++i];
+        else if (strcmp(argv[i], "-algo") == 0 && i + 1 < argc)
+            algo = argv[++i];
+        else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+            profile_name = argv[++i];
+        else if (strcmp(argv[i], "-verify") == 0)
+            verify = 1;
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (strcmp(argv[i], "-direct") == 0)
+            direct = 1;
+        else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc)
+        {
+            if (IO_parse_backend(argv[++i], &backend) < 0)
+                break;
+        }
+        else if (Timestamp_option(argc, argv, &i) == 0 && Busy_Poll_option(argc, argv, &i) <= 0)
+            break;
     }
-    p->_run = run;
-    p->_time = time;
-    p->_speed = speed;
-    p->_next = next;
-    return p;
-}
-
-void Node_free(Node *node)
-{
-    free(node);
-}
-
-/*
- * Allocates a new empty StrList.
- * It's the user responsibility to free it with StrList_free.
- */
-StrList *StrList_alloc()
-{
-    StrList *p = (StrList *)malloc(sizeof(StrList));
-    p->_head = NULL;
-    p->_size = 0;
-    return p;
-}
-
-/*
- * Frees the memory and resources allocated to StrList.
- * If StrList==NULL does nothing (same as free).
- */
-void StrList_free(StrList *StrList)
-{
-    if (StrList == NULL)
-        return;
-    Node *p1 = StrList->_head;
-    Node *p2;
-    while (p1)
+    const TCP_Profile *profile = TCP_Tuning_find_profile(profile_name);
+    if (i < argc || port == NULL || profile == NULL)
     {
-        p2 = p1;
-        p1 = p1->_next;
-        Node_free(p2);
+        printf("Usage: %s -p <port> [-algo <algorithm>] [-profile <name>] [-io <syscall|uring>] [-verify] [-json <file>] [-csv <file>] [-o <file> [-direct]] " BUSY_POLL_USAGE " " TIMESTAMP_USAGE "\n", argv[0]);
+        printf("Profiles:\n");
+        TCP_Tuning_print_profiles();
+        return -1;
     }
-    free(StrList);
-}
 
-/*
- * Returns the number of elements in the StrList.
- */
-size_t StrList_size(const StrList *StrList)
-{
-    return StrList->_size;
-}
+    IO_init(backend, NULL, 0);
+    if (Busy_Poll_start() < 0 || Timestamp_start() < 0)
+        return -1;
+    Stats *stats = Stats_alloc();
+    Compress_Reader reader;     // runs sent with -compress
+    if (Compress_Reader_init(&reader) < 0)
+        return -1;
 
-/*
- * Inserts an element in the end of the StrList.
- */
-void StrList_insertLast(StrList *StrList, int run, double time, double speed)
-{
-    Node *p = Node_alloc(run, time, speed, NULL);
-    if (StrList->_head == NULL)
+    // per-run timer, plus every run's figures for the final report
+    Run_Timer timer;
+    Histogram *allGaps = Histogram_alloc();
+    Histogram *allTtfb = Histogram_alloc();
+    Histogram *allTimes = Histogram_alloc();
+    if (Run_Timer_init(&timer) < 0 || allGaps == NULL || allTtfb == NULL || allTimes == NULL)
     {
-        StrList->_head = p;
-    }
-    else
-    {
-        Node *q = StrList->_head;
-        while (q->_next)
-        {
-            q = q->_next;
-        }
-        q->_next = p;
+        perror("Histogram_alloc() failed");
+        return -1;
     }
-    StrList->_size++;
-}
-
-void cleanup(int listeningSocket, int clientSocket)
-{
-    close(clientSocket);
-    close(listeningSocket);
-}
-
-int main(int argc, char *argv[])
-{
-    char *message = "Exit\n";
-    StrList *list = StrList_alloc();
 
     // Create a socket.
     int listeningSocket = socket(AF_INET, SOCK_STREAM, 0);
@@ -134,13 +114,22 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // Accepted sockets inherit these, and SO_RCVBUF must be set before listen() to size the window scale.
+    printf("Using tuning profile %s\n", profile->name);
+    if (TCP_Tuning_apply(listeningSocket, profile) < 0)
+    {
+        cleanup(listeningSocket, -1);
+        return 1;
+    }
+    Busy_Poll_socket(listeningSocket);
+
     // Bind the socket to the server address.
     struct sockaddr_in serverAddress;
     memset(&serverAddress, 0, sizeof(serverAddress));
 
     // Fill the server address structure.
     serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(atoi(argv[2]));
+    serverAddress.sin_port = htons(atoi(port));
     serverAddress.sin_addr.s_addr = INADDR_ANY;
 
     // Bind the server address to the socket.
@@ -179,87 +168,189 @@ int main(int argc, char *argv[])
             return -1;
         }
         printf("Connection accepted\n");
+        Timestamp_socket(clientSocket);
 
         // Receive data from the client.
-        char buffer[BUFFER_SIZE] = {0};
-
+        char buffer[BUFFER_SIZE];
+        int buffered = 0; // bytes received into buffer
+        int parsed = 0;   // bytes of buffer already consumed, the rest belongs to the next run
         // create a list to store the data
         int round = 1;
         int exitflag = 0;
+        int disconnected = 0;
 
         while (exitflag == 0)
         {
-            // Clear the buffer
-            bzero(buffer, BUFFER_SIZE);
-
-            clock_t start_time, end_time;
-
-            // Receive data from client in chunks
-            int bytes_received;
-            int firstround = 1;
-            int totalBytes = 0;
+            // Each run is a Payload_Header, header.size payload bytes and 'F'; 'E' instead of a header ends the session.
+            Payload_Header header;
+            size_t header_bytes = 0;
+            uint64_t totalBytes = 0;
+            uint64_t runSize = 0;
+            Payload expected;
+            int64_t mismatch = -1;
             int finishflag = 0;
-            exitflag = 0;
+            int is_file = 0;
+            int is_compressed = 0;
+            File_Sink sink;     // -o: every run is written to out_path
+            IO_reset_syscalls();
+            Run_Timer_arm(&timer);
 
-            while ((bytes_received = recv(clientSocket, buffer, sizeof(buffer), 0)) > 0 && finishflag == 0 && exitflag == 0)
+            while (finishflag == 0 && exitflag == 0)
             {
-                totalBytes += bytes_received;
-
-                if (firstround)
+                if (parsed == buffered)
                 {
-                    start_time = clock();
-                    printf("start receiving data\n");
+                    int bytes_received = IO_recv(clientSocket, buffer, sizeof(buffer));
+                    if (bytes_received < 0)
+                    {
+                        perror("recv(2)");
+                        cleanup(listeningSocket, clientSocket);
+                        return 1;
+                    }
+                    if (bytes_received == 0)
+                    {
+                        fprintf(stdout, "Client %s:%d disconnected\n", inet_ntoa(clientAddress.sin_addr), ntohs(clientAddress.sin_port));
+                        disconnected = 1;
+                        exitflag = 1;
+                        break;
+                    }
+                    buffered = bytes_received;
+                    parsed = 0;
+                    Run_Timer_chunk(&timer);
                 }
-                if (memchr(buffer, 'F', sizeof(buffer)) != NULL)
-                {
-                    printf("Received finish command. Exiting loop.\n");
-                    finishflag = 1;
-                    break;
-                }
-                if (memchr(buffer, 'E', sizeof(buffer)) != NULL)
+
+                char *data = buffer + parsed;
+                size_t available = buffered - parsed;
+
+                if (header_bytes < sizeof(header))
                 {
-                    printf("Received exit command. Exiting loop.\n");
-                    exitflag = 1;
-                    break;
+                    if (header_bytes == 0 && data[0] == 'E')
+                    {
+                        printf("Received exit command. Exiting loop.\n");
+                        parsed++;
+                        exitflag = 1;
+                        break;
+                    }
+                    if (header_bytes == 0)
+                    {
+                        if (!Run_Timer_started(&timer))
+                            Run_Timer_chunk(&timer); // the run started in the previous run's last chunk
+                        printf("start receiving data\n");
+                    }
+
+                    size_t n = sizeof(header) - header_bytes < available ? sizeof(header) - header_bytes : available;
+                    memcpy((char *)&header + header_bytes, data, n);
+                    header_bytes += n;
+                    parsed += n;
+
+                    uint64_t seed;
+                    if (header_bytes == sizeof(header))
+                    {
+                        if (Payload_header_unpack(&header, &seed, &runSize) < 0)
+                        {
+                            printf("Invalid payload header\n");
+                            cleanup(listeningSocket, clientSocket);
+                            return 1;
+                        }
+                        Payload_init(&expected, seed);
+                        is_file = (Payload_header_flags(&header) & PAYLOAD_FILE) != 0;
+                        is_compressed = (Payload_header_flags(&header) & PAYLOAD_COMPRESSED) != 0;
+                        Compress_Reader_reset(&reader);
+                        if (out_path != NULL && File_Sink_open(&sink, out_path, runSize, direct) < 0)
+                        {
+                            cleanup(listeningSocket, clientSocket);
+                            return 1;
+                        }
+                    }
                 }
-                // Handle received data
-                if (bytes_received < 0)
+                else if (totalBytes < runSize)
                 {
-                    perror("recv(2)");
-                    cleanup(listeningSocket, clientSocket);
-                    return 1;
+                    size_t n = runSize - totalBytes < available ? runSize - totalBytes : available;
+                    size_t used = n;
+                    const char *payload = data;
+                    if (is_compressed)
+                    {
+                        // frames end where blocks do: consumed bytes and application bytes differ
+                        ssize_t consumed = Compress_Reader_feed(&reader, data, available, &payload, &n);
+                        if (consumed < 0 || totalBytes + n > runSize)
+                        {
+                            cleanup(listeningSocket, clientSocket);
+                            return 1;
+                        }
+                        used = (size_t)consumed;
+                    }
+                    if (out_path != NULL && File_Sink_write(&sink, payload, n) < 0)
+                    {
+                        cleanup(listeningSocket, clientSocket);
+                        return 1;
+                    }
+                    if (verify && !is_file)
+                    {
+                        int64_t at = Payload_verify(&expected, payload, n);
+                        if (mismatch == -1)
+                            mismatch = at;
+                    }
+                    totalBytes += n;
+                    parsed += used;
                 }
-                else if (bytes_received == 0)
+                else if (data[0] == 'F')
                 {
-                    fprintf(stdout, "Client %s:%d disconnected\n", inet_ntoa(clientAddress.sin_addr), ntohs(clientAddress.sin_port));
-                    cleanup(listeningSocket, clientSocket);
-                    break;
+                    printf("Received finish command. Exiting loop.\n");
+                    parsed++;
+                    finishflag = 1;
                 }
                 else
                 {
-                    // Ensure that the buffer is null-terminated
-                    if (buffer[BUFFER_SIZE - 1] != '\0')
-                        buffer[BUFFER_SIZE - 1] = '\0';
+                    printf("Expected finish command after %llu bytes\n", (unsigned long long)runSize);
+                    cleanup(listeningSocket, clientSocket);
+                    return 1;
                 }
-                firstround = 0;
-                bzero(buffer, BUFFER_SIZE);
             }
-            // Capture end time
-            end_time = clock();
-            // Calculate time difference in milliseconds
-            double milliseconds = ((double)(end_time - start_time) / CLOCKS_PER_SEC) * 1000.0;
-            if (exitflag == 0)
+            // Wall-clock time from the first to the last chunk of the run
+            double milliseconds = Run_Timer_total_ms(&timer);
+            if (finishflag)
             {
                 printf("end receiving data\n");
-                printf("Total bytes received: %d\n", totalBytes);
-                StrList_insertLast(list, round, milliseconds, totalBytes / (milliseconds * 1000.0));
-                fprintf(stdout, "Run #%d Data: Time: %fms Speed: %fMB/s\n", round, milliseconds, totalBytes / (milliseconds * 1000.0));
+                printf("Total bytes received: %llu\n", (unsigned long long)totalBytes);
+                if (out_path != NULL)
+                {
+                    // synced before it is reported, so the figure is the disk's and not the page cache's
+                    if (File_Sink_close(&sink) < 0)
+                    {
+                        cleanup(listeningSocket, clientSocket);
+                        return 1;
+                    }
+                    double disk_ms = File_Sink_disk_ms(&sink);
+                    printf("Disk: wrote %llu bytes to %s in %f ms (%f MB/s)\n", (unsigned long long)File_Sink_written(&sink),
+                           out_path, disk_ms, disk_ms > 0 ? File_Sink_written(&sink) / (disk_ms * 1000.0) : 0.0);
+                }
+                if (verify && is_file)
+                    printf("Integrity: not checked, the run is a file\n");
+                else if (verify && mismatch == -1)
+                    printf("Integrity: OK\n");
+                else if (verify)
+                    printf("Integrity: MISMATCH at byte %lld\n", (long long)mismatch);
+                printf("I/O syscalls: %lu (%s)\n", IO_syscalls(), IO_backend_name());
+                if (is_compressed)
+                    Compress_Reader_print_stats(&reader, milliseconds);
+                double speed = milliseconds > 0 ? totalBytes / (milliseconds * 1000.0) : 0.0;
+                Stats_add(stats, round, milliseconds, speed);
+                fprintf(stdout, "Run #%d Data: Time: %fms Speed: %fMB/s TTFB: %fms\n", round, milliseconds, speed, Run_Timer_ttfb_ms(&timer));
+                Histogram_print(Run_Timer_gaps(&timer), "Chunk inter-arrival", 1000.0, "us");
+                Histogram_merge(allGaps, Run_Timer_gaps(&timer));
+                Histogram_record(allTtfb, (uint64_t)(Run_Timer_ttfb_ms(&timer) * 1000000.0));
+                Histogram_record(allTimes, (uint64_t)(milliseconds * 1000000.0));
                 round++;
             }
         }
 
+        if (disconnected)
+        {
+            cleanup(listeningSocket, clientSocket);
+            break;
+        }
+
         // Send back a message to the client.
-        int bytes_sent = send(clientSocket, message, strlen(message), 0);
+        int bytes_sent = IO_send(clientSocket, message, strlen(message));
         printf("Sending exit message to the client\n");
 
         // Handle sent data
@@ -278,33 +369,25 @@ int main(int argc, char *argv[])
 
     fprintf(stdout, "Server finished!\n\n");
 
-    printf("-----------------------------\n");
-    printf("Stats:\n");
-    printf("CC Algorithm: %s\n", argv[4]);
-    printf("Number of runs: %zu\n", list->_size);
-    Node *current = list->_head; // Use a temporary pointer to traverse the list
-
-    for (int i = 0; i < list->_size; i++)
+    printf("CC Algorithm: %s\n", algo);
+    print_stats(stats);
+    if (Stats_size(stats) > 0)
     {
-        printf("Run #%d Data: Time: %f ms, Speed: %f MB/s\n", current->_run, current->_time, current->_speed);
-        current = current->_next;
+        Histogram_print(allTimes, "Transfer time", 1000000.0, "ms");
+        Histogram_print(allTtfb, "Time to first byte", 1000000.0, "ms");
+        Histogram_print(allGaps, "Chunk inter-arrival", 1000.0, "us");
     }
-    // Reset temporary pointer to head for calculating averages
-    current = list->_head;
-    float totalTime = 0.0;
-    float totalSpeed = 0.0;
-
-    for (int i = 0; i < list->_size; i++)
-    {
-        totalTime += current->_time;
-        totalSpeed += current->_speed;
-        current = current->_next;
-    }
-
-    printf("Average Time: %f ms\n", totalTime / list->_size);
-    printf("Average Speed: %f MB/s\n", totalSpeed / list->_size);
-    printf("-----------------------------\n");
-
-    StrList_free(list);
+    Timestamp_print();
+    if (json_path != NULL)
+        Stats_write_json(stats, json_path, Busy_Poll_label(algo));
+    if (csv_path != NULL)
+        Stats_write_csv(stats, csv_path, Busy_Poll_label(algo));
+
+    Stats_free(stats);
+    Compress_Reader_free(&reader);
+    Run_Timer_destroy(&timer);
+    Histogram_free(allGaps);
+    Histogram_free(allTtfb);
+    Histogram_free(allTimes);
     return 0;
 }
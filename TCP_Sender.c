@@ -8,56 +8,358 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include "TCP_Info.h"
+#include "TCP_Tuning.h"
+#include "IO_Backend.h"
+#include "Payload.h"
+#include "File_IO.h"
+#include "Compress.h"
+#include "Timing.h"
+#include "Busy_Poll.h"
+#include "Timestamp.h"
 
-#define BUFFER_SIZE (2*1024*1024)
+#define BUFFER_SIZE (2*1024*1024) // default run size, and the largest chunk generated at once
+#define DRAIN_TIMEOUT_MS 5000
+#define DRAIN_POLL_US 50
+#define SWEEP_MAX (TCP_ALGO_MAX * 8)
+
+typedef struct _Sweep_Result
+{
+    const char *profile;
+    char algo[TCP_ALGO_NAME_MAX];
+    double mean_ms;
+    double mean_speed; // MB/s
+} Sweep_Result;
+
+typedef struct _Run_Data
+{
+    char *chunk;       // generated payload, registered for zero-copy sends
+    size_t chunk_size;
+    uint64_t size;     // payload bytes per run
+    uint64_t seed;
+    File_Source *file; // -f: sent instead of the payload stream, read into chunk or mapped
+    Compress_Writer *compress; // -compress: the payload goes out as Compress frames
+} Run_Data;
+
+
+/*
+* @brief
+Waits until the kernel send queue of sock is empty, i.e. the receiver acknowledged everything sent.
+* @param sock
+The connected socket.
+* @param timeout_ms
+Upper bound on the wait.
+*/
+void wait_for_drain(int sock, int timeout_ms)
+{
+    for (long waited = 0; waited < timeout_ms * 1000L; waited += DRAIN_POLL_US)
+    {
+        int pending = 0;
+        if (ioctl(sock, SIOCOUTQ, &pending) != 0 || pending == 0)
+            return;
+        usleep(DRAIN_POLL_US);
+    }
+}
 
 /*
 * @brief
-A random data generator function based on srand() and rand().
-* @param size
-The size of the data to generate (up to 2^32 bytes).
+Sends len bytes as Compress frames of up to COMPRESS_BLOCK_SIZE application bytes each.
 * @return
-A pointer to the buffer.
+0 on success, -1 if send() failed.
 */
-char *util_generate_random_data(unsigned int size)
+int send_compressed(int sock, Compress_Writer *writer, const char *data, size_t len)
 {
-    char *buffer = NULL;
+    for (size_t offset = 0; offset < len; offset += COMPRESS_BLOCK_SIZE)
+    {
+        const char *frame;
+        size_t n = len - offset < COMPRESS_BLOCK_SIZE ? len - offset : COMPRESS_BLOCK_SIZE;
+        size_t frame_len = Compress_Writer_frame(writer, data + offset, n, &frame);
+        if (IO_send(sock, frame, frame_len) < 0)
+            return -1;
+    }
+    return 0;
+}
 
-    // Argument check.
-    if (size == 0)
-        return NULL;
+/*
+* @brief
+Sends one run: the payload header, the payload and the Finish flag.
+* @param data
+The payload. Runs larger than the chunk are generated, or read from the file, chunk by chunk while sending.
+* @param sampler
+Optional TCP_INFO sampler; its samples are exported to <csv_prefix>_<algo>_run<round>.csv.
+* @param ms
+If not NULL, receives the time from the first send() until the receiver acknowledged the run.
+* @return
+0 on success, -1 if send() failed.
+*/
+int send_run(int sock, Run_Data *data, TCP_Info_Sampler *sampler, const char *csv_prefix, const char *algo, int round, double *ms)
+{
+    if (sampler != NULL && TCP_Info_start(sampler) < 0)
+        return -1;
 
-    buffer = (char *)calloc(size, sizeof(char));
+    IO_reset_syscalls();
+    if (data->file != NULL)
+        File_Source_reset_time(data->file);
+    if (data->compress != NULL)
+        Compress_Writer_reset_stats(data->compress);
+    double start = Timing_now_ms();
 
-    // Error checking.
-    if (buffer == NULL)
-        return NULL;
+    // The header lets the receiver frame the run and regenerate the payload.
+    Payload_Header header;
+    Payload_header_pack(&header, data->seed, data->size);
+    Payload_header_set_flags(&header, (data->file != NULL ? PAYLOAD_FILE : 0) | (data->compress != NULL ? PAYLOAD_COMPRESSED : 0));
+    if (IO_send(sock, &header, sizeof(header)) < 0)
+    {
+        perror("send(2)");
+        return -1;
+    }
 
-    // Randomize the seed of the random number generator.
-    srand(time(NULL));
+    // Send the data.
+    uint64_t bytesSent = 0;
+    while (bytesSent < data->size)
+    {
+        size_t n = data->size - bytesSent < data->chunk_size ? data->size - bytesSent : data->chunk_size;
+        const char *chunk = data->chunk;
+        if (data->file != NULL)
+        {
+            chunk = File_Source_read(data->file, data->chunk, bytesSent, n);
+            if (chunk == NULL)
+                return -1;
+        }
+        else if (data->size > data->chunk_size)
+            Payload_fill_at(data->seed, bytesSent, data->chunk, n);
+        if (data->compress != NULL ? send_compressed(sock, data->compress, chunk, n) < 0 : IO_send(sock, chunk, n) < 0)
+        {
+            perror("send(2)");
+            return -1;
+        }
+        bytesSent += n;
+    }
+    printf("Sent %llu bytes\n", (unsigned long long)bytesSent);
+    if (data->compress != NULL)
+        Compress_Writer_print_stats(data->compress);
+    if (data->file != NULL)
+    {
+        double disk_ms = File_Source_disk_ms(data->file);
+        printf("Disk: read %llu bytes in %f ms (%f MB/s)\n", (unsigned long long)bytesSent, disk_ms,
+               disk_ms > 0 ? bytesSent / (disk_ms * 1000.0) : 0.0);
+    }
+    printf("Sending Finish message to the server\n");
+    char *finishMessage = "F";
+    IO_send(sock, finishMessage, strlen(finishMessage));
+    printf("Finish message sent\n");
+    printf("Run #%d: %lu I/O syscalls (%s)\n", round, IO_syscalls(), IO_backend_name());
 
-    for (unsigned int i = 0; i < size; i++) {
-        *(buffer + i) = ((unsigned int)rand() % 256);
-        // 'F' and 'E' reserved for Finish and End flags respectively
-        if ((*(buffer + i) == 'F') || (*(buffer + i) == 'E'))
-            i--;
+    if (sampler != NULL || ms != NULL)
+        wait_for_drain(sock, DRAIN_TIMEOUT_MS);
+    if (ms != NULL)
+        *ms = Timing_now_ms() - start;
+
+    if (sampler != NULL)
+    {
+        TCP_Info_stop(sampler);
+
+        char path[256];
+        snprintf(path, sizeof(path), "%s_%s_run%d.csv", csv_prefix, algo, round);
+        if (TCP_Info_export_csv(sampler, path) == 0)
+            printf("Wrote %zu TCP_INFO samples to %s\n", TCP_Info_size(sampler), path);
     }
+    return 0;
+}
 
-    return buffer;
+int compare_sweep_results(const void *a, const void *b)
+{
+    double sa = ((const Sweep_Result *)a)->mean_speed;
+    double sb = ((const Sweep_Result *)b)->mean_speed;
+    return (sa < sb) - (sa > sb); // fastest first
+}
+
+/*
+* @brief
+Runs every available congestion control algorithm with every tuning profile on the
+connected socket and prints the combinations ranked by throughput.
+* @param rounds
+Runs per combination.
+* @return
+0 on success, -1 if a run failed.
+*/
+int run_sweep(int sock, Run_Data *data, int rounds, TCP_Info_Sampler *sampler, const char *csv_prefix)
+{
+    char algos[TCP_ALGO_MAX][TCP_ALGO_NAME_MAX];
+    int algo_count = TCP_Tuning_available_algos(algos, TCP_ALGO_MAX);
+    if (algo_count <= 0)
+        return -1;
+
+    size_t profile_count;
+    const TCP_Profile *profiles = TCP_Tuning_profiles(&profile_count);
+
+    TCP_Profile baseline;
+    TCP_Tuning_snapshot(sock, &baseline);
+
+    Sweep_Result results[SWEEP_MAX];
+    int result_count = 0;
+    int round = 1;
+
+    // profiles outermost, so "default" runs before buffer sizes are locked
+    for (size_t p = 0; p < profile_count; p++)
+    {
+        for (int a = 0; a < algo_count && result_count < SWEEP_MAX; a++)
+        {
+            printf("\n=== Sweep: profile %s, algo %s ===\n", profiles[p].name, algos[a]);
+            TCP_Tuning_apply(sock, &baseline);
+            if (TCP_Tuning_apply(sock, &profiles[p]) < 0 || TCP_Tuning_set_algo(sock, algos[a]) < 0)
+            {
+                printf("Skipping combination\n");
+                continue;
+            }
+
+            double total_ms = 0;
+            char label[2 * TCP_ALGO_NAME_MAX + 16];
+            snprintf(label, sizeof(label), "%s_%s", profiles[p].name, algos[a]);
+            for (int r = 0; r < rounds; r++)
+            {
+                double ms;
+                if (send_run(sock, data, sampler, csv_prefix, label, round++, &ms) < 0)
+                    return -1;
+                total_ms += ms;
+            }
+
+            Sweep_Result *res = &results[result_count++];
+            res->profile = profiles[p].name;
+            strncpy(res->algo, algos[a], TCP_ALGO_NAME_MAX);
+            res->mean_ms = total_ms / rounds;
+            res->mean_speed = data->size / (res->mean_ms * 1000.0);
+        }
+    }
+
+    qsort(results, result_count, sizeof(Sweep_Result), compare_sweep_results);
+
+    printf("\n-----------------------------\n");
+    printf("Sweep ranking (%d runs each, sender side, until fully ACKed):\n", rounds);
+    printf("Rank  Profile   Algo          Time (ms)     Speed (MB/s)\n");
+    for (int i = 0; i < result_count; i++)
+        printf("%-5d %-9s %-13s %-13f %f\n", i + 1, results[i].profile, results[i].algo, results[i].mean_ms, results[i].mean_speed);
+    printf("Note: TCP_MAXSEG only applies to new connections, the sweep reuses one.\n");
+    printf("-----------------------------\n");
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
     char buffer[BUFFER_SIZE] = {0};
 
-    // Generate some random data.
-    char *message = util_generate_random_data(BUFFER_SIZE);
-    if (message == NULL)
+    const char *ip = NULL;
+    const char *port = NULL;
+    const char *algo = NULL;
+    double sample_ms = 0;                   // 0 disables TCP_INFO sampling
+    const char *csv_prefix = "tcpinfo";
+    const char *profile_name = "default";
+    int sweep_rounds = 0;                   // 0 disables the sweep
+    int rounds = 0;                         // 0 asks before every run
+    IO_Backend backend = IO_SYSCALL;
+    const char *file_path = NULL;
+    File_Read_Mode read_mode = FILE_PREAD;
+    File_Source file;
+    Compress_Writer compress;
+    int use_compress = 0;
+    Run_Data data;
+    data.size = BUFFER_SIZE;
+    data.seed = Payload_random_seed();
+    data.file = NULL;
+    data.compress = NULL;
+
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc)
+            ip = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            port = argv[++i];
+        else if (strcmp(argv[i], "-algo") == 0 && i + 1 < argc)
+            algo = argv[++i];
+        else if (strcmp(argv[i], "-tcpinfo") == 0 && i + 1 < argc)
+            sample_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+            csv_prefix = argv[++i];
+        else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+            profile_name = argv[++i];
+        else if (strcmp(argv[i], "-sweep") == 0 && i + 1 < argc)
+            sweep_rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-rounds") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc)
+            data.size = Payload_parse_size(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            data.seed = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            file_path = argv[++i];
+        else if (strcmp(argv[i], "-compress") == 0)
+            use_compress = 1;
+        else if (strcmp(argv[i], "-fread") == 0 && i + 1 < argc)
+        {
+            if (File_parse_read_mode(argv[++i], &read_mode) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc)
+        {
+            if (IO_parse_backend(argv[++i], &backend) < 0)
+                break;
+        }
+        else if (Timestamp_option(argc, argv, &i) == 0 && Busy_Poll_option(argc, argv, &i) <= 0)
+            break;
+    }
+    const TCP_Profile *profile = TCP_Tuning_find_profile(profile_name);
+    if (i < argc || ip == NULL || port == NULL || data.size == 0 || (algo == NULL && sweep_rounds <= 0) || sample_ms < 0 || rounds < 0 || profile == NULL)
     {
-        perror("util_generate_random_data() failed");
+        printf("Usage: %s -ip <server_ip> -p <port> -algo <algorithm> [-profile <name>] [-rounds <n>] [-sweep <rounds>] [-tcpinfo <interval_ms>] [-csv <prefix>] [-io <syscall|uring>] [-size <bytes[K|M|G]>] [-seed <n>] [-f <file> [-fread <pread|mmap>]] [-compress] " BUSY_POLL_USAGE " " TIMESTAMP_USAGE "\n", argv[0]);
+        printf("Profiles:\n");
+        TCP_Tuning_print_profiles();
         return -1;
     }
-    printf("Generated %d bytes of random data\n", BUFFER_SIZE);
+    if (algo == NULL)
+        algo = "cubic";
+
+    // -f streams the file in place of the payload, whatever its size
+    if (file_path != NULL)
+    {
+        if (File_Source_open(&file, file_path, read_mode) < 0)
+            return -1;
+        if (File_Source_size(&file) == 0)
+        {
+            printf("%s is empty\n", file_path);
+            File_Source_close(&file);
+            return -1;
+        }
+        data.file = &file;
+        data.size = File_Source_size(&file);
+        printf("File: %s, %llu bytes, read with %s\n", file_path, (unsigned long long)data.size,
+               read_mode == FILE_MMAP ? "mmap" : "pread");
+    }
+
+    if (use_compress)
+    {
+        if (Compress_Writer_init(&compress) < 0)
+            return -1;
+        data.compress = &compress;
+    }
+
+    // Generate the payload; runs larger than one chunk are generated while sending.
+    data.chunk_size = data.size < BUFFER_SIZE ? data.size : BUFFER_SIZE;
+    data.chunk = Payload_alloc(data.seed, data.chunk_size);
+    if (data.chunk == NULL)
+    {
+        perror("Payload_alloc() failed");
+        return -1;
+    }
+    if (data.file == NULL)
+        printf("Payload: %llu bytes per run, seed 0x%016llx\n", (unsigned long long)data.size, (unsigned long long)data.seed);
+
+    // The chunk is registered with io_uring so it can be sent zero-copy.
+    IO_init(backend, data.chunk, data.chunk_size);
+    if (Busy_Poll_start() < 0 || Timestamp_start() < 0)
+        return -1;
 
     // Create a socket.
     int sock = -1;
@@ -68,29 +370,20 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    if (strcmp(argv[6], "reno") == 0)
-    {
-        printf("Setting TCP to Reno\n");
-        if (setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, "reno", strlen("reno")) != 0)
-        {
-            perror("setsockopt() failed");
-            return -1;
-        }
-    }
-    else if (strcmp(argv[6], "cubic") == 0)
+    if (TCP_Tuning_set_algo(sock, algo) < 0)
     {
-        printf("Setting TCP to Cubic\n");
-        if (setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, "cubic", strlen("cubic")) != 0)
-        {
-            perror("setsockopt() failed");
-            return -1;
-        }
+        close(sock);
+        return -1;
     }
-    else
+
+    // Buffer sizes and MSS must be set before connect() to shape the handshake.
+    printf("Using tuning profile %s\n", profile->name);
+    if (TCP_Tuning_apply(sock, profile) < 0)
     {
-        printf("Invalid TCP congestion control algorithm\n");
+        close(sock);
         return -1;
     }
+    Busy_Poll_socket(sock);
 
     // Create a server address.
     struct sockaddr_in serverAddress;
@@ -98,7 +391,13 @@ int main(int argc, char *argv[])
 
     // Set the server address.
     serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(atoi(argv[4]));
+    serverAddress.sin_port = htons(atoi(port));
+    if (inet_pton(AF_INET, ip, &serverAddress.sin_addr) <= 0)
+    {
+        perror("inet_pton() failed");
+        close(sock);
+        return -1;
+    }
 
     // Connect to the server.
     if (connect(sock, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0)
@@ -108,45 +407,67 @@ int main(int argc, char *argv[])
         return -1;
     }
     printf("connected to server\n");
+    Timestamp_socket(sock);
 
-    char again = 'y';
-    while (again == 'y')
+    TCP_Info_Sampler *sampler = NULL;
+    if (sample_ms > 0)
     {
-        // Send the data.
-        int bytesSent = 0;
-        while (bytesSent < BUFFER_SIZE)
+        sampler = TCP_Info_alloc(sock, (unsigned int)(sample_ms * 1000.0), TCP_INFO_DEFAULT_CAPACITY);
+        if (sampler == NULL)
         {
-            int ret = send(sock, message + bytesSent, BUFFER_SIZE - bytesSent, 0);
-            if (ret < 0)
+            perror("TCP_Info_alloc() failed");
+            close(sock);
+            return -1;
+        }
+        printf("Sampling TCP_INFO every %.3f ms\n", sample_ms);
+    }
+
+    if (sweep_rounds > 0)
+    {
+        if (run_sweep(sock, &data, sweep_rounds, sampler, csv_prefix) < 0)
+        {
+            TCP_Info_free(sampler);
+            close(sock);
+            return 1;
+        }
+    }
+    else
+    {
+        int round = 1;
+        char again = 'y';
+        while (again == 'y')
+        {
+            if (send_run(sock, &data, sampler, csv_prefix, algo, round, NULL) < 0)
             {
-                perror("send(2)");
+                TCP_Info_free(sampler);
                 close(sock);
                 return 1;
             }
-            bytesSent += ret;
-            printf("Sent %d bytes\n", bytesSent);
-        }
-        printf("Sending Finish message to the server\n");
-        char *finishMessage = "F";
-        send(sock, finishMessage, strlen(finishMessage), 0);
-        printf("Finish message sent\n");
+            round++;
 
-        printf("Do you want to send the message again? (y/n): ");
-        scanf(" %c", &again);
+            if (rounds > 0)
+                again = round <= rounds ? 'y' : 'n';
+            else
+            {
+                printf("Do you want to send the message again? (y/n): ");
+                if (scanf(" %c", &again) != 1)
+                    again = 'n';
+            }
+        }
     }
 
     // Send exit message to the server
     printf("Sending exit message to the server\n");
     char *exitMessage = "E";
-    send(sock, exitMessage, strlen(exitMessage), 0);
+    IO_send(sock, exitMessage, strlen(exitMessage));
     printf("Exit message sent\n");
 
     // Receive a message from the server.
-    int bytes_received = recv(sock, buffer, sizeof(buffer), 0);
+    int bytes_received = IO_recv(sock, buffer, sizeof(buffer));
     if (bytes_received <= 0)
     {
         perror("recv(2)");
-        close(sock);
+        IO_close(sock);
         return 1;
     }
 
@@ -158,12 +479,22 @@ int main(int argc, char *argv[])
     // Print the received message.
     // fprintf(stdout, "Got %d bytes from the server, which says: %s\n", bytes_received, buffer);
 
+    TCP_Info_print(sock);
+    Timestamp_drain(sock);
+    Timestamp_print();
+
     // Close the socket with the server.
-    close(sock);
+    IO_close(sock);
 
     fprintf(stdout, "Connection closed!\n");
 
-    free(message);
+    TCP_Info_free(sampler);
+    IO_cleanup();
+    free(data.chunk);
+    if (data.file != NULL)
+        File_Source_close(data.file);
+    if (data.compress != NULL)
+        Compress_Writer_free(data.compress);
     // Return 0 to indicate that the client ran successfully.
     return 0;
 }
@@ -0,0 +1,136 @@
+#include "TCP_Tuning.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define AVAILABLE_ALGOS_PATH "/proc/sys/net/ipv4/tcp_available_congestion_control"
+
+/*
+ * "default" must stay first: setting SO_SNDBUF/SO_RCVBUF turns buffer autotuning off
+ * for the rest of the connection, so a sweep runs it before any profile that sets them.
+ */
+static const TCP_Profile profiles[] = {
+    {"default", TCP_UNCHANGED, TCP_UNCHANGED, TCP_UNCHANGED, TCP_UNCHANGED, TCP_UNCHANGED, TCP_UNCHANGED},
+    {"bulk", 4 * 1024 * 1024, 4 * 1024 * 1024, 0, TCP_UNCHANGED, TCP_UNCHANGED, TCP_UNCHANGED},
+    {"latency", 256 * 1024, 256 * 1024, 1, 16 * 1024, TCP_UNCHANGED, TCP_UNCHANGED},
+    {"wan", 2 * 1024 * 1024, 2 * 1024 * 1024, 0, 128 * 1024, 1448, TCP_UNCHANGED},
+    {"paced", 4 * 1024 * 1024, 4 * 1024 * 1024, 0, TCP_UNCHANGED, TCP_UNCHANGED, 125000000},
+};
+
+const TCP_Profile *TCP_Tuning_profiles(size_t *count)
+{
+    *count = sizeof(profiles) / sizeof(profiles[0]);
+    return profiles;
+}
+
+const TCP_Profile *TCP_Tuning_find_profile(const char *name)
+{
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    {
+        if (strcmp(profiles[i].name, name) == 0)
+            return &profiles[i];
+    }
+    return NULL;
+}
+
+void TCP_Tuning_print_profiles(void)
+{
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    {
+        const TCP_Profile *p = &profiles[i];
+        printf("  %-8s sndbuf %ld rcvbuf %ld nodelay %ld notsent_lowat %ld maxseg %ld max_pacing_rate %ld\n",
+               p->name, p->sndbuf, p->rcvbuf, p->nodelay, p->notsent_lowat, p->maxseg, p->max_pacing_rate);
+    }
+}
+
+static int set_int(int sock, int level, int name, const char *label, long value)
+{
+    if (value == TCP_UNCHANGED)
+        return 0;
+
+    int v = (int)value;
+    if (setsockopt(sock, level, name, &v, sizeof(v)) != 0)
+    {
+        fprintf(stderr, "setsockopt(%s=%ld): ", label, value);
+        perror(NULL);
+        return -1;
+    }
+    return 0;
+}
+
+static long get_int(int sock, int level, int name)
+{
+    unsigned int v = 0;
+    socklen_t len = sizeof(v);
+    if (getsockopt(sock, level, name, &v, &len) != 0)
+        return TCP_UNCHANGED;
+    return (long)v;
+}
+
+int TCP_Tuning_apply(int sock, const TCP_Profile *profile)
+{
+    int rc = 0;
+    rc |= set_int(sock, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", profile->sndbuf);
+    rc |= set_int(sock, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", profile->rcvbuf);
+    rc |= set_int(sock, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", profile->nodelay);
+    rc |= set_int(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", profile->notsent_lowat);
+    rc |= set_int(sock, IPPROTO_TCP, TCP_MAXSEG, "TCP_MAXSEG", profile->maxseg);
+    rc |= set_int(sock, SOL_SOCKET, SO_MAX_PACING_RATE, "SO_MAX_PACING_RATE", profile->max_pacing_rate);
+    return rc ? -1 : 0;
+}
+
+int TCP_Tuning_snapshot(int sock, TCP_Profile *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->name = "snapshot";
+    // buffers are left alone: setting them, even to their current size, ends autotuning
+    out->sndbuf = TCP_UNCHANGED;
+    out->rcvbuf = TCP_UNCHANGED;
+    out->nodelay = get_int(sock, IPPROTO_TCP, TCP_NODELAY);
+    out->notsent_lowat = get_int(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+    out->maxseg = TCP_UNCHANGED; // fixed once connected
+    out->max_pacing_rate = get_int(sock, SOL_SOCKET, SO_MAX_PACING_RATE);
+    return 0;
+}
+
+int TCP_Tuning_available_algos(char names[][TCP_ALGO_NAME_MAX], int max)
+{
+    FILE *fp = fopen(AVAILABLE_ALGOS_PATH, "r");
+    if (fp == NULL)
+    {
+        perror("fopen(" AVAILABLE_ALGOS_PATH ") failed");
+        return -1;
+    }
+
+    int count = 0;
+    char name[64];
+    while (count < max && fscanf(fp, "%63s", name) == 1)
+    {
+        strncpy(names[count], name, TCP_ALGO_NAME_MAX - 1);
+        names[count][TCP_ALGO_NAME_MAX - 1] = '\0';
+        count++;
+    }
+
+    fclose(fp);
+    return count;
+}
+
+int TCP_Tuning_set_algo(int sock, const char *algo)
+{
+    printf("Setting TCP to %s\n", algo);
+    if (setsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, algo, strlen(algo)) == 0)
+        return 0;
+
+    perror("setsockopt(TCP_CONGESTION) failed");
+
+    char names[TCP_ALGO_MAX][TCP_ALGO_NAME_MAX];
+    int count = TCP_Tuning_available_algos(names, TCP_ALGO_MAX);
+    printf("Available congestion control algorithms:");
+    for (int i = 0; i < count; i++)
+        printf(" %s", names[i]);
+    printf("\n");
+    return -1;
+}
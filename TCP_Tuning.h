@@ -0,0 +1,43 @@
+#ifndef TCP_TUNING_H
+#define TCP_TUNING_H
+
+#include <stddef.h>
+
+#define TCP_ALGO_NAME_MAX 16
+#define TCP_ALGO_MAX 16
+#define TCP_UNCHANGED (-1) // leave the socket option at the kernel default
+
+/*
+ * A named set of socket options. Every field set to TCP_UNCHANGED is left alone,
+ * so the "default" profile measures what the kernel does on its own.
+ */
+typedef struct _TCP_Profile
+{
+    const char *name;
+    long sndbuf;          // SO_SNDBUF, bytes
+    long rcvbuf;          // SO_RCVBUF, bytes
+    long nodelay;         // TCP_NODELAY, 0/1
+    long notsent_lowat;   // TCP_NOTSENT_LOWAT, bytes
+    long maxseg;          // TCP_MAXSEG, bytes; only takes effect before connect()
+    long max_pacing_rate; // SO_MAX_PACING_RATE, bytes per second
+} TCP_Profile;
+
+/* Looks a built-in profile up by name, NULL if there is none. */
+const TCP_Profile *TCP_Tuning_find_profile(const char *name);
+/* Returns the built-in profile table and stores its length in count. */
+const TCP_Profile *TCP_Tuning_profiles(size_t *count);
+/* Prints the built-in profiles, one per line. */
+void TCP_Tuning_print_profiles(void);
+
+/* Applies every set field of profile to sock. */
+int TCP_Tuning_apply(int sock, const TCP_Profile *profile);
+/* Reads the current values of the profile's options from sock; the buffer sizes stay TCP_UNCHANGED,
+   so applying the snapshot never locks them (a sweep restores it before every profile). */
+int TCP_Tuning_snapshot(int sock, TCP_Profile *out);
+
+/* Reads /proc/sys/net/ipv4/tcp_available_congestion_control, returns the number of names. */
+int TCP_Tuning_available_algos(char names[][TCP_ALGO_NAME_MAX], int max);
+/* Sets TCP_CONGESTION, printing the available algorithms if the kernel refuses. */
+int TCP_Tuning_set_algo(int sock, const char *algo);
+
+#endif
@@ -0,0 +1,284 @@
+#include "Timestamp.h"
+#include "Timing.h"
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a send waiting for its stamps, by the key the kernel gives it (SOF_TIMESTAMPING_OPT_ID)
+typedef struct _Timestamp_Send
+{
+    uint32_t key;       // datagrams: sends since SO_TIMESTAMPING was set; streams: offset of the last byte
+    uint64_t sent_ns;   // the application's send()
+    uint64_t tx_ns;     // the kernel's transmit stamp, 0 until it comes
+} Timestamp_Send;
+
+typedef struct _Timestamp_Socket
+{
+    int stream;
+    uint64_t sends;     // datagrams sent, or stream bytes
+    Timestamp_Send pending[TIMESTAMP_PENDING];
+    uint32_t head;      // oldest pending
+    uint32_t count;
+} Timestamp_Socket;
+
+static struct
+{
+    int enabled;
+    pthread_mutex_t lock;           // sockets and histograms: striped paths and ACK threads stamp at once
+    Timestamp_Socket *sockets[TIMESTAMP_MAX_FD];
+    Histogram *rx_queue;            // ns
+    Histogram *tx_stack;
+    Histogram *one_way;
+    Histogram *rtt;
+    uint64_t skewed;                // one-way delays below 0: the two clocks are not in sync
+} stamps = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int Timestamp_option(int argc, char *argv[], int *i)
+{
+    (void)argc;
+    if (strcmp(argv[*i], "-tstamp") != 0)
+        return 0;
+    stamps.enabled = 1;
+    return 1;
+}
+
+int Timestamp_start(void)
+{
+    if (!stamps.enabled)
+        return 0;
+    stamps.rx_queue = Histogram_alloc();
+    stamps.tx_stack = Histogram_alloc();
+    stamps.one_way = Histogram_alloc();
+    stamps.rtt = Histogram_alloc();
+    if (stamps.rx_queue == NULL || stamps.tx_stack == NULL || stamps.one_way == NULL || stamps.rtt == NULL)
+    {
+        perror("malloc failed");
+        stamps.enabled = 0;
+        return -1;
+    }
+    printf("Kernel timestamps: software RX/TX stamps on every socket\n");
+    return 0;
+}
+
+int Timestamp_enabled(void)
+{
+    return stamps.enabled;
+}
+
+void Timestamp_socket(int fd)
+{
+    if (!stamps.enabled || fd < 0 || fd >= TIMESTAMP_MAX_FD)
+        return;
+    int type = 0;
+    socklen_t len = sizeof(type);
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len);
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (type == SOCK_STREAM)
+        flags |= SOF_TIMESTAMPING_TX_ACK;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+    {
+        perror("setsockopt(SO_TIMESTAMPING) failed");
+        return;
+    }
+
+    pthread_mutex_lock(&stamps.lock);
+    Timestamp_Socket *s = stamps.sockets[fd];
+    if (s == NULL)
+        s = stamps.sockets[fd] = (Timestamp_Socket *)malloc(sizeof(Timestamp_Socket));
+    if (s != NULL)
+    {
+        s->stream = type == SOCK_STREAM;
+        s->sends = 0;
+        s->head = 0;
+        s->count = 0;
+    }
+    pthread_mutex_unlock(&stamps.lock);
+}
+
+void Timestamp_forget(int fd)
+{
+    if (!Timestamp_stamped(fd))
+        return;
+    pthread_mutex_lock(&stamps.lock);
+    free(stamps.sockets[fd]);
+    stamps.sockets[fd] = NULL;
+    pthread_mutex_unlock(&stamps.lock);
+}
+
+int Timestamp_stamped(int fd)
+{
+    return fd >= 0 && fd < TIMESTAMP_MAX_FD && stamps.sockets[fd] != NULL;
+}
+
+uint64_t Timestamp_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t Timestamp_now_us(void)
+{
+    return (uint32_t)(Timestamp_now_ns() / 1000);
+}
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+/* later minus earlier, 0 if the clocks put them the other way round */
+static uint64_t elapsed(uint64_t earlier, uint64_t later)
+{
+    return later > earlier ? later - earlier : 0;
+}
+
+void Timestamp_sent(int fd, size_t len, uint64_t sent_ns)
+{
+    if (!Timestamp_stamped(fd))
+        return;
+    pthread_mutex_lock(&stamps.lock);
+    Timestamp_Socket *s = stamps.sockets[fd];
+    if (s != NULL)
+    {
+        // the kernel numbers every datagram, and a stream's stamps by the offset of the last byte of a send()
+        s->sends += s->stream ? len : 1;
+        if (s->count == TIMESTAMP_PENDING)
+        {
+            s->head = (s->head + 1) % TIMESTAMP_PENDING;   // never stamped: dropped, or the key of a partial send()
+            s->count--;
+        }
+        Timestamp_Send *p = &s->pending[(s->head + s->count) % TIMESTAMP_PENDING];
+        p->key = (uint32_t)(s->sends - 1);
+        p->sent_ns = sent_ns;
+        p->tx_ns = 0;
+        s->count++;
+    }
+    pthread_mutex_unlock(&stamps.lock);
+    // on loopback the transmit stamp is queued before send() returns, on a device soon after
+    Timestamp_drain(fd);
+}
+
+/* Matches a stamp of fd's error queue with its send; under stamps.lock. */
+static void take_stamp(Timestamp_Socket *s, uint32_t key, uint32_t type, uint64_t at_ns)
+{
+    for (uint32_t i = 0; i < s->count; i++)
+    {
+        Timestamp_Send *p = &s->pending[(s->head + i) % TIMESTAMP_PENDING];
+        if (p->key != key)
+            continue;
+        if (type == SCM_TSTAMP_SND && p->tx_ns == 0)
+        {
+            p->tx_ns = at_ns;
+            Histogram_record(stamps.tx_stack, elapsed(p->sent_ns, at_ns));
+        }
+        else if (type == SCM_TSTAMP_ACK && p->tx_ns != 0)
+            Histogram_record(stamps.rtt, elapsed(p->tx_ns, at_ns));
+        // a datagram is done once sent, a stream's bytes once ACKed, and everything before them too
+        if ((type == SCM_TSTAMP_SND && !s->stream) || type == SCM_TSTAMP_ACK)
+        {
+            s->head = (s->head + i + 1) % TIMESTAMP_PENDING;
+            s->count -= i + 1;
+        }
+        return;
+    }
+}
+
+int Timestamp_drain(int fd)
+{
+    if (!Timestamp_stamped(fd))
+        return 0;
+    int read = 0;
+    for (;;)
+    {
+        char control[TIMESTAMP_CONTROL + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;   // EAGAIN: nothing left
+        read++;
+
+        uint64_t at_ns = 0;
+        const struct sock_extended_err *err = NULL;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPING)
+                at_ns = timespec_ns(&((const struct scm_timestamping *)CMSG_DATA(c))->ts[0]);
+            else if ((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+                     (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))
+                err = (const struct sock_extended_err *)CMSG_DATA(c);
+        }
+        if (at_ns == 0 || err == NULL || err->ee_errno != ENOMSG || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+            continue;
+
+        pthread_mutex_lock(&stamps.lock);
+        if (stamps.sockets[fd] != NULL)
+            take_stamp(stamps.sockets[fd], err->ee_data, err->ee_info, at_ns);
+        pthread_mutex_unlock(&stamps.lock);
+    }
+    return read;
+}
+
+uint64_t Timestamp_received(const struct msghdr *msg)
+{
+    if (!stamps.enabled)
+        return 0;
+    uint64_t rx_ns = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR((struct msghdr *)msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPING)
+            rx_ns = timespec_ns(&((const struct scm_timestamping *)CMSG_DATA(c))->ts[0]);
+    }
+    if (rx_ns == 0)
+        return 0;
+    uint64_t now = Timestamp_now_ns();
+    pthread_mutex_lock(&stamps.lock);
+    Histogram_record(stamps.rx_queue, elapsed(rx_ns, now));
+    pthread_mutex_unlock(&stamps.lock);
+    return rx_ns;
+}
+
+void Timestamp_arrived(uint32_t tsval, uint32_t tsecr, uint64_t rx_ns)
+{
+    if (!stamps.enabled || rx_ns == 0)
+        return;
+    // header stamps are microseconds that wrap every 71 minutes: only their difference counts
+    uint32_t rx_us = (uint32_t)(rx_ns / 1000);
+    pthread_mutex_lock(&stamps.lock);
+    if (tsval != 0)
+    {
+        int32_t one_way = (int32_t)(rx_us - tsval);
+        if (one_way < 0)
+            stamps.skewed++;
+        else
+            Histogram_record(stamps.one_way, (uint64_t)one_way * 1000);
+    }
+    if (tsecr != 0 && (int32_t)(rx_us - tsecr) >= 0)
+        Histogram_record(stamps.rtt, (uint64_t)(rx_us - tsecr) * 1000);
+    pthread_mutex_unlock(&stamps.lock);
+}
+
+void Timestamp_print(void)
+{
+    if (!stamps.enabled)
+        return;
+    pthread_mutex_lock(&stamps.lock);
+    printf("Kernel timestamps:\n");
+    Histogram_print(stamps.rx_queue, "RX queueing (kernel to read)", 1000.0, "us");
+    Histogram_print(stamps.tx_stack, "TX stack (send to transmit)", 1000.0, "us");
+    if (stamps.one_way->_count > 0 || stamps.skewed > 0)
+        Histogram_print(stamps.one_way, "One-way delay", 1000.0, "us");
+    if (stamps.skewed > 0)
+        printf("One-way delay: %llu samples below 0, the clocks of the two hosts are not in sync\n",
+               (unsigned long long)stamps.skewed);
+    Histogram_print(stamps.rtt, "RTT (kernel stamps)", 1000.0, "us");
+    pthread_mutex_unlock(&stamps.lock);
+}
@@ -0,0 +1,59 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/*
+ * Kernel timestamps (-tstamp on every tool), to see where latency builds up in the stack.
+ * SO_TIMESTAMPING has the kernel stamp each datagram or TCP segment in software as it comes
+ * in from the device and as it goes out to it; IO_Backend reads the stamps of what it
+ * receives from the ancillary data and those of what it sent from the socket's error queue.
+ * Four histograms come out of them:
+ *   - RX queueing: the kernel's receive stamp to the application's read of it;
+ *   - TX stack: the application's send() to the kernel's transmit stamp;
+ *   - one-way delay (RUDP): the sender's clock in the header (tsval) to the receive stamp;
+ *   - RTT: RUDP, the tsval an ACK echoes (tsecr) to the ACK's receive stamp; TCP, the
+ *     transmit stamp of a send's last byte to the stamp of its ACK (SOF_TIMESTAMPING_TX_ACK).
+ * All are on CLOCK_REALTIME, the kernel's stamp clock: the one-way delay between hosts is
+ * only as good as their clock sync (PTP, NTP), and counts as skewed when it comes out negative.
+ * Stamps of streams received through io_uring (multishot) are not read, use -io syscall.
+ */
+#define TIMESTAMP_USAGE "[-tstamp]"
+#define TIMESTAMP_MAX_FD 1024
+#define TIMESTAMP_PENDING 1024      // sends per socket waiting for their transmit stamp (TCP: and their ACK)
+
+/* Takes -tstamp at argv[*i]: 1 if taken, 0 if not. */
+int Timestamp_option(int argc, char *argv[], int *i);
+/* Allocates the histograms when -tstamp is on; -1 on failure. */
+int Timestamp_start(void);
+int Timestamp_enabled(void);
+/* Turns SO_TIMESTAMPING on for fd, when -tstamp is on; a TCP socket once connected (the stamps count bytes from then). */
+void Timestamp_socket(int fd);
+/* fd is closed, its sends waiting for stamps are dropped. */
+void Timestamp_forget(int fd);
+/* 1 if Timestamp_socket() turned the stamps of fd on. */
+int Timestamp_stamped(int fd);
+
+/* CLOCK_REALTIME, the clock of the kernel's stamps: in ns, and as the microseconds a header carries. */
+uint64_t Timestamp_now_ns(void);
+uint32_t Timestamp_now_us(void);
+
+/* IO_Backend: a send of len bytes on fd, started at sent_ns (Timestamp_now_ns()), returned; reads the stamps already in the error queue. */
+void Timestamp_sent(int fd, size_t len, uint64_t sent_ns);
+/* Reads the stamps in fd's error queue; the number read. */
+int Timestamp_drain(int fd);
+/* IO_Backend: the receive stamp in msg's ancillary data, its RX queueing recorded; 0 if it has none. */
+uint64_t Timestamp_received(const struct msghdr *msg);
+/* Room for the ancillary data of a stamp (struct scm_timestamping), to add to a control buffer. */
+#define TIMESTAMP_CONTROL CMSG_SPACE(3 * sizeof(struct timespec))
+
+/* RUDP: a packet received at rx_ns carried tsval and tsecr (0: none); records its one-way delay and RTT. */
+void Timestamp_arrived(uint32_t tsval, uint32_t tsecr, uint64_t rx_ns);
+
+/* Prints the four histograms, if -tstamp is on. */
+void Timestamp_print(void);
+
+#endif
@@ -0,0 +1,175 @@
+#include "Timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t Timing_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+double Timing_now_ms(void)
+{
+    return Timing_now_ns() / 1000000.0;
+}
+
+// ************ Histogram **************
+static size_t bucket_index(uint64_t value)
+{
+    if (value >= (1ULL << HIST_MAX_BITS))
+        return HIST_BUCKETS - 1;
+    if (value < HIST_SUB_COUNT)
+        return (size_t)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+    return (size_t)(shift + 1) * HIST_SUB_COUNT + (size_t)((value >> shift) - HIST_SUB_COUNT);
+}
+
+/* Highest value that falls into bucket index. */
+static uint64_t bucket_value(size_t index)
+{
+    if (index < HIST_SUB_COUNT)
+        return index;
+
+    int shift = (int)(index / HIST_SUB_COUNT) - 1;
+    uint64_t sub = index % HIST_SUB_COUNT + HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+Histogram *Histogram_alloc(void)
+{
+    Histogram *p = (Histogram *)malloc(sizeof(Histogram));
+    if (p == NULL)
+        return NULL;
+    Histogram_reset(p);
+    return p;
+}
+
+void Histogram_free(Histogram *hist)
+{
+    free(hist);
+}
+
+void Histogram_reset(Histogram *hist)
+{
+    memset(hist, 0, sizeof(Histogram));
+    hist->_min = UINT64_MAX;
+}
+
+void Histogram_record(Histogram *hist, uint64_t value)
+{
+    hist->_counts[bucket_index(value)]++;
+    hist->_count++;
+    hist->_sum += (double)value;
+    if (value < hist->_min)
+        hist->_min = value;
+    if (value > hist->_max)
+        hist->_max = value;
+}
+
+void Histogram_merge(Histogram *dst, const Histogram *src)
+{
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        dst->_counts[i] += src->_counts[i];
+    dst->_count += src->_count;
+    dst->_sum += src->_sum;
+    if (src->_min < dst->_min)
+        dst->_min = src->_min;
+    if (src->_max > dst->_max)
+        dst->_max = src->_max;
+}
+
+uint64_t Histogram_percentile(const Histogram *hist, double percentile)
+{
+    if (hist->_count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->_count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->_counts[i];
+        if (seen >= rank)
+        {
+            uint64_t value = bucket_value(i);
+            return value > hist->_max ? hist->_max : value;
+        }
+    }
+    return hist->_max;
+}
+
+double Histogram_mean(const Histogram *hist)
+{
+    return hist->_count ? hist->_sum / hist->_count : 0.0;
+}
+
+void Histogram_print(const Histogram *hist, const char *label, double scale, const char *unit)
+{
+    if (hist->_count == 0)
+    {
+        printf("%s: no samples\n", label);
+        return;
+    }
+    printf("%s: n=%llu min %.3f p50 %.3f p99 %.3f p999 %.3f max %.3f %s\n", label, (unsigned long long)hist->_count,
+           hist->_min / scale, Histogram_percentile(hist, 50.0) / scale, Histogram_percentile(hist, 99.0) / scale,
+           Histogram_percentile(hist, 99.9) / scale, hist->_max / scale, unit);
+}
+
+// ************ Run timer **************
+int Run_Timer_init(Run_Timer *timer)
+{
+    memset(timer, 0, sizeof(Run_Timer));
+    timer->_gaps = Histogram_alloc();
+    return timer->_gaps == NULL ? -1 : 0;
+}
+
+void Run_Timer_destroy(Run_Timer *timer)
+{
+    Histogram_free(timer->_gaps);
+    timer->_gaps = NULL;
+}
+
+void Run_Timer_arm(Run_Timer *timer)
+{
+    timer->_armed_ns = Timing_now_ns();
+    timer->_first_ns = 0;
+    timer->_last_ns = 0;
+    Histogram_reset(timer->_gaps);
+}
+
+void Run_Timer_chunk(Run_Timer *timer)
+{
+    uint64_t now = Timing_now_ns();
+    if (timer->_first_ns == 0)
+        timer->_first_ns = now;
+    else
+        Histogram_record(timer->_gaps, now - timer->_last_ns);
+    timer->_last_ns = now;
+}
+
+int Run_Timer_started(const Run_Timer *timer)
+{
+    return timer->_first_ns != 0;
+}
+
+double Run_Timer_ttfb_ms(const Run_Timer *timer)
+{
+    return timer->_first_ns ? (timer->_first_ns - timer->_armed_ns) / 1000000.0 : 0.0;
+}
+
+double Run_Timer_total_ms(const Run_Timer *timer)
+{
+    return timer->_first_ns ? (timer->_last_ns - timer->_first_ns) / 1000000.0 : 0.0;
+}
+
+const Histogram *Run_Timer_gaps(const Run_Timer *timer)
+{
+    return timer->_gaps;
+}
@@ -0,0 +1,62 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Wall-clock timing on CLOCK_MONOTONIC. clock() counts CPU time, which stands
+ * still while a receiver is blocked in recv(), so it must not time transfers.
+ */
+
+#define HIST_SUB_BITS 7                     // 128 sub-buckets per power of two, < 1% error
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40                    // values up to 2^40 ns (~18 minutes)
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/* Log-linear (HDR-style) histogram of non-negative integer values, e.g. nanoseconds. */
+typedef struct _Histogram
+{
+    uint64_t _counts[HIST_BUCKETS];
+    uint64_t _count;
+    uint64_t _min;
+    uint64_t _max;
+    double _sum;
+} Histogram;
+
+/* Times one run: how long it took to start, its length, and the gaps between chunks. */
+typedef struct _Run_Timer
+{
+    uint64_t _armed_ns;      // when the receiver started waiting for the run
+    uint64_t _first_ns;      // first byte
+    uint64_t _last_ns;       // latest byte
+    Histogram *_gaps;        // inter-arrival time of chunks, ns
+} Run_Timer;
+
+uint64_t Timing_now_ns(void);
+double Timing_now_ms(void);
+
+Histogram *Histogram_alloc(void);
+void Histogram_free(Histogram *hist);
+void Histogram_reset(Histogram *hist);
+void Histogram_record(Histogram *hist, uint64_t value);
+void Histogram_merge(Histogram *dst, const Histogram *src);
+/* Value at percentile (0-100); 0 if the histogram is empty. */
+uint64_t Histogram_percentile(const Histogram *hist, double percentile);
+double Histogram_mean(const Histogram *hist);
+/* Prints count, min, p50, p99, p999 and max, with values divided by scale. */
+void Histogram_print(const Histogram *hist, const char *label, double scale, const char *unit);
+
+/* Allocates the gap histogram; returns -1 on failure. */
+int Run_Timer_init(Run_Timer *timer);
+void Run_Timer_destroy(Run_Timer *timer);
+/* Starts waiting for the next run and clears the previous one. */
+void Run_Timer_arm(Run_Timer *timer);
+/* Records the arrival of a chunk of the run. */
+void Run_Timer_chunk(Run_Timer *timer);
+int Run_Timer_started(const Run_Timer *timer);
+double Run_Timer_ttfb_ms(const Run_Timer *timer);
+double Run_Timer_total_ms(const Run_Timer *timer);
+const Histogram *Run_Timer_gaps(const Run_Timer *timer);
+
+#endif
@@ -0,0 +1,328 @@
+#include "Trace.h"
+#include "Timing.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define PCAPNG_SHB 0x0A0D0D0Au
+#define PCAPNG_IDB 0x00000001u
+#define PCAPNG_EPB 0x00000006u
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4Du
+#define LINKTYPE_IPV4 228
+#define IP_UDP_HEADERS 28
+
+typedef struct _Trace_Ring
+{
+    Trace_Event *_events;
+    uint64_t _mask;
+    uint64_t _head;              // events ever written; only the owning thread writes
+    struct _Trace_Ring *_next;
+} Trace_Ring;
+
+Trace_Level trace_level = TRACE_INFO;
+
+static struct
+{
+    int enabled;
+    size_t capacity;
+    pthread_mutex_t lock;        // guards the ring list, taken once per thread
+    Trace_Ring *rings;
+    struct sockaddr_in local;
+    struct sockaddr_in peer;
+} trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread Trace_Ring *thread_ring;
+
+int Trace_parse_level(const char *name, Trace_Level *out)
+{
+    static const char *names[] = {"error", "warn", "info", "debug"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *out = (Trace_Level)i;
+            return 0;
+        }
+    }
+    printf("Unknown log level %s (error, warn, info or debug)\n", name);
+    return -1;
+}
+
+void Trace_set_level(Trace_Level level)
+{
+    trace_level = level;
+}
+
+int Trace_enable(size_t capacity)
+{
+    size_t rounded = 1;
+    while (rounded < capacity)
+        rounded <<= 1;
+    trace.capacity = rounded;
+    trace.enabled = 1;
+    return 0;
+}
+
+void Trace_set_endpoints(int fd)
+{
+    socklen_t len = sizeof(trace.local);
+    getsockname(fd, (struct sockaddr *)&trace.local, &len);
+    len = sizeof(trace.peer);
+    getpeername(fd, (struct sockaddr *)&trace.peer, &len);
+}
+
+static Trace_Ring *ring_alloc(void)
+{
+    Trace_Ring *ring = (Trace_Ring *)calloc(1, sizeof(Trace_Ring));
+    if (ring == NULL)
+        return NULL;
+    ring->_events = (Trace_Event *)malloc(trace.capacity * sizeof(Trace_Event));
+    if (ring->_events == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->_mask = trace.capacity - 1;
+
+    pthread_mutex_lock(&trace.lock);
+    ring->_next = trace.rings;
+    trace.rings = ring;
+    pthread_mutex_unlock(&trace.lock);
+    return ring;
+}
+
+void Trace_packet(Trace_Dir dir, const RUDP_Packet *p, size_t wire_len)
+{
+    if (trace_level >= TRACE_DEBUG)
+        printf("%s SYN %d ACK %d DATA %d FIN %d PROBE %d NACK %d length %05d checksum %04X seq_num %d window %d\n", dir == TRACE_IN ? "IN " : "OUT",
+               p->flags.SYN, p->flags.ACK, p->flags.DATA, p->flags.FIN, p->flags.PROBE, p->flags.NACK, p->length, p->checksum, p->seq_num, p->window);
+
+    if (!trace.enabled)
+        return;
+    if (thread_ring == NULL && (thread_ring = ring_alloc()) == NULL)
+    {
+        trace.enabled = 0;
+        perror("Trace ring allocation failed");
+        return;
+    }
+
+    Trace_Event *e = &thread_ring->_events[thread_ring->_head & thread_ring->_mask];
+    e->t_ns = Timing_now_ns();
+    e->wire_len = (uint32_t)wire_len;
+    e->seq_num = p->seq_num;
+    e->length = p->length;
+    e->checksum = p->checksum;
+    e->flags = p->all_flags;
+    e->dir = (uint8_t)dir;
+    thread_ring->_head++;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    uint64_t x = ((const Trace_Event *)a)->t_ns, y = ((const Trace_Event *)b)->t_ns;
+    return (x > y) - (x < y);
+}
+
+/* Copies the events of every ring into one array sorted by time. */
+static Trace_Event *collect(size_t *count, uint64_t *overwritten)
+{
+    size_t total = 0;
+    *overwritten = 0;
+    for (Trace_Ring *r = trace.rings; r != NULL; r = r->_next)
+    {
+        total += r->_head < trace.capacity ? r->_head : trace.capacity;
+        *overwritten += r->_head > trace.capacity ? r->_head - trace.capacity : 0;
+    }
+
+    Trace_Event *events = (Trace_Event *)malloc((total ? total : 1) * sizeof(Trace_Event));
+    if (events == NULL)
+        return NULL;
+
+    size_t n = 0;
+    for (Trace_Ring *r = trace.rings; r != NULL; r = r->_next)
+    {
+        uint64_t first = r->_head > trace.capacity ? r->_head - trace.capacity : 0;
+        for (uint64_t i = first; i < r->_head; i++)
+            events[n++] = r->_events[i & r->_mask];
+    }
+    qsort(events, n, sizeof(Trace_Event), compare_events);
+    *count = n;
+    return events;
+}
+
+int Trace_dump_text(FILE *fp)
+{
+    size_t count;
+    uint64_t overwritten;
+    Trace_Event *events = collect(&count, &overwritten);
+    if (events == NULL)
+        return -1;
+
+    if (overwritten > 0)
+        fprintf(fp, "# %llu older events were overwritten\n", (unsigned long long)overwritten);
+    fprintf(fp, "# time_us dir flags seq_num length checksum wire_len\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        const Trace_Event *e = &events[i];
+        RUDP_flags f;
+        memcpy(&f, &e->flags, 1);
+        fprintf(fp, "%.3f %s %s%s%s%s%s%s%s %u %u %04X %u\n", (e->t_ns - events[0].t_ns) / 1000.0, e->dir == TRACE_IN ? "IN " : "OUT",
+                e->flags == 0xFF ? "CLOSE" : "", e->flags != 0xFF && f.SYN ? "S" : "",
+                e->flags != 0xFF && f.ACK ? "A" : "", e->flags != 0xFF && f.DATA ? "D" : "",
+                e->flags != 0xFF && f.FIN ? "F" : "", e->flags != 0xFF && f.PROBE ? "P" : "",
+                e->flags != 0xFF && f.NACK ? "N" : "", e->seq_num, e->length,
+                e->checksum, e->wire_len);
+    }
+    free(events);
+    return 0;
+}
+
+// ************ pcapng **************
+static void write_u32(FILE *fp, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+static uint16_t ip_checksum(const uint8_t *header, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i += 2)
+        sum += (uint32_t)(header[i] << 8 | header[i + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* IPv4 + UDP headers and the RUDP header of one event; the RUDP payload itself was not recorded. */
+static size_t build_packet(const Trace_Event *e, uint8_t *out)
+{
+    const struct sockaddr_in *src = e->dir == TRACE_OUT ? &trace.local : &trace.peer;
+    const struct sockaddr_in *dst = e->dir == TRACE_OUT ? &trace.peer : &trace.local;
+    uint32_t udp_len = 8 + e->wire_len;
+    uint32_t ip_len = 20 + udp_len;
+
+    memset(out, 0, IP_UDP_HEADERS);
+    out[0] = 0x45;                               // IPv4, 20 byte header
+    out[2] = (uint8_t)((ip_len > 0xFFFF ? 0xFFFF : ip_len) >> 8);
+    out[3] = (uint8_t)(ip_len > 0xFFFF ? 0xFF : ip_len);
+    out[6] = 0x40;                               // don't fragment
+    out[8] = 64;                                 // TTL
+    out[9] = 17;                                 // UDP
+    memcpy(out + 12, &src->sin_addr, 4);
+    memcpy(out + 16, &dst->sin_addr, 4);
+    uint16_t sum = ip_checksum(out, 20);
+    out[10] = (uint8_t)(sum >> 8);
+    out[11] = (uint8_t)sum;
+
+    memcpy(out + 20, &src->sin_port, 2);
+    memcpy(out + 22, &dst->sin_port, 2);
+    out[24] = (uint8_t)(udp_len >> 8);
+    out[25] = (uint8_t)udp_len;                  // checksum 0: not computed
+
+    RUDP_Packet header;
+    memset(&header, 0, offsetof(RUDP_Packet, data));
+    header.all_flags = e->flags;
+    header.length = e->length;
+    header.checksum = e->checksum;
+    header.seq_num = e->seq_num;
+    memcpy(out + IP_UDP_HEADERS, &header, offsetof(RUDP_Packet, data));
+    return IP_UDP_HEADERS + offsetof(RUDP_Packet, data);
+}
+
+int Trace_dump_pcapng(FILE *fp)
+{
+    size_t count;
+    uint64_t overwritten;
+    Trace_Event *events = collect(&count, &overwritten);
+    if (events == NULL)
+        return -1;
+
+    // monotonic event times to wall clock
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t offset = ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+
+    // Section Header Block
+    write_u32(fp, PCAPNG_SHB);
+    write_u32(fp, 28);
+    write_u32(fp, PCAPNG_BYTE_ORDER);
+    uint16_t version[2] = {1, 0};
+    fwrite(version, sizeof(version), 1, fp);
+    int64_t section_length = -1;
+    fwrite(&section_length, sizeof(section_length), 1, fp);
+    write_u32(fp, 28);
+
+    // Interface Description Block, raw IPv4 with nanosecond timestamps (if_tsresol = 9)
+    write_u32(fp, PCAPNG_IDB);
+    write_u32(fp, 32);
+    uint16_t link[2] = {LINKTYPE_IPV4, 0};
+    fwrite(link, sizeof(link), 1, fp);
+    write_u32(fp, 0);                                 // no snap length limit
+    uint16_t tsresol[2] = {9, 1};
+    fwrite(tsresol, sizeof(tsresol), 1, fp);
+    write_u32(fp, 9);                                 // value 9 and 3 bytes padding
+    write_u32(fp, 0);                                 // opt_endofopt
+    write_u32(fp, 32);
+
+    // Enhanced Packet Blocks
+    uint8_t packet[IP_UDP_HEADERS + offsetof(RUDP_Packet, data)];
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t captured = build_packet(&events[i], packet);
+        uint32_t padded = (uint32_t)((captured + 3) & ~3u);
+        uint32_t block = 32 + padded;
+        uint64_t ts = (uint64_t)((int64_t)events[i].t_ns + offset);
+
+        write_u32(fp, PCAPNG_EPB);
+        write_u32(fp, block);
+        write_u32(fp, 0);                             // interface
+        write_u32(fp, (uint32_t)(ts >> 32));
+        write_u32(fp, (uint32_t)ts);
+        write_u32(fp, (uint32_t)captured);
+        write_u32(fp, IP_UDP_HEADERS + events[i].wire_len);
+        fwrite(packet, 1, captured, fp);
+        fwrite("\0\0\0", 1, padded - captured, fp);
+        write_u32(fp, block);
+    }
+
+    free(events);
+    return ferror(fp) ? -1 : 0;
+}
+
+int Trace_dump(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        perror("fopen() failed");
+        return -1;
+    }
+
+    size_t len = strlen(path);
+    int result = len > 7 && strcmp(path + len - 7, ".pcapng") == 0 ? Trace_dump_pcapng(fp) : Trace_dump_text(fp);
+    if (fclose(fp) != 0)
+        result = -1;
+    return result;
+}
+
+void Trace_cleanup(void)
+{
+    pthread_mutex_lock(&trace.lock);
+    Trace_Ring *r = trace.rings;
+    while (r != NULL)
+    {
+        Trace_Ring *next = r->_next;
+        free(r->_events);
+        free(r);
+        r = next;
+    }
+    trace.rings = NULL;
+    trace.enabled = 0;
+    pthread_mutex_unlock(&trace.lock);
+    thread_ring = NULL;
+}
@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "RUDP_API.h"
+
+/*
+ * Log levels and packet tracing for RUDP_API.
+ *
+ * Messages go through Trace_log(), which costs one comparison below the current
+ * level. Packets are recorded as fixed-size binary events into a ring owned by the
+ * calling thread (single writer, no locks), and written out after the run as text
+ * or as pcapng for Wireshark. At TRACE_DEBUG every packet is also printed live.
+ */
+typedef enum _Trace_Level
+{
+    TRACE_ERROR = 0,
+    TRACE_WARN = 1,
+    TRACE_INFO = 2,
+    TRACE_DEBUG = 3,
+} Trace_Level;
+
+typedef enum _Trace_Dir
+{
+    TRACE_IN = 0,
+    TRACE_OUT = 1,
+} Trace_Dir;
+
+typedef struct _Trace_Event
+{
+    uint64_t t_ns;         // CLOCK_MONOTONIC
+    uint32_t wire_len;     // bytes sent or received
+    uint16_t seq_num;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t flags;         // RUDP_Packet.all_flags
+    uint8_t dir;           // Trace_Dir
+} Trace_Event;
+
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+
+extern Trace_Level trace_level;
+
+#define Trace_log(level, ...)              \
+    do                                     \
+    {                                      \
+        if ((level) <= trace_level)        \
+            printf(__VA_ARGS__);           \
+    } while (0)
+
+/* Parses "error", "warn", "info" or "debug". */
+int Trace_parse_level(const char *name, Trace_Level *out);
+void Trace_set_level(Trace_Level level);
+
+/* Starts recording packets; each thread gets a ring of capacity events (rounded up to a power of two), oldest overwritten. */
+int Trace_enable(size_t capacity);
+/* Remembers fd's addresses for the pcapng IP/UDP headers; call once fd is connected. */
+void Trace_set_endpoints(int fd);
+void Trace_packet(Trace_Dir dir, const RUDP_Packet *packet, size_t wire_len);
+
+/* Writes every recorded event in time order: pcapng if path ends in ".pcapng", text otherwise. */
+int Trace_dump(const char *path);
+int Trace_dump_text(FILE *fp);
+int Trace_dump_pcapng(FILE *fp);
+/* Frees the rings; call once the threads that recorded have stopped. */
+void Trace_cleanup(void);
+
+#endif
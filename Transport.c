@@ -0,0 +1,26 @@
+#include "Transport.h"
+#include <stdio.h>
+#include <string.h>
+
+static const Transport *const transports[] = {&Transport_tcp, &Transport_rudp};
+#define TRANSPORT_COUNT (sizeof(transports) / sizeof(transports[0]))
+
+const Transport *Transport_find(const char *name)
+{
+    for (size_t i = 0; i < TRANSPORT_COUNT; i++)
+    {
+        if (strcmp(transports[i]->name, name) == 0)
+            return transports[i];
+    }
+    printf("Unknown transport %s (", name);
+    for (size_t i = 0; i < TRANSPORT_COUNT; i++)
+        printf("%s%s", i > 0 ? ", " : "", transports[i]->name);
+    printf(")\n");
+    return NULL;
+}
+
+void Transport_print_usage(void)
+{
+    for (size_t i = 0; i < TRANSPORT_COUNT; i++)
+        printf("  -t %-5s %s\n", transports[i]->name, transports[i]->usage);
+}
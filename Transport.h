@@ -0,0 +1,65 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A transport as netbench drives it: every backend moves runs (see Run.h) from a
+ * sender to a receiver, and netbench does the rest - payload, files, compression,
+ * verification, timing and statistics - the same way for all of them.
+ *
+ * A session is open(), then any number of runs, then close(). The sender starts a
+ * run with connect() and sends it in parts, the last one flagged; the receiver waits
+ * for it with accept() and receives until done. A new backend fills in a Transport
+ * and adds itself to the table in Transport.c.
+ */
+typedef struct _Transport_Conn
+{
+    int sock;              // connected or bound socket, -1 before open()
+    int listen_sock;       // TCP receiver, -1 otherwise
+    int sender;
+    int runs;              // runs started in the session
+    uint32_t record_left;  // TCP: bytes left of the current record
+    int record_last;       // TCP: the current record ends the run
+    int pingpong;          // set before open(): every message is answered (Ping_Pong.h), so send() does not wait for the peer
+    int batch;             // set before open() with pingpong: requests sent before their echoes are read
+    int more;              // pingpong: another message follows this send() right away, they may go out together
+} Transport_Conn;
+
+typedef struct _Transport
+{
+    const char *name;
+    const char *usage;     // its own options, for the usage line
+    /* Takes argv[*i], and its value, if it is one of the backend's options: 1, 0 if it is not, -1 if it is invalid. */
+    int (*option)(int argc, char *argv[], int *i);
+    /* Sender (ip set): sets up to reach ip:port. Receiver (ip NULL): listens on port. */
+    int (*open)(Transport_Conn *conn, const char *ip, unsigned short int port);
+    /* Sender: starts a run. */
+    int (*connect)(Transport_Conn *conn);
+    /* Receiver: waits for the next run; *done is -1 when the sender ended the session instead. */
+    int (*accept)(Transport_Conn *conn, int *done);
+    /* Sends the next len bytes of the run; with last they end it, and it returns once the receiver has it all. */
+    int (*send)(Transport_Conn *conn, const void *buf, size_t len, int last);
+    /* Receives up to cap (at least NETBENCH_RECV_SIZE) next bytes of the run; *done is 1 after its last. With
+       pingpong either side may send and receive, one whole message at a time. */
+    ssize_t (*recv)(Transport_Conn *conn, void *buf, size_t cap, int *done);
+    /* Ends the session; the sender tells the receiver. */
+    int (*close)(Transport_Conn *conn);
+    /* Prints the transport's own counters. */
+    void (*stats)(const Transport_Conn *conn);
+} Transport;
+
+#define NETBENCH_RECV_SIZE 65536
+#define NETBENCH_SIZE_DEFAULT (2 * 1024 * 1024) // bytes per run, as RUDP_Sender and TCP_Sender send
+
+extern const Transport Transport_tcp;
+extern const Transport Transport_rudp;
+
+/* Looks a backend up by name, printing the known ones if there is none. */
+const Transport *Transport_find(const char *name);
+/* Prints every backend's options, one per line. */
+void Transport_print_usage(void);
+
+#endif
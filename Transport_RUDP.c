@@ -0,0 +1,191 @@
+#include "Transport.h"
+#include "RUDP_API.h"
+#include "RUDP_Export.h"
+#include "Impair.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+/*
+ * Every run is one RUDP connection and one message, FIN on its last segment; the close packet ends the session.
+ * With -messages a ping-pong goes through the message API instead: a batch of requests shares segments
+ * (rudp_sendmsg() with RUDP_MSG_MORE) and goes out in one turn, and so do their echoes.
+ */
+static struct
+{
+    const char *impair_spec;
+    Impair_Config impair;
+    const char *trace_path;
+    Trace_Level level;
+    const char *export_target;
+    unsigned int export_ms;
+    int ack_thread;
+    int messages;
+} rudp = {NULL, {0}, NULL, TRACE_INFO, NULL, RUDP_EXPORT_DEFAULT_MS, 0, 0};
+
+static int rudp_option(int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "-ackthread") == 0)
+    {
+        rudp.ack_thread = 1;
+        return 1;
+    }
+    if (strcmp(argv[*i], "-messages") == 0)
+    {
+        rudp.messages = 1;
+        return 1;
+    }
+    if (*i + 1 >= argc)
+        return 0;
+    int taken = rudp_config_option(argc, argv, i);
+    if (taken != 0)
+        return taken;
+    if (strcmp(argv[*i], "-impair") == 0)
+    {
+        rudp.impair_spec = argv[++*i];
+        return Impair_parse(rudp.impair_spec, &rudp.impair) < 0 ? -1 : 1;
+    }
+    if (strcmp(argv[*i], "-log") == 0)
+        return Trace_parse_level(argv[++*i], &rudp.level) < 0 ? -1 : 1;
+    if (strcmp(argv[*i], "-trace") == 0)
+    {
+        rudp.trace_path = argv[++*i];
+        return 1;
+    }
+    if (strcmp(argv[*i], "-export") == 0)
+    {
+        rudp.export_target = argv[++*i];
+        return RUDP_Export_parse(rudp.export_target) < 0 ? -1 : 1;
+    }
+    if (strcmp(argv[*i], "-export-ms") == 0)
+    {
+        rudp.export_ms = (unsigned int)atoi(argv[++*i]);
+        return 1;
+    }
+    return 0;
+}
+
+static int transport_rudp_open(Transport_Conn *conn, const char *ip, unsigned short int port)
+{
+    conn->sender = ip != NULL;
+    conn->listen_sock = -1;
+    // one message per turn otherwise: the requests of a batch would each end the sender's turn
+    if (conn->batch > 1 && !rudp.messages)
+    {
+        printf("-batch needs -messages with -t rudp\n");
+        return -1;
+    }
+
+    Trace_set_level(rudp.level);
+    if (rudp.trace_path != NULL)
+        Trace_enable(TRACE_DEFAULT_CAPACITY);
+    if (rudp.impair_spec != NULL)
+        Impair_init(&rudp.impair);
+
+    conn->sock = udp_socket(ip, port);
+    if (conn->sock < 0)
+        return -1;
+    if (rudp.ack_thread && conn->sender && rudp_set_ack_thread(conn->sock, 1) < 0)
+    {
+        rudp_close(conn->sock, 0);
+        conn->sock = -1;
+        return -1;
+    }
+    if (rudp.export_target != NULL && RUDP_Export_start(rudp.export_target, rudp.export_ms) < 0)
+    {
+        rudp_close(conn->sock, 0);
+        conn->sock = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int transport_rudp_connect(Transport_Conn *conn)
+{
+    conn->runs++;
+    return rudp_socket(conn->sock);
+}
+
+static int transport_rudp_accept(Transport_Conn *conn, int *done)
+{
+    *done = 0;
+    int accepted;
+    while ((accepted = rudp_accept(conn->sock, 0, done)) < 0 && errno == EAGAIN && conn->runs == 0)
+        printf("No sender yet, still waiting\n");
+    if (accepted < 0)
+    {
+        if (conn->runs == 0)
+        {
+            perror("Failed to accept connection");
+            return -1;
+        }
+        // the sender's close packet was lost
+        printf("No new run from the sender, ending the session\n");
+        *done = -1;
+        return 0;
+    }
+    if (*done == 0)
+        conn->runs++;
+    return 0;
+}
+
+static int transport_rudp_send(Transport_Conn *conn, const void *buf, size_t len, int last)
+{
+    if (rudp.messages && conn->pingpong)
+    {
+        struct iovec iov = {(void *)buf, len};
+        return rudp_sendmsg(conn->sock, &iov, 1, conn->more ? RUDP_MSG_MORE : 0) < 0 ? -1 : 0;
+    }
+    return rudp_send_part(conn->sock, buf, (unsigned int)len, last) > 0 ? 0 : -1;
+}
+
+static ssize_t transport_rudp_recv(Transport_Conn *conn, void *buf, size_t cap, int *done)
+{
+    if (rudp.messages && conn->pingpong)
+    {
+        // a whole message at a time; what does not fit in cap is dropped
+        struct iovec iov = {buf, cap};
+        ssize_t n = rudp_recvmsg(conn->sock, &iov, 1, done);
+        if (n < 0 || *done < 0)
+            return n < 0 ? -1 : 0;
+        *done = 1;
+        return (size_t)n < cap ? n : (ssize_t)cap;
+    }
+    return rudp_recv(conn->sock, buf, (unsigned int)cap, done);
+}
+
+static int transport_rudp_close(Transport_Conn *conn)
+{
+    int result = conn->sock >= 0 ? rudp_close(conn->sock, conn->sender) : 0;
+    conn->sock = -1;
+    RUDP_Export_stop();
+    if (rudp.trace_path != NULL && Trace_dump(rudp.trace_path) == 0)
+        printf("Packet trace written to %s\n", rudp.trace_path);
+    Trace_cleanup();
+    return result;
+}
+
+static void transport_rudp_stats(const Transport_Conn *conn)
+{
+    (void)conn; // the totals of every socket
+    RUDP_Stats stats;
+    rudp_get_total_stats(&stats);
+    rudp_print_stats(&stats);
+    Impair_print_stats();
+}
+
+const Transport Transport_rudp = {
+    .name = "rudp",
+    .usage = "[-impair <spec>] [-log <error|warn|info|debug>] [-trace <file[.pcapng]>] [-export <unix:path|shm:name>] [-export-ms <ms>] [-ackthread] [-messages] " RUDP_CONFIG_USAGE,
+    .option = rudp_option,
+    .open = transport_rudp_open,
+    .connect = transport_rudp_connect,
+    .accept = transport_rudp_accept,
+    .send = transport_rudp_send,
+    .recv = transport_rudp_recv,
+    .close = transport_rudp_close,
+    .stats = transport_rudp_stats,
+};
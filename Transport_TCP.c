@@ -0,0 +1,342 @@
+#include "Transport.h"
+#include "TCP_Tuning.h"
+#include "IO_Backend.h"
+#include "Busy_Poll.h"
+#include "Timestamp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+/*
+ * Runs go over one TCP connection, each as records: a 4-byte big-endian length,
+ * TCP_RECORD_LAST set on the last record of the run, then that many bytes.
+ * TCP_RECORD_CLOSE in place of a record ends the session.
+ */
+#define TCP_RECORD_LAST 0x80000000u
+#define TCP_RECORD_CLOSE 0xFFFFFFFFu
+#define DRAIN_TIMEOUT_MS 5000
+#define DRAIN_POLL_US 50
+#define TCP_RECORD_INLINE 1024 // records up to this long go out in one send() with their length
+
+static struct
+{
+    const char *algo;
+    const TCP_Profile *profile;
+} tcp = {"cubic", NULL};
+
+static int tcp_option(int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "-algo") == 0 && *i + 1 < argc)
+    {
+        tcp.algo = argv[++*i];
+        return 1;
+    }
+    if (strcmp(argv[*i], "-profile") == 0 && *i + 1 < argc)
+    {
+        tcp.profile = TCP_Tuning_find_profile(argv[++*i]);
+        if (tcp.profile == NULL)
+        {
+            printf("Profiles:\n");
+            TCP_Tuning_print_profiles();
+            return -1;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Ping-pong messages go out as soon as they are written, not once the last one is ACKed (Nagle). */
+static int set_nodelay(const Transport_Conn *conn, int sock)
+{
+    int on = 1;
+    if (conn->pingpong && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+    {
+        perror("setsockopt(TCP_NODELAY) failed");
+        return -1;
+    }
+    return 0;
+}
+
+static int tcp_open(Transport_Conn *conn, const char *ip, unsigned short int port)
+{
+    const TCP_Profile *profile = tcp.profile != NULL ? tcp.profile : TCP_Tuning_find_profile("default");
+    conn->sender = ip != NULL;
+    conn->listen_sock = -1;
+    conn->record_left = 0;
+    conn->record_last = 0;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1)
+    {
+        perror("socket(2) failed");
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+
+    if (conn->sender)
+    {
+        // algorithm, buffer sizes and MSS before connect(), to shape the handshake
+        if (inet_pton(AF_INET, ip, &address.sin_addr) <= 0)
+        {
+            perror("inet_pton() failed");
+            close(sock);
+            return -1;
+        }
+        Busy_Poll_socket(sock);
+        printf("Using tuning profile %s, algo %s\n", profile->name, tcp.algo);
+        if (TCP_Tuning_set_algo(sock, tcp.algo) < 0 || TCP_Tuning_apply(sock, profile) < 0 || set_nodelay(conn, sock) < 0)
+        {
+            close(sock);
+            return -1;
+        }
+        if (connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            perror("connect() failed");
+            close(sock);
+            return -1;
+        }
+        printf("connected to server\n");
+        Timestamp_socket(sock);
+        conn->sock = sock;
+        return 0;
+    }
+
+    // accepted sockets inherit the profile, and SO_RCVBUF must be set before listen() to size the window scale
+    int enableReuse = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enableReuse, sizeof(int)) == -1)
+    {
+        perror("setsockopt(2)");
+        close(sock);
+        return -1;
+    }
+    printf("Using tuning profile %s\n", profile->name);
+    if (TCP_Tuning_apply(sock, profile) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    Busy_Poll_socket(sock);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        perror("bind() failed");
+        close(sock);
+        return -1;
+    }
+    if (listen(sock, 1) == -1)
+    {
+        perror("listen() failed");
+        close(sock);
+        return -1;
+    }
+    printf("Waiting for incoming TCP-connections...\n");
+    conn->listen_sock = sock;
+    conn->sock = -1;
+    return 0;
+}
+
+static int tcp_connect(Transport_Conn *conn)
+{
+    conn->runs++;
+    return 0;
+}
+
+/* Receives exactly len bytes; 0 if the peer closed the connection first. */
+static ssize_t recv_all(int sock, void *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = IO_recv(sock, (char *)buf + got, len - got);
+        if (n <= 0)
+            return n;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+/* Reads the next record header into conn; 0 when it is TCP_RECORD_CLOSE or the connection ended. */
+static int next_record(Transport_Conn *conn)
+{
+    uint32_t record;
+    ssize_t n = recv_all(conn->sock, &record, sizeof(record));
+    if (n < 0)
+    {
+        perror("recv(2)");
+        return -1;
+    }
+    record = ntohl(record);
+    if (n == 0 || record == TCP_RECORD_CLOSE)
+        return 0;
+    conn->record_left = record & ~TCP_RECORD_LAST;
+    conn->record_last = (record & TCP_RECORD_LAST) != 0;
+    return 1;
+}
+
+static int tcp_accept(Transport_Conn *conn, int *done)
+{
+    *done = 0;
+    if (conn->sock < 0)
+    {
+        struct sockaddr_in clientAddress;
+        socklen_t clientAddressLen = sizeof(clientAddress);
+        conn->sock = accept(conn->listen_sock, (struct sockaddr *)&clientAddress, &clientAddressLen);
+        if (conn->sock == -1)
+        {
+            perror("accept() failed");
+            return -1;
+        }
+        printf("Connection accepted from %s:%d\n", inet_ntoa(clientAddress.sin_addr), ntohs(clientAddress.sin_port));
+        Timestamp_socket(conn->sock);
+        if (set_nodelay(conn, conn->sock) < 0)
+            return -1;
+    }
+
+    // the run starts with its first record
+    int result = next_record(conn);
+    if (result < 0)
+        return -1;
+    if (result == 0)
+    {
+        *done = -1;
+        return 0;
+    }
+    conn->runs++;
+    return 0;
+}
+
+/* Waits until the kernel send queue of sock is empty, i.e. the receiver acknowledged everything sent. */
+static void wait_for_drain(int sock, int timeout_ms)
+{
+    for (long waited = 0; waited < timeout_ms * 1000L; waited += DRAIN_POLL_US)
+    {
+        int pending = 0;
+        if (ioctl(sock, SIOCOUTQ, &pending) != 0 || pending == 0)
+            return;
+        usleep(DRAIN_POLL_US);
+    }
+}
+
+static int tcp_send(Transport_Conn *conn, const void *buf, size_t len, int last)
+{
+    uint32_t record = htonl((uint32_t)len | (last ? TCP_RECORD_LAST : 0));
+    ssize_t sent;
+    if (len <= TCP_RECORD_INLINE)
+    {
+        // one segment, not a length and then its record, when nothing holds the first back
+        char inline_record[sizeof(record) + TCP_RECORD_INLINE];
+        memcpy(inline_record, &record, sizeof(record));
+        if (len > 0)
+            memcpy(inline_record + sizeof(record), buf, len);
+        sent = IO_send(conn->sock, inline_record, sizeof(record) + len);
+    }
+    else
+    {
+        sent = IO_send(conn->sock, &record, sizeof(record));
+        if (sent >= 0)
+            sent = IO_send(conn->sock, buf, len);
+    }
+    if (sent < 0)
+    {
+        perror("send(2)");
+        return -1;
+    }
+    // like RUDP, a run is sent once the receiver has ACKed all of it; a ping-pong message once it is answered
+    if (last && !conn->pingpong)
+        wait_for_drain(conn->sock, DRAIN_TIMEOUT_MS);
+    return 0;
+}
+
+static ssize_t tcp_recv(Transport_Conn *conn, void *buf, size_t cap, int *done)
+{
+    // a run may carry empty records; the first one was read by tcp_accept()
+    while (conn->record_left == 0 && !conn->record_last)
+    {
+        int result = next_record(conn);
+        if (result <= 0)
+        {
+            if (result == 0)
+                printf("Connection closed in the middle of a run\n");
+            return -1;
+        }
+    }
+
+    ssize_t n = 0;
+    if (conn->record_left > 0)
+    {
+        n = IO_recv(conn->sock, buf, cap < conn->record_left ? cap : conn->record_left);
+        if (n <= 0)
+        {
+            if (n == 0)
+                printf("Connection closed in the middle of a run\n");
+            else
+                perror("recv(2)");
+            return -1;
+        }
+        conn->record_left -= (uint32_t)n;
+    }
+    if (conn->record_left == 0 && conn->record_last)
+    {
+        conn->record_last = 0;
+        *done = 1;
+    }
+    return n;
+}
+
+static int tcp_close(Transport_Conn *conn)
+{
+    int result = 0;
+    if (conn->sender && conn->sock >= 0)
+    {
+        uint32_t record = htonl(TCP_RECORD_CLOSE);
+        if (IO_send(conn->sock, &record, sizeof(record)) < 0)
+        {
+            perror("send(2)");
+            result = -1;
+        }
+    }
+    if (conn->sock >= 0)
+        IO_close(conn->sock);
+    if (conn->listen_sock >= 0)
+        close(conn->listen_sock);
+    conn->sock = conn->listen_sock = -1;
+    return result;
+}
+
+static void tcp_stats(const Transport_Conn *conn)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (conn->sock < 0 || getsockopt(conn->sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+    {
+        printf("TCP: %d runs\n", conn->runs);
+        return;
+    }
+    printf("TCP: %d runs, %u segments retransmitted, srtt %u us (var %u us), cwnd %u, ssthresh %u\n", conn->runs,
+           info.tcpi_total_retrans, info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_snd_cwnd, info.tcpi_snd_ssthresh);
+}
+
+const Transport Transport_tcp = {
+    .name = "tcp",
+    .usage = "[-algo <algorithm>] [-profile <name>]",
+    .option = tcp_option,
+    .open = tcp_open,
+    .connect = tcp_connect,
+    .accept = tcp_accept,
+    .send = tcp_send,
+    .recv = tcp_recv,
+    .close = tcp_close,
+    .stats = tcp_stats,
+};
@@ -0,0 +1,766 @@
+#include "XDP.h"
+#include "Timing.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XDP_NO_PORT 0xFFFFFFFFu     // the port map's value with no socket attached: matches no port
+#define XDP_LEARNED 16              // source MAC addresses remembered from the frames received
+#define XDP_STATS_EVERY 256         // frames received between reads of the kernel's drop counts
+#define XDP_ARP_MS 1000             // longest wait for the peer's MAC address
+#define XDP_PASS_JUMP 0x7FFF        // jump offset placeholder: to the program's XDP_PASS
+
+#define INSN(code, dst, src, off, imm) {(code), (dst), (src), (off), (imm)}
+
+// a ring shared with the kernel: we produce into fill and TX, consume from RX and completion
+typedef struct _XDP_Ring
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *descs;        // uint64_t frame addresses (fill, completion) or struct xdp_desc (RX, TX)
+    void *map;
+    size_t map_size;
+} XDP_Ring;
+
+typedef struct _XDP_Neighbour
+{
+    uint32_t ip;
+    unsigned char mac[ETH_ALEN];
+} XDP_Neighbour;
+
+static struct
+{
+    int xsk;                          // the AF_XDP socket, -1 before XDP_init()
+    int prog_fd;
+    int link_fd;                      // the program stays on the device while it is open
+    int xsks_map;                     // queue -> AF_XDP socket
+    int port_map;                     // the attached socket's port, network order
+    char dev[IF_NAMESIZE];
+    int ifindex;
+    unsigned int queue;
+    unsigned int mtu;
+    unsigned char mac[ETH_ALEN];
+    char *umem;
+    XDP_Ring fill, comp, rx, tx;
+    uint64_t free[XDP_FRAMES / 2];    // TX frames in neither the TX nor the completion ring
+    unsigned int nfree;
+    unsigned int queued;              // TX descriptors not kicked yet
+    int busy;
+
+    int fd;                           // the attached UDP socket, -1 for none
+    struct sockaddr_in local;
+    struct sockaddr_in peer;          // sin_port 0: not connected
+    unsigned char peer_mac[ETH_ALEN];
+    int peer_mac_known;
+    uint64_t timeout_ns;              // its SO_RCVTIMEO, 0 for none
+    uint16_t ip_id;
+
+    XDP_Neighbour learned[XDP_LEARNED];
+    unsigned int nlearned;
+    uint32_t dropped;                 // frames the kernel dropped for the socket (statistics)
+    unsigned int received;            // frames since the statistics were read
+    unsigned long syscalls;
+} xdp = {.xsk = -1, .prog_fd = -1, .link_fd = -1, .xsks_map = -1, .port_map = -1, .fd = -1};
+
+static long bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int map_create(uint32_t type, uint32_t max_entries)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = max_entries;
+    return (int)bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_update(int map, uint32_t key, uint32_t value)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)map;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&value;
+    attr.flags = BPF_ANY;
+    return (int)bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+/*
+ * The XDP program: an unfragmented IPv4 UDP datagram to the attached socket's port goes to the
+ * AF_XDP socket of the queue it came in on, everything else (ARP, other ports) to the kernel.
+ */
+static int load_program(void)
+{
+    struct bpf_insn prog[] = {
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, XDP_HEADERS),
+        INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, XDP_PASS_JUMP, 0),            // shorter than the headers
+        INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, 12, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, XDP_PASS_JUMP, htons(ETH_P_IP)),
+        INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_4, BPF_REG_2, 14, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, XDP_PASS_JUMP, 0x45),                 // IPv4 without options
+        INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_4, BPF_REG_2, 23, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, XDP_PASS_JUMP, IPPROTO_UDP),
+        INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, 20, 0),
+        INSN(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_4, 0, 0, htons(IP_MF | IP_OFFMASK)),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, XDP_PASS_JUMP, 0),                    // a fragment: the kernel reassembles it
+        INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_7, BPF_REG_2, 36, 0),                       // destination port
+        INSN(BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -4, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, xdp.port_map),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, XDP_PASS_JUMP, 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_0, 0, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_X, BPF_REG_1, BPF_REG_7, XDP_PASS_JUMP, 0),            // another port
+        INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, xdp.xsks_map),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),                       // no socket on that queue
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    int count = (int)(sizeof(prog) / sizeof(prog[0]));
+    for (int i = 0; i < count; i++)
+        if (BPF_CLASS(prog[i].code) == BPF_JMP && prog[i].off == XDP_PASS_JUMP)
+            prog[i].off = (short)(count - 2 - i - 1);
+
+    static char log[16384];
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)prog;
+    attr.insn_cnt = (uint32_t)count;
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    attr.expected_attach_type = BPF_XDP;
+    xdp.prog_fd = (int)bpf(BPF_PROG_LOAD, &attr);
+    if (xdp.prog_fd >= 0)
+        return 0;
+
+    // again with the verifier's log, to say why
+    int error = errno;
+    attr.log_buf = (uint64_t)(uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    if (bpf(BPF_PROG_LOAD, &attr) < 0 && log[0] != '\0')
+        printf("XDP program rejected:\n%s\n", log);
+    errno = error;
+    return -1;
+}
+
+static int ring_map(XDP_Ring *r, const struct xdp_ring_offset *off, size_t desc_size, off_t pgoff)
+{
+    r->map_size = off->desc + XDP_RING_SIZE * desc_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xdp.xsk, pgoff);
+    if (r->map == MAP_FAILED)
+    {
+        r->map = NULL;
+        return -1;
+    }
+    r->producer = (uint32_t *)((char *)r->map + off->producer);
+    r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+    r->descs = (char *)r->map + off->desc;
+    return 0;
+}
+
+/* Entries the kernel produced that we have not consumed. */
+static uint32_t ring_ready(const XDP_Ring *r)
+{
+    return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - *r->consumer;
+}
+
+/* Entries we produced that the kernel has not consumed. */
+static uint32_t ring_pending(const XDP_Ring *r)
+{
+    return *r->producer - __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE);
+}
+
+/* Gives frame back to the kernel to receive into. */
+static void fill_put(uint64_t frame)
+{
+    uint32_t prod = *xdp.fill.producer;
+    ((uint64_t *)xdp.fill.descs)[prod & (XDP_RING_SIZE - 1)] = frame;
+    __atomic_store_n(xdp.fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+/* Takes the TX frames the kernel is done with. */
+static void reap(void)
+{
+    uint32_t n = ring_ready(&xdp.comp);
+    uint32_t cons = *xdp.comp.consumer;
+    for (uint32_t i = 0; i < n; i++)
+        xdp.free[xdp.nfree++] = ((uint64_t *)xdp.comp.descs)[(cons + i) & (XDP_RING_SIZE - 1)];
+    __atomic_store_n(xdp.comp.consumer, cons + n, __ATOMIC_RELEASE);
+}
+
+/* Has the kernel send the TX descriptors queued: in copy mode a sendto() takes a batch of them at a time. */
+static void kick(void)
+{
+    for (int tries = 0; xdp.queued > 0 && ring_pending(&xdp.tx) > 0 && tries < XDP_RING_SIZE / XDP_TX_BATCH; tries++)
+    {
+        __atomic_add_fetch(&xdp.syscalls, 1, __ATOMIC_RELAXED);
+        if (sendto(xdp.xsk, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+        {
+            perror("sendto() on the XDP socket failed");
+            break;
+        }
+    }
+    xdp.queued = 0;
+    reap();
+}
+
+static uint16_t ip_checksum(const void *header, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)header;
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += (uint32_t)(p[i] << 8 | p[i + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return htons((uint16_t)~sum);
+}
+
+static void learn(uint32_t ip, const unsigned char *mac)
+{
+    for (unsigned int i = 0; i < xdp.nlearned; i++)
+        if (xdp.learned[i].ip == ip)
+        {
+            memcpy(xdp.learned[i].mac, mac, ETH_ALEN);
+            return;
+        }
+    XDP_Neighbour *n = &xdp.learned[xdp.nlearned < XDP_LEARNED ? xdp.nlearned++ : ip % XDP_LEARNED];
+    n->ip = ip;
+    memcpy(n->mac, mac, ETH_ALEN);
+}
+
+/* The peer's MAC address from the kernel's ARP table, for the peer reached through our device. */
+static int arp_lookup(unsigned char *mac)
+{
+    FILE *fp = fopen("/proc/net/arp", "r");
+    if (fp == NULL)
+        return -1;
+    char line[256], ip[64], hw[32], dev[IF_NAMESIZE + 1];
+    unsigned int flags;
+    int found = -1;
+    char want[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &xdp.peer.sin_addr, want, sizeof(want));
+    while (found < 0 && fgets(line, sizeof(line), fp) != NULL)
+    {
+        // IP address, HW type, Flags, HW address, Mask, Device; flag 0x2: complete
+        if (sscanf(line, "%63s %*s %x %31s %*s %16s", ip, &flags, hw, dev) != 4 || strcmp(ip, want) != 0 ||
+            strcmp(dev, xdp.dev) != 0 || !(flags & 0x2))
+            continue;
+        unsigned int b[ETH_ALEN];
+        if (sscanf(hw, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETH_ALEN)
+            continue;
+        for (int i = 0; i < ETH_ALEN; i++)
+            mac[i] = (unsigned char)b[i];
+        found = 0;
+    }
+    fclose(fp);
+    return found;
+}
+
+/* Learned from its frames, else the kernel's ARP table, else asked for: a datagram to its discard port has the kernel resolve it. */
+static void resolve_peer(void)
+{
+    for (unsigned int i = 0; i < xdp.nlearned; i++)
+        if (xdp.learned[i].ip == xdp.peer.sin_addr.s_addr)
+        {
+            memcpy(xdp.peer_mac, xdp.learned[i].mac, ETH_ALEN);
+            xdp.peer_mac_known = 1;
+            return;
+        }
+    if (arp_lookup(xdp.peer_mac) == 0)
+    {
+        xdp.peer_mac_known = 1;
+        return;
+    }
+
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in discard = xdp.peer;
+    discard.sin_port = htons(9);
+    if (probe < 0 || sendto(probe, "", 0, 0, (struct sockaddr *)&discard, sizeof(discard)) < 0)
+        perror("ARP probe failed");
+    if (probe >= 0)
+        close(probe);
+    for (int waited = 0; waited < XDP_ARP_MS && !xdp.peer_mac_known; waited += 10)
+    {
+        usleep(10000);
+        xdp.peer_mac_known = arp_lookup(xdp.peer_mac) == 0;
+    }
+    if (!xdp.peer_mac_known)
+        printf("XDP: no MAC address for %s on %s\n", inet_ntoa(xdp.peer.sin_addr), xdp.dev);
+}
+
+int XDP_init(const char *dev, unsigned int queue)
+{
+    if (strlen(dev) >= IF_NAMESIZE || (xdp.ifindex = (int)if_nametoindex(dev)) == 0)
+    {
+        errno = ENODEV;
+        return -1;
+    }
+    strcpy(xdp.dev, dev);
+    xdp.queue = queue;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, dev);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || ioctl(sock, SIOCGIFMTU, &ifr) < 0)
+    {
+        perror("SIOCGIFMTU failed");
+        if (sock >= 0)
+            close(sock);
+        return -1;
+    }
+    xdp.mtu = (unsigned int)ifr.ifr_mtu;
+    if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0)
+    {
+        perror("SIOCGIFHWADDR failed");
+        close(sock);
+        return -1;
+    }
+    memcpy(xdp.mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    close(sock);
+
+    xdp.xsks_map = map_create(BPF_MAP_TYPE_XSKMAP, queue + 1);
+    xdp.port_map = map_create(BPF_MAP_TYPE_ARRAY, 1);
+    if (xdp.xsks_map < 0 || xdp.port_map < 0 || map_update(xdp.port_map, 0, XDP_NO_PORT) < 0)
+    {
+        perror("BPF map setup failed");
+        XDP_cleanup();
+        return -1;
+    }
+
+    // the UMEM: frames the kernel copies received frames into and sends ours from
+    size_t umem_size = (size_t)XDP_FRAMES * XDP_FRAME_SIZE;
+    xdp.umem = (char *)mmap(NULL, umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xdp.umem == MAP_FAILED)
+    {
+        xdp.umem = NULL;
+        perror("mmap() of the UMEM failed");
+        XDP_cleanup();
+        return -1;
+    }
+    xdp.xsk = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)xdp.umem;
+    reg.len = umem_size;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    int size = XDP_RING_SIZE;
+    struct xdp_mmap_offsets off;
+    socklen_t off_len = sizeof(off);
+    if (xdp.xsk < 0 || setsockopt(xdp.xsk, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+        setsockopt(xdp.xsk, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xdp.xsk, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xdp.xsk, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xdp.xsk, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0 ||
+        getsockopt(xdp.xsk, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0 ||
+        ring_map(&xdp.fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+        ring_map(&xdp.comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+        ring_map(&xdp.rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0 ||
+        ring_map(&xdp.tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0)
+    {
+        perror("AF_XDP socket setup failed");
+        XDP_cleanup();
+        return -1;
+    }
+
+    // the first half of the frames receive, the second half send
+    for (uint64_t i = 0; i < XDP_FRAMES / 2; i++)
+        fill_put(i * XDP_FRAME_SIZE);
+    xdp.nfree = 0;
+    for (uint64_t i = XDP_FRAMES / 2; i < XDP_FRAMES; i++)
+        xdp.free[xdp.nfree++] = i * XDP_FRAME_SIZE;
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = (uint32_t)xdp.ifindex;
+    sxdp.sxdp_queue_id = queue;
+    sxdp.sxdp_flags = XDP_COPY;
+    if (bind(xdp.xsk, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+    {
+        perror("bind() of the AF_XDP socket failed");
+        XDP_cleanup();
+        return -1;
+    }
+    if (map_update(xdp.xsks_map, queue, (uint32_t)xdp.xsk) < 0 || load_program() < 0)
+    {
+        perror("XDP program setup failed");
+        XDP_cleanup();
+        return -1;
+    }
+
+    // generic (SKB) mode works on any device; the link detaches the program when the process exits
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = (uint32_t)xdp.prog_fd;
+    attr.link_create.target_ifindex = (uint32_t)xdp.ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    xdp.link_fd = (int)bpf(BPF_LINK_CREATE, &attr);
+    if (xdp.link_fd < 0)
+    {
+        perror("Attaching the XDP program failed");
+        XDP_cleanup();
+        return -1;
+    }
+    printf("AF_XDP on %s queue %u: copy mode, generic XDP, MTU %u\n", dev, queue, xdp.mtu);
+    return 0;
+}
+
+void XDP_cleanup(void)
+{
+    if (xdp.xsk >= 0 && xdp.tx.map != NULL)
+        kick();
+    if (xdp.link_fd >= 0)
+        close(xdp.link_fd);
+    if (xdp.prog_fd >= 0)
+        close(xdp.prog_fd);
+    if (xdp.xsks_map >= 0)
+        close(xdp.xsks_map);
+    if (xdp.port_map >= 0)
+        close(xdp.port_map);
+    XDP_Ring *rings[] = {&xdp.fill, &xdp.comp, &xdp.rx, &xdp.tx};
+    for (int i = 0; i < 4; i++)
+        if (rings[i]->map != NULL)
+            munmap(rings[i]->map, rings[i]->map_size);
+    if (xdp.xsk >= 0)
+        close(xdp.xsk);
+    if (xdp.umem != NULL)
+        munmap(xdp.umem, (size_t)XDP_FRAMES * XDP_FRAME_SIZE);
+    memset(&xdp, 0, sizeof(xdp));
+    xdp.xsk = xdp.prog_fd = xdp.link_fd = xdp.xsks_map = xdp.port_map = xdp.fd = -1;
+}
+
+int XDP_attach(int fd)
+{
+    if (xdp.xsk < 0)
+        return -1;
+    if (xdp.fd >= 0)
+    {
+        printf("XDP: socket %d has %s already, socket %d goes through the kernel\n", xdp.fd, xdp.dev, fd);
+        return -1;
+    }
+    socklen_t len = sizeof(xdp.local);
+    if (getsockname(fd, (struct sockaddr *)&xdp.local, &len) < 0 || xdp.local.sin_family != AF_INET ||
+        map_update(xdp.port_map, 0, xdp.local.sin_port) < 0)
+    {
+        perror("XDP: attaching the socket failed");
+        return -1;
+    }
+    xdp.fd = fd;
+    struct timeval timeout;
+    len = sizeof(timeout);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &len) == 0)
+        xdp.timeout_ns = (uint64_t)timeout.tv_sec * 1000000000ULL + (uint64_t)timeout.tv_usec * 1000ULL;
+    XDP_peer_changed(fd);
+    return 0;
+}
+
+int XDP_attached(int fd)
+{
+    return fd >= 0 && fd == xdp.fd;
+}
+
+void XDP_peer_changed(int fd)
+{
+    if (!XDP_attached(fd))
+        return;
+    kick(); // what is queued was for the last peer
+    socklen_t len = sizeof(xdp.local);
+    getsockname(fd, (struct sockaddr *)&xdp.local, &len);
+    len = sizeof(xdp.peer);
+    if (getpeername(fd, (struct sockaddr *)&xdp.peer, &len) < 0)
+        memset(&xdp.peer, 0, sizeof(xdp.peer));
+    xdp.peer_mac_known = 0;
+    if (xdp.peer.sin_port != 0)
+        resolve_peer();
+}
+
+void XDP_set_timeout(int fd, int seconds)
+{
+    if (XDP_attached(fd))
+        xdp.timeout_ns = seconds > 0 ? (uint64_t)seconds * 1000000000ULL : 0;
+}
+
+size_t XDP_max_datagram(int fd)
+{
+    (void)fd;
+    // a received frame lands XDP_PACKET_HEADROOM into its chunk
+    size_t frame = xdp.mtu + sizeof(struct ethhdr);
+    if (frame > XDP_FRAME_SIZE - XDP_PACKET_HEADROOM)
+        frame = XDP_FRAME_SIZE - XDP_PACKET_HEADROOM;
+    return frame - XDP_HEADERS;
+}
+
+void XDP_forget(int fd)
+{
+    if (!XDP_attached(fd))
+        return;
+    kick(); // the last datagrams, a close say, go before the socket does
+    map_update(xdp.port_map, 0, XDP_NO_PORT);
+    xdp.fd = -1;
+    memset(&xdp.peer, 0, sizeof(xdp.peer));
+    xdp.peer_mac_known = 0;
+}
+
+ssize_t XDP_send(int fd, const void *buf, size_t len)
+{
+    if (xdp.peer.sin_port == 0)
+    {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    if (!xdp.peer_mac_known)
+        resolve_peer();
+    if (!xdp.peer_mac_known)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    if (len > XDP_max_datagram(fd))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // a frame to build it in: the kernel hands them back once sent
+    if (xdp.nfree == 0)
+        reap();
+    for (uint64_t started = Timing_now_ns(); xdp.nfree == 0 || ring_pending(&xdp.tx) == XDP_RING_SIZE;)
+    {
+        xdp.queued += xdp.queued == 0;
+        kick();
+        if (xdp.nfree > 0 && ring_pending(&xdp.tx) < XDP_RING_SIZE)
+            break;
+        if (Timing_now_ns() - started > 1000000000ULL)
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        sched_yield();
+    }
+    uint64_t addr = xdp.free[--xdp.nfree];
+    unsigned char *frame = (unsigned char *)xdp.umem + addr;
+
+    struct ethhdr eth;
+    memcpy(eth.h_dest, xdp.peer_mac, ETH_ALEN);
+    memcpy(eth.h_source, xdp.mac, ETH_ALEN);
+    eth.h_proto = htons(ETH_P_IP);
+    struct iphdr ip;
+    memset(&ip, 0, sizeof(ip));
+    ip.version = 4;
+    ip.ihl = 5;
+    ip.tot_len = htons((uint16_t)(sizeof(struct iphdr) + sizeof(struct udphdr) + len));
+    ip.id = htons(xdp.ip_id++);
+    ip.frag_off = htons(IP_DF);
+    ip.ttl = 64;
+    ip.protocol = IPPROTO_UDP;
+    ip.saddr = xdp.local.sin_addr.s_addr;
+    ip.daddr = xdp.peer.sin_addr.s_addr;
+    ip.check = ip_checksum(&ip, sizeof(ip));
+    // no UDP checksum (0, allowed over IPv4): RUDP checks its own payload
+    struct udphdr udp;
+    udp.source = xdp.local.sin_port;
+    udp.dest = xdp.peer.sin_port;
+    udp.len = htons((uint16_t)(sizeof(struct udphdr) + len));
+    udp.check = 0;
+    memcpy(frame, &eth, sizeof(eth));
+    memcpy(frame + sizeof(eth), &ip, sizeof(ip));
+    memcpy(frame + sizeof(eth) + sizeof(ip), &udp, sizeof(udp));
+    memcpy(frame + XDP_HEADERS, buf, len);
+
+    uint32_t prod = *xdp.tx.producer;
+    struct xdp_desc *desc = &((struct xdp_desc *)xdp.tx.descs)[prod & (XDP_RING_SIZE - 1)];
+    desc->addr = addr;
+    desc->len = (uint32_t)(XDP_HEADERS + len);
+    desc->options = 0;
+    __atomic_store_n(xdp.tx.producer, prod + 1, __ATOMIC_RELEASE);
+    if (++xdp.queued >= XDP_TX_BATCH)
+        kick();
+    return (ssize_t)len;
+}
+
+/* Takes the next frame of the RX ring: its UDP payload into buf, or -1 if it is not for the socket (dropped). */
+static ssize_t take(void *buf, size_t len, struct sockaddr *addr, socklen_t *addrlen)
+{
+    uint32_t cons = *xdp.rx.consumer;
+    const struct xdp_desc *desc = &((const struct xdp_desc *)xdp.rx.descs)[cons & (XDP_RING_SIZE - 1)];
+    const unsigned char *frame = (const unsigned char *)xdp.umem + desc->addr;
+    uint32_t frame_len = desc->len;
+    uint64_t chunk = desc->addr - desc->addr % XDP_FRAME_SIZE;
+
+    struct ethhdr eth;
+    struct iphdr ip;
+    struct udphdr udp;
+    ssize_t result = -1;
+    if (frame_len >= XDP_HEADERS)
+    {
+        memcpy(&eth, frame, sizeof(eth));
+        memcpy(&ip, frame + sizeof(eth), sizeof(ip));
+        memcpy(&udp, frame + sizeof(eth) + sizeof(ip), sizeof(udp));
+        size_t payload = ntohs(udp.len) >= sizeof(udp) ? ntohs(udp.len) - sizeof(udp) : 0;
+        // a connected socket takes datagrams from its peer only
+        int wanted = eth.h_proto == htons(ETH_P_IP) && ip.ihl == 5 && ip.protocol == IPPROTO_UDP &&
+                     udp.dest == xdp.local.sin_port && payload <= frame_len - XDP_HEADERS &&
+                     (xdp.peer.sin_port == 0 || (ip.saddr == xdp.peer.sin_addr.s_addr && udp.source == xdp.peer.sin_port));
+        if (wanted)
+        {
+            learn(ip.saddr, eth.h_source);
+            memcpy(buf, frame + XDP_HEADERS, payload < len ? payload : len);
+            result = (ssize_t)(payload < len ? payload : len);
+            if (addr != NULL && addrlen != NULL)
+            {
+                struct sockaddr_in from;
+                memset(&from, 0, sizeof(from));
+                from.sin_family = AF_INET;
+                from.sin_addr.s_addr = ip.saddr;
+                from.sin_port = udp.source;
+                memcpy(addr, &from, *addrlen < sizeof(from) ? *addrlen : sizeof(from));
+                *addrlen = sizeof(from);
+            }
+        }
+    }
+    __atomic_store_n(xdp.rx.consumer, cons + 1, __ATOMIC_RELEASE);
+    fill_put(chunk);
+    return result;
+}
+
+/* Waits for the RX ring, or wake_fd, up to timeout_ms (-1: no limit): 1, 2, 0 on timeout, -1 on error. */
+static int wait_rx(int wake_fd, int timeout_ms)
+{
+    kick();
+    if (ring_ready(&xdp.rx) > 0)
+        return 1;
+    uint64_t deadline = timeout_ms >= 0 ? Timing_now_ns() + (uint64_t)timeout_ms * 1000000ULL : UINT64_MAX;
+    if (xdp.busy)
+    {
+        // spin on the ring itself, a look at wake_fd now and then
+        struct pollfd wake = {.fd = wake_fd, .events = POLLIN};
+        for (unsigned int spins = 1;; spins++)
+        {
+            if (ring_ready(&xdp.rx) > 0)
+                return 1;
+            if (spins % 1024 == 0)
+            {
+                if (wake_fd >= 0 && poll(&wake, 1, 0) > 0)
+                    return 2;
+                if (Timing_now_ns() >= deadline)
+                    return 0;
+            }
+        }
+    }
+
+    struct pollfd pfd[2] = {{.fd = xdp.xsk, .events = POLLIN}, {.fd = wake_fd, .events = POLLIN}};
+    int ret;
+    __atomic_add_fetch(&xdp.syscalls, 1, __ATOMIC_RELAXED);
+    while ((ret = poll(pfd, 2, timeout_ms)) < 0 && errno == EINTR)
+        ;
+    if (ret <= 0)
+        return ret;
+    return pfd[1].revents != 0 ? 2 : 1;
+}
+
+ssize_t XDP_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addrlen, uint32_t *dropped)
+{
+    (void)fd;
+    uint64_t deadline = 0;
+    for (;;)
+    {
+        while (ring_ready(&xdp.rx) > 0)
+        {
+            ssize_t n = take(buf, len, addr, addrlen);
+            if (n < 0)
+                continue;
+            if (dropped != NULL && ++xdp.received >= XDP_STATS_EVERY)
+            {
+                // SO_RXQ_OVFL's count: what the kernel could not put in the RX ring
+                struct xdp_statistics stats;
+                socklen_t stats_len = sizeof(stats);
+                __atomic_add_fetch(&xdp.syscalls, 1, __ATOMIC_RELAXED);
+                if (getsockopt(xdp.xsk, SOL_XDP, XDP_STATISTICS, &stats, &stats_len) == 0)
+                    xdp.dropped = (uint32_t)(stats.rx_dropped + stats.rx_ring_full);
+                xdp.received = 0;
+            }
+            if (dropped != NULL)
+                *dropped = xdp.dropped;
+            return n;
+        }
+        if (flags & MSG_DONTWAIT)
+        {
+            kick(); // nothing more to take: what was answered goes now
+            errno = EAGAIN;
+            return -1;
+        }
+
+        uint64_t now = Timing_now_ns();
+        if (deadline == 0)
+            deadline = xdp.timeout_ns > 0 ? now + xdp.timeout_ns : UINT64_MAX;
+        if (now >= deadline)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        int wait_ms = deadline == UINT64_MAX ? -1 : (int)((deadline - now + 999999) / 1000000);
+        if (wait_rx(-1, wait_ms) < 0)
+            return -1;
+    }
+}
+
+int XDP_wait_readable_or(int fd, int wake_fd, int timeout_ms)
+{
+    (void)fd;
+    return wait_rx(wake_fd, timeout_ms);
+}
+
+void XDP_set_busy_poll(int on)
+{
+    xdp.busy = on;
+}
+
+unsigned long XDP_syscalls(void)
+{
+    return __atomic_load_n(&xdp.syscalls, __ATOMIC_RELAXED);
+}
+
+void XDP_reset_syscalls(void)
+{
+    xdp.syscalls = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef XDP_H
+#define XDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * AF_XDP datapath for a UDP socket (-io xdp:<dev>[:queue], IO_Backend.h). An XDP program on
+ * <dev> (generic mode, so any device works, veth included) redirects the UDP datagrams to the
+ * attached socket's port into an AF_XDP socket; they come in through its RX ring, copied into
+ * a UMEM frame, and go out through its TX ring with Ethernet, IPv4 and UDP headers written
+ * here, never through the kernel's UDP stack. The UDP socket itself stays as it is: it holds
+ * the port, and its bind and connect say which addresses to use. TX descriptors are queued and
+ * the kernel is kicked once per batch, or before the next wait, as the io_uring backend does.
+ * One socket at a time uses it, on the thread that set it up; others go through the kernel.
+ * The program is built and loaded with the bpf() system call, no libbpf.
+ */
+#define XDP_FRAME_SIZE 4096     // UMEM chunk: a frame of the device's MTU, headers included
+#define XDP_FRAMES 4096         // half for the fill ring (RX), half for TX
+#define XDP_RING_SIZE 2048      // descriptors per ring, a power of two
+#define XDP_TX_BATCH 32         // TX descriptors queued before a kick
+#define XDP_HEADERS 42          // Ethernet + IPv4 + UDP
+
+/* Loads the program on dev and binds an AF_XDP socket to its queue, copy mode; -1 on failure. */
+int XDP_init(const char *dev, unsigned int queue);
+void XDP_cleanup(void);
+
+/* fd, a bound UDP socket, sends and receives through the AF_XDP socket from now on; -1 if it cannot (one is already). */
+int XDP_attach(int fd);
+int XDP_attached(int fd);
+/* fd was connected or disconnected: reads its addresses again, and resolves the peer's MAC address. */
+void XDP_peer_changed(int fd);
+/* Receives on fd give up after seconds (0: never), like its SO_RCVTIMEO. */
+void XDP_set_timeout(int fd, int seconds);
+/* The largest datagram fd can send, for the device's MTU. */
+size_t XDP_max_datagram(int fd);
+/* Sends what is queued and detaches fd. */
+void XDP_forget(int fd);
+
+/* Queues a datagram to fd's peer; it goes out at the next kick. */
+ssize_t XDP_send(int fd, const void *buf, size_t len);
+/* Receives a datagram for fd, flags 0 or MSG_DONTWAIT; *dropped, if not NULL, gets the frames the kernel dropped so far. */
+ssize_t XDP_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addrlen, uint32_t *dropped);
+/* IO_wait_readable_or() for fd: 1 readable, 2 wake_fd readable, 0 timed out, -1 error. */
+int XDP_wait_readable_or(int fd, int wake_fd, int timeout_ms);
+/* Busy polling: waits spin on the RX ring, without a system call, instead of sleeping in poll(). */
+void XDP_set_busy_poll(int on);
+
+/* System calls (kicks, polls, statistics) since the last XDP_reset_syscalls(). */
+unsigned long XDP_syscalls(void);
+void XDP_reset_syscalls(void);
+
+#endif
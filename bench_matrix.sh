@@ -0,0 +1,317 @@
+#!/bin/bash
+# Runs the TCP reno/cubic and RUDP comparison over every loss rate, unattended.
+# With PINGPONG, every cell is also run as request/response traffic (netbench -pingpong).
+#
+# Sender and receiver live in two private network namespaces joined by a veth
+# pair, so the host's lo is never touched. netem is applied to both ends, like
+# the old "tc qdisc add dev lo" procedure which impaired data and ACKs alike.
+#
+# Needs root (ip netns, tc). Settings come from the environment:
+#   LOSSES="0 2 5 10"   netem loss in percent, one matrix row per value
+#   DELAY=""            netem delay per direction, e.g. 10ms
+#   RATE=""             netem rate, e.g. 100mbit
+#   ALGOS="reno cubic"  TCP congestion control algorithms
+#   ROUNDS=5            runs per cell
+#   SIZE=2M             bytes per run
+#   IO=syscall          I/O backend of all four tools
+#   BUSYPOLL=""         1 adds a -busypoll cell after every other one, labelled +busypoll
+#   PINGPONG=""         round trips per round, e.g. 1000, for a second table of RTT percentiles
+#   PINGPONG_SIZE=64    bytes per request and per echo
+#   PINGPONG_BATCH=""   requests per batch, e.g. 16, adds an RUDP cell on the message API, labelled +batch<n>
+#   RESUME=""           I/O backends, e.g. "syscall uring", for a -resume file transfer each whose receiver
+#                       is killed in the middle and restarted, labelled rudp+resume-<io>
+#   RESUME_SIZE=256M    bytes of that file
+#   OUT=bench_results   logs, per-run CSV and the table
+#   CELL_TIMEOUT=600    seconds before a cell is abandoned
+
+LOSSES=${LOSSES:-"0 2 5 10"}
+DELAY=${DELAY:-}
+RATE=${RATE:-}
+ALGOS=${ALGOS:-"reno cubic"}
+ROUNDS=${ROUNDS:-5}
+SIZE=${SIZE:-2M}
+IO=${IO:-syscall}
+BUSYPOLL=${BUSYPOLL:-}
+PINGPONG=${PINGPONG:-}
+PINGPONG_SIZE=${PINGPONG_SIZE:-64}
+PINGPONG_BATCH=${PINGPONG_BATCH:-}
+RESUME=${RESUME:-}
+RESUME_SIZE=${RESUME_SIZE:-256M}
+OUT=${OUT:-bench_results}
+CELL_TIMEOUT=${CELL_TIMEOUT:-600}
+
+NS_SND=netbench_snd
+NS_RCV=netbench_rcv
+IP_SND=10.213.0.1
+IP_RCV=10.213.0.2
+PORT=5201
+BIN=$(cd "$(dirname "$0")" && pwd)
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "bench_matrix.sh: needs root for ip netns and tc" >&2
+    exit 1
+fi
+
+cleanup()
+{
+    ip netns del $NS_SND 2>/dev/null
+    ip netns del $NS_RCV 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+setup_namespaces()
+{
+    cleanup
+    ip netns add $NS_SND || return 1
+    ip netns add $NS_RCV || return 1
+    ip link add veth_snd netns $NS_SND type veth peer name veth_rcv netns $NS_RCV || return 1
+    # RUDP sends 16K datagrams; lo's MTU keeps them unfragmented, so one loss is one lost segment
+    ip -n $NS_SND link set veth_snd mtu 65535 up || return 1
+    ip -n $NS_RCV link set veth_rcv mtu 65535 up || return 1
+    ip -n $NS_SND link set lo up
+    ip -n $NS_RCV link set lo up
+    ip -n $NS_SND addr add $IP_SND/24 dev veth_snd || return 1
+    ip -n $NS_RCV addr add $IP_RCV/24 dev veth_rcv || return 1
+}
+
+# set_impairment <loss%>: replaces the netem qdisc on both ends
+set_impairment()
+{
+    local args=""
+    [ "$1" != "0" ] && args="$args loss $1%"
+    [ -n "$DELAY" ] && args="$args delay $DELAY"
+    [ -n "$RATE" ] && args="$args rate $RATE"
+
+    ip netns exec $NS_SND tc qdisc del dev veth_snd root 2>/dev/null
+    ip netns exec $NS_RCV tc qdisc del dev veth_rcv root 2>/dev/null
+    [ -z "$args" ] && return 0
+
+    ip netns exec $NS_SND tc qdisc add dev veth_snd root netem $args || return 1
+    ip netns exec $NS_RCV tc qdisc add dev veth_rcv root netem $args || return 1
+}
+
+# wait_listen <tcp|udp>: waits until the receiver has bound PORT
+wait_listen()
+{
+    local flag=-Hltn
+    [ "$1" = udp ] && flag=-Hlun
+    for _ in $(seq 50); do
+        [ -n "$(ip netns exec $NS_RCV ss $flag "sport = :$PORT")" ] && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# run_pair <transport> <name> <log> <receiver> <sender>: runs both, 0 if they left results in <log>.csv
+run_pair()
+{
+    local transport=$1 name=$2 log=$3 receiver=$4 sender=$5
+
+    rm -f "$log.csv"
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_RCV $receiver > "$log.receiver.log" 2>&1 &
+    local pid=$!
+    if ! wait_listen "$transport"; then
+        echo "  $name: receiver did not start, see $log.receiver.log"
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null
+        return 1
+    fi
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_SND $sender < /dev/null > "$log.sender.log" 2>&1
+    wait $pid
+
+    if [ ! -s "$log.csv" ]; then
+        echo "  $name: no results, see $log.receiver.log and $log.sender.log"
+        return 1
+    fi
+}
+
+# run_cell <loss> <transport> <label> [-busypoll]: one receiver, one sender doing ROUNDS runs
+run_cell()
+{
+    local loss=$1 transport=$2 label=$3 mode=$4
+    local name=$label${mode:++${mode#-}}
+    local log="$OUT/loss${loss}_$name"
+    local receiver sender
+
+    if [ "$transport" = tcp ]; then
+        receiver="$BIN/TCP_Receiver -p $PORT -algo $label -io $IO -verify -csv $log.csv $mode"
+        sender="$BIN/TCP_Sender -ip $IP_RCV -p $PORT -algo $label -io $IO -size $SIZE -rounds $ROUNDS $mode"
+    else
+        receiver="$BIN/RUDP_Receiver -p $PORT -io $IO -verify -csv $log.csv $mode"
+        sender="$BIN/RUDP_Sender -ip $IP_RCV -p $PORT -io $IO -size $SIZE -rounds $ROUNDS $mode"
+    fi
+    run_pair "$transport" "$name" "$log" "$receiver" "$sender" || return 1
+
+    if grep -q MISMATCH "$log.receiver.log"; then
+        echo "  $name: payload integrity MISMATCH, see $log.receiver.log"
+    fi
+    tail -n +2 "$log.csv" | sed "s/^/$loss,/" >> "$OUT/matrix.csv"
+    echo "  $name: $(($(wc -l < "$log.csv") - 1)) runs"
+}
+
+# run_pingpong_cell <loss> <transport> <label> [-busypoll|-messages]: ROUNDS rounds of PINGPONG echoed requests;
+# -messages sends them PINGPONG_BATCH at a time through the RUDP message API
+run_pingpong_cell()
+{
+    local loss=$1 transport=$2 label=$3 mode=$4
+    local batch=""
+    if [ "$mode" = -messages ]; then
+        label=$label+batch$PINGPONG_BATCH
+        batch="-batch $PINGPONG_BATCH"
+    fi
+    local name=$label${mode:++${mode#-}}
+    [ "$mode" = -messages ] && name=$label
+    local log="$OUT/pingpong_loss${loss}_$name"
+    local options="-t rudp"
+    [ "$transport" = tcp ] && options="-t tcp -algo $label"
+
+    local receiver="$BIN/netbench recv $options -p $PORT -io $IO -pingpong $mode"
+    local sender="$BIN/netbench send $options -ip $IP_RCV -p $PORT -io $IO -size $PINGPONG_SIZE -rounds $ROUNDS -pingpong $PINGPONG $batch -label $label -csv $log.csv $mode"
+    run_pair "$transport" "ping-pong $name" "$log" "$receiver" "$sender" || return 1
+
+    if grep -q MISMATCH "$log.sender.log"; then
+        echo "  ping-pong $name: echo MISMATCH, see $log.sender.log"
+    fi
+    tail -n +2 "$log.csv" | sed "s/^/$loss,/" >> "$OUT/pingpong.csv"
+    echo "  ping-pong $name: $(($(wc -l < "$log.csv") - 1)) rounds"
+}
+
+# run_resume_cell <loss> <io>: sends a file with -resume, kills the receiver once it has synced a part of it,
+# starts it again and checks the sender finishes the file from there
+run_resume_cell()
+{
+    local loss=$1 io=$2
+    local name=rudp+resume-$io
+    local log="$OUT/loss${loss}_$name"
+    local src="$OUT/resume.src" out="$log.out"
+    local receiver="$BIN/RUDP_Receiver -p $PORT -io $io -o $out -resume"
+
+    if [ ! -s "$src" ]; then
+        head -c "$RESUME_SIZE" /dev/urandom > "$src" || return 1
+    fi
+    rm -f "$out" "$out.resume"
+
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_RCV $receiver > "$log.receiver.log" 2>&1 &
+    local pid=$!
+    if ! wait_listen udp; then
+        echo "  $name: receiver did not start, see $log.receiver.log"
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null
+        return 1
+    fi
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_SND $BIN/RUDP_Sender -ip $IP_RCV -p $PORT -io $io -f "$src" -resume \
+        < /dev/null > "$log.sender.log" 2>&1 &
+    local sender=$!
+
+    # the block map is first written after RESUME_SYNC_BLOCKS blocks
+    for _ in $(seq $((CELL_TIMEOUT * 10))); do
+        [ -e "$out.resume" ] && break
+        kill -0 $sender 2>/dev/null || break
+        sleep 0.1
+    done
+    if [ ! -e "$out.resume" ]; then
+        echo "  $name: the transfer ended before the receiver could be killed, see $log.sender.log"
+        kill $pid $sender 2>/dev/null
+        wait $pid $sender 2>/dev/null
+        return 1
+    fi
+    pkill -9 -x RUDP_Receiver
+    wait $pid 2>/dev/null
+    # an io_uring ring is torn down after its process: the port stays bound until then (connected, so -a)
+    for _ in $(seq 50); do
+        [ -z "$(ip netns exec $NS_RCV ss -Huan "sport = :$PORT")" ] && break
+        sleep 0.1
+    done
+
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_RCV $receiver > "$log.receiver2.log" 2>&1 &
+    pid=$!
+    wait $sender
+    local result=$?
+    wait $pid
+
+    if [ $result -ne 0 ] || ! cmp -s "$src" "$out"; then
+        echo "  $name: the resumed file does not match, see $log.sender.log and $log.receiver2.log"
+        return 1
+    fi
+    echo "  $name: $(grep -c "trying again" "$log.sender.log") restarts, file matches"
+    rm -f "$out"
+}
+
+print_table()
+{
+    awk -F, 'NR > 1 {
+        key = $1 "," $2
+        if (!(key in n)) order[++keys] = key
+        n[key]++
+        t[key] += $4; tt[key] += $4 * $4
+        s[key] += $5; ss[key] += $5 * $5
+    }
+    function sd(sum, sq, k) { return k > 1 ? sqrt((sq - sum * sum / k) / (k - 1)) : 0 }
+    END {
+        printf "%-6s %-16s %5s %12s %10s %14s %10s\n", "loss%", "label", "runs", "time ms", "stddev", "speed MB/s", "stddev"
+        for (i = 1; i <= keys; i++) {
+            key = order[i]; k = n[key]
+            split(key, f, ",")
+            printf "%-6s %-16s %5d %12.3f %10.3f %14.3f %10.3f\n", f[1], f[2], k,
+                   t[key] / k, sd(t[key], tt[key], k), s[key] / k, sd(s[key], ss[key], k)
+        }
+    }' "$OUT/matrix.csv"
+}
+
+# loss,label,round,size,messages,messages_per_s,mean_us,p50_us,p99_us,p999_us,max_us: means over the rounds
+print_pingpong_table()
+{
+    awk -F, 'NR > 1 {
+        key = $1 "," $2
+        if (!(key in n)) order[++keys] = key
+        n[key]++
+        rate[key] += $6; p50[key] += $8; p99[key] += $9; p999[key] += $10
+    }
+    END {
+        printf "%-6s %-16s %6s %12s %10s %10s %10s\n", "loss%", "label", "rounds", "messages/s", "p50 us", "p99 us", "p999 us"
+        for (i = 1; i <= keys; i++) {
+            key = order[i]; k = n[key]
+            split(key, f, ",")
+            printf "%-6s %-16s %6d %12.1f %10.1f %10.1f %10.1f\n", f[1], f[2], k,
+                   rate[key] / k, p50[key] / k, p99[key] / k, p999[key] / k
+        }
+    }' "$OUT/pingpong.csv"
+}
+
+mkdir -p "$OUT" || exit 1
+echo "loss,label,run,time_ms,speed_mbps" > "$OUT/matrix.csv"
+echo "loss,label,round,size,messages,messages_per_s,mean_us,p50_us,p99_us,p999_us,max_us" > "$OUT/pingpong.csv"
+
+setup_namespaces || { echo "Could not create the namespaces" >&2; exit 1; }
+
+for loss in $LOSSES; do
+    echo "loss $loss%${DELAY:+ delay $DELAY}${RATE:+ rate $RATE}"
+    if ! set_impairment "$loss"; then
+        echo "Could not apply netem (is sch_netem available?)" >&2
+        exit 1
+    fi
+    for algo in $ALGOS; do
+        run_cell "$loss" tcp "$algo"
+        [ -n "$BUSYPOLL" ] && run_cell "$loss" tcp "$algo" -busypoll
+    done
+    run_cell "$loss" udp rudp
+    [ -n "$BUSYPOLL" ] && run_cell "$loss" udp rudp -busypoll
+    for io in $RESUME; do
+        run_resume_cell "$loss" "$io"
+    done
+    [ -z "$PINGPONG" ] && continue
+    for algo in $ALGOS; do
+        run_pingpong_cell "$loss" tcp "$algo"
+        [ -n "$BUSYPOLL" ] && run_pingpong_cell "$loss" tcp "$algo" -busypoll
+    done
+    run_pingpong_cell "$loss" udp rudp
+    [ -n "$BUSYPOLL" ] && run_pingpong_cell "$loss" udp rudp -busypoll
+    [ -n "$PINGPONG_BATCH" ] && run_pingpong_cell "$loss" udp rudp -messages
+done
+
+echo
+print_table | tee "$OUT/table.txt"
+if [ -n "$PINGPONG" ]; then
+    echo
+    print_pingpong_table | tee "$OUT/pingpong.txt"
+fi
@@ -0,0 +1,136 @@
+#!/bin/bash
+# Compares RUDP through the kernel's UDP sockets (-io syscall) with the AF_XDP datapath
+# (-io xdp:<dev>): packets per second and CPU cycles per packet of sender and receiver.
+#
+# Sender and receiver live in two private network namespaces joined by a veth pair at an
+# Ethernet MTU; XDP runs in copy mode on it (generic XDP), and both backends send the same
+# segment size so each segment is one frame.
+#
+# Needs root (ip netns, bpf). Settings come from the environment:
+#   ROUNDS=5            runs per backend
+#   SIZE=64M            bytes per run
+#   SEGMENT=1400        RUDP segment size, fits the 1500 MTU
+#   BUSYPOLL=""         1 adds a busy-polled cell per backend
+#   OUT=bench_xdp       logs and the table
+#   CELL_TIMEOUT=600    seconds before a cell is abandoned
+
+ROUNDS=${ROUNDS:-5}
+SIZE=${SIZE:-64M}
+SEGMENT=${SEGMENT:-1400}
+BUSYPOLL=${BUSYPOLL:-}
+OUT=${OUT:-bench_xdp}
+CELL_TIMEOUT=${CELL_TIMEOUT:-600}
+
+NS_SND=netbench_xdp_snd
+NS_RCV=netbench_xdp_rcv
+DEV_SND=veth_snd
+DEV_RCV=veth_rcv
+IP_SND=10.214.0.1
+IP_RCV=10.214.0.2
+PORT=5202
+BIN=$(cd "$(dirname "$0")" && pwd)
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "bench_xdp.sh: needs root for ip netns and XDP" >&2
+    exit 1
+fi
+
+cleanup()
+{
+    ip netns del $NS_SND 2>/dev/null
+    ip netns del $NS_RCV 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+setup_namespaces()
+{
+    cleanup
+    ip netns add $NS_SND || return 1
+    ip netns add $NS_RCV || return 1
+    ip link add $DEV_SND netns $NS_SND type veth peer name $DEV_RCV netns $NS_RCV || return 1
+    ip -n $NS_SND link set $DEV_SND mtu 1500 up || return 1
+    ip -n $NS_RCV link set $DEV_RCV mtu 1500 up || return 1
+    ip -n $NS_SND link set lo up
+    ip -n $NS_RCV link set lo up
+    ip -n $NS_SND addr add $IP_SND/24 dev $DEV_SND || return 1
+    ip -n $NS_RCV addr add $IP_RCV/24 dev $DEV_RCV || return 1
+}
+
+# wait_listen: waits until the receiver has bound PORT
+wait_listen()
+{
+    for _ in $(seq 50); do
+        [ -n "$(ip netns exec $NS_RCV ss -Hlun "sport = :$PORT")" ] && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# run_cell <label> <receiver io> <sender io> [-busypoll]: one receiver, one sender doing ROUNDS runs
+run_cell()
+{
+    local label=$1 io_rcv=$2 io_snd=$3 mode=$4
+    local name=$label${mode:++${mode#-}}
+    local log="$OUT/$name"
+
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_RCV "$BIN/RUDP_Receiver" -p $PORT -io "$io_rcv" -segment "$SEGMENT" \
+        -verify $mode > "$log.receiver.log" 2>&1 &
+    local pid=$!
+    if ! wait_listen; then
+        echo "  $name: receiver did not start, see $log.receiver.log"
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null
+        return 1
+    fi
+    timeout "$CELL_TIMEOUT" ip netns exec $NS_SND "$BIN/RUDP_Sender" -ip $IP_RCV -p $PORT -io "$io_snd" \
+        -segment "$SEGMENT" -size "$SIZE" -rounds "$ROUNDS" $mode < /dev/null > "$log.sender.log" 2>&1
+    wait $pid
+
+    if grep -q MISMATCH "$log.receiver.log"; then
+        echo "  $name: payload integrity MISMATCH, see $log.receiver.log"
+    fi
+    if ! grep -q "^Packets:" "$log.receiver.log"; then
+        echo "  $name: no results, see $log.receiver.log and $log.sender.log"
+        return 1
+    fi
+    if [ "$label" = xdp ] && ! grep -q "^AF_XDP on" "$log.sender.log"; then
+        echo "  $name: AF_XDP unavailable, it ran on syscalls; see $log.sender.log"
+    fi
+    echo "$name" >> "$OUT/cells"
+}
+
+# averages <log>: the mean pps and cycles per packet of the "Packets:" lines in <log>
+averages()
+{
+    awk '/^Packets:/ {
+        for (i = 1; i <= NF; i++) {
+            if ($(i + 1) == "pps,") { pps += $i }
+            if ($(i + 1) == "CPU" && $(i + 2) == "cycles") { cycles += $i }
+        }
+        n++
+    }
+    END { if (n > 0) printf "%d %.0f %.0f", n, pps / n, cycles / n; else printf "0 0 0" }' "$1"
+}
+
+print_table()
+{
+    printf "%-20s %5s %14s %16s %14s %16s\n" "backend" "runs" "sender pps" "sender cyc/pkt" "receiver pps" "receiver cyc/pkt"
+    while read -r name; do
+        read -r runs snd_pps snd_cycles <<< "$(averages "$OUT/$name.sender.log")"
+        read -r _ rcv_pps rcv_cycles <<< "$(averages "$OUT/$name.receiver.log")"
+        printf "%-20s %5d %14s %16s %14s %16s\n" "$name" "$runs" "$snd_pps" "$snd_cycles" "$rcv_pps" "$rcv_cycles"
+    done < "$OUT/cells"
+}
+
+mkdir -p "$OUT" || exit 1
+rm -f "$OUT/cells"
+setup_namespaces || { echo "bench_xdp.sh: could not set up the namespaces" >&2; exit 1; }
+
+echo "RUDP, $ROUNDS x $SIZE, segment $SEGMENT, veth at MTU 1500"
+for mode in "" ${BUSYPOLL:+-busypoll}; do
+    run_cell syscall syscall syscall $mode
+    run_cell xdp xdp:$DEV_RCV xdp:$DEV_SND $mode
+done
+
+echo
+print_table | tee "$OUT/table.txt"
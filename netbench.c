@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Transport.h"
+#include "IO_Backend.h"
+#include "Payload.h"
+#include "File_IO.h"
+#include "Compress.h"
+#include "Run.h"
+#include "Stats.h"
+#include "Timing.h"
+#include "Busy_Poll.h"
+#include "Timestamp.h"
+#include "Ping_Pong.h"
+
+/*
+* @brief
+Takes argv[*i] if it is one of the options every transport shares. Transport options go to transport.
+* @return
+1 if it was taken, 0 if it is unknown, -1 if it is invalid.
+*/
+static int transport_option(const Transport *transport, int argc, char *argv[], int *i)
+{
+    if (strcmp(argv[*i], "-t") == 0 && *i + 1 < argc)
+    {
+        ++*i; // looked up before the other options
+        return 1;
+    }
+    return transport->option(argc, argv, i);
+}
+
+/*
+* @brief
+Sends rounds runs (0 asks before every run), each timed until the receiver has all of it.
+With -pingpong, a round is that many requests instead, each timed until its echo is back.
+*/
+static int run_sender(const Transport *transport, int argc, char *argv[])
+{
+    const char *ip = NULL;
+    const char *port = NULL;
+    IO_Backend backend = IO_SYSCALL;
+    const char *size_arg = NULL;            // NETBENCH_SIZE_DEFAULT, or PING_PONG_SIZE_DEFAULT with -pingpong
+    uint64_t seed = Payload_random_seed();
+    int rounds = 0;
+    const char *file_path = NULL;
+    File_Read_Mode read_mode = FILE_PREAD;
+    int use_compress = 0;
+    int pingpong = 0;                       // round trips per round, 0 for bulk runs
+    int batch = 1;                          // requests sent before their echoes are read
+    const char *json_path = NULL;
+    const char *csv_path = NULL;
+    const char *label = transport->name;
+    int i;
+    for (i = 2; i < argc; i++)
+    {
+        int taken = transport_option(transport, argc, argv, &i);
+        if (taken == 0)
+            taken = Busy_Poll_option(argc, argv, &i);
+        if (taken == 0)
+            taken = Timestamp_option(argc, argv, &i);
+        if (taken < 0)
+            break;
+        if (taken > 0)
+            continue;
+        if (strcmp(argv[i], "-ip") == 0 && i + 1 < argc)
+            ip = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            port = argv[++i];
+        else if (strcmp(argv[i], "-rounds") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc)
+            size_arg = argv[++i];
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            file_path = argv[++i];
+        else if (strcmp(argv[i], "-compress") == 0)
+            use_compress = 1;
+        else if (strcmp(argv[i], "-pingpong") == 0 && i + 1 < argc)
+        {
+            if ((pingpong = atoi(argv[++i])) <= 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+        {
+            if ((batch = atoi(argv[++i])) <= 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "-label") == 0 && i + 1 < argc)
+            label = argv[++i];
+        else if (strcmp(argv[i], "-fread") == 0 && i + 1 < argc)
+        {
+            if (File_parse_read_mode(argv[++i], &read_mode) < 0)
+                break;
+        }
+        else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc)
+        {
+            if (IO_parse_backend(argv[++i], &backend) < 0)
+                break;
+        }
+        else
+            break;
+    }
+    uint64_t size = size_arg != NULL ? Payload_parse_size(size_arg) : pingpong > 0 ? PING_PONG_SIZE_DEFAULT : NETBENCH_SIZE_DEFAULT;
+    if (i < argc || ip == NULL || port == NULL || size == 0 || rounds < 0 || (pingpong > 0 && (file_path != NULL || use_compress)) ||
+        (batch > 1 && pingpong == 0))
+    {
+        printf("Usage: %s send -t <transport> -ip <server_ip> -p <port> [-rounds <n>] [-io <syscall|uring|xdp:dev[:queue]>] [-size <bytes[K|M|G]>] [-seed <n>] [-f <file> [-fread <pread|mmap>]] [-compress] [-pingpong <requests> [-batch <n>]] [-json <file>] [-csv <file>] [-label <name>] " BUSY_POLL_USAGE " " TIMESTAMP_USAGE " [transport options]\n", argv[0]);
+        printf("-pingpong: requests of -size bytes (default %d), each echoed; not with -f or -compress\n", PING_PONG_SIZE_DEFAULT);
+        printf("-batch: requests sent back to back before their echoes are read (-t rudp needs -messages)\n");
+        Transport_print_usage();
+        return 1;
+    }
+    Ping_Pong pp;
+    if (pingpong > 0 && Ping_Pong_init(&pp, size, pingpong, batch) < 0)
+        return 1;
+
+    File_Source file;
+    Compress_Writer compress;
+    if (use_compress && Compress_Writer_init(&compress) < 0)
+        return 1;
+    if (file_path != NULL)
+    {
+        if (File_Source_open(&file, file_path, read_mode) < 0)
+            return 1;
+        size = File_Source_size(&file);
+        printf("File: %s, %llu bytes, read with %s\n", file_path, (unsigned long long)size,
+               read_mode == FILE_MMAP ? "mmap" : "pread");
+    }
+    else if (pingpong > 0)
+        printf("Ping-pong: %d requests of %llu bytes per round, %d at a time\n", pingpong, (unsigned long long)size, batch);
+    else
+        printf("Payload: %llu bytes per run, seed 0x%016llx\n", (unsigned long long)size, (unsigned long long)seed);
+
+    // the payload is generated, or the file read, into chunk; runs go out from part, registered for zero-copy sends
+    char *chunk = (char *)malloc(RUN_PART_SIZE);
+    char *part = (char *)malloc(RUN_PART_SIZE);
+    if (chunk == NULL || part == NULL)
+    {
+        perror("malloc failed");
+        return 1;
+    }
+    Payload_Header header;
+    Payload_header_pack(&header, seed, size);
+    Payload_header_set_flags(&header, (file_path != NULL ? PAYLOAD_FILE : 0) | (use_compress ? PAYLOAD_COMPRESSED : 0));
+
+    IO_init(backend, part, RUN_PART_SIZE);
+    if (Busy_Poll_start() < 0 || Timestamp_start() < 0)
+        return 1;
+    Transport_Conn conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.pingpong = pingpong > 0;
+    conn.batch = batch;
+    if (transport->open(&conn, ip, (unsigned short int)atoi(port)) < 0)
+        return 1;
+
+    Stats *stats = Stats_alloc();
+    int round = 1;
+    int failed = 0;
+    char again = 'y';
+    while (again == 'y')
+    {
+        IO_reset_syscalls();
+        if (pingpong > 0)
+        {
+            if (transport->connect(&conn) < 0 || Ping_Pong_run(&pp, transport, &conn, round) < 0)
+            {
+                printf("Could not run round #%d\n", round);
+                failed = 1;
+                break;
+            }
+        }
+        else
+        {
+            if (file_path != NULL)
+                File_Source_reset_time(&file);
+            if (use_compress)
+                Compress_Writer_reset_stats(&compress);
+
+            Run_Source src;
+            Run_Source_init(&src, &header, NULL, file_path != NULL ? &file : NULL, chunk, size, use_compress ? &compress : NULL);
+            double start = Timing_now_ms();
+            failed = transport->connect(&conn) < 0;
+            while (!failed)
+            {
+                ssize_t n = Run_Source_read(&src, part, RUN_PART_SIZE);
+                int last = Run_Source_done(&src);
+                if (n < 0 || transport->send(&conn, part, (size_t)n, last) < 0)
+                    failed = 1;
+                if (last)
+                    break;
+            }
+            if (failed)
+            {
+                printf("Could not send run #%d\n", round);
+                break;
+            }
+
+            double milliseconds = Timing_now_ms() - start;
+            double speed = milliseconds > 0 ? (sizeof(header) + size) / (milliseconds * 1000.0) : 0.0;
+            Stats_add(stats, round, milliseconds, speed);
+            printf("Run #%d: sent %llu bytes in %f ms (%f MB/s), until the receiver had it all\n", round,
+                   (unsigned long long)(sizeof(header) + size), milliseconds, speed);
+            if (use_compress)
+                Compress_Writer_print_stats(&compress);
+            if (file_path != NULL)
+            {
+                double disk_ms = File_Source_disk_ms(&file);
+                printf("Disk: read %llu bytes in %f ms (%f MB/s)\n", (unsigned long long)size, disk_ms,
+                       disk_ms > 0 ? size / (disk_ms * 1000.0) : 0.0);
+            }
+        }
+        IO_print_packets();
+        printf("I/O syscalls: %lu (%s)\n\n", IO_syscalls(), IO_backend_name());
+        round++;
+
+        if (rounds > 0)
+            again = round <= rounds ? 'y' : 'n';
+        else
+        {
+            printf("Do you want to send the message again? (y/n): ");
+            if (scanf(" %c", &again) != 1)
+                again = 'n';
+        }
+    }
+
+    printf("Sender side (%s):\n", transport->name);
+    if (pingpong > 0)
+    {
+        Ping_Pong_print(&pp);
+        if (json_path != NULL)
+            Ping_Pong_write_json(&pp, json_path, Busy_Poll_label(label));
+        if (csv_path != NULL)
+            Ping_Pong_write_csv(&pp, csv_path, Busy_Poll_label(label));
+        Ping_Pong_free(&pp);
+    }
+    else
+    {
+        print_stats(stats);
+        if (json_path != NULL)
+            Stats_write_json(stats, json_path, Busy_Poll_label(label));
+        if (csv_path != NULL)
+            Stats_write_csv(stats, csv_path, Busy_Poll_label(label));
+    }
+    transport->stats(&conn);
+    Timestamp_print();
+    if (transport->close(&conn) < 0)
+        failed = 1;
+
+    Stats_free(stats);
+    free(chunk);
+    free(part);
+    if (file_path != NULL)
+        File_Source_close(&file);
+    if (use_compress)
+        Compress_Writer_free(&compress);
+    IO_cleanup();
+    printf("\nClient finished!\n");
+    return failed;
+}
+
+/*
+* @brief
+Receives runs until the sender ends the session, and reports them all.
+*/
+static int run_receiver(const Transport *transport, int argc, char *argv[])
+{
+    const char *port = NULL;
+    IO_Backend backend = IO_SYSCALL;
+    int verify = 0;
+    const char *json_path = NULL;
+    const char *csv_path = NULL;
+    const char *label = transport->name;
+    const char *out_path = NULL;
+    int direct = 0;
+    int pingpong = 0;
+    int i;
+    for (i = 2; i < argc; i++)
+    {
+        int taken = transport_option(transport, argc, argv, &i);
+        if (taken == 0)
+            taken = Busy_Poll_option(argc, argv, &i);
+        if (taken == 0)
+            taken = Timestamp_option(argc, argv, &i);
+        if (taken < 0)
+            break;
+        if (taken > 0)
+            continue;
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            port = argv[++i];
+        else if (strcmp(argv[i], "-pingpong") == 0)
+            pingpong = 1;
+        else if (strcmp(argv[i], "-verify") == 0)
+            verify = 1;
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "-label") == 0 && i + 1 < argc)
+            label = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (strcmp(argv[i], "-direct") == 0)
+            direct = 1;
+        else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc)
+        {
+            if (IO_parse_backend(argv[++i], &backend) < 0)
+                break;
+        }
+        else
+            break;
+    }
+    if (i < argc || port == NULL)
+    {
+        printf("Usage: %s recv -t <transport> -p <port> [-io <syscall|uring|xdp:dev[:queue]>] [-verify] [-json <file>] [-csv <file>] [-label <name>] [-o <file> [-direct]] [-pingpong] " BUSY_POLL_USAGE " " TIMESTAMP_USAGE " [transport options]\n", argv[0]);
+        printf("-pingpong: echoes the requests of netbench send -pingpong instead of receiving runs\n");
+        Transport_print_usage();
+        return 1;
+    }
+
+    char *buffer = (char *)malloc(pingpong ? PING_PONG_SIZE_MAX + NETBENCH_RECV_SIZE : NETBENCH_RECV_SIZE);
+    Compress_Reader reader;     // runs sent with -compress
+    Run_Report report;
+    if (buffer == NULL || Compress_Reader_init(&reader) < 0 || Run_Report_init(&report) < 0)
+        return 1;
+    Run_State run;
+    run.verify = verify;
+    run.out_path = out_path;
+    run.direct = direct;
+    run.reader = &reader;
+    run.timer = &report.timer;
+    run.resume = NULL;
+
+    IO_init(backend, NULL, 0);
+    if (Busy_Poll_start() < 0 || Timestamp_start() < 0)
+        return 1;
+    Transport_Conn conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.pingpong = pingpong;
+    if (transport->open(&conn, NULL, (unsigned short int)atoi(port)) < 0)
+        return 1;
+
+    int failed = 0;
+    for (;;)
+    {
+        int done = 0;
+        IO_reset_syscalls();
+        Run_State_start(&run);
+        if (transport->accept(&conn, &done) < 0)
+        {
+            failed = 1;
+            break;
+        }
+        if (done == -1)
+            break;   // the sender ended the session
+        if (pingpong)
+        {
+            int echoed = Ping_Pong_echo(transport, &conn, buffer);
+            if (echoed < 0)
+            {
+                failed = 1;
+                break;
+            }
+            printf("Round #%d: echoed %d requests\n", conn.runs, echoed);
+            IO_print_packets();
+            printf("I/O syscalls: %lu (%s)\n\n", IO_syscalls(), IO_backend_name());
+            continue;
+        }
+
+        // TTFB counts from the start of the run (a handshake, or the first record) to its first data
+        Run_Timer_arm(&report.timer);
+        while (done == 0)
+        {
+            ssize_t n = transport->recv(&conn, buffer, NETBENCH_RECV_SIZE, &done);
+            if (n < 0 || Run_State_consume(&run, buffer, (size_t)n) < 0)
+                break;
+        }
+        if (Run_State_finish(&run, &report, done > 0, "Chunk inter-arrival") < 0 || done <= 0)
+        {
+            failed = 1;
+            break;
+        }
+        IO_print_packets();
+        printf("I/O syscalls: %lu (%s)\n\n", IO_syscalls(), IO_backend_name());
+    }
+
+    printf("Transport: %s\n", transport->name);
+    if (!pingpong)
+        Run_Report_print(&report, "Chunk inter-arrival", json_path, csv_path, Busy_Poll_label(label));
+    transport->stats(&conn);
+    Timestamp_print();
+    transport->close(&conn);
+
+    Run_Report_free(&report);
+    Compress_Reader_free(&reader);
+    free(buffer);
+    IO_cleanup();
+    printf("\nReceiver finished!\n");
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    // the transport decides which options are valid, so it is looked up first
+    const char *name = "tcp";
+    for (int i = 2; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0)
+            name = argv[i + 1];
+    }
+    int sender = argc > 1 && strcmp(argv[1], "send") == 0;
+    if (argc < 2 || (!sender && strcmp(argv[1], "recv") != 0))
+    {
+        printf("Usage: %s send|recv -t <transport> ... (%s send or %s recv for their options)\n", argv[0], argv[0], argv[0]);
+        Transport_print_usage();
+        return 1;
+    }
+    const Transport *transport = Transport_find(name);
+    if (transport == NULL)
+        return 1;
+
+    return sender ? run_sender(transport, argc, argv) : run_receiver(transport, argc, argv);
+}